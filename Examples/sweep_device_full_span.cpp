@@ -69,27 +69,44 @@ int _tmain(int argc, _TCHAR* argv[])
     // configure the sweep (note this only needs to be done once
     wsa_configure_sweep(wsasweepdev, pscfg);
 
-    // contineously capture the data
-    while(1) 
-        // start a sweep, and capture the spectrum
-        wsa_capture_power_spectrum(wsasweepdev, pscfg, &psbuf);
+    // sweep continuously into a ring of 4 spectra, without restarting between sweeps
+    result = wsa_sweep_continuous_start(wsasweepdev, pscfg, 4);
+
+    // somewhere to copy the latest spectrum to
+    psbuf = (float *) malloc(sizeof(float) * pscfg->buflen);
+    struct wsa_spectrum_frame_info frame_info;
+
+    while(1) {
+        // assemble the next sweep into the ring
+        // (in a real application this would run in its own thread)
+        result = wsa_sweep_continuous_capture(wsasweepdev, pscfg);
+        if (result < 0)
+            break;
+
+        // grab the latest complete spectrum; this never blocks the capture
+        if (wsa_sweep_continuous_read(pscfg, 0, psbuf, &frame_info, NULL) < 0)
+            continue;
 
         // grab the maximum of the spectral data
         for(uint32_t i = 0; i < pscfg->buflen; i++) {
-            if (pscfg->buf[i] > max_power && i > 30) {
-                max_power = pscfg->buf[i];
+            if (psbuf[i] > max_power && i > 30) {
+                max_power = psbuf[i];
                 max_i = i;
             }
         }
 
         // print the max
-        printf("%d, %d %0.2f \n", pscfg->buflen,  max_i, max_power);
+        printf("sweep %llu: %d, %d %0.2f \n", frame_info.sweep_number, pscfg->buflen,  max_i, max_power);
         
         // reset the max
         max_i = 0; 
         max_power = -900;
     }
 
+    // stop sweeping
+    wsa_sweep_continuous_stop(wsasweepdev, pscfg);
+    free(psbuf);
+
     // free the buffer of the sweep device 
     wsa_power_spectrum_free(pscfg);
     
@@ -19,6 +19,10 @@
 
 #pragma once
 
+#include <stdio.h>
+#include "thinkrf_stdint.h"
+#include "wsa_atomic.h"
+
 /// Special-purpose flag for diagnosing data dropout 2017-11-10.
 /// @note If this flag is set, ensure g_debug_mask does not have the DEBUG_FILE_OUT bit set.
 //#define DEBUG_DROPOUT	(0)
@@ -42,11 +46,18 @@
 #define DEBUG_SPECTRUM_ALL    (DEBUG_SWEEP_PLAN | DEBUG_COLLECT | DEBUG_SPEED | DEBUG_PEAKS | DEBUG_SPEC_DATA | DEBUG_FILE_OUT | DEBUG_SWEEP_CFG)
 #define DEBUG_ALL			  (DEBUG_PERFORMANCE_ALL | DEBUG_SPECTRUM_ALL)		// Ensure this always has all flags set.
 
-extern uint32_t g_debug_mask;	///< In user application, set to any combination of above flags to enable corresponding output, or zero for no output.	
+extern uint32_t volatile g_debug_mask;	///< In user application, set to any combination of above flags to enable corresponding output, or zero for no output.	
+											///< Read atomically, so it may be changed with wsa_atomic_store_u32() while other threads print.
+
+/// Flags compiled into the build; DEBUG_PRINTF() calls for any other flag are removed entirely, arguments and all,
+/// whatever g_debug_mask holds. Define on the compiler command line to limit it: the release build sets it to 0.
+#ifndef DEBUG_PRINTF_COMPILED_MASK
+#define DEBUG_PRINTF_COMPILED_MASK (0xFFFFFFFFu)
+#endif
 
 #define DEBUG_PRINTF(DEBUG_MASK, FMT, ...) \
   do { \
-    if(g_debug_mask & DEBUG_MASK) \
+    if((DEBUG_PRINTF_COMPILED_MASK & (DEBUG_MASK)) && (wsa_atomic_load_u32(&g_debug_mask) & (DEBUG_MASK))) \
       fprintf(stderr, "%s(): " FMT "\n", __FUNCTION__, __VA_ARGS__); \
   } while(0)
 
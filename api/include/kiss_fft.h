@@ -23,15 +23,15 @@ extern "C" {
   in the tools/ directory.
 */
 
+/* Allocations go through the library's allocator, see wsa_alloc.h. */
+#include "wsa_alloc.h"
+
 #ifdef USE_SIMD
 # include <xmmintrin.h>
 # define kiss_fft_scalar __m128
-#define KISS_FFT_MALLOC(nbytes) _mm_malloc(nbytes,16)
-#define KISS_FFT_FREE _mm_free
-#else	
-#define KISS_FFT_MALLOC malloc
-#define KISS_FFT_FREE free
 #endif	
+#define KISS_FFT_MALLOC(nbytes) wsa_malloc_aligned(nbytes,WSA_ALLOC_ALIGN)
+#define KISS_FFT_FREE wsa_free
 
 
 #ifdef FIXED_POINT
@@ -65,8 +65,8 @@ typedef struct kiss_fft_state* kiss_fft_cfg;
  *  The return value from fft_alloc is a cfg buffer used internally
  *  by the fft routine or NULL.
  *
- *  If lenmem is NULL, then kiss_fft_alloc will allocate a cfg buffer using malloc.
- *  The returned value should be free()d when done to avoid memory leaks.
+ *  If lenmem is NULL, then kiss_fft_alloc will allocate a cfg buffer using wsa_malloc_aligned.
+ *  The returned value should be freed with kiss_fft_free when done to avoid memory leaks.
  *  
  *  The state can be placed in a user supplied buffer 'mem':
  *  If lenmem is not NULL and mem is not NULL and *lenmem is large enough,
@@ -98,8 +98,8 @@ void kiss_fft(kiss_fft_cfg cfg,const kiss_fft_cpx *fin,kiss_fft_cpx *fout);
 void kiss_fft_stride(kiss_fft_cfg cfg,const kiss_fft_cpx *fin,kiss_fft_cpx *fout,int fin_stride);
 
 /* If kiss_fft_alloc allocated a buffer, it is one contiguous 
-   buffer and can be simply free()d when no longer needed*/
-#define kiss_fft_free free
+   buffer and can be simply freed with kiss_fft_free when no longer needed*/
+#define kiss_fft_free wsa_free
 
 /*
  Cleans up some memory that gets managed internally. Not necessary to call, but it might clean up 
@@ -0,0 +1,31 @@
+///
+/// @file
+/// The allocator every library allocation goes through, including kiss_fft's.
+///
+/// By default memory comes from the C heap. An application can install its own allocator with
+/// wsa_set_allocator(), e.g. to use an arena or a hugepage pool, or to count allocations.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#ifndef __WSA_ALLOC_H__
+#define __WSA_ALLOC_H__
+
+#include <stddef.h>
+
+/// Alignment of the sample and FFT buffers, enough for any SIMD load and a cache line.
+#define WSA_ALLOC_ALIGN 64
+
+/// An allocator. Every function gets the ctx pointer it was installed with.
+struct wsa_allocator {
+    void *(*alloc)(void *ctx, size_t size);							///< Like malloc()
+    void *(*aligned_alloc)(void *ctx, size_t size, size_t align);	///< align is a power of two
+    void (*free)(void *ctx, void *ptr);								///< Frees memory from either alloc function, or NULL
+    void *ctx;
+};
+
+void *wsa_malloc(size_t size);
+void *wsa_malloc_aligned(size_t size, size_t align);
+void wsa_free(void *ptr);
+
+#endif
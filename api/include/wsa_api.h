@@ -3,6 +3,8 @@
 
 
 #include "wsa_lib.h"
+#include "wsa_alloc.h"
+#include "wsa_iqcorr.h"
 
 #ifdef _THINKRFDLL_
 #ifdef _DLL_
@@ -21,9 +23,29 @@
 
 DECL void wsa_debuglevel(int);
 DECL void wsa_debugcallback(void(*callback)(void * pvoid, char const * pstring), void * pvoid);
+DECL void wsa_debug_flush(void);
 DECL const char *wsa_get_error_msg(int16_t err_code);
 
 
+// ////////////////////////////////////////////////////////////////////////////
+// STATISTICS FUNCTIONS                                                      //
+// ////////////////////////////////////////////////////////////////////////////
+
+DECL int16_t wsa_stats_read(struct wsa_device *dev, struct wsa_stats *stats, uint8_t reset);
+DECL void wsa_stats_reset(struct wsa_device *dev);
+DECL const char *wsa_stats_counter_name(enum wsa_stats_counter counter);
+DECL const char *wsa_stats_timer_name(enum wsa_stats_timer timer);
+DECL uint64_t wsa_stats_timer_percentile(struct wsa_stats const *stats, enum wsa_stats_timer timer, double percent);
+
+
+// ////////////////////////////////////////////////////////////////////////////
+// MEMORY FUNCTIONS                                                          //
+// ////////////////////////////////////////////////////////////////////////////
+
+DECL int16_t wsa_set_allocator(struct wsa_allocator const *allocator);
+DECL void wsa_get_allocator(struct wsa_allocator *allocator);
+
+
 // ////////////////////////////////////////////////////////////////////////////
 // WSA RELATED FUNCTIONS                                                     //
 // ////////////////////////////////////////////////////////////////////////////
@@ -106,6 +128,19 @@ DECL int16_t wsa_read_vrt_packet (struct wsa_device * const dev,
 		int32_t * const i32_buffer,
 		int32_t samples_per_packet,
 		uint32_t timeout);
+DECL int16_t wsa_read_vrt_packet_timed (struct wsa_device * const dev, 
+		struct wsa_vrt_packet_header * const header, 
+		struct wsa_vrt_packet_trailer * const trailer,
+		struct wsa_receiver_packet * const receiver,
+		struct wsa_digitizer_packet *digitizer,
+		struct wsa_extension_packet * const sweep,
+		int16_t * const i16_buffer,
+		int16_t * const q16_buffer,
+		int32_t * const i32_buffer,
+		int32_t samples_per_packet,
+		uint32_t timeout,
+		uint64_t *wait_ns,
+		uint64_t *decode_ns);
 
 DECL int16_t wsa_get_fft_size(int32_t const samples_per_packet, uint32_t const stream_id, int32_t *array_size);
 
@@ -120,6 +155,18 @@ DECL int16_t wsa_compute_fft(int32_t const samples_per_packet,
 						float * fft_buffer
 						);
 
+DECL int16_t wsa_compute_fft_ex(int32_t const samples_per_packet,
+						int32_t const fft_size,
+						uint32_t const stream_id,
+						int16_t const reference_level,
+						uint8_t const spectral_inversion,
+						int16_t * const i16_buffer,
+						int16_t * const q16_buffer,
+						int32_t * const i32_buffer,
+						float * fft_buffer,
+						struct wsa_iqcorr *iqcorr
+						);
+
 DECL int16_t peak_find(struct wsa_device *dev, 
 					uint64_t fstart, 
 					uint64_t fstop, 
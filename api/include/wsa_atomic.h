@@ -0,0 +1,154 @@
+///
+/// @file
+/// Minimal atomic operations and memory barriers used to share data between a capture thread
+/// and its consumers without locks.
+///
+/// 32-bit operations compile to plain loads, stores and locked adds. Where the compiler has the
+/// __atomic builtins, loads and stores use them, so no full barrier is needed and ThreadSanitizer
+/// sees them as atomic. The 64-bit operations are for counters that would wrap too soon in 32 bits;
+/// they use a compare-and-swap where the platform has no native 64-bit add, which is still
+/// lock-free on every platform we build for.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#ifndef __WSA_ATOMIC_H__
+#define __WSA_ATOMIC_H__
+
+#include "thinkrf_stdint.h"
+
+#ifdef _WIN32
+#include <intrin.h>
+#define WSA_INLINE __inline
+#else
+#define WSA_INLINE __inline__
+#endif
+
+
+///
+/// Full memory barrier: no load or store moves across it, in the compiler or the CPU.
+///
+static WSA_INLINE void wsa_memory_barrier( void )
+{
+#ifdef _WIN32
+    long volatile fence = 0;
+    _InterlockedOr(&fence, 0);
+#else
+    __sync_synchronize();
+#endif
+}
+
+
+///
+/// Read a 32-bit value shared with another thread.
+///
+/// Loads that follow in program order are not performed before this one.
+///
+static WSA_INLINE uint32_t wsa_atomic_load_u32( uint32_t volatile *ptr )
+{
+#if defined(__ATOMIC_ACQUIRE)
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#else
+    uint32_t value = *ptr;
+    wsa_memory_barrier();
+    return value;
+#endif
+}
+
+
+///
+/// Write a 32-bit value shared with another thread.
+///
+/// Stores that precede in program order are visible before this one.
+///
+static WSA_INLINE void wsa_atomic_store_u32( uint32_t volatile *ptr, uint32_t value )
+{
+#if defined(__ATOMIC_RELEASE)
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+#else
+    wsa_memory_barrier();
+    *ptr = value;
+#endif
+}
+
+
+///
+/// Atomically add to a 32-bit value shared with other threads.
+///
+/// @returns The new value.
+///
+static WSA_INLINE uint32_t wsa_atomic_add_u32( uint32_t volatile *ptr, uint32_t value )
+{
+#ifdef _WIN32
+    return (uint32_t)_InterlockedExchangeAdd((long volatile *)ptr, (long)value) + value;
+#else
+    return __sync_add_and_fetch(ptr, value);
+#endif
+}
+
+
+///
+/// Atomically replace a 32-bit value shared with other threads if it still holds an expected value.
+///
+/// @returns Non-zero if the value was replaced, 0 if it held something else.
+///
+static WSA_INLINE int wsa_atomic_cas_u32( uint32_t volatile *ptr, uint32_t expected, uint32_t value )
+{
+#ifdef _WIN32
+    return (uint32_t)_InterlockedCompareExchange((long volatile *)ptr, (long)value, (long)expected) == expected;
+#else
+    return __sync_bool_compare_and_swap(ptr, expected, value);
+#endif
+}
+
+
+///
+/// Atomically add to a 64-bit value shared with other threads.
+///
+static WSA_INLINE void wsa_atomic_add_u64( uint64_t volatile *ptr, uint64_t value )
+{
+#ifdef _WIN32
+    __int64 old;
+    do {
+        old = *(__int64 volatile *)ptr;
+    } while (_InterlockedCompareExchange64((__int64 volatile *)ptr, old + (__int64)value, old) != old);
+#else
+    __sync_fetch_and_add(ptr, value);
+#endif
+}
+
+
+///
+/// Read a 64-bit value shared with other threads, without tearing on 32-bit platforms.
+///
+static WSA_INLINE uint64_t wsa_atomic_load_u64( uint64_t volatile *ptr )
+{
+#ifdef _WIN32
+    return (uint64_t)_InterlockedCompareExchange64((__int64 volatile *)ptr, 0, 0);
+#else
+    return __sync_fetch_and_add(ptr, 0);
+#endif
+}
+
+
+///
+/// Atomically replace a 64-bit value shared with other threads.
+///
+/// @returns The previous value.
+///
+static WSA_INLINE uint64_t wsa_atomic_exchange_u64( uint64_t volatile *ptr, uint64_t value )
+{
+    uint64_t old;
+
+    do {
+        old = wsa_atomic_load_u64(ptr);
+#ifdef _WIN32
+    } while ((uint64_t)_InterlockedCompareExchange64((__int64 volatile *)ptr, (__int64)value, (__int64)old) != old);
+#else
+    } while (!__sync_bool_compare_and_swap(ptr, old, value));
+#endif
+
+    return old;
+}
+
+#endif
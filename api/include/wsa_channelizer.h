@@ -0,0 +1,70 @@
+///
+/// @file
+/// Polyphase channelizer: many narrow channels out of one wide IQ stream at once.
+///
+/// The stream is split into \b M channels, spaced fs / M apart across the sampled band. Channel k
+/// is centred on k * fs / M for k < M / 2, and on (k - M) * fs / M, below 0 Hz, above that. Each
+/// channel is brought to 0 Hz, filtered to fs / M wide, and decimated by M, so every M input
+/// samples give one IQ sample in each channel. The channels share one lowpass prototype filter,
+/// split into M branches of \b taps_per_channel taps each, and one M point FFT per output sample,
+/// so the cost per input sample grows with log M rather than M, as it would with a down-converter
+/// per channel.
+///
+/// The channels overlap at their edges, where the prototype is 6 dB down. A signal there shows in
+/// both neighbours, and one straddling the edge aliases in each.
+///
+/// Samples are pushed as normalized I and Q, as normalize_iq_data() gives them, in any amounts.
+/// Output samples are worked out in batches, shared among worker threads, and written to a ring
+/// per channel that readers take from with wsa_channelizer_read(), possibly on other threads. The
+/// rings are not held up by slow readers: a reader that falls a ring behind skips ahead.
+///
+/// Pushes continue one stream, so after a break in the capture (see WSA_GAP_*), call
+/// wsa_channelizer_reset() to start over.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#ifndef __WSA_CHANNELIZER_H__
+#define __WSA_CHANNELIZER_H__
+
+#include "thinkrf_stdint.h"
+
+/// Largest number of worker threads.
+#define WSA_CHANNELIZER_MAX_WORKERS 64
+
+/// Prototype taps per channel when wsa_channelizer_config::taps_per_channel is 0.
+#define WSA_CHANNELIZER_TAPS 16
+
+/// Output samples kept per channel when wsa_channelizer_config::ring is 0.
+#define WSA_CHANNELIZER_RING 4096
+
+/// Most output samples worked out at once. Rings hold at least twice this.
+#define WSA_CHANNELIZER_BATCH 256
+
+/// Settings for wsa_channelizer_alloc().
+struct wsa_channelizer_config {
+    uint32_t channels;				///< M, at least 2
+    uint32_t taps_per_channel;		///< Prototype taps per channel, or 0 for WSA_CHANNELIZER_TAPS
+
+    /// Lowpass prototype of channels * taps_per_channel taps, cutting off at fs / (2 M), or NULL
+    /// for a Blackman-windowed sinc. Scaled to unity gain at 0 Hz.
+    float const *prototype;
+
+    uint32_t workers;				///< Worker threads, or 0 to compute on the thread pushing
+    uint32_t ring;					///< Output samples kept per channel, rounded up to a power of 2, or 0 for WSA_CHANNELIZER_RING
+};
+
+/// A channelizer.
+struct wsa_channelizer;
+
+int16_t wsa_channelizer_alloc( struct wsa_channelizer_config const *config, struct wsa_channelizer **channelizer );
+void wsa_channelizer_free( struct wsa_channelizer *channelizer );
+void wsa_channelizer_reset( struct wsa_channelizer *channelizer );
+
+int16_t wsa_channelizer_push( struct wsa_channelizer *channelizer, float const *idata, float const *qdata,
+                              int32_t samples );
+uint64_t wsa_channelizer_produced( struct wsa_channelizer *channelizer );
+uint32_t wsa_channelizer_read( struct wsa_channelizer *channelizer, uint32_t channel, uint64_t *position,
+                               float *idata, float *qdata, uint32_t max );
+
+#endif
@@ -2,6 +2,7 @@
 #define __WSA_CLIENT_H__
 
 #include "thinkrf_stdint.h"
+#include "wsa_stats.h"
 
 #define MAX_STR_LEN 512
 #define MAX_BUF_SIZE 20
@@ -10,7 +11,13 @@
 #define CTRL_PORT "37001"
 #define DATA_PORT "37000"
 
-#define WSA_ARE_YOU_DEAD_Q (1 << 0)
+/* Data on its way from a socket to a file through a pipe, see wsa_sock_splice() */
+struct wsa_splice {
+	int32_t pipe_fds[2];
+	int32_t file_fd;
+	int32_t size;		/* capacity of the pipe */
+	int32_t fill;		/* bytes in the pipe, not yet in the file */
+};
 
 int16_t wsa_get_host_info(char *name);
 
@@ -20,10 +27,25 @@ int16_t wsa_setup_sock(char *sock_name, const char *sock_addr,
 int16_t wsa_close_sock(int32_t sock_fd);
 
 int32_t wsa_sock_send(int32_t sock_fd, char const *out_str, int32_t len);
+int wsa_sock_poll(int32_t sock_fd, int32_t timeout_ms);
+int16_t wsa_sock_set_nonblocking(int32_t sock_fd);
+int wsa_sock_would_block(void);
+int16_t wsa_sock_wait_until(int32_t sock_fd, uint64_t deadline_ns, struct wsa_stats *stats);
+int16_t wsa_sock_recv_until(int32_t sock_fd, uint8_t *rx_buf_ptr, int32_t buf_size,
+					  uint64_t deadline_ns, int32_t *bytes_received, struct wsa_stats *stats);
+int16_t wsa_sock_recv_now(int32_t sock_fd, uint8_t *rx_buf_ptr, int32_t buf_size,
+					  int32_t *bytes_received, struct wsa_stats *stats);
 int16_t wsa_sock_recv(int32_t sock_fd, uint8_t *rx_buf_ptr, int32_t buf_size,
-					  uint32_t time_out, int32_t *bytes_received);
+					  uint32_t time_out, int32_t *bytes_received, struct wsa_stats *stats);
 int16_t wsa_sock_recv_data(int32_t sock_fd, uint8_t *rx_buf_ptr, 
-						   int32_t buf_size, uint32_t time_out, int32_t *total_bytes, uint32_t flags);
+						   int32_t buf_size, uint64_t deadline_ns, int32_t *total_bytes,
+						   struct wsa_stats *stats);
+int wsa_sock_splice_open(struct wsa_splice *sp, int32_t file_fd);
+int16_t wsa_sock_splice_put(struct wsa_splice *sp, uint8_t const *buf, int32_t len);
+int16_t wsa_sock_splice(struct wsa_splice *sp, int32_t sock_fd, int32_t len,
+						uint64_t deadline_ns, struct wsa_stats *stats);
+int16_t wsa_sock_splice_flush(struct wsa_splice *sp);
+void wsa_sock_splice_close(struct wsa_splice *sp);
 void wsa_initialize_client();
 void wsa_destroy_client();
 
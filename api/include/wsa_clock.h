@@ -0,0 +1,50 @@
+///
+/// @file
+/// Monotonic clock used to time the stages of a capture.
+///
+/// The clock is unaffected by changes to the time of day and counts in nanoseconds; only the
+/// difference between two readings is meaningful.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#ifndef __WSA_CLOCK_H__
+#define __WSA_CLOCK_H__
+
+#include "thinkrf_stdint.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#define WSA_CLOCK_INLINE __inline
+#else
+#include <time.h>
+#define WSA_CLOCK_INLINE __inline__
+#endif
+
+
+///
+/// Read the monotonic clock.
+///
+/// @return The time in nanoseconds since an arbitrary starting point.
+///
+static WSA_CLOCK_INLINE uint64_t wsa_clock_ns( void )
+{
+#ifdef _WIN32
+    LARGE_INTEGER count;
+    LARGE_INTEGER freq;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+
+    return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000ULL +
+           (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000ULL / (uint64_t)freq.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+#endif
@@ -0,0 +1,64 @@
+///
+/// @file
+/// Digital down-converter: a narrow band at an offset from the capture's centre, at a sample rate
+/// of one's choosing.
+///
+/// The device's own decimation (wsa_set_decimation()) runs only by WSA_MIN_DECIMATION to
+/// WSA_MAX_DECIMATION, about its centre frequency. A DDC works on the samples after they are read
+/// instead, so a sub-band anywhere in the capture can be taken out without retuning, and several
+/// at once from the same stream.
+///
+/// The samples are mixed by a complex oscillator so the band's centre, \b offset from the
+/// capture's centre, moves to 0 Hz, and are then filtered and decimated in stages: halfband
+/// filters, each halving the rate, while the rate is still twice the output rate or more,
+/// and then one polyphase resampler by L / M for the rest. Each filter is designed for the stage
+/// it is in, to keep \b bandwidth about 0 Hz flat and reject what would alias into it by 90 dB, so
+/// the early stages, where the band is narrow next to the sample rate, need few taps.
+///
+/// The output rate is sample_rate * L / M / 2^halfbands, L and M the closest ratio with L up to
+/// WSA_DDC_MAX_PHASES. It is exactly output_rate when that divides into the sample rate with a
+/// small enough L, as for any power of 2 decimation; wsa_ddc_output_rate() gives it otherwise.
+///
+/// Samples are pushed in any amounts, as normalized I and Q or straight from the packets
+/// wsa_read_vrt_packet() gives; the outputs they complete are written to the caller's buffers.
+/// Pushes continue one stream, so after a break in the capture (see WSA_GAP_*), call
+/// wsa_ddc_reset() to start over.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#ifndef __WSA_DDC_H__
+#define __WSA_DDC_H__
+
+#include "thinkrf_stdint.h"
+
+/// Largest interpolation, L, of the final resampler.
+#define WSA_DDC_MAX_PHASES 1024
+
+/// Most halfband stages.
+#define WSA_DDC_MAX_HALFBANDS 24
+
+/// Settings for wsa_ddc_alloc().
+struct wsa_ddc_config {
+    double sample_rate;				///< Input samples per second
+    double offset;					///< Centre of the band, in Hz from the capture's centre; negative below it
+    double output_rate;				///< Output samples per second, above 0 and up to sample_rate
+    double bandwidth;				///< Width kept flat about the band's centre, in Hz, below output_rate, or 0 for 80% of it
+};
+
+/// A digital down-converter.
+struct wsa_ddc;
+
+int16_t wsa_ddc_alloc( struct wsa_ddc_config const *config, struct wsa_ddc **ddc );
+void wsa_ddc_free( struct wsa_ddc *ddc );
+void wsa_ddc_reset( struct wsa_ddc *ddc );
+
+double wsa_ddc_output_rate( struct wsa_ddc const *ddc );
+int32_t wsa_ddc_max_output( struct wsa_ddc const *ddc, int32_t samples );
+
+int32_t wsa_ddc_push( struct wsa_ddc *ddc, float const *idata, float const *qdata, int32_t samples,
+                      float *out_i, float *out_q );
+int32_t wsa_ddc_push_packet( struct wsa_ddc *ddc, uint32_t stream_id, int16_t *i16_buffer, int16_t *q16_buffer,
+                             int32_t *i32_buffer, int32_t samples, float *out_i, float *out_q );
+
+#endif
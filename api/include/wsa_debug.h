@@ -5,6 +5,9 @@
 #ifndef __WSA_DEBUG_H__
 #define __WSA_DEBUG_H__
 
+#include "thinkrf_stdint.h"
+#include "wsa_atomic.h"
+
 // Different debug levels
 // DHIGH shows fewest messages; DLOW shows DHIGH, DMED and DLOW messages.
 //
@@ -21,14 +24,43 @@
 #define DEBUGLEVEL DMED
 #endif
 
+// Most verbose level compiled into the build. doutf() calls above it are removed
+// entirely, so they cost nothing whatever level is set with wsa_debuglevel().
+// Define on the compiler command line to lower it: the release build keeps DHIGH
+// (errors) only.
+#ifndef WSA_LOG_COMPILED_LEVEL
+#define WSA_LOG_COMPILED_LEVEL DLOW
+#endif
+
 #define ENABLE_PRINTING 0
 
 #define WSA_API_LOG_FILE "wsa_api.log"
 #define ENABLE_LOG_FILE 1
 
+// Messages are formatted into an in-memory ring and written to the log file by a
+// background thread, so a call never waits on the disk. The ring holds
+// WSA_LOG_RING_SLOTS messages of up to WSA_LOG_MSG_MAX - 1 characters each; longer
+// messages are truncated, and messages arriving while the ring is full are dropped
+// and counted in the log.
+
+#define WSA_LOG_RING_SLOTS 1024
+#define WSA_LOG_MSG_MAX 256
+
+// Active level, set with wsa_debuglevel(). Read atomically without a lock, so it may
+// be changed while other threads log.
+extern uint32_t volatile wsa_debug_level;
+
 int  wsa_doutf(int, const char *, ...);
 
-#define doutf wsa_doutf
+// Messages above the active level cost a comparison: the arguments are not evaluated
+// and nothing is formatted. Messages above WSA_LOG_COMPILED_LEVEL are not compiled.
+#define doutf(level, ...) \
+	do { \
+		if ((level) <= WSA_LOG_COMPILED_LEVEL && \
+				(uint32_t) (level) <= wsa_atomic_load_u32(&wsa_debug_level)) { \
+			wsa_doutf((level), __VA_ARGS__); \
+		} \
+	} while (0)
 
 
 #endif
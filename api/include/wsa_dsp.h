@@ -6,6 +6,8 @@
 // ////////////////////////////////////////////////////////////////////////////
 // Normalize Section                                                         //
 // ////////////////////////////////////////////////////////////////////////////
+void get_normalization_factor(uint32_t const stream_id, kiss_fft_scalar  * normalization_factor);
+
 void normalize_iq_data(int32_t samples_per_packet,
 					uint32_t stream_id,
 					int16_t * i16_buffer,
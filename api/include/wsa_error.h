@@ -153,6 +153,7 @@
 #define WSA_ERR_MALLOCFAILED	(LNEG_NUM - 2002)
 #define WSA_ERR_UNKNOWN_ERROR	(LNEG_NUM - 2003)
 #define WSA_ERR_INVINPUT	(LNEG_NUM - 2004)
+#define WSA_ERR_THREADFAILED	(LNEG_NUM - 2005)
 
 // ///////////////////////////////
 // SWEEP ERRORS					//
@@ -174,6 +175,9 @@
 #define WSA_ERR_INVSWEEPSTARTID (LNEG_NUM - 3014)
 #define WSA_ERR_SWEEPWHILESTREAMING (LNEG_NUM - 3015)
 #define WSA_ERR_INV_SWEEP_FREQ (LNEG_NUM - 3016)
+#define WSA_ERR_SWEEPFRAMEUNAVAILABLE (LNEG_NUM - 3017)
+#define WSA_ERR_SWEEPVIEWSENABLED (LNEG_NUM - 3018)
+#define WSA_ERR_SWEEPDAMAGED (LNEG_NUM - 3019)
 
 // ///////////////////////////////
 // STREAM ERRORS  				//
@@ -0,0 +1,60 @@
+///
+/// @file
+/// Streaming DC offset and IQ imbalance correction.
+///
+/// A zero-IF receiver leaves a DC offset on I and Q, which shows as a spur at the centre of every
+/// spectrum, and I and Q slightly unequal in gain and off quadrature, which shows as an image of
+/// each signal mirrored about the centre. A corrector estimates both from the samples themselves
+/// and takes them out: I has its mean taken away, and Q its mean and the part of it that follows
+/// I, and is then scaled to the power of I, so the two are at right angles and equal again.
+///
+/// The estimates are running averages over the stream rather than over each packet alone, each
+/// packet moving them towards its own by its share of \b time_constant samples. They settle over a
+/// few time constants, and then follow drift with temperature or tuning, but no single packet,
+/// whose own mean may be off by whatever signal it holds, moves them much. The first packet after
+/// wsa_iqcorr_alloc() or wsa_iqcorr_reset() sets them outright.
+///
+/// A push takes normalized samples, as normalize_iq_data() gives them, and corrects them in
+/// place: one pass to sum the packet's means and powers, and one to correct with the estimates
+/// updated by them. For real (I-only) data, only the DC offset of I is taken out.
+///
+/// wsa_compute_fft_ex() and the real-time spectrum engine (wsa_rtsa_config.iq_correction) take one
+/// to correct their spectra. A corrector is not locked: it must be used by one thread at a time.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#ifndef __WSA_IQCORR_H__
+#define __WSA_IQCORR_H__
+
+#include "thinkrf_stdint.h"
+
+/// Default time constant of the estimates, in samples.
+#define WSA_IQCORR_DEFAULT_TIME_CONSTANT (1 << 20)
+
+/// Settings for wsa_iqcorr_alloc().
+struct wsa_iqcorr_config {
+    uint32_t time_constant;			///< Samples for the estimates to move 63% of the way to a change, or 0 for the default
+    uint8_t dc_only;				///< Non-zero to take out the DC offset only, and leave I and Q unbalanced
+};
+
+/// The estimates a corrector works with.
+struct wsa_iqcorr_estimate {
+    uint64_t samples;				///< Samples the estimates are from, since the last reset
+    double dc_i;					///< Mean of I, normalized
+    double dc_q;					///< Mean of Q, normalized
+    double gain;					///< RMS of Q over RMS of I, once their means are taken out
+    double phase;					///< How far Q is off quadrature with I, in degrees; positive when Q leans towards I
+};
+
+/// A DC offset and IQ imbalance corrector.
+struct wsa_iqcorr;
+
+int16_t wsa_iqcorr_alloc( struct wsa_iqcorr_config const *config, struct wsa_iqcorr **iqcorr );
+void wsa_iqcorr_free( struct wsa_iqcorr *iqcorr );
+void wsa_iqcorr_reset( struct wsa_iqcorr *iqcorr );
+
+int16_t wsa_iqcorr_push( struct wsa_iqcorr *iqcorr, float *idata, float *qdata, int32_t samples );
+void wsa_iqcorr_estimate( struct wsa_iqcorr const *iqcorr, struct wsa_iqcorr_estimate *estimate );
+
+#endif
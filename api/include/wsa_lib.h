@@ -2,6 +2,7 @@
 #define __WSA_LIB_H__
 
 #include "wsa_commons.h"
+#include "wsa_stats.h"
 
 #include <limits.h>
 #include <math.h>
@@ -24,6 +25,15 @@
 #define MAX_VRT_PKT_COUNT 15
 #define MIN_VRT_PKT_COUNT 0
 
+// Gaps found before a packet, in wsa_vrt_packet_header.gap
+#define WSA_GAP_DROPPED 0x01	// packets of the stream are missing, by the packet count
+#define WSA_GAP_REORDERED 0x02	// the packet count went back: the packet is out of order
+#define WSA_GAP_LATE 0x04		// the timestamp is later than the samples before it predict
+#define WSA_GAP_EARLY 0x08		// the timestamp is earlier than the samples before it predict
+
+// Streams whose packet counts and timestamps are followed at once
+#define WSA_TRACKED_STREAMS 8
+
 
 // VRT packet stream indentifier
 #define RECEIVER_STREAM_ID 0x90000001
@@ -270,6 +280,19 @@ struct wsa_vrt_packet_header {
 	uint8_t packet_type;
 	uint32_t stream_id;
 	struct wsa_time time_stamp;
+	uint8_t gap;		// WSA_GAP_* flags, 0 if the packet follows on from the last of its stream
+	uint8_t dropped;	// packets missing just before this one, by the packet count
+};
+
+// What is expected next of one stream, see wsa_read_vrt_packet_raw()
+struct wsa_stream_track {
+	uint32_t stream_id;		// 0 if the slot is free
+	uint8_t next_count;
+	uint8_t timed;			// the last packet's time is known
+	uint32_t last_sec;
+	uint64_t last_psec;
+	uint32_t last_samples;
+	uint64_t psec_per_sample;	// learned from the first two packets in a row, 0 until then
 };
 
 //structure to hold receiver packet data
@@ -339,9 +362,16 @@ struct wsa_socket {
 	int32_t data;
 };
 
+struct wsa_transport_ops;
+
 struct wsa_device {
 	struct wsa_descriptor descr;
 	struct wsa_socket sock;
+	struct wsa_stats stats;
+	struct wsa_transport_ops const *transport;	// chosen at connect, see wsa_transport.h
+	void *transport_ctx;
+	struct wsa_stream_track track[WSA_TRACKED_STREAMS];
+	uint8_t probe_pending;	// a status query went unanswered; its reply may still come
 };
 
 struct wsa_resp {
@@ -362,6 +392,9 @@ int16_t wsa_send_command(struct wsa_device *dev, char const *command);
 int16_t wsa_send_command_file(struct wsa_device *dev, char const *file_name);
 int16_t wsa_send_query(struct wsa_device *dev, char const *command, struct wsa_resp *resp);
 
+void wsa_stream_track_reset(struct wsa_device *dev);
+int16_t _wsa_recv_data_checked(struct wsa_device *dev, uint8_t *rx_buf_ptr,
+		int32_t buf_size, uint64_t probe_ns, uint64_t deadline_ns, int32_t *total_bytes);
 int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device, 
 		struct wsa_vrt_packet_header * const header, 
 		struct wsa_vrt_packet_trailer * const trailer,
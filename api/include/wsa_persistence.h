@@ -0,0 +1,57 @@
+///
+/// @file
+/// Digital persistence: a decaying histogram of where spectra fall, for finding intermittent
+/// signals.
+///
+/// The histogram has \b width columns across the spectrum and \b height rows across an amplitude
+/// range. Every bin of every spectrum pushed adds a hit to the cell of its column and amplitude,
+/// and older hits fade by \b decay with each spectrum after, so a signal seen once shows for a
+/// while and a steady one stays lit. Bin b goes to column floor(b * width / bins), as for display
+/// traces; amplitudes outside the range go to the top or bottom row.
+///
+/// A push is one pass over the spectrum and touches only the cells hit. Rather than fading every
+/// cell each time, each new hit is given more weight than the last, and the cells are scaled back
+/// only once in a long while, when the weight grows large. The cells are kept in square tiles of
+/// neighbouring columns and amplitudes, so a spectrum, whose neighbouring bins are mostly at
+/// neighbouring amplitudes, lands on few cache lines. wsa_persistence_read() gives the histogram as
+/// a plain image.
+///
+/// Spectra come from the real-time spectrum engine, with wsa_persistence_rtsa_spectrum() as its
+/// callback, from wsa_capture_power_spectrum() results, with wsa_persistence_push_spectrum(), or
+/// from anywhere else with wsa_persistence_push(). A histogram is not locked: pushes and reads must
+/// not overlap.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#ifndef __WSA_PERSISTENCE_H__
+#define __WSA_PERSISTENCE_H__
+
+#include "thinkrf_stdint.h"
+#include "wsa_lib.h"
+#include "wsa_sweep_device.h"
+#include "wsa_rtsa.h"
+
+/// Settings for wsa_persistence_alloc().
+struct wsa_persistence_config {
+    uint32_t width;					///< Columns across the spectrum
+    uint32_t height;				///< Rows across the amplitude range
+    float min_dbm;					///< Bottom of the amplitude range
+    float max_dbm;					///< Top of the amplitude range, above min_dbm
+    float decay;					///< Part of each hit left after each later spectrum, above 0 and up to 1 for none fading
+};
+
+/// A persistence histogram.
+struct wsa_persistence;
+
+int16_t wsa_persistence_alloc( struct wsa_persistence_config const *config, struct wsa_persistence **persistence );
+void wsa_persistence_free( struct wsa_persistence *persistence );
+void wsa_persistence_reset( struct wsa_persistence *persistence );
+
+int16_t wsa_persistence_push( struct wsa_persistence *persistence, float const *spectrum, uint32_t bins );
+int16_t wsa_persistence_push_spectrum( struct wsa_persistence *persistence, struct wsa_power_spectrum_config const *cfg );
+void wsa_persistence_rtsa_spectrum( void *persistence, struct wsa_rtsa_spectrum const *spectrum, float const *power );
+
+float wsa_persistence_read( struct wsa_persistence *persistence, float *image );
+
+#endif
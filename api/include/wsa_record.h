@@ -0,0 +1,57 @@
+///
+/// @file
+/// Recording the raw VRT stream from a device's data channel to a file.
+///
+/// A recording is the packets exactly as the device sent them, back to back, so it can be
+/// replayed later through the same parser. Next to it, in a file named after it with ".idx"
+/// appended, an index gives each packet's offset, stream id and timestamp, so a reader can seek
+/// by time without scanning the recording.
+///
+/// Only each packet's 5-word header is looked at, to find its size and fill in the index. By
+/// default packets are read into a large aligned buffer and written out in big blocks. With
+/// WSA_RECORD_SPLICE, on Linux and over TCP, the payloads instead go from the socket to the file
+/// with splice() and never enter user space. That saves the copy where the network driver and
+/// file system can hand pages over, but costs more system calls per packet: over loopback to
+/// wsasim, copying is cheaper. Measure with wsabench_record.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#ifndef __WSA_RECORD_H__
+#define __WSA_RECORD_H__
+
+#include "thinkrf_stdint.h"
+#include "wsa_lib.h"
+
+/// First bytes of an index file.
+#define WSA_RECORD_INDEX_MAGIC "WSAVRTX1"
+#define WSA_RECORD_INDEX_MAGIC_LEN 8
+
+/// Suffix added to a recording's path to name its index.
+#define WSA_RECORD_INDEX_SUFFIX ".idx"
+
+/// Size of the buffer packets are gathered in when they are not spliced.
+#define WSA_RECORD_BUFFER_SIZE (1024 * 1024)
+
+/// Options for wsa_recorder_alloc().
+#define WSA_RECORD_SPLICE 0x1		///< Splice the data where the platform allows it, rather than copying it
+
+/// One index entry, in host byte order, following the magic.
+struct wsa_record_index_entry {
+    uint64_t offset;				///< Byte offset of the packet in the recording
+    uint32_t stream_id;				///< The packet's stream identifier
+    uint32_t sec;					///< Integer-seconds timestamp
+    uint64_t psec;					///< Fractional-seconds timestamp in picoseconds, or 0
+};
+
+/// A recording in progress.
+struct wsa_recorder;
+
+int16_t wsa_recorder_alloc( struct wsa_device *dev, char const *path, uint32_t flags, struct wsa_recorder **recorder );
+int16_t wsa_recorder_run( struct wsa_recorder *recorder, uint64_t max_packets, uint32_t timeout );
+void wsa_recorder_stop( struct wsa_recorder *recorder );
+void wsa_recorder_totals( struct wsa_recorder *recorder, uint64_t *packets, uint64_t *bytes );
+uint8_t wsa_recorder_zero_copy( struct wsa_recorder const *recorder );
+int16_t wsa_recorder_free( struct wsa_recorder *recorder );
+
+#endif
@@ -0,0 +1,50 @@
+///
+/// @file
+/// A recording of the raw VRT stream, served as if it were a device.
+///
+/// Open a recording made with wsa_recorder_run(), or any file of back-to-back VRT packets, with
+/// wsa_open() and an interface string of the form "FILE::<path>[::REALTIME][::LOOP]". The file
+/// is memory mapped, and wsa_read_vrt_packet_raw() and everything built on it parse the packets
+/// in place, so the only copy is of the payload into the caller's buffer.
+///
+/// Commands are answered from a small table of settings rather than a device; one that cannot be
+/// parsed is reported by the next "SYST:ERR?". Starting a block capture, a stream or a sweep lets
+/// packets through; stopping it holds them back. Packets are served in file order: each capture
+/// picks up where the last one stopped, so capturing the same way as when the file was recorded
+/// gets the same packets back. A start id, if one is given, skips ahead to the extension packet
+/// that carries it. Finite sweeps do not end by themselves, as the file cannot say where they
+/// ended.
+///
+/// By default packets are served as fast as they are read. With REALTIME they are held back
+/// until their VRT timestamps, counted from the first packet of each capture, come due. With
+/// LOOP the recording starts over at its end; otherwise reads there return
+/// WSA_ERR_SOCKETNODATA at once.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#ifndef __WSA_REPLAY_H__
+#define __WSA_REPLAY_H__
+
+#include "thinkrf_stdint.h"
+
+/// Interface type of a replayed recording, as in "FILE::<path>".
+#define WSA_REPLAY_INTF "FILE"
+
+/// Identity reported by a replay. It claims the widest model so that any recorded plan passes
+/// the range checks.
+#define WSA_REPLAY_IDN "ThinkRF,R5500-427,REPLAY,1.0"
+
+/// Options for wsa_replay_open(), and their spellings in the interface string.
+#define WSA_REPLAY_REALTIME 0x1		///< Serve packets at the pace of their timestamps
+#define WSA_REPLAY_LOOP 0x2			///< Start over at the end of the recording
+#define WSA_REPLAY_REALTIME_STRING "REALTIME"
+#define WSA_REPLAY_LOOP_STRING "LOOP"
+
+/// A recording being replayed: the context of wsa_replay_transport, see wsa_transport.h.
+struct wsa_replay;
+
+int16_t wsa_replay_open( char const *path, uint32_t flags, struct wsa_replay **replay );
+void wsa_replay_close( struct wsa_replay *replay );
+
+#endif
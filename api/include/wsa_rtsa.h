@@ -0,0 +1,88 @@
+///
+/// @file
+/// Real-time spectrum: a gap-free run of overlapped FFTs over a streaming capture.
+///
+/// wsa_compute_fft() transforms one packet at a time, so a stream is either cut into windows at
+/// packet boundaries, with no overlap, or has packets thrown away while the last one is
+/// transformed. The real-time spectrum engine instead reads the stream from the device's data
+/// channel and joins the IF packets into one continuous run of samples. It takes a
+/// Hanning-windowed FFT every \b hop samples, so successive windows overlap by fft_size - hop
+/// samples and run across packet boundaries: a hop of fft_size / 2 overlaps by 50%, fft_size / 4
+/// by 75%.
+///
+/// The transforms are shared among worker threads. The spectra are handed to a callback in order,
+/// on the thread running wsa_rtsa_run(), each stamped with the time of its first sample. When all
+/// the transforms in flight are waiting to be handed over, reading stops until the oldest is, so
+/// a slow callback holds up the stream rather than losing spectra.
+///
+/// Where the stream breaks, as packets are lost or timestamps do not follow on (see WSA_GAP_*),
+/// the samples not yet in a whole window are discarded and the windows start again with the
+/// packet after the break. The samples lost are counted in the totals, so a run with none
+/// dropped is known to have covered every sample the device sent.
+///
+/// With iq_correction set, the samples have their DC offset and IQ imbalance taken out as they
+/// are received, by a corrector with the default settings that follows them over the whole run.
+///
+/// The engine does not start or stop the capture: call wsa_stream_start() before
+/// wsa_rtsa_run(), and wsa_stream_stop() after.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#ifndef __WSA_RTSA_H__
+#define __WSA_RTSA_H__
+
+#include "thinkrf_stdint.h"
+#include "wsa_lib.h"
+
+/// Largest number of worker threads.
+#define WSA_RTSA_MAX_WORKERS 64
+
+/// Transforms in flight per worker when wsa_rtsa_config::queue is 0.
+#define WSA_RTSA_QUEUE_PER_WORKER 4
+
+/// One spectrum handed to the callback.
+struct wsa_rtsa_spectrum {
+    uint64_t number;				///< Spectra before this one since the engine was made
+    uint64_t first_sample;			///< Samples received before this spectrum's first one
+    struct wsa_time time_stamp;		///< Time of the spectrum's first sample
+    uint32_t stream_id;				///< Stream of the samples, which sets the data format
+    int32_t bins;					///< Number of power values: fft_size, or fft_size / 2 for I-only data
+    uint8_t gap;					///< WSA_GAP_* flags of a break just before this spectrum, otherwise 0
+};
+
+/// Settings for wsa_rtsa_alloc().
+struct wsa_rtsa_config {
+    int32_t fft_size;				///< Samples in each FFT, even
+    int32_t hop;					///< Samples from the start of one FFT to the next, 1 to fft_size
+    uint32_t workers;				///< Worker threads, or 0 to compute on the thread reading the stream
+    uint32_t queue;					///< Transforms in flight at once, or 0 for WSA_RTSA_QUEUE_PER_WORKER per worker
+    int16_t reference_level;		///< dBm added to every power value, as for wsa_compute_fft()
+    uint8_t spectral_inversion;		///< Non-zero to reverse the spectra, as for wsa_compute_fft()
+    uint8_t iq_correction;			///< Non-zero to take out the DC offset and IQ imbalance first (see wsa_iqcorr.h)
+
+    /// Called with each spectrum in order, \p power holding spectrum->bins values in dBm. Both
+    /// are only valid during the call.
+    void (*spectrum)( void *arg, struct wsa_rtsa_spectrum const *spectrum, float const *power );
+    void *arg;						///< Passed to the callback
+};
+
+/// Counts since the engine was made.
+struct wsa_rtsa_totals {
+    uint64_t packets;				///< IF packets received
+    uint64_t samples;				///< Samples received
+    uint64_t spectra;				///< Spectra handed to the callback
+    uint64_t breaks;				///< Times the stream broke
+    uint64_t dropped_samples;		///< Samples the device sent that were not received, where known
+};
+
+/// A real-time spectrum engine on one device.
+struct wsa_rtsa;
+
+int16_t wsa_rtsa_alloc( struct wsa_device *dev, struct wsa_rtsa_config const *config, struct wsa_rtsa **rtsa );
+int16_t wsa_rtsa_run( struct wsa_rtsa *rtsa, uint64_t max_spectra, uint32_t timeout );
+void wsa_rtsa_stop( struct wsa_rtsa *rtsa );
+void wsa_rtsa_totals( struct wsa_rtsa *rtsa, struct wsa_rtsa_totals *totals );
+void wsa_rtsa_free( struct wsa_rtsa *rtsa );
+
+#endif
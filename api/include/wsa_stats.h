@@ -0,0 +1,96 @@
+///
+/// @file
+/// Per-device counters and timing histograms for the receive and DSP hot paths.
+///
+/// Every struct wsa_device carries a struct wsa_stats that the library updates as it works. Updates
+/// are lock-free atomic adds, so the block can be read from another thread while captures run, and
+/// cheap enough that the stats are always on. Read them with wsa_stats_read().
+///
+/// Timers are kept as log2 histograms of nanoseconds: bucket k counts the durations d with
+/// 2^k <= d < 2^(k+1) (bucket 0 also holds d = 0), and the last bucket holds everything longer.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#ifndef __WSA_STATS_H__
+#define __WSA_STATS_H__
+
+#include "thinkrf_stdint.h"
+#include "wsa_atomic.h"
+
+/// Number of buckets in each timing histogram; the last one holds durations of 2^31 ns (~2 s) or more.
+#define WSA_STATS_HIST_BUCKETS 32
+
+/// Event counters.
+enum wsa_stats_counter {
+    WSA_STAT_PACKETS = 0,			///< VRT packets received, of all types
+    WSA_STAT_BYTES,					///< Bytes of VRT packets received
+    WSA_STAT_RECV_CALLS,			///< recv() calls on the control and data sockets
+    WSA_STAT_SELECT_WAITS,			///< Waits for socket data, one poll each
+    WSA_STAT_TIMEOUTS,				///< Waits that reached their deadline with no data
+    WSA_STAT_STALLS,				///< Data reads that stalled and sent the device a status query
+    WSA_STAT_SCPI_QUERIES,			///< SCPI queries sent, including the error checks after each command
+    WSA_STAT_SAMPLE_LOSS,			///< IF packets whose trailer flags sample loss
+    WSA_STAT_OVER_RANGE,			///< IF packets whose trailer flags over range
+    WSA_STAT_DROPPED,				///< Packets missing from their stream, by the VRT packet count
+    WSA_STAT_REORDERED,				///< Packets whose VRT packet count went back
+    WSA_STAT_LATE,					///< IF packets timestamped later than the samples before them predict
+    WSA_STAT_EARLY,					///< IF packets timestamped earlier than the samples before them predict
+    WSA_STAT_COUNTERS				///< Number of counters
+};
+
+/// Timers.
+enum wsa_stats_timer {
+    WSA_STAT_SELECT_TIME = 0,		///< Time blocked waiting for socket data
+    WSA_STAT_SCPI_RTT,				///< SCPI query round trip, from sending to the end of the reply
+    WSA_STAT_DECODE_TIME,			///< Decoding one IF packet's payload
+    WSA_STAT_WINDOW_TIME,			///< Windowing one sweep block
+    WSA_STAT_FFT_TIME,				///< Transforming one sweep block
+    WSA_STAT_LOG_TIME,				///< Converting one sweep block to dBm
+    WSA_STAT_TIMERS					///< Number of timers
+};
+
+/// Statistics for one device.
+struct wsa_stats {
+    uint64_t counter[WSA_STAT_COUNTERS];						///< Indexed by enum wsa_stats_counter
+    uint64_t timer_total_ns[WSA_STAT_TIMERS];					///< Sum of all durations, by enum wsa_stats_timer
+    uint64_t timer_hist[WSA_STAT_TIMERS][WSA_STATS_HIST_BUCKETS];	///< Histogram of durations, by enum wsa_stats_timer
+};
+
+
+///
+/// Count events.
+///
+static WSA_INLINE void wsa_stats_count( struct wsa_stats *stats, enum wsa_stats_counter counter, uint64_t n )
+{
+    wsa_atomic_add_u64(&stats->counter[counter], n);
+}
+
+
+///
+/// Record one duration.
+///
+static WSA_INLINE void wsa_stats_time( struct wsa_stats *stats, enum wsa_stats_timer timer, uint64_t ns )
+{
+    uint32_t bucket = 0;
+
+#if defined(__GNUC__)
+    if (ns > 1) {
+        bucket = 63 - (uint32_t)__builtin_clzll(ns);
+    }
+#else
+    uint64_t v = ns;
+    while (v > 1) {
+        v >>= 1;
+        bucket++;
+    }
+#endif
+    if (bucket >= WSA_STATS_HIST_BUCKETS) {
+        bucket = WSA_STATS_HIST_BUCKETS - 1;
+    }
+
+    wsa_atomic_add_u64(&stats->timer_hist[timer][bucket], 1);
+    wsa_atomic_add_u64(&stats->timer_total_ns[timer], ns);
+}
+
+#endif
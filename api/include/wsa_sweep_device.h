@@ -44,6 +44,12 @@
 ///
 /// @{
 
+/// Detectors used to reduce the power spectrum to a display trace.
+#define WSA_TRACE_DETECTOR_PEAK 1			///< Largest bin value in each trace point
+#define WSA_TRACE_DETECTOR_SAMPLE 2			///< First bin value in each trace point
+#define WSA_TRACE_DETECTOR_NEG_PEAK 3		///< Smallest bin value in each trace point
+#define WSA_TRACE_DETECTOR_AVERAGE 4		///< Power average of all bins in each trace point
+
 /// An object containing sweep device properties.
 struct wsa_sweep_device_properties_t {
     uint32_t mode;							///< Device mode
@@ -70,6 +76,24 @@ struct wsa_sweep_plan {
     uint32_t spp;						///< Samples per packet
     uint32_t ppb;						///< Packets per block
     uint8_t dd_mode;					///< Flag to indicate if DD mode is needed
+    uint8_t only_dd;					///< Flag to indicate that only the DD entry is needed
+};
+
+/// One band of a (possibly multi-band) sweep.
+///
+/// The caller fills in fstart and fstop; wsa_power_spectrum_alloc_bands() works out the rest.
+/// Band b's spectrum occupies cfg->buf[bin_offset .. bin_offset + bin_count - 1].
+struct wsa_sweep_band {
+    uint64_t fstart;					///< Desired start frequency in Hz
+    uint64_t fstop;						///< Desired stop frequency in Hz
+    uint64_t fstart_actual;				///< Actual start frequency in Hz
+    uint64_t fstop_actual;				///< Actual stop frequency in Hz
+    uint32_t bin_offset;				///< Index of the band's first bin in the spectrum buffer
+    uint32_t bin_count;					///< Number of bins in the band
+    uint32_t block_offset;				///< Index of the band's first block in the sweep
+    uint32_t block_count;				///< Number of blocks the device produces for the band, 0 for a band cut from another's DD block
+    uint8_t dd_mode;					///< Flag to indicate the band starts below the DD cutoff; all such bands share the sweep's one DD block, its first
+    uint8_t only_dd;					///< Flag to indicate the band is covered by the DD block alone
 };
 
 /// A sweep device.
@@ -80,14 +104,88 @@ struct wsa_sweep_device {
     } device_settings;					///< Device settings that get sent to a sweep
 };
 
+/// A min/max/mean pyramid over the power spectrum buffer.
+///
+/// Level 0 is the spectrum buffer itself and is not stored here. Node j of level k covers
+/// bins [j * 2^k, (j + 1) * 2^k), clipped to the buffer length.
+struct wsa_spectrum_pyramid {
+    uint32_t levels;					///< Number of levels, including level 0
+    uint32_t *level_len;				///< Number of nodes in each level
+    uint32_t *level_offset;				///< Index of the first node of each level in the node arrays
+    float *min;							///< Smallest bin value under each node
+    float *max;							///< Largest bin value under each node
+    float *sum;							///< Sum of bin values under each node
+};
+
+/// Metadata for one block (frequency step) of a captured power spectrum.
+///
+/// One entry is kept per block, in the order the blocks were received, and is filled from packets
+/// that are read anyway, so it costs no extra I/O. The DD block shared by the bands below the DD
+/// cutoff gets one entry per band, each with that band's bins.
+struct wsa_spectrum_segment {
+    uint64_t fstart;					///< Frequency of the first bin written by this block, in Hz
+    uint64_t fstop;						///< Frequency just past the last bin written by this block, in Hz
+    uint64_t fcenter;					///< Centre frequency reported by the device for this block, in Hz
+    uint32_t bin_offset;				///< Index of the first bin written by this block
+    uint32_t bin_count;					///< Number of bins written by this block, 0 if the block never completed
+    struct wsa_time timestamp;			///< VRT timestamp of the first data packet of the block
+    float reflevel;						///< Reference level applied to the block, in dBm
+    uint8_t over_range;					///< Set if any packet of the block reported over range
+    uint8_t sample_loss;				///< Set if any packet of the block reported sample loss
+    uint8_t spectral_inversion;			///< Set if the block's spectrum was inverted
+};
+
+/// Time spent in each stage of power spectrum captures, summed over the captures made since the
+/// timing was enabled. See wsa_power_spectrum_set_timing().
+///
+/// Times are in nanoseconds from a monotonic clock. Stages not listed (plan bookkeeping, the trace
+/// and pyramid updates) make up the difference between their sum and the wall-clock time.
+struct wsa_sweep_timing {
+    uint64_t configure_ns;				///< Loading the sweep plan into the device
+    uint64_t start_ns;					///< Starting the sweep on the device
+    uint64_t wait_ns;					///< Waiting for and receiving packets, including header parsing
+    uint64_t decode_ns;					///< Decoding data payloads and scaling them into the FFT input
+    uint64_t window_ns;					///< Windowing each block
+    uint64_t fft_ns;					///< Transforming each block
+    uint64_t log_ns;					///< Converting each block to dBm and copying it out
+    uint64_t sweeps;					///< Number of sweeps captured
+    uint64_t packets;					///< Number of packets read, of all types
+    uint64_t blocks;					///< Number of blocks transformed
+};
+
+/// Information about one completed spectrum in continuous sweep mode.
+struct wsa_spectrum_frame_info {
+    uint64_t sweep_number;				///< Number of the sweep since continuous mode started, from 0
+    struct wsa_time first_timestamp;	///< Timestamp of the first data packet of the sweep
+    struct wsa_time last_timestamp;		///< Timestamp of the last data packet of the sweep
+};
+
+/// A ring of spectrum frames filled by continuous sweep mode.
+///
+/// Frame f holds cfg->buflen values starting at data + f * cfg->buflen. Sweep n is written to frame n % nframes.
+/// Each frame has a sequence counter that is odd while the frame is being written, so readers on
+/// other threads can detect and retry a torn copy without taking a lock.
+struct wsa_spectrum_ring {
+    uint32_t nframes;					///< Number of frames in the ring
+    float *data;						///< Spectrum data for all frames
+    struct wsa_spectrum_frame_info *info;	///< Information for each frame
+    struct wsa_spectrum_segment *segments;	///< Block metadata for each frame, segment_count entries per frame
+    uint32_t volatile *seq;				///< Sequence counter for each frame
+    uint32_t volatile completed;		///< Number of sweeps completed and published
+    uint32_t volatile damaged;			///< Number of sweeps dropped because packets were lost or out of place
+    uint64_t next_sweep;				///< Number of the sweep being collected
+    uint32_t start_id;					///< Sweep start id the device sends at the start of each sweep
+    uint8_t synced;						///< Set once the start id of the sweep being collected has been read
+};
+
 /// A configuration that we are going to sweep with and capture power spectrum data.
 struct wsa_power_spectrum_config {
     uint8_t only_dd;					///< Flag to indicate if only DD packets will be produced
     uint8_t compensation_entry;			///< NOTUSED: Flag to indicate an entry is required at the end to compensate for last frequency
     uint64_t compensation_freq;			///< NOTUSED: Frequency of the very last entry
     uint32_t mode;						///< Device mode to be used for the sweep
-    uint64_t fstart;					///< Desired start frequency
-    uint64_t fstop;						///< Desired stop frequency
+    uint64_t fstart;					///< Desired start frequency (of the first band)
+    uint64_t fstop;						///< Desired stop frequency (of the last band)
     uint64_t rbw;						///< Desired resolution bandwidth
     struct wsa_sweep_plan *sweep_plan;	///< A sweep plan that accomplishes the desired sweep.
     uint32_t packet_total;				///< Number of packets to be generated by this sweep.
@@ -98,6 +196,21 @@ struct wsa_power_spectrum_config {
     uint32_t buflen;					///< Length of the float buffer.
 	uint64_t fstart_actual;				///< Actual start frequency
 	uint64_t fstop_actual;				///< Actual stop frequency
+    float *trace;						///< Optional reduced display trace, NULL if not requested.
+    uint32_t tracelen;					///< Number of points in the display trace.
+    uint32_t trace_detector;			///< Detector used to reduce bins to trace points (WSA_TRACE_DETECTOR_*).
+    uint32_t *trace_count;				///< Number of bins folded into each trace point so far.
+    uint32_t trace_next_bin;			///< First bin not yet folded into the trace during a capture.
+    float const *trace_pending;			///< Values of the block held back from the trace until the next one, or NULL.
+    uint32_t trace_pending_bin;			///< Index of the first bin of the held back block.
+    uint32_t trace_pending_count;		///< Number of bins in the held back block.
+    struct wsa_spectrum_pyramid *pyramid;	///< Optional zoom pyramid over buf, NULL if not requested.
+    struct wsa_spectrum_ring *ring;		///< Completed spectra in continuous sweep mode, NULL otherwise.
+    struct wsa_spectrum_segment *segments;	///< Metadata for each block of the last capture.
+    uint32_t segment_count;				///< Number of entries in segments, one per block, and one per band for the DD block.
+    struct wsa_sweep_band *bands;		///< The bands making up the sweep, in increasing frequency order.
+    uint32_t band_count;				///< Number of entries in bands.
+    struct wsa_sweep_timing *timing;	///< Stage times, NULL unless enabled by wsa_power_spectrum_set_timing().
 };
 
 
@@ -163,6 +276,29 @@ DECL int16_t wsa_power_spectrum_alloc( struct wsa_sweep_device *sweep_device, ui
                                   uint32_t rbw, char const *mode, struct wsa_power_spectrum_config **pscfg );
 
 
+///
+/// Allocate memory for power spectrum data collection over a list of disjoint bands.
+///
+/// Each band becomes one entry in the device's sweep list, so the sweep only visits the requested
+/// spectrum. The output buffer is segmented: the bands' spectra are stored back to back in cfg->buf,
+/// at the offsets given in cfg->bands.
+///
+/// @param[in] sweep_device The sweep device to be used.
+/// @param[in] bands The bands to sweep, with fstart and fstop set, in increasing frequency order and not overlapping.
+/// @param[in] band_count The number of bands.
+/// @param[in] rbw The desired resolution bandwidth.
+/// @param[in] mode The mode in which to perform the sweep.
+/// @param[in,out] pscfgptr A pointer to an unallocated power spectrum config structure.
+///                         On return, this pointer points to a populated power spectrum configuration structure.
+///
+/// @returns 0 on success, WSA_ERR_INVINPUT if the bands are out of order or overlap, otherwise a negative
+///          error code.
+///
+DECL int16_t wsa_power_spectrum_alloc_bands( struct wsa_sweep_device *sweep_device, struct wsa_sweep_band const *bands,
+                                             uint32_t band_count, uint32_t rbw, char const *mode,
+                                             struct wsa_power_spectrum_config **pscfgptr );
+
+
 ///
 /// Free up storage for a power spectrum config object.
 ///
@@ -174,6 +310,79 @@ DECL int16_t wsa_power_spectrum_alloc( struct wsa_sweep_device *sweep_device, ui
 DECL void wsa_power_spectrum_free( struct wsa_power_spectrum_config *cfg );
 
 
+///
+/// Request a reduced display trace from subsequent captures.
+///
+/// The trace is computed block by block as wsa_capture_power_spectrum() writes out the spectrum,
+/// so a display-width trace costs no extra pass over the full-resolution data.
+/// Trace point p covers the bins b with p = floor(b * tracelen / buflen).
+/// Trace points with no captured bins are set to POISONED_BUFFER_VALUE.
+/// Where blocks overlap the trace takes the later block's values, as the spectrum buffer does, so
+/// the trace is the same whether or not the buffer is kept.
+///
+/// @param[in,out] cfg The power spectrum configuration to modify.
+/// @param[in] tracelen Number of trace points, from 1 to cfg->buflen. Zero disables the trace.
+/// @param[in] detector One of the WSA_TRACE_DETECTOR_* values.
+/// @param[in] keep_buf If zero, the full-resolution buffer cfg->buf is released and not written by
+///                     captures; only cfg->trace is produced. If non-zero, both are produced.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+DECL int16_t wsa_power_spectrum_set_trace( struct wsa_power_spectrum_config *cfg, uint32_t tracelen,
+                                           uint32_t detector, uint8_t keep_buf );
+
+
+///
+/// Enable or disable the zoom pyramid for subsequent captures.
+///
+/// The pyramid holds power-of-two levels of min/max/mean over cfg->buf and is updated block by block
+/// as wsa_capture_power_spectrum() writes out the spectrum. It lets wsa_power_spectrum_zoom() reduce
+/// any range of bins to a display width without visiting every bin.
+///
+/// @param[in,out] cfg The power spectrum configuration to modify. Its full-resolution buffer must be kept.
+/// @param[in] enable Non-zero to build the pyramid, zero to release it.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+DECL int16_t wsa_power_spectrum_set_pyramid( struct wsa_power_spectrum_config *cfg, uint8_t enable );
+
+
+///
+/// Enable or disable timing of each stage of subsequent captures.
+///
+/// When enabled, cfg->timing accumulates the time spent configuring, waiting for packets, decoding,
+/// windowing, transforming and converting to dBm. Timing costs two clock reads per stage per packet
+/// or block, so leave it off unless it is wanted.
+///
+/// @param[in,out] cfg The power spectrum configuration to modify.
+/// @param[in] enable Non-zero to enable timing and clear the totals, zero to release them.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+DECL int16_t wsa_power_spectrum_set_timing( struct wsa_power_spectrum_config *cfg, uint8_t enable );
+
+
+///
+/// Reduce a range of spectrum bins to a number of display pixels using the zoom pyramid.
+///
+/// Pixel p covers bins first_bin + floor(p * nbins / pixels) up to, but not including,
+/// first_bin + floor((p + 1) * nbins / pixels). When there are more pixels than bins, each pixel
+/// shows the single bin it falls on.
+///
+/// @param[in] cfg The power spectrum configuration, with the pyramid enabled.
+/// @param[in] first_bin The first bin of the zoom window.
+/// @param[in] nbins The number of bins in the zoom window.
+/// @param[in] pixels The number of output points.
+/// @param[out] min_out Smallest value for each pixel, or NULL if not wanted.
+/// @param[out] max_out Largest value for each pixel, or NULL if not wanted.
+/// @param[out] mean_out Mean value for each pixel, or NULL if not wanted.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+DECL int16_t wsa_power_spectrum_zoom( struct wsa_power_spectrum_config const *cfg, uint32_t first_bin, uint32_t nbins,
+                                      uint32_t pixels, float *min_out, float *max_out, float *mean_out );
+
+
 ///
 /// Configure a sweep device according to an existing sweep configuration.
 ///
@@ -199,10 +408,92 @@ DECL int16_t wsa_configure_sweep( struct wsa_sweep_device *sweep_device, struct
 /// @param[in,out] buf A pointer to an alternate memory buffer to be used to store the results, otherwise
 ///                    if set to NULL on entry this function populates it with a pointer to the allocated results memory buffer.
 ///
+/// @note
+/// If a display trace was requested with wsa_power_spectrum_set_trace(), cfg->trace is filled as well.
+/// If the zoom pyramid was enabled with wsa_power_spectrum_set_pyramid(), it is kept up to date with cfg->buf.
+/// cfg->segments receives the timestamp, reference level and trailer flags of each block.
+///
 ///@returns A negative error code if an error occurred, otherwise zero to indicate success.
 ///
 DECL int16_t wsa_capture_power_spectrum( struct wsa_sweep_device *sweep_device, struct wsa_power_spectrum_config *pscfg, float **buf );
 
+
+///
+/// Start continuous sweep mode.
+///
+/// The device, already set up with wsa_configure_sweep(), is told to repeat the sweep indefinitely and is
+/// started once, with a sweep start id it sends in an extension packet at the start of every sweep.
+/// Each call to wsa_sweep_continuous_capture() then assembles the next sweep into a ring of
+/// nframes preallocated spectrum frames, with no restart between sweeps.
+///
+/// The display trace and zoom pyramid are views of cfg->buf, which continuous mode does not write,
+/// and could not be updated while other threads read them. They must be disabled first; readers
+/// reduce the frames they copy out of the ring instead.
+///
+/// @param[in] sweep_device The sweep device to use.
+/// @param[in,out] cfg The power spectrum configuration to use, with no trace or pyramid.
+/// @param[in] nframes Number of frames in the ring, at least 2.
+///
+/// @returns 0 on success, WSA_ERR_SWEEPVIEWSENABLED if a trace or pyramid is enabled, otherwise a
+///          negative error code.
+///
+DECL int16_t wsa_sweep_continuous_start( struct wsa_sweep_device *sweep_device, struct wsa_power_spectrum_config *cfg,
+                                         uint32_t nframes );
+
+
+///
+/// Collect the next sweep in continuous sweep mode and publish it to the ring.
+///
+/// Call this repeatedly from the capture thread. It returns once the next sweep has been published
+/// or dropped.
+///
+/// Each sweep starts at the extension packet carrying the sweep start id, so a lost packet spoils
+/// at most the sweep it belongs to. A sweep with a gap in any stream (see WSA_GAP_*), or cut short
+/// by the start of the next, is dropped rather than published: its sweep number is skipped, it is
+/// counted in ring->damaged, and WSA_ERR_SWEEPDAMAGED is returned. Continuous mode is still running
+/// then, and the next call collects the sweep after it.
+///
+/// @param[in] sweep_device The sweep device to use.
+/// @param[in,out] cfg The power spectrum configuration passed to wsa_sweep_continuous_start().
+///
+/// @returns 0 on success, WSA_ERR_SWEEPDAMAGED if the sweep was dropped, otherwise a negative error code.
+///
+DECL int16_t wsa_sweep_continuous_capture( struct wsa_sweep_device *sweep_device, struct wsa_power_spectrum_config *cfg );
+
+
+///
+/// Copy a completed spectrum out of the ring.
+///
+/// This never blocks the capture thread and may be called from any other thread while
+/// wsa_sweep_continuous_capture() is running.
+///
+/// @param[in] cfg The power spectrum configuration passed to wsa_sweep_continuous_start().
+/// @param[in] age 0 for the latest completed sweep, 1 for the one before, and so on up to nframes - 2.
+/// @param[out] out Buffer of cfg->buflen values to receive the spectrum.
+/// @param[out] info Receives the sweep number and timestamps of the frame, or NULL if not wanted.
+/// @param[out] segments Receives cfg->segment_count block metadata entries for the frame, or NULL if not wanted.
+///
+/// @returns 0 on success, WSA_ERR_SWEEPFRAMEUNAVAILABLE if that sweep has not completed yet or has
+///          already been overwritten, otherwise a negative error code.
+///
+DECL int16_t wsa_sweep_continuous_read( struct wsa_power_spectrum_config *cfg, uint32_t age, float *out,
+                                        struct wsa_spectrum_frame_info *info, struct wsa_spectrum_segment *segments );
+
+
+///
+/// Stop continuous sweep mode and release the ring.
+///
+/// The packets of the sweep in progress are flushed from the device and the data socket, so the
+/// next capture starts clean. The capture thread must have returned from
+/// wsa_sweep_continuous_capture(), and no reader may be in wsa_sweep_continuous_read().
+///
+/// @param[in] sweep_device The sweep device to use.
+/// @param[in,out] cfg The power spectrum configuration passed to wsa_sweep_continuous_start().
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+DECL int16_t wsa_sweep_continuous_stop( struct wsa_sweep_device *sweep_device, struct wsa_power_spectrum_config *cfg );
+
 #endif
 
 /// @}				// name Public Functions
@@ -0,0 +1,96 @@
+///
+/// @file
+/// How a device connection moves bytes: the transport operations a struct wsa_device calls.
+///
+/// wsa_connect() picks a transport from the interface string once, and from then on
+/// wsa_send_command(), wsa_send_query(), wsa_read_vrt_packet_raw() and wsa_disconnect() call
+/// through the device's table without looking at the interface type again. Three transports are
+/// built in:
+/// \li wsa_tcp_transport, the device's control and data sockets ("TCPIP::<address>")
+/// \li wsa_replay_transport, a recording served as a device ("FILE::<path>", see wsa_replay.h)
+/// \li wsa_mem_transport, a device played in this process by callbacks, so tests and benchmarks
+///     can drive the whole library without sockets
+///
+/// Any other table may be connected with wsa_connect_transport().
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#ifndef __WSA_TRANSPORT_H__
+#define __WSA_TRANSPORT_H__
+
+#include "thinkrf_stdint.h"
+#include "wsa_stats.h"
+#include "wsa_lib.h"
+
+/// The two channels of a device connection.
+enum wsa_channel {
+    WSA_CHANNEL_CMD,		///< SCPI commands out, replies back
+    WSA_CHANNEL_DATA		///< VRT packets from the device
+};
+
+///
+/// Operations on a device connection. Each takes the context given to wsa_connect_transport().
+///
+struct wsa_transport_ops {
+    /// Interface type, copied to the device descriptor's intf_type.
+    char const *name;
+
+    /// Send \p len bytes on the command channel. Returns the number sent, or a negative error.
+    int32_t (*send)( void *ctx, char const *buf, int32_t len );
+
+    /// Read what has arrived on \p channel, up to \p size bytes, without waiting. Sets
+    /// \p received to 0 if nothing has. Returns 0, or a negative error. The command channel is
+    /// only read after poll() has returned 0 for it, as replies are never there sooner.
+    int16_t (*recv)( void *ctx, enum wsa_channel channel, uint8_t *buf, int32_t size, int32_t *received,
+                     struct wsa_stats *stats );
+
+    /// Wait until \p channel has something to read, or until \p deadline_ns on the
+    /// wsa_clock_ns() clock. Returns 0, WSA_ERR_SOCKETNODATA at the deadline, or another negative
+    /// error.
+    int16_t (*poll)( void *ctx, enum wsa_channel channel, uint64_t deadline_ns, struct wsa_stats *stats );
+
+    /// Optional: the next whole VRT packet on the data channel, in place, valid until the next
+    /// call. Transports that hold their packets in memory set this so they are parsed without a
+    /// copy; the others leave it NULL. Returns as poll() does.
+    int16_t (*next_packet)( void *ctx, uint64_t deadline_ns, uint8_t const **packet, uint32_t *packet_bytes );
+
+    /// Close the connection and free the context.
+    void (*close)( void *ctx );
+};
+
+extern struct wsa_transport_ops const wsa_tcp_transport;
+extern struct wsa_transport_ops const wsa_replay_transport;
+extern struct wsa_transport_ops const wsa_mem_transport;
+
+/// The device end of a memory transport.
+struct wsa_mem_link;
+
+///
+/// The device behind a memory transport, played by callbacks made from the library's calls, on
+/// the thread making them.
+///
+struct wsa_mem_device {
+    /// Called with each command or query the library sends, a line at a time. Answer queries
+    /// with wsa_mem_reply(); push any data the command starts with wsa_mem_push_data(). Return
+    /// 0, or a negative error to fail the send.
+    int16_t (*command)( void *arg, struct wsa_mem_link *link, char const *command );
+
+    /// Called when the library waits for data and none is queued. Push some, or return
+    /// WSA_ERR_SOCKETNODATA if there will be none by \p deadline_ns. May be NULL if all the data
+    /// is pushed from command().
+    int16_t (*fill)( void *arg, struct wsa_mem_link *link, uint64_t deadline_ns );
+
+    void *arg;				///< Passed to the callbacks
+};
+
+int16_t wsa_connect_transport( struct wsa_device *dev, struct wsa_transport_ops const *ops, void *ctx );
+
+int16_t wsa_mem_link_alloc( struct wsa_mem_device const *device, struct wsa_mem_link **link );
+int16_t wsa_mem_reply( struct wsa_mem_link *link, char const *reply );
+int16_t wsa_mem_push_data( struct wsa_mem_link *link, void const *buf, int32_t len );
+
+int16_t _wsa_recv_until( struct wsa_device *dev, enum wsa_channel channel, uint8_t *buf, int32_t size,
+                         uint64_t deadline_ns, int32_t *received );
+
+#endif
@@ -0,0 +1,59 @@
+///
+/// @file
+/// A waterfall: the history of a stream of spectra, each reduced to a display width, in a fixed
+/// amount of memory.
+///
+/// Each spectrum pushed becomes one row of \b width points, reduced with one of the
+/// WSA_TRACE_DETECTOR_* detectors as display traces are (see wsa_power_spectrum_set_trace()). The
+/// rows go into a ring of \b nrows, so once it is full each new row replaces the oldest. Every row
+/// keeps its time and the smallest and largest of its points, so wsa_waterfall_range() can give
+/// the colour scale of the rows on screen without a pass over them.
+///
+/// Spectra come from the real-time spectrum engine, with wsa_waterfall_rtsa_spectrum() as its
+/// callback, from consecutive wsa_capture_power_spectrum() results, with
+/// wsa_waterfall_push_spectrum(), or from anywhere else with wsa_waterfall_push().
+///
+/// Each row is stored twice, at its place in the ring and again nrows rows further on, so the
+/// latest rows are always one contiguous block, oldest first. wsa_waterfall_latest() points into
+/// it rather than copying. Rows are pushed from one thread; others may read them without a lock,
+/// calling wsa_waterfall_intact() after reading to check that the rows were not replaced
+/// meanwhile.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#ifndef __WSA_WATERFALL_H__
+#define __WSA_WATERFALL_H__
+
+#include "thinkrf_stdint.h"
+#include "wsa_lib.h"
+#include "wsa_sweep_device.h"
+#include "wsa_rtsa.h"
+
+/// About one row.
+struct wsa_waterfall_row {
+    uint32_t number;				///< Rows pushed before this one
+    uint32_t bins;					///< Points in the spectrum the row was reduced from
+    struct wsa_time time_stamp;		///< Time of the spectrum, or 0 if it had none
+    float min;						///< Smallest point in the row, in dBm
+    float max;						///< Largest point in the row, in dBm
+};
+
+/// A waterfall.
+struct wsa_waterfall;
+
+int16_t wsa_waterfall_alloc( uint32_t width, uint32_t nrows, uint32_t detector, struct wsa_waterfall **waterfall );
+void wsa_waterfall_free( struct wsa_waterfall *waterfall );
+
+int16_t wsa_waterfall_push( struct wsa_waterfall *waterfall, float const *spectrum, uint32_t bins,
+                            struct wsa_time const *time_stamp );
+int16_t wsa_waterfall_push_spectrum( struct wsa_waterfall *waterfall, struct wsa_power_spectrum_config const *cfg );
+void wsa_waterfall_rtsa_spectrum( void *waterfall, struct wsa_rtsa_spectrum const *spectrum, float const *power );
+
+uint32_t wsa_waterfall_latest( struct wsa_waterfall *waterfall, uint32_t count, float const **rows,
+                               struct wsa_waterfall_row const **info, uint32_t *first );
+uint8_t wsa_waterfall_intact( struct wsa_waterfall *waterfall, uint32_t first );
+int16_t wsa_waterfall_range( struct wsa_waterfall *waterfall, uint32_t count, float *min, float *max );
+uint32_t wsa_waterfall_width( struct wsa_waterfall const *waterfall );
+
+#endif
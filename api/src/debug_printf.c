@@ -20,6 +20,6 @@
 
 // Define a default bitmask with all output disabled.
 // See debug_printf.h for possible values of this bitmask, and adjust as desired in your application.
-uint32_t g_debug_mask = 0;
+uint32_t volatile g_debug_mask = 0;
 
 /// @}
@@ -333,8 +333,8 @@ void kf_factor(int n,int * facbuf)
  *
  * User-callable function to allocate all necessary storage space for the fft.
  *
- * The return value is a contiguous block of memory, allocated with malloc.  As such,
- * It can be freed with free(), rather than a kiss_fft-specific function.
+ * The return value is a contiguous block of memory, allocated with KISS_FFT_MALLOC.  As such,
+ * It can be freed with KISS_FFT_FREE, rather than a kiss_fft-specific function.
  * */
 kiss_fft_cfg kiss_fft_alloc(int nfft,int inverse_fft,void * mem,size_t * lenmem )
 {
@@ -1,7 +1,18 @@
+#ifdef __linux__
+#define _GNU_SOURCE		// splice()
+#endif
+
 #include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
 
 #include "wsa_client.h"
 #include "wsa_error.h"
+#include "wsa_debug.h"
+
+// Pipe size asked for when splicing, so a whole VRT packet fits at once.
+#define WSA_SPLICE_PIPE_SIZE (1024 * 1024)
 
 /**
  * Close the connection
@@ -20,6 +31,289 @@ int16_t wsa_close_sock(int32_t sock_fd)
 	return 0;
 }
 
+/**
+ * Wait for data to read on a socket
+ *
+ * @param sock_fd - The socket.
+ * @param timeout_ms - How long to wait in milliseconds, or 0 to only check.
+ * 
+ * @return 1 if the socket is readable (or has an error to read), 0 if the
+ * time ran out or the wait was interrupted by a signal, or -1 on error.
+ */
+int wsa_sock_poll(int32_t sock_fd, int32_t timeout_ms)
+{
+	struct pollfd pfd;
+	int result;
+
+	pfd.fd = sock_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	result = poll(&pfd, 1, timeout_ms);
+	if (result < 0 && errno == EINTR)
+		return 0;
+
+	return result;
+}
+
+/**
+ * Make reads from a socket return at once when there is no data
+ *
+ * @param sock_fd - The socket.
+ * 
+ * @return 0 on success, or WSA_ERR_SOCKETSETFUPFAILED.
+ */
+int16_t wsa_sock_set_nonblocking(int32_t sock_fd)
+{
+	int flags = fcntl(sock_fd, F_GETFL, 0);
+
+	if (flags == -1 || fcntl(sock_fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		return WSA_ERR_SOCKETSETFUPFAILED;
+
+	return 0;
+}
+
+/**
+ * Check whether the last failed socket call failed only because a
+ * non-blocking socket had nothing to give.
+ *
+ * @return Non-zero if so.
+ */
+int wsa_sock_would_block(void)
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+/**
+ * Set up to move data from a socket to a file through a pipe with
+ * wsa_sock_splice(), which needs Linux's splice() and a file system that
+ * supports it.  The file is checked by splicing one byte into it, then
+ * truncated back to empty, so the file must be new.
+ *
+ * @param sp - The splice state to set up.
+ * @param file_fd - The file the data will go to.
+ *
+ * @return 0 on success, or -1 if the data must be read and written instead.
+ */
+int wsa_sock_splice_open(struct wsa_splice *sp, int32_t file_fd)
+{
+#ifdef __linux__
+	int fds[2];
+	char probe = 0;
+	int size;
+
+	sp->pipe_fds[0] = -1;
+	sp->pipe_fds[1] = -1;
+	sp->file_fd = file_fd;
+	sp->fill = 0;
+
+	if (pipe(fds) == -1)
+		return -1;
+
+	// best effort; a smaller pipe still works, in more calls
+	fcntl(fds[1], F_SETPIPE_SZ, WSA_SPLICE_PIPE_SIZE);
+	size = fcntl(fds[1], F_GETPIPE_SZ);
+
+	// A pipe holds a number of pages rather than bytes, and each small write
+	// or socket fragment may take a page, so it can fill up well before
+	// size bytes.  Writes to it must not block then, but empty it first.
+	if (size <= 0 || fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK) == -1 ||
+		write(fds[1], &probe, 1) != 1 ||
+		splice(fds[0], NULL, file_fd, NULL, 1, SPLICE_F_MOVE) != 1 ||
+		ftruncate(file_fd, 0) == -1 || lseek(file_fd, 0, SEEK_SET) == -1) {
+		doutf(DMED, "splice() to the file is not available, copying instead\n");
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	sp->pipe_fds[0] = fds[0];
+	sp->pipe_fds[1] = fds[1];
+	sp->size = size;
+
+	return 0;
+#else
+	(void) file_fd;
+
+	sp->pipe_fds[0] = -1;
+	sp->pipe_fds[1] = -1;
+
+	return -1;
+#endif
+}
+
+/**
+ * Write everything in the pipe out to the file.
+ *
+ * @param sp - The splice state.
+ *
+ * @return 0 on success, or WSA_ERR_FILEWRITEFAILED.
+ */
+int16_t wsa_sock_splice_flush(struct wsa_splice *sp)
+{
+#ifdef __linux__
+	ssize_t written;
+
+	while (sp->fill > 0) {
+		written = splice(sp->pipe_fds[0], NULL, sp->file_fd, NULL, (size_t) sp->fill, SPLICE_F_MOVE);
+		if (written <= 0) {
+			if (written < 0 && errno == EINTR)
+				continue;
+			doutf(DHIGH, "splice() to the file failed with error %d\n", errno);
+			return WSA_ERR_FILEWRITEFAILED;
+		}
+		sp->fill -= (int32_t) written;
+	}
+#else
+	(void) sp;
+#endif
+
+	return 0;
+}
+
+/**
+ * Queue a few bytes from memory, such as a packet header already read, to
+ * go to the file after those already queued.
+ *
+ * @param sp - The splice state.
+ * @param buf - The bytes.
+ * @param len - The number of bytes, at most the pipe's size.
+ *
+ * @return 0 on success, or WSA_ERR_FILEWRITEFAILED.
+ */
+int16_t wsa_sock_splice_put(struct wsa_splice *sp, uint8_t const *buf, int32_t len)
+{
+#ifdef __linux__
+	ssize_t written;
+	int16_t result;
+
+	while (len > 0) {
+		if (sp->fill + len > sp->size) {
+			result = wsa_sock_splice_flush(sp);
+			if (result < 0)
+				return result;
+		}
+
+		written = write(sp->pipe_fds[1], buf, (size_t) len);
+		if (written <= 0) {
+			if (written < 0 && errno == EINTR)
+				continue;
+			if (written < 0 && errno == EAGAIN && sp->fill > 0) {
+				// out of pages in the pipe
+				result = wsa_sock_splice_flush(sp);
+				if (result < 0)
+					return result;
+				continue;
+			}
+			return WSA_ERR_FILEWRITEFAILED;
+		}
+		buf += written;
+		len -= (int32_t) written;
+		sp->fill += (int32_t) written;
+	}
+
+	return 0;
+#else
+	(void) sp;
+	(void) buf;
+	(void) len;
+
+	return WSA_ERR_FILEWRITEFAILED;
+#endif
+}
+
+/**
+ * Queue \b len bytes from a socket, read by an absolute deadline, to go to
+ * the file.  The data goes through the kernel's page cache only and is
+ * never copied into user space.  The pipe is written out to the file only
+ * when it fills, or by wsa_sock_splice_flush(), so it is done in large
+ * chunks whatever the size of the socket reads.
+ *
+ * @param sp - The splice state.
+ * @param sock_fd - The socket, which may be non-blocking.
+ * @param len - The number of bytes to move.
+ * @param deadline_ns - When to give up, on the wsa_clock_ns() clock.
+ * @param stats - The device's statistics, or NULL
+ *
+ * @return 0 on success, WSA_ERR_SOCKETNODATA if the data did not all arrive
+ * by the deadline, WSA_ERR_FILEWRITEFAILED, or another negative value on
+ * error.
+ */
+int16_t wsa_sock_splice(struct wsa_splice *sp, int32_t sock_fd, int32_t len,
+						uint64_t deadline_ns, struct wsa_stats *stats)
+{
+#ifdef __linux__
+	ssize_t moved;
+	int16_t result;
+
+	while (len > 0) {
+		if (sp->fill == sp->size) {
+			result = wsa_sock_splice_flush(sp);
+			if (result < 0)
+				return result;
+		}
+
+		moved = splice(sock_fd, NULL, sp->pipe_fds[1], NULL,
+			(size_t) (len < sp->size - sp->fill ? len : sp->size - sp->fill),
+			SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (stats)
+			wsa_stats_count(stats, WSA_STAT_RECV_CALLS, 1);
+
+		if (moved == 0) {
+			doutf(DMED, "Connection is already closed.\n");
+			return WSA_ERR_SOCKETERROR;
+		}
+		if (moved < 0) {
+			if (!wsa_sock_would_block()) {
+				doutf(DHIGH, "splice() from the socket failed with error %d\n", errno);
+				return WSA_ERR_SOCKETERROR;
+			}
+			// if the socket has data, the pipe is out of pages
+			if (sp->fill > 0 && wsa_sock_poll(sock_fd, 0) > 0) {
+				result = wsa_sock_splice_flush(sp);
+				if (result < 0)
+					return result;
+				continue;
+			}
+			result = wsa_sock_wait_until(sock_fd, deadline_ns, stats);
+			if (result < 0)
+				return result;
+			continue;
+		}
+
+		len -= (int32_t) moved;
+		sp->fill += (int32_t) moved;
+	}
+
+	return 0;
+#else
+	(void) sp;
+	(void) sock_fd;
+	(void) len;
+	(void) deadline_ns;
+	(void) stats;
+
+	return WSA_ERR_SOCKETERROR;
+#endif
+}
+
+/**
+ * Release the pipe from wsa_sock_splice_open(), if it made one.  Data still
+ * in it is lost, so flush first.
+ *
+ * @param sp - The splice state.
+ */
+void wsa_sock_splice_close(struct wsa_splice *sp)
+{
+	if (sp->pipe_fds[0] >= 0)
+		close(sp->pipe_fds[0]);
+	if (sp->pipe_fds[1] >= 0)
+		close(sp->pipe_fds[1]);
+	sp->pipe_fds[0] = -1;
+	sp->pipe_fds[1] = -1;
+	sp->fill = 0;
+}
+
 void wsa_initialize_client()
 {
 	//Empty, since no initialization needs to be done
@@ -21,6 +21,104 @@ int16_t wsa_close_sock(int32_t sock_fd)
 	return 0;
 }
 
+/**
+ * Wait for data to read on a socket
+ *
+ * @param sock_fd - The socket.
+ * @param timeout_ms - How long to wait in milliseconds, or 0 to only check.
+ * 
+ * @return 1 if the socket is readable (or has an error to read), 0 if the
+ * time ran out, or -1 on error.
+ */
+int wsa_sock_poll(int32_t sock_fd, int32_t timeout_ms)
+{
+	WSAPOLLFD pfd;
+
+	pfd.fd = (SOCKET) sock_fd;
+	pfd.events = POLLRDNORM;
+	pfd.revents = 0;
+
+	return WSAPoll(&pfd, 1, timeout_ms);
+}
+
+/**
+ * Make reads from a socket return at once when there is no data
+ *
+ * @param sock_fd - The socket.
+ * 
+ * @return 0 on success, or WSA_ERR_SOCKETSETFUPFAILED.
+ */
+int16_t wsa_sock_set_nonblocking(int32_t sock_fd)
+{
+	u_long mode = 1;
+
+	if (ioctlsocket((SOCKET) sock_fd, FIONBIO, &mode) != 0)
+		return WSA_ERR_SOCKETSETFUPFAILED;
+
+	return 0;
+}
+
+/**
+ * Check whether the last failed socket call failed only because a
+ * non-blocking socket had nothing to give.
+ *
+ * @return Non-zero if so.
+ */
+int wsa_sock_would_block(void)
+{
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+
+/**
+ * Moving socket data to a file without a copy needs Linux's splice(), so
+ * callers always fall back to reading and writing the data themselves.
+ *
+ * @return -1
+ */
+int wsa_sock_splice_open(struct wsa_splice *sp, int32_t file_fd)
+{
+	(void) file_fd;
+
+	sp->pipe_fds[0] = -1;
+	sp->pipe_fds[1] = -1;
+	sp->fill = 0;
+
+	return -1;
+}
+
+int16_t wsa_sock_splice_flush(struct wsa_splice *sp)
+{
+	(void) sp;
+
+	return 0;
+}
+
+int16_t wsa_sock_splice_put(struct wsa_splice *sp, uint8_t const *buf, int32_t len)
+{
+	(void) sp;
+	(void) buf;
+	(void) len;
+
+	return WSA_ERR_FILEWRITEFAILED;
+}
+
+int16_t wsa_sock_splice(struct wsa_splice *sp, int32_t sock_fd, int32_t len,
+						uint64_t deadline_ns, struct wsa_stats *stats)
+{
+	(void) sp;
+	(void) sock_fd;
+	(void) len;
+	(void) deadline_ns;
+	(void) stats;
+
+	return WSA_ERR_SOCKETERROR;
+}
+
+void wsa_sock_splice_close(struct wsa_splice *sp)
+{
+	(void) sp;
+}
+
 void wsa_initialize_client()
 {
 	struct WSAData ws_data;		// create an instance of Winsock data type
@@ -0,0 +1,145 @@
+///
+/// @file
+/// The library's allocator, and the default one backed by the C heap.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_error.h"
+#include "wsa_alloc.h"
+
+
+///
+/// Default allocator: the C heap. Windows needs _aligned_free() for aligned blocks, so there
+/// every block is allocated aligned and one free function handles them all.
+///
+static void *wsa_default_alloc( void *ctx, size_t size )
+{
+    (void)ctx;
+
+#ifdef _WIN32
+    return _aligned_malloc(size ? size : 1, 2 * sizeof(void *));
+#else
+    return malloc(size);
+#endif
+}
+
+
+static void *wsa_default_aligned_alloc( void *ctx, size_t size, size_t align )
+{
+    void *ptr = NULL;
+
+    (void)ctx;
+
+    if (align < sizeof(void *)) {
+        align = sizeof(void *);
+    }
+
+#ifdef _WIN32
+    ptr = _aligned_malloc(size ? size : 1, align);
+#else
+    if (posix_memalign(&ptr, align, size ? size : 1) != 0) {
+        ptr = NULL;
+    }
+#endif
+
+    return ptr;
+}
+
+
+static void wsa_default_free( void *ctx, void *ptr )
+{
+    (void)ctx;
+
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+
+static struct wsa_allocator wsa_allocator_current = {
+    wsa_default_alloc,
+    wsa_default_aligned_alloc,
+    wsa_default_free,
+    NULL
+};
+
+
+///
+/// Install the allocator the library uses for all its memory.
+///
+/// Every block is freed by the allocator that allocated it, so install it before the library
+/// allocates anything: before opening a device or creating a sweep device. This is not
+/// thread-safe.
+///
+/// @param[in] allocator The allocator, which is copied, or NULL to go back to the C heap.
+///
+/// @returns 0 on success, or WSA_ERR_INVINPUT if a function is missing.
+///
+int16_t wsa_set_allocator( struct wsa_allocator const *allocator )
+{
+    if (allocator == NULL) {
+        wsa_allocator_current.alloc = wsa_default_alloc;
+        wsa_allocator_current.aligned_alloc = wsa_default_aligned_alloc;
+        wsa_allocator_current.free = wsa_default_free;
+        wsa_allocator_current.ctx = NULL;
+        return 0;
+    }
+
+    if (allocator->alloc == NULL || allocator->aligned_alloc == NULL || allocator->free == NULL) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    wsa_allocator_current = *allocator;
+
+    return 0;
+}
+
+
+///
+/// Get the allocator in use, e.g. to wrap it with one that counts allocations.
+///
+/// @param[out] allocator Where to copy the allocator.
+///
+void wsa_get_allocator( struct wsa_allocator *allocator )
+{
+    *allocator = wsa_allocator_current;
+}
+
+
+///
+/// Allocate memory, like malloc().
+///
+void *wsa_malloc( size_t size )
+{
+    return wsa_allocator_current.alloc(wsa_allocator_current.ctx, size);
+}
+
+
+///
+/// Allocate memory aligned to align bytes, a power of two such as WSA_ALLOC_ALIGN.
+///
+void *wsa_malloc_aligned( size_t size, size_t align )
+{
+    return wsa_allocator_current.aligned_alloc(wsa_allocator_current.ctx, size, align);
+}
+
+
+///
+/// Free memory from wsa_malloc() or wsa_malloc_aligned(). Does nothing for NULL.
+///
+void wsa_free( void *ptr )
+{
+    if (ptr != NULL) {
+        wsa_allocator_current.free(wsa_allocator_current.ctx, ptr);
+    }
+}
@@ -30,6 +30,40 @@
  * will use any of its functions to access a WSA, and a link to 
  * the wsa_api.lib.  \b wsa_api also depends on the others *.h files provided
  * in the \b include folder  
+ *
+ * @section threads Threads
+ * The library keeps its state in each \b wsa_device and in the objects
+ * allocated for it (sweep devices, power spectrum configurations), so
+ * several devices can be driven at once, one per thread, with no locking:
+ *  - Different devices may be used concurrently from different threads.
+ *  - One device must be used by one thread at a time.  Commands, queries
+ *    and captures on it share its sockets, so calls on the same device from
+ *    two threads need a lock in the application.
+ *  - wsa_stats_read() and wsa_stats_reset() may be called from any thread
+ *    while the device is in use, from the end of wsa_open() until wsa_close().
+ *  - The DSP functions work only on the buffers passed to them.
+ *  - A real-time spectrum engine (wsa_rtsa.h) reads its device on the
+ *    thread calling wsa_rtsa_run() and shares the transforms among worker
+ *    threads of its own; its callback runs on the calling thread.
+ *  - A channelizer (wsa_channelizer.h) is fed from one thread at a time and
+ *    shares each batch among worker threads of its own; its channels may be
+ *    read from any thread.
+ *  - A down-converter (wsa_ddc.h) must be used by one thread at a time, but
+ *    several, on the same stream or not, may run on different threads.
+ *  - An IQ corrector (wsa_iqcorr.h), and so wsa_compute_fft_ex() called
+ *    with one, must be used by one thread at a time.
+ *
+ * The few process-wide settings are:
+ *  - wsa_debuglevel(), which may be called at any time from any thread.
+ *  - \b g_debug_mask, which may be changed at any time with
+ *    wsa_atomic_store_u32().
+ *  - wsa_debugcallback(), which must be set before other threads use the
+ *    library.
+ *  - wsa_set_allocator(), which must be called before the library allocates
+ *    anything.
+ *
+ * Logging from all threads goes through one lock-free queue to the log
+ * file.  `make stress` checks this contract under ThreadSanitizer.
  */
 
 
@@ -47,6 +81,8 @@
 #include "wsa_client.h"
 #include "wsa_dsp.h"
 #include "wsa_sweep_device.h"
+#include "wsa_clock.h"
+#include "wsa_transport.h"
 
 #ifdef _WIN32
 # define strtok_r strtok_s
@@ -248,7 +284,7 @@ int16_t wsa_query_scpi(struct wsa_device *dev, char const *command, char *respon
 {
 	struct wsa_resp query;		
     size_t len = strlen(command);
-    char * tmpbuffer = malloc(len + 2);
+    char * tmpbuffer = wsa_malloc(len + 2);
 	
     if(tmpbuffer) {
 	    sprintf(tmpbuffer, "%s\n", command);
@@ -256,7 +292,7 @@ int16_t wsa_query_scpi(struct wsa_device *dev, char const *command, char *respon
 	    wsa_send_query(dev, tmpbuffer, &query);
 	    strcpy(response, query.output);
 
-        free(tmpbuffer);
+        wsa_free(tmpbuffer);
 
 	    return (int16_t) query.status;
     }
@@ -275,14 +311,14 @@ int16_t wsa_send_scpi(struct wsa_device *dev, char const *command)
 {
 	int16_t result;
     size_t len = strlen(command);
-    char * tmpbuffer = malloc(len + 2);
+    char * tmpbuffer = wsa_malloc(len + 2);
 	
     if(tmpbuffer) {
 	    sprintf(tmpbuffer, "%s\n", command);
 	
 	    result = wsa_send_command(dev, tmpbuffer);
 
-        free(tmpbuffer);
+        wsa_free(tmpbuffer);
 
         return result;
     }
@@ -727,7 +763,10 @@ int16_t wsa_flush_data(struct wsa_device *dev)
 
 
 /**
- * Read out the data remaining in the data socket(reads for 1 second)
+ * Read out the data remaining in the data channel. Reading stops once no data
+ * has arrived for 360 ms, or after at most 1 second. The packet counts and
+ * timestamps expected of each stream are forgotten, see
+ * wsa_stream_track_reset().
  *
  * @param dev - A pointer to the WSA device structure.
  *
@@ -737,28 +776,32 @@ int16_t wsa_clean_data_socket(struct wsa_device *dev)
 	int32_t bytes_received = 0;
 	uint8_t *packet;
     int32_t packet_size = WSA_MAX_CAPTURE_BLOCK;
-	uint32_t timeout = 360;
-    clock_t start_time;
-    clock_t end_time;
+	uint64_t quiet_ns = 360 * 1000000ULL;
+	uint64_t now;
+	uint64_t end_time;
+	uint64_t wait_until;
 	
-	start_time = clock();
-	end_time = 1000 + start_time;
+	now = wsa_clock_ns();
+	end_time = now + 1000 * 1000000ULL;
 
-	packet = (uint8_t *) malloc(packet_size * sizeof(uint8_t));
+	packet = (uint8_t *) wsa_malloc(packet_size * sizeof(uint8_t));
 	if (packet == NULL)	{
 		doutf(DHIGH, "In wsa_clean_data_socket: failed to allocate memory\n");
 		return WSA_ERR_MALLOCFAILED;
 	}
 	// read the left over packets from the socket
-	while(clock() <= end_time) {
-		wsa_sock_recv_data(dev->sock.data, 
-									packet, 
-									packet_size, 
-									timeout,	
-									&bytes_received, 0);
+	while (now < end_time) {
+		wait_until = now + quiet_ns < end_time ? now + quiet_ns : end_time;
+		if (_wsa_recv_until(dev, WSA_CHANNEL_DATA, packet, packet_size, wait_until,
+				&bytes_received) < 0)
+			break;
+		now = wsa_clock_ns();
 	}
 
-	free(packet);
+	wsa_free(packet);
+
+	// what was thrown away would show as a gap
+	wsa_stream_track_reset(dev);
 
 	return 0;
 }
@@ -901,34 +944,75 @@ int16_t wsa_read_vrt_packet (struct wsa_device * const dev,
 		int32_t * const i32_buffer,
 		int32_t samples_per_packet,
 		uint32_t timeout)		
+{
+	return wsa_read_vrt_packet_timed(dev, header, trailer, receiver, digitizer, sweep_info,
+		i16_buffer, q16_buffer, i32_buffer, samples_per_packet, timeout, NULL, NULL);
+}
+
+/**
+ * Reads one VRT packet as \b wsa_read_vrt_packet does, and adds the time
+ * spent to the given totals.
+ *
+ * @param wait_ns - If not NULL, the nanoseconds spent waiting for and 
+ *		receiving the packet are added to it
+ * @param decode_ns - If not NULL, the nanoseconds spent decoding the 
+ *		packet's data payload are added to it
+ *
+ * See \b wsa_read_vrt_packet for the other parameters.
+ *
+ * @return 0 on success or a negative value on error
+ */
+int16_t wsa_read_vrt_packet_timed (struct wsa_device * const dev, 
+		struct wsa_vrt_packet_header * const header, 
+		struct wsa_vrt_packet_trailer * const trailer,
+		struct wsa_receiver_packet * const receiver,
+		struct wsa_digitizer_packet * digitizer,
+		struct wsa_extension_packet * const sweep_info,
+		int16_t * const i16_buffer, 
+		int16_t * const q16_buffer,
+		int32_t * const i32_buffer,
+		int32_t samples_per_packet,
+		uint32_t timeout,
+		uint64_t *wait_ns,
+		uint64_t *decode_ns)		
 {
 	uint8_t *data_buffer;
 	int16_t result = 0;
 	int16_t result2 = 0;
+	uint64_t t0 = 0;
 	int i = 0;
 	// allocate the data buffer
-	data_buffer = (uint8_t *) malloc(samples_per_packet * BYTES_PER_VRT_WORD * sizeof(uint8_t));
+	data_buffer = (uint8_t *) wsa_malloc(samples_per_packet * BYTES_PER_VRT_WORD * sizeof(uint8_t));
 	if (data_buffer == NULL) {
 		doutf(DHIGH, "In wsa_read_vrt_packet: failed to allocate memory\n");
 		return WSA_ERR_MALLOCFAILED;
 	}
 		
+	if (wait_ns)
+		t0 = wsa_clock_ns();
 	result = wsa_read_vrt_packet_raw(dev, header, trailer, receiver, digitizer, sweep_info, 
 		data_buffer, (uint16_t) samples_per_packet, timeout);
+	if (wait_ns)
+		*wait_ns += wsa_clock_ns() - t0;
 
 	doutf(DLOW, "wsa_read_vrt_packet_raw returned %hd\n", result);
 	
 	// check the result returned
 	if (result < 0)	{
 		doutf(DHIGH, "Error in wsa_read_vrt_packet: %s\n", wsa_get_error_msg(result));
-		wsa_system_abort_capture(dev);
-		result2 = wsa_flush_data(dev); 
-		wsa_clean_data_socket(dev);
+		// a device that did not answer a status query will not answer these either
+		if (result != WSA_ERR_DEVICE_NO_RESPONSE) {
+			wsa_system_abort_capture(dev);
+			result2 = wsa_flush_data(dev); 
+			wsa_clean_data_socket(dev);
+		}
 
-		free(data_buffer);
+		wsa_free(data_buffer);
 		return result;
 	} 
 
+	t0 = wsa_clock_ns();
+
 	// decode ZIF data packets
 	if (header->stream_id == I16Q16_DATA_STREAM_ID) 
 		result = (int16_t) wsa_decode_zif_frame(data_buffer, samples_per_packet, i16_buffer, q16_buffer, header->samples_per_packet);
@@ -937,6 +1021,13 @@ int16_t wsa_read_vrt_packet (struct wsa_device * const dev,
 	else if (header->stream_id == I32_DATA_STREAM_ID || header->stream_id == I16_DATA_STREAM_ID)
 		result = (int16_t) wsa_decode_i_only_frame(header->stream_id, data_buffer, samples_per_packet, i16_buffer, i32_buffer,  header->samples_per_packet);
 
+	if (header->packet_type == IF_PACKET_TYPE) {
+		t0 = wsa_clock_ns() - t0;
+		wsa_stats_time(&dev->stats, WSA_STAT_DECODE_TIME, t0);
+		if (decode_ns)
+			*decode_ns += t0;
+	}
+
 	// apply reflevel offset to R5500 if needed
 	//if (header->packet_type == IF_PACKET_TYPE){
 	if (header->packet_type == CONTEXT_PACKET_TYPE) {	// don@bearanascence.com 10May17 in conference with Mohammad et al.
@@ -948,7 +1039,7 @@ int16_t wsa_read_vrt_packet (struct wsa_device * const dev,
 			}
 		}
 	}
-	free(data_buffer);
+	wsa_free(data_buffer);
 
 	return 0;
 }
@@ -1000,6 +1091,42 @@ int16_t wsa_compute_fft(int32_t const samples_per_packet,
 				float * fft_buffer
 				)
 {
+	return wsa_compute_fft_ex(samples_per_packet, fft_size, stream_id,
+				reference_level, spectral_inversion, i16_buffer, q16_buffer,
+				i32_buffer, fft_buffer, NULL);
+}
+
+
+/**
+ * Compute the DFT of a complex data vector, as wsa_compute_fft() does,
+ * taking out the DC offset and IQ imbalance first.
+ *
+ * @param samples_per_packet The number of time domain samples to process
+ * @param stream_id The ID value identifying the type of data stream
+ * @param reference_level A dBm value used to calibrate the signal
+ * @param spectral_inversion A byte containing whether spectral inversion is active
+ * @param i16_buffer A buffer containing 16-bit iData
+ * @param q16_buffer A buffer containing 16-bit qData
+ * @param i32_buffer A buffer containing 32-bit iData
+ * @param fft_buffer A Buffer to store the FFT data
+ * @param iqcorr A corrector from wsa_iqcorr_alloc(), updated with the packet's
+ * samples, or NULL for none.
+ *
+ * @return 0 on success or a negative number on error.
+ * @retval -4 Malloc failed when allocating internal buffer space.
+ */
+int16_t wsa_compute_fft_ex(int32_t const samples_per_packet,
+				int32_t const fft_size,
+				uint32_t const stream_id,
+				int16_t const reference_level,
+				uint8_t const spectral_inversion,
+				int16_t * const i16_buffer,
+				int16_t * const q16_buffer,
+				int32_t * const i32_buffer,
+				float * fft_buffer,
+				struct wsa_iqcorr *iqcorr
+				)
+{
 
 	kiss_fft_scalar *idata;
 	kiss_fft_scalar *qdata;
@@ -1013,10 +1140,10 @@ int16_t wsa_compute_fft(int32_t const samples_per_packet,
 	int16_t result = 0;
 	int32_t i = 0;
 
-	idata = (float *) malloc(sizeof(float) * samples_per_packet);
-	qdata = (float *) malloc(sizeof(float) * samples_per_packet);
-	fftout = (kiss_fft_cpx *) malloc(sizeof(kiss_fft_cpx) * samples_per_packet);
-	iq = (kiss_fft_cpx *) malloc(sizeof(kiss_fft_cpx) * samples_per_packet);
+	idata = (float *) wsa_malloc_aligned(sizeof(float) * samples_per_packet, WSA_ALLOC_ALIGN);
+	qdata = (float *) wsa_malloc_aligned(sizeof(float) * samples_per_packet, WSA_ALLOC_ALIGN);
+	fftout = (kiss_fft_cpx *) wsa_malloc_aligned(sizeof(kiss_fft_cpx) * samples_per_packet, WSA_ALLOC_ALIGN);
+	iq = (kiss_fft_cpx *) wsa_malloc_aligned(sizeof(kiss_fft_cpx) * samples_per_packet, WSA_ALLOC_ALIGN);
 
 	if (!idata || !qdata || !fftout || !iq) {
 		fprintf(stderr, "In wsa_compute_fft: malloc() failed\n");
@@ -1033,8 +1160,12 @@ int16_t wsa_compute_fft(int32_t const samples_per_packet,
 					qdata);
 	doutf(DHIGH, "In wsa_compute_fft: normalized data\n");
 
-	// correct the DC offset
-	//correct_dc_offset(samples_per_packet, idata, qdata);
+	// correct the DC offset and IQ imbalance
+	if (iqcorr) {
+		wsa_iqcorr_push(iqcorr, idata,
+				(stream_id == I16Q16_DATA_STREAM_ID) ? qdata : NULL,
+				samples_per_packet);
+	}
 
 	window_hanning_scalar_array(idata, samples_per_packet);
 	window_hanning_scalar_array(qdata, samples_per_packet);
@@ -1047,8 +1178,8 @@ int16_t wsa_compute_fft(int32_t const samples_per_packet,
 	}
 	fft_cfg = kiss_fft_alloc(samples_per_packet, 0, 0, 0);		// Allocate storage for KISS FFT.
 	kiss_fft(fft_cfg, iq, fftout);						// Do the DFT.
-	free(fft_cfg);
-	free(iq);
+	kiss_fft_free(fft_cfg);
+	wsa_free(iq);
 	doutf(DHIGH, "In wsa_compute_fft: finished computing FFT\n");    
     
     // Perform fft shift
@@ -1085,9 +1216,9 @@ int16_t wsa_compute_fft(int32_t const samples_per_packet,
 	doutf(DHIGH, "In wsa_compute_fft: finished moving buffer\n");
 
 	// Free all the dynamic data we used.
-	free(idata);
-	free(qdata);
-	free(fftout);
+	wsa_free(idata);
+	wsa_free(qdata);
+	wsa_free(fftout);
 	
 	return result;
 }
@@ -0,0 +1,644 @@
+///
+/// @file
+/// The polyphase channelizer. See wsa_channelizer.h.
+///
+/// With prototype h of L = P * M taps, output n of channel k is the input mixed down by k / M
+/// cycles per sample, filtered and taken at sample s = n * M + M - 1:
+///
+///     y_k[n] = sum_i h[i] x[s - i] e^(-j 2 pi k (s - i) / M)
+///
+/// Splitting i into branches and taking the sum over them as an inverse FFT, with the prototype
+/// stored reversed as g[t] = h[L - 1 - t], this comes to
+///
+///     u[m] = sum_q g[q M + m] x[n M + q M + m],   for m < M
+///     y_k[n] = sum_j u[(M - j) % M] e^(j 2 pi k j / M)
+///
+/// where x[n M] is the first of the L samples output n covers. The inner sum runs over
+/// consecutive taps and samples, with I and Q kept apart.
+///
+/// The pushed samples are kept in xi and xq, the last L - M of the samples already used first. A
+/// batch of outputs is worked out as soon as any is whole, shared among the workers by their
+/// number; the thread pushing takes the first share. \b writing is bumped before a batch is
+/// written to the rings and \b produced after, so a reader knows which of the samples it copied
+/// may have been overwritten.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <string.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "kiss_fft.h"
+#include "wsa_lib.h"
+#include "wsa_error.h"
+#include "wsa_debug.h"
+#include "wsa_alloc.h"
+#include "wsa_atomic.h"
+#include "wsa_channelizer.h"
+
+struct wsa_channelizer_worker {
+    struct wsa_channelizer *ch;
+    uint32_t index;					///< Share of each batch, 0 for the thread pushing
+    kiss_fft_cfg fft;
+    kiss_fft_cpx *in;
+    kiss_fft_cpx *out;
+    float *ui;						///< Branch sums
+    float *uq;
+    uint64_t round;					///< Last batch worked on
+#ifdef _WIN32
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+    uint8_t started;
+};
+
+struct wsa_channelizer {
+    uint32_t m;
+    uint32_t length;				///< Prototype taps, L
+    float *g;						///< The prototype, reversed
+
+    // the samples pushed: xi[0] is the first of the next output's L
+    float *xi;
+    float *xq;
+    uint32_t len;
+    uint32_t keep;					///< L - M, the samples carried between batches
+    uint32_t size;
+
+    // rings: channel k's output n is at [k * ring + n % ring]
+    float *ring_i;
+    float *ring_q;
+    uint32_t ring;
+    uint64_t volatile writing;		///< Outputs being or been written
+    uint64_t volatile produced;		///< Outputs written
+
+    // The batch being worked out. All guarded by the lock, but read by the workers once they
+    // have seen round change, as the pushing thread leaves them be until pending is 0.
+    uint64_t round;
+    uint64_t base;					///< Number of the batch's first output
+    uint32_t batch;
+    uint32_t pending;				///< Workers not done with it
+    uint8_t quit;
+
+    struct wsa_channelizer_worker *workers;	///< The pushing thread, then each thread
+    uint32_t nshares;						///< Entries in workers
+    uint32_t nworkers;						///< Threads started
+#ifdef _WIN32
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE start;		///< round changed, or quit was set
+    CONDITION_VARIABLE finished;	///< pending reached 0
+#else
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+#endif
+    uint8_t locks_made;
+};
+
+
+static void wsa_channelizer_lock( struct wsa_channelizer *ch )
+{
+#ifdef _WIN32
+    EnterCriticalSection(&ch->lock);
+#else
+    pthread_mutex_lock(&ch->lock);
+#endif
+}
+
+
+static void wsa_channelizer_unlock( struct wsa_channelizer *ch )
+{
+#ifdef _WIN32
+    LeaveCriticalSection(&ch->lock);
+#else
+    pthread_mutex_unlock(&ch->lock);
+#endif
+}
+
+
+#ifdef _WIN32
+static void wsa_channelizer_wait( struct wsa_channelizer *ch, CONDITION_VARIABLE *cond )
+{
+    SleepConditionVariableCS(cond, &ch->lock, INFINITE);
+}
+#else
+static void wsa_channelizer_wait( struct wsa_channelizer *ch, pthread_cond_t *cond )
+{
+    pthread_cond_wait(cond, &ch->lock);
+}
+#endif
+
+
+///
+/// Work out the worker's share of the batch: outputs [base + first, base + last).
+///
+static void wsa_channelizer_compute( struct wsa_channelizer *ch, struct wsa_channelizer_worker *worker,
+                                     uint64_t base, uint32_t first, uint32_t last )
+{
+    uint32_t m = ch->m;
+    float const *g = ch->g;
+    float const *xi;
+    float const *xq;
+    float *ui = worker->ui;
+    float *uq = worker->uq;
+    uint32_t pos;
+    uint32_t n;
+    uint32_t t;
+    uint32_t k;
+
+    for (n = first; n < last; n++) {
+        xi = ch->xi + n * m;
+        xq = ch->xq + n * m;
+
+        // Four branches at a time, summed in locals as in wsa_ddc_dot() (wsa_ddc.c).
+        for (k = 0; k + 4 <= m; k += 4) {
+            float i0 = 0, i1 = 0, i2 = 0, i3 = 0;
+            float q0 = 0, q1 = 0, q2 = 0, q3 = 0;
+
+            for (t = k; t < ch->length; t += m) {
+                i0 += g[t] * xi[t];
+                i1 += g[t + 1] * xi[t + 1];
+                i2 += g[t + 2] * xi[t + 2];
+                i3 += g[t + 3] * xi[t + 3];
+                q0 += g[t] * xq[t];
+                q1 += g[t + 1] * xq[t + 1];
+                q2 += g[t + 2] * xq[t + 2];
+                q3 += g[t + 3] * xq[t + 3];
+            }
+            ui[k] = i0;
+            ui[k + 1] = i1;
+            ui[k + 2] = i2;
+            ui[k + 3] = i3;
+            uq[k] = q0;
+            uq[k + 1] = q1;
+            uq[k + 2] = q2;
+            uq[k + 3] = q3;
+        }
+        for (; k < m; k++) {
+            ui[k] = 0;
+            uq[k] = 0;
+            for (t = k; t < ch->length; t += m) {
+                ui[k] += g[t] * xi[t];
+                uq[k] += g[t] * xq[t];
+            }
+        }
+
+        worker->in[0].r = ui[0];
+        worker->in[0].i = uq[0];
+        for (k = 1; k < m; k++) {
+            worker->in[k].r = ui[m - k];
+            worker->in[k].i = uq[m - k];
+        }
+        kiss_fft(worker->fft, worker->in, worker->out);
+
+        pos = (uint32_t)((base + n) & (ch->ring - 1));
+        for (k = 0; k < m; k++) {
+            ch->ring_i[(size_t)k * ch->ring + pos] = worker->out[k].r;
+            ch->ring_q[(size_t)k * ch->ring + pos] = worker->out[k].i;
+        }
+    }
+}
+
+
+///
+/// Work out one worker's share of a batch: its number's part of the outputs in order.
+///
+static void wsa_channelizer_share( struct wsa_channelizer *ch, struct wsa_channelizer_worker *worker,
+                                   uint64_t base, uint32_t batch )
+{
+    uint32_t shares = ch->nworkers + 1;
+
+    wsa_channelizer_compute(ch, worker, base, (uint32_t)((uint64_t)batch * worker->index / shares),
+                            (uint32_t)((uint64_t)batch * (worker->index + 1) / shares));
+}
+
+
+#ifdef _WIN32
+static DWORD WINAPI wsa_channelizer_worker_main( LPVOID arg )
+#else
+static void *wsa_channelizer_worker_main( void *arg )
+#endif
+{
+    struct wsa_channelizer_worker *worker = arg;
+    struct wsa_channelizer *ch = worker->ch;
+    uint64_t base;
+    uint32_t batch;
+
+    wsa_channelizer_lock(ch);
+    while (!ch->quit) {
+        if (worker->round == ch->round) {
+            wsa_channelizer_wait(ch, &ch->start);
+            continue;
+        }
+        worker->round = ch->round;
+        base = ch->base;
+        batch = ch->batch;
+        wsa_channelizer_unlock(ch);
+
+        wsa_channelizer_share(ch, worker, base, batch);
+
+        wsa_channelizer_lock(ch);
+        ch->pending--;
+        if (ch->pending == 0) {
+#ifdef _WIN32
+            WakeConditionVariable(&ch->finished);
+#else
+            pthread_cond_signal(&ch->finished);
+#endif
+        }
+    }
+    wsa_channelizer_unlock(ch);
+
+    return 0;
+}
+
+
+///
+/// Work out every whole output in the input, write them to the rings, and drop the samples no
+/// longer needed.
+///
+static void wsa_channelizer_run( struct wsa_channelizer *ch )
+{
+    uint64_t base = wsa_atomic_load_u64(&ch->produced);
+    uint32_t batch;
+
+    if (ch->len < ch->length) {
+        return;
+    }
+    batch = (ch->len - ch->keep) / ch->m;
+
+    wsa_atomic_add_u64(&ch->writing, batch);
+
+    if (ch->nworkers == 0) {
+        wsa_channelizer_compute(ch, &ch->workers[0], base, 0, batch);
+    } else {
+        wsa_channelizer_lock(ch);
+        ch->round++;
+        ch->base = base;
+        ch->batch = batch;
+        ch->pending = ch->nworkers;
+#ifdef _WIN32
+        WakeAllConditionVariable(&ch->start);
+#else
+        pthread_cond_broadcast(&ch->start);
+#endif
+        wsa_channelizer_unlock(ch);
+
+        wsa_channelizer_share(ch, &ch->workers[0], base, batch);
+
+        wsa_channelizer_lock(ch);
+        while (ch->pending > 0) {
+            wsa_channelizer_wait(ch, &ch->finished);
+        }
+        wsa_channelizer_unlock(ch);
+    }
+
+    wsa_atomic_add_u64(&ch->produced, batch);
+
+    ch->len -= batch * ch->m;
+    memmove(ch->xi, ch->xi + batch * ch->m, sizeof(float) * ch->len);
+    memmove(ch->xq, ch->xq + batch * ch->m, sizeof(float) * ch->len);
+}
+
+
+///
+/// Create a channelizer.
+///
+/// @param[in] config The channels, prototype filter, workers and ring size.
+/// @param[out] channelizer The new channelizer.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_channelizer_alloc( struct wsa_channelizer_config const *config, struct wsa_channelizer **channelizer )
+{
+    struct wsa_channelizer *ch;
+    struct wsa_channelizer_worker *worker;
+    uint32_t taps;
+    uint32_t ring;
+    uint32_t i;
+    double *h;
+    double sum;
+    double t;
+    int ok;
+
+    if (config == NULL || channelizer == NULL || config->channels < 2 || config->workers > WSA_CHANNELIZER_MAX_WORKERS) {
+        return WSA_ERR_INVINPUT;
+    }
+    taps = (config->taps_per_channel > 0) ? config->taps_per_channel : WSA_CHANNELIZER_TAPS;
+    ring = (config->ring > 0) ? config->ring : WSA_CHANNELIZER_RING;
+    if (ring < 2 * WSA_CHANNELIZER_BATCH) {
+        ring = 2 * WSA_CHANNELIZER_BATCH;
+    }
+    if (ring > 0x40000000 || (uint64_t)config->channels * taps > 0x1000000) {
+        return WSA_ERR_INVINPUT;
+    }
+    i = 1;
+    while (i < ring) {
+        i <<= 1;
+    }
+    ring = i;
+
+    ch = wsa_malloc(sizeof(struct wsa_channelizer));
+    if (ch == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+    memset(ch, 0, sizeof(struct wsa_channelizer));
+    ch->m = config->channels;
+    ch->length = ch->m * taps;
+    ch->keep = ch->length - ch->m;
+    ch->size = ch->keep + WSA_CHANNELIZER_BATCH * ch->m;
+    ch->ring = ring;
+
+#ifdef _WIN32
+    InitializeCriticalSection(&ch->lock);
+    InitializeConditionVariable(&ch->start);
+    InitializeConditionVariable(&ch->finished);
+#else
+    pthread_mutex_init(&ch->lock, NULL);
+    pthread_cond_init(&ch->start, NULL);
+    pthread_cond_init(&ch->finished, NULL);
+#endif
+    ch->locks_made = 1;
+
+    h = wsa_malloc(sizeof(double) * ch->length);
+    ch->g = wsa_malloc_aligned(sizeof(float) * ch->length, WSA_ALLOC_ALIGN);
+    ch->xi = wsa_malloc_aligned(sizeof(float) * ch->size, WSA_ALLOC_ALIGN);
+    ch->xq = wsa_malloc_aligned(sizeof(float) * ch->size, WSA_ALLOC_ALIGN);
+    ch->ring_i = wsa_malloc_aligned(sizeof(float) * ch->m * (size_t)ring, WSA_ALLOC_ALIGN);
+    ch->ring_q = wsa_malloc_aligned(sizeof(float) * ch->m * (size_t)ring, WSA_ALLOC_ALIGN);
+    ch->workers = wsa_malloc(sizeof(struct wsa_channelizer_worker) * (config->workers + 1));
+    if (!h || !ch->g || !ch->xi || !ch->xq || !ch->ring_i || !ch->ring_q || !ch->workers) {
+        wsa_free(h);
+        wsa_channelizer_free(ch);
+        return WSA_ERR_MALLOCFAILED;
+    }
+    memset(ch->workers, 0, sizeof(struct wsa_channelizer_worker) * (config->workers + 1));
+    ch->nshares = config->workers + 1;
+    memset(ch->ring_i, 0, sizeof(float) * ch->m * (size_t)ring);
+    memset(ch->ring_q, 0, sizeof(float) * ch->m * (size_t)ring);
+
+    // the prototype: the one given, or a sinc cutting off at half a channel, Blackman windowed
+    sum = 0;
+    for (i = 0; i < ch->length; i++) {
+        if (config->prototype) {
+            h[i] = config->prototype[i];
+        } else {
+            t = ((double)i - (ch->length - 1) / 2.0) / ch->m;
+            h[i] = (t == 0) ? 1.0 : sin(M_PI * t) / (M_PI * t);
+            h[i] *= 0.42 - 0.5 * cos(2 * M_PI * i / (ch->length - 1)) + 0.08 * cos(4 * M_PI * i / (ch->length - 1));
+        }
+        sum += h[i];
+    }
+    if (sum == 0) {
+        wsa_free(h);
+        wsa_channelizer_free(ch);
+        return WSA_ERR_INVINPUT;
+    }
+    for (i = 0; i < ch->length; i++) {
+        ch->g[ch->length - 1 - i] = (float)(h[i] / sum);
+    }
+    wsa_free(h);
+
+    for (i = 0; i <= config->workers; i++) {
+        worker = &ch->workers[i];
+        worker->ch = ch;
+        worker->index = i;
+        worker->fft = kiss_fft_alloc(ch->m, 1, 0, 0);
+        worker->in = wsa_malloc_aligned(sizeof(kiss_fft_cpx) * ch->m, WSA_ALLOC_ALIGN);
+        worker->out = wsa_malloc_aligned(sizeof(kiss_fft_cpx) * ch->m, WSA_ALLOC_ALIGN);
+        worker->ui = wsa_malloc_aligned(sizeof(float) * ch->m, WSA_ALLOC_ALIGN);
+        worker->uq = wsa_malloc_aligned(sizeof(float) * ch->m, WSA_ALLOC_ALIGN);
+        if (!worker->fft || !worker->in || !worker->out || !worker->ui || !worker->uq) {
+            wsa_channelizer_free(ch);
+            return WSA_ERR_MALLOCFAILED;
+        }
+    }
+
+    wsa_channelizer_reset(ch);
+
+    for (i = 1; i <= config->workers; i++) {
+        worker = &ch->workers[i];
+#ifdef _WIN32
+        worker->thread = CreateThread(NULL, 0, wsa_channelizer_worker_main, worker, 0, NULL);
+        ok = (worker->thread != NULL);
+#else
+        ok = (pthread_create(&worker->thread, NULL, wsa_channelizer_worker_main, worker) == 0);
+#endif
+        if (!ok) {
+            wsa_channelizer_free(ch);
+            return WSA_ERR_THREADFAILED;
+        }
+        worker->started = 1;
+        ch->nworkers++;
+    }
+
+    doutf(DMED, "Channelizer: %u channels, %u taps each, %u workers, %u samples per ring\n",
+          (unsigned)ch->m, (unsigned)taps, (unsigned)config->workers, (unsigned)ring);
+
+    *channelizer = ch;
+
+    return 0;
+}
+
+
+///
+/// Stop the worker threads and free the channelizer. Nothing may be pushing to or reading from
+/// it.
+///
+void wsa_channelizer_free( struct wsa_channelizer *channelizer )
+{
+    struct wsa_channelizer *ch = channelizer;
+    uint32_t i;
+
+    if (ch == NULL) {
+        return;
+    }
+
+    if (ch->locks_made) {
+        wsa_channelizer_lock(ch);
+        ch->quit = 1;
+#ifdef _WIN32
+        WakeAllConditionVariable(&ch->start);
+#else
+        pthread_cond_broadcast(&ch->start);
+#endif
+        wsa_channelizer_unlock(ch);
+    }
+
+    if (ch->workers) {
+        for (i = 0; i < ch->nshares; i++) {
+            if (ch->workers[i].started) {
+#ifdef _WIN32
+                WaitForSingleObject(ch->workers[i].thread, INFINITE);
+                CloseHandle(ch->workers[i].thread);
+#else
+                pthread_join(ch->workers[i].thread, NULL);
+#endif
+            }
+            kiss_fft_free(ch->workers[i].fft);
+            wsa_free(ch->workers[i].in);
+            wsa_free(ch->workers[i].out);
+            wsa_free(ch->workers[i].ui);
+            wsa_free(ch->workers[i].uq);
+        }
+        wsa_free(ch->workers);
+    }
+
+    if (ch->locks_made) {
+#ifdef _WIN32
+        DeleteCriticalSection(&ch->lock);
+#else
+        pthread_mutex_destroy(&ch->lock);
+        pthread_cond_destroy(&ch->start);
+        pthread_cond_destroy(&ch->finished);
+#endif
+    }
+
+    wsa_free(ch->g);
+    wsa_free(ch->xi);
+    wsa_free(ch->xq);
+    wsa_free(ch->ring_i);
+    wsa_free(ch->ring_q);
+    wsa_free(ch);
+}
+
+
+///
+/// Forget the samples pushed so far, to start a new stream, as after a break. The next output
+/// is worked out from zeros before the first new sample. Output samples already in the rings
+/// stay, and the new ones are numbered on after them.
+///
+void wsa_channelizer_reset( struct wsa_channelizer *channelizer )
+{
+    memset(channelizer->xi, 0, sizeof(float) * channelizer->keep);
+    memset(channelizer->xq, 0, sizeof(float) * channelizer->keep);
+    channelizer->len = channelizer->keep;
+}
+
+
+///
+/// Add samples to the stream, and work out and write to the rings every output sample they
+/// complete.
+///
+/// @param[in] channelizer The channelizer.
+/// @param[in] idata I samples, normalized.
+/// @param[in] qdata Q samples, normalized, or NULL for real data.
+/// @param[in] samples Number of samples.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_channelizer_push( struct wsa_channelizer *channelizer, float const *idata, float const *qdata,
+                              int32_t samples )
+{
+    struct wsa_channelizer *ch = channelizer;
+    uint32_t left;
+    uint32_t take;
+
+    if (ch == NULL || idata == NULL || samples < 0) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    for (left = (uint32_t)samples; left > 0; left -= take) {
+        take = ch->size - ch->len;
+        if (take > left) {
+            take = left;
+        }
+        memcpy(ch->xi + ch->len, idata, sizeof(float) * take);
+        if (qdata) {
+            memcpy(ch->xq + ch->len, qdata, sizeof(float) * take);
+            qdata += take;
+        } else {
+            memset(ch->xq + ch->len, 0, sizeof(float) * take);
+        }
+        idata += take;
+        ch->len += take;
+
+        wsa_channelizer_run(ch);
+    }
+
+    return 0;
+}
+
+
+///
+/// Get the number of output samples written to each channel's ring so far. May be called from
+/// any thread while samples are pushed.
+///
+uint64_t wsa_channelizer_produced( struct wsa_channelizer *channelizer )
+{
+    return wsa_atomic_load_u64(&channelizer->produced);
+}
+
+
+///
+/// Copy a channel's output samples out of its ring. May be called from any thread while samples
+/// are pushed, with one reader per channel or a position each.
+///
+/// Where the samples from \p position on have been overwritten, reading starts from the oldest
+/// the ring still holds, so \p position moves on by more than the number read; the difference is
+/// the number lost.
+///
+/// @param[in] channelizer The channelizer.
+/// @param[in] channel The channel, below the number of channels.
+/// @param[in,out] position The number of the first output sample wanted, 0 for the first ever.
+///                         Moved on past those read.
+/// @param[out] idata Receives the I samples.
+/// @param[out] qdata Receives the Q samples.
+/// @param[in] max Most samples to read.
+///
+/// @returns The number of samples read: up to max, all the ring holds from the position on.
+///
+uint32_t wsa_channelizer_read( struct wsa_channelizer *channelizer, uint32_t channel, uint64_t *position,
+                               float *idata, float *qdata, uint32_t max )
+{
+    struct wsa_channelizer *ch = channelizer;
+    float const *ring_i;
+    float const *ring_q;
+    uint64_t produced;
+    uint64_t first;
+    uint32_t pos;
+    uint32_t n;
+    uint32_t part;
+
+    if (channel >= ch->m) {
+        return 0;
+    }
+    ring_i = ch->ring_i + (size_t)channel * ch->ring;
+    ring_q = ch->ring_q + (size_t)channel * ch->ring;
+
+    for (;;) {
+        // outputs before produced + WSA_CHANNELIZER_BATCH - ring may be overwritten by the next
+        // batch before they are copied
+        produced = wsa_atomic_load_u64(&ch->produced);
+        first = *position;
+        if (produced + WSA_CHANNELIZER_BATCH > ch->ring && first < produced + WSA_CHANNELIZER_BATCH - ch->ring) {
+            first = produced + WSA_CHANNELIZER_BATCH - ch->ring;
+        }
+        n = (first < produced) ? (uint32_t)(produced - first) : 0;
+        if (n > max) {
+            n = max;
+        }
+
+        pos = (uint32_t)(first & (ch->ring - 1));
+        part = (n < ch->ring - pos) ? n : ch->ring - pos;
+        memcpy(idata, ring_i + pos, sizeof(float) * part);
+        memcpy(qdata, ring_q + pos, sizeof(float) * part);
+        memcpy(idata + part, ring_i, sizeof(float) * (n - part));
+        memcpy(qdata + part, ring_q, sizeof(float) * (n - part));
+
+        wsa_memory_barrier();
+        if (wsa_atomic_load_u64(&ch->writing) <= first + ch->ring) {
+            break;
+        }
+    }
+
+    *position = first + n;
+
+    return n;
+}
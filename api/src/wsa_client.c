@@ -7,6 +7,7 @@
 #include "wsa_client.h"
 #include "wsa_error.h"
 #include "wsa_debug.h"
+#include "wsa_clock.h"
 
 #if defined(_WIN32) && defined(UNICODE)
 # undef gai_strerror
@@ -21,7 +22,6 @@ void *get_in_addr(struct sockaddr *sock_addr);
 int16_t _addr_check(const char *sock_addr, const char *sock_port,
 					struct addrinfo *ai_list);
 
-static int wsa_unblock_device(int sock);
 
 /**
  * Get sockaddr, IPv4 or IPv6
@@ -184,7 +184,7 @@ int16_t wsa_setup_sock(char *sock_name, const char *sock_addr,
 #else
         struct timeval tv;
         tv.tv_sec  = timeout / 1000;
-        tv.tv_usec = timeout * 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
 
         /* Ignore result */ setsockopt(temp_fd, SOL_SOCKET, SO_RCVTIMEO, (char*)&tv, sizeof(tv));
 #endif
@@ -257,187 +257,224 @@ int32_t wsa_sock_send(int32_t sock_fd, char const *out_str, int32_t len)
 
 
 /**
- * Reads data from the given server socket \b buf_size bytes 
- * at a time.  It does not loop to keep checking \b buf_size of bytes are
- * received. \n
- * This socket receive function makes used of select() function to check for
- * data availability before receiving.
+ * Wait until a socket has data to read or an absolute deadline passes.
+ * The wait is a single wsa_sock_poll() for the time left to the deadline,
+ * so it ends no later than the deadline whatever the timer resolution, and
+ * uses no CPU.
  *
- * @param sock_fd - The socket at which the data will be received.
- * @param rx_buf_ptr - A uint8 pointer buffer to store the incoming bytes.
- * @param buf_size - The size of the buffer in bytes.
- * @param time_out - Time out in milliseconds.
- * @param bytes_received - Pointer to int32_t storing number of bytes read (on success)
+ * @param sock_fd - The socket to wait on.
+ * @param deadline_ns - When to give up, on the wsa_clock_ns() clock.
+ * @param stats - The device's statistics, or NULL
  * 
- * @return 0 on success or a negative value on error
- */		
-int16_t wsa_sock_recv(int32_t sock_fd, uint8_t *rx_buf_ptr, int32_t buf_size,
-					  uint32_t time_out, int32_t *bytes_received)
+ * @return 0 once there is data, WSA_ERR_SOCKETNODATA if none came by the
+ * deadline, or WSA_ERR_SOCKETERROR
+ */
+int16_t wsa_sock_wait_until(int32_t sock_fd, uint64_t deadline_ns, struct wsa_stats *stats)
 {
-	fd_set read_fd;		// temp file descriptor for select()
 	int32_t ret_val;	// return value of a function
+	uint64_t now;
+	uint64_t t0 = 0;
+	int32_t wait_ms;
 
-	struct timeval timer;
-	long seconds = (long) floor(time_out / 1000.0);
-
-	// first set the time out timer
-	timer.tv_sec = seconds;
-	timer.tv_usec = (long) (time_out - (seconds * 1000)) * 1000;
-	// *****
-	// Use select() & FD_SET to make this receiving non-blocking (i.e. with
-	// time out value)
-	// *****
-
-	// FD_ZERO() clears out the fd_set called socks, so that
-	//   it doesn't contain any file descriptors.
-	FD_ZERO(&read_fd);
-
-	// FD_SET() adds the file descriptor "socket" to the fd_set,
-	//	so that select() will return if a connection comes in
-	//	on that socket (which means you have to do accept(), etc.)
-	FD_SET(sock_fd, &read_fd);
+	// only an interrupted or early wake-up goes round again
+	do {
+		now = wsa_clock_ns();
+		if (now >= deadline_ns)
+			wait_ms = 0;
+		else if (deadline_ns - now > 0x7fffffffULL * 1000000ULL)
+			wait_ms = 0x7fffffff;
+		else
+			// round up, so the wait never ends before the deadline
+			wait_ms = (int32_t) ((deadline_ns - now + 999999ULL) / 1000000ULL);
+
+		if (stats)
+			t0 = now;
+		ret_val = wsa_sock_poll(sock_fd, wait_ms);
+		if (stats) {
+			wsa_stats_time(stats, WSA_STAT_SELECT_TIME, wsa_clock_ns() - t0);
+			wsa_stats_count(stats, WSA_STAT_SELECT_WAITS, 1);
+		}
+	} while (ret_val == 0 && wait_ms > 0 && wsa_clock_ns() < deadline_ns);
 
-	ret_val = select(sock_fd + 1, &read_fd, NULL, NULL, &timer);
-	// Make reading of socket non-blocking w/ time-out of s.ms sec
-	if (ret_val == -1) {
-		doutf(DHIGH, "init select() function returned with error %d (\"%s\")\n", errno, strerror(errno));
+	if (ret_val < 0) {
+		doutf(DHIGH, "wsa_sock_poll() returned with error %d (\"%s\")\n", errno, strerror(errno));
 
 		return WSA_ERR_SOCKETERROR;
 	}
-	else if (ret_val) {
-		doutf(DLOW, "Data is available now.\n");
-	}
-	else {
-		doutf(DLOW, "No data received within %d milliseconds.\n", time_out);
-        if(ret_val) {
-    		doutf(DMED, "In wsa_sock_recv: select returned %d\n", ret_val);
-        }
+	else if (ret_val == 0) {
+		doutf(DLOW, "No data received by the deadline.\n");
+		if (stats)
+			wsa_stats_count(stats, WSA_STAT_TIMEOUTS, 1);
 
 		return WSA_ERR_SOCKETNODATA;
 	}
 
-	// if the socket is read-able, rx packet
-	if (FD_ISSET(sock_fd, &read_fd)) {
+	doutf(DLOW, "Data is available now.\n");
+
+	return 0;
+}
+
+
+/**
+ * Reads data from the given server socket \b buf_size bytes at a time,
+ * waiting until an absolute deadline for some to arrive.  It does not loop
+ * to keep checking \b buf_size of bytes are received. \n
+ * Each wait is one wsa_sock_wait_until(), so the call returns no later than
+ * the deadline.  The socket may be non-blocking: a read that would block
+ * just waits again.
+ *
+ * @param sock_fd - The socket at which the data will be received.
+ * @param rx_buf_ptr - A uint8 pointer buffer to store the incoming bytes.
+ * @param buf_size - The size of the buffer in bytes.
+ * @param deadline_ns - When to give up, on the wsa_clock_ns() clock.
+ * @param bytes_received - Pointer to int32_t storing number of bytes read (on success)
+ * @param stats - The device's statistics, or NULL
+ * 
+ * @return 0 on success, WSA_ERR_SOCKETNODATA if nothing arrived by the
+ * deadline, or another negative value on error
+ */
+int16_t wsa_sock_recv_until(int32_t sock_fd, uint8_t *rx_buf_ptr, int32_t buf_size,
+					  uint64_t deadline_ns, int32_t *bytes_received, struct wsa_stats *stats)
+{
+	int32_t ret_val;	// return value of a function
+	int16_t wait_result;
+
+	do {
+		wait_result = wsa_sock_wait_until(sock_fd, deadline_ns, stats);
+		if (wait_result < 0)
+			return wait_result;
+
 		// read incoming data buf_size at a time
 		// Need to cast the buffer pointer to char*
 		// since that is the data type on Windows
 		ret_val = recv(sock_fd, (char *) rx_buf_ptr, buf_size, 0);
-		
-		// checked the return value
-		if (ret_val == 0) {
-			// Connection closed
-			doutf(DMED, "Connection is already closed.\n");
+		if (stats)
+			wsa_stats_count(stats, WSA_STAT_RECV_CALLS, 1);
+	} while (ret_val < 0 && wsa_sock_would_block());
+	
+	// checked the return value
+	if (ret_val == 0) {
+		// Connection closed
+		doutf(DMED, "Connection is already closed.\n");
 
-			return WSA_ERR_SOCKETERROR;
-		}
-		else if (ret_val < 0) {
-			doutf(DHIGH, "recv() function returned with error %d (\"%s\")\n", errno, strerror(errno));
-			return WSA_ERR_SOCKETSETFUPFAILED;
-		}
-		
-		doutf(DLOW, "Received (%d bytes)\n", ret_val);
+		return WSA_ERR_SOCKETERROR;
 	}
+	else if (ret_val < 0) {
+		doutf(DHIGH, "recv() function returned with error %d (\"%s\")\n", errno, strerror(errno));
+		return WSA_ERR_SOCKETSETFUPFAILED;
+	}
+	
+	doutf(DLOW, "Received (%d bytes)\n", ret_val);
 		
 	*bytes_received = ret_val;
 	return 0;
 }
 
 
+/**
+ * Reads whatever data the given server socket holds now, up to \b buf_size
+ * bytes, without waiting for more.  The socket must be non-blocking, or
+ * known to have data, e.g. from wsa_sock_wait_until().
+ *
+ * @param sock_fd - The socket at which the data will be received.
+ * @param rx_buf_ptr - A uint8 pointer buffer to store the incoming bytes.
+ * @param buf_size - The size of the buffer in bytes.
+ * @param bytes_received - Pointer to int32_t storing number of bytes read,
+ * 0 if there were none
+ * @param stats - The device's statistics, or NULL
+ *
+ * @return 0 on success, or a negative value on error
+ */
+int16_t wsa_sock_recv_now(int32_t sock_fd, uint8_t *rx_buf_ptr, int32_t buf_size,
+					  int32_t *bytes_received, struct wsa_stats *stats)
+{
+	int32_t ret_val;
+
+	*bytes_received = 0;
+
+	ret_val = recv(sock_fd, (char *) rx_buf_ptr, buf_size, 0);
+	if (stats)
+		wsa_stats_count(stats, WSA_STAT_RECV_CALLS, 1);
+
+	if (ret_val == 0) {
+		doutf(DMED, "Connection is already closed.\n");
+		return WSA_ERR_SOCKETERROR;
+	}
+	else if (ret_val < 0) {
+		if (wsa_sock_would_block())
+			return 0;
+		doutf(DHIGH, "recv() function returned with error %d (\"%s\")\n", errno, strerror(errno));
+		return WSA_ERR_SOCKETSETFUPFAILED;
+	}
+
+	*bytes_received = ret_val;
+	return 0;
+}
+
+
+/**
+ * Reads data from the given server socket \b buf_size bytes 
+ * at a time.  It does not loop to keep checking \b buf_size of bytes are
+ * received. \n
+ * Equivalent to wsa_sock_recv_until() with a deadline \b time_out
+ * milliseconds from now.
+ *
+ * @param sock_fd - The socket at which the data will be received.
+ * @param rx_buf_ptr - A uint8 pointer buffer to store the incoming bytes.
+ * @param buf_size - The size of the buffer in bytes.
+ * @param time_out - Time out in milliseconds.
+ * @param bytes_received - Pointer to int32_t storing number of bytes read (on success)
+ * @param stats - The device's statistics, or NULL
+ * 
+ * @return 0 on success or a negative value on error
+ */		
+int16_t wsa_sock_recv(int32_t sock_fd, uint8_t *rx_buf_ptr, int32_t buf_size,
+					  uint32_t time_out, int32_t *bytes_received, struct wsa_stats *stats)
+{
+	return wsa_sock_recv_until(sock_fd, rx_buf_ptr, buf_size,
+		wsa_clock_ns() + (uint64_t) time_out * 1000000ULL, bytes_received, stats);
+}
+
+
 /**
  * Gets incoming data packet from the server socket \b buf_size bytes 
  * at a time.  This function will check to ensure the \b buf_size of bytes
- * are received.
+ * are received by an absolute deadline. \n
+ * On WSA_ERR_SOCKETNODATA, \b total_bytes holds what did arrive, so the
+ * caller can check on the device and call again for the rest.
  *
  * @param in_sock - The socket at which the data will be received.
  * @param rx_buf_ptr - A char pointer buffer to store the incoming bytes.
  * @param buf_size - The size of the buffer in bytes.
- * @param time_out - Time out in milliseconds.
- * @param total_bytes - Pointer to int32_t storing number of bytes read (on success)
+ * @param deadline_ns - When to give up, on the wsa_clock_ns() clock.
+ * @param total_bytes - Pointer to int32_t storing number of bytes read
+ * @param stats - The device's statistics, or NULL
  * 
  * @return 0 on success or a negative value on error
  */
 int16_t wsa_sock_recv_data(int32_t sock_fd, uint8_t *rx_buf_ptr, 
-						   int32_t buf_size, uint32_t time_out, int32_t *total_bytes, uint32_t flags)
+						   int32_t buf_size, uint64_t deadline_ns, int32_t *total_bytes,
+						   struct wsa_stats *stats)
 {
 	int16_t recv_result = 0;
 	int32_t bytes_received = 0;
 	int32_t bytes_expected = buf_size;
-	uint16_t retry = 0;
-	uint16_t try_limit = 3;
 
 	*total_bytes = 0;
 	
-	do {
+	while (*total_bytes < buf_size) {
+		recv_result = wsa_sock_recv_until(sock_fd, rx_buf_ptr, bytes_expected, deadline_ns, &bytes_received, stats);
+		if (recv_result < 0)
+			return recv_result;
 
-		recv_result = wsa_sock_recv(sock_fd, rx_buf_ptr, bytes_expected, time_out / (uint32_t) try_limit, &bytes_received);
-		if (recv_result == 0) {
-			retry = 0;
-			*total_bytes += bytes_received;
-
-			if (*total_bytes < buf_size) {
-				rx_buf_ptr += bytes_received;
-				bytes_expected -= bytes_received;
-			}
-			else {
-				doutf(DLOW, "total bytes received: %d\n", *total_bytes);
-				break;
-			}
-
-			doutf(DLOW, "bytes received: %d\n", bytes_received);
-		} else {
-			if (flags & WSA_ARE_YOU_DEAD_Q) {
-				doutf(DHIGH, "socket timeout; poking the device\n");
-				wsa_unblock_device(sock_fd);
-			}
-
-			// if got error, try again to make sure?
-			if (retry == (try_limit - 1)) {
-				return recv_result;
-			}
-			retry++;
-		}
-	} while (1);
-
-	return 0;
-}
+		*total_bytes += bytes_received;
+		rx_buf_ptr += bytes_received;
+		bytes_expected -= bytes_received;
 
-static int wsa_unblock_device(int vrtsock)
-{
-	int result;
-	int sockfd;
-	struct sockaddr_in serv_addr; 
-	int len;
-
-	// Get the IP address.
-	len = sizeof(serv_addr);
-	result = getpeername(vrtsock, (struct sockaddr *) &serv_addr, &len);
-	if (result) {
-		doutf(DHIGH, "wsa_unblock_device() error: result = %d (%d)\n", result, errno);
-
-		return -1;
+		doutf(DLOW, "bytes received: %d\n", bytes_received);
 	}
-	
-	// Create a socket.
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	if (sockfd < 0) {
-		doutf(DHIGH, "wsa_unblock_device() error: could not create socket\n");
-		return -2;
-	} 
-	
-	// Connect to port 80 instead.
-	serv_addr.sin_port = htons(80); 
-
-	// Connect to the server on the device.
-	result = connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
-	if (result < 0) {
-		doutf(DHIGH, "wsa_unblock_device() error: could not connect to socket\n");
-		return -3;
-	} 
 
-	// Now close it.
-	wsa_close_sock(sockfd);
+	doutf(DLOW, "total bytes received: %d\n", *total_bytes);
 
-	// All done.
 	return 0;
 }
-
@@ -6,6 +6,7 @@
 
 #include "wsa_commons.h"
 #include "wsa_error.h"
+#include "wsa_alloc.h"
 
 
 #ifdef _WIN32
@@ -19,7 +20,7 @@
  */
 const char *_wsa_get_err_msg(int16_t err_id)
 {
-	static struct wsa_err_item {
+	static const struct wsa_err_item {
 		int16_t err_id;
 		const char *err_msg;
 	} wsa_err_list[] = {
@@ -73,6 +74,8 @@ const char *_wsa_get_err_msg(int16_t err_id)
 			"check the Ethernet connection (repower WSA if necessary)"},
 		{WSA_ERR_INVLANCONFIG,
 			"Invalid LAN configuration option"},
+		{WSA_ERR_DEVICE_NO_RESPONSE,
+			"The device stopped sending data and does not answer a status query"},
 
 						
 		//*****
@@ -170,6 +173,7 @@ const char *_wsa_get_err_msg(int16_t err_id)
 		{WSA_ERR_MALLOCFAILED, "Memory allocation failed"},
 		{WSA_ERR_UNKNOWN_ERROR, "Unknown error"},
 		{WSA_ERR_INVINPUT, "Invalid input"},
+		{WSA_ERR_THREADFAILED, "Unable to start a thread"},
 		
 		//*****
 		// Sweep Errors   
@@ -193,6 +197,9 @@ const char *_wsa_get_err_msg(int16_t err_id)
 		{WSA_ERR_INVSWEEPSTARTID, "Sweep Start ID is out of bounds"},
 		{WSA_ERR_SWEEPWHILESTREAMING, "Cannot initiate sweep mode while streaming"},
 		{WSA_ERR_INV_SWEEP_FREQ, "Invalid start/stop frequencies"},
+		{WSA_ERR_SWEEPFRAMEUNAVAILABLE, "Requested spectrum frame is not available"},
+		{WSA_ERR_SWEEPVIEWSENABLED, "Continuous sweep mode needs the trace and pyramid disabled"},
+		{WSA_ERR_SWEEPDAMAGED, "Continuous sweep lost packets and was dropped"},
 		
 		
 		//*****
@@ -250,7 +257,7 @@ int16_t wsa_tokenize_file(FILE *fptr, char *cmd_strs[])
 	rewind(fptr);
 	
 	// allocate memory to contain the whole file:
-	buffer = (char *) malloc (sizeof(char) * fSize);
+	buffer = (char *) wsa_malloc(sizeof(char) * fSize);
 	if (buffer == NULL) {
 		fputs("Memory error", stderr); 	
 		return WSA_ERR_MALLOCFAILED;
@@ -273,7 +280,7 @@ int16_t wsa_tokenize_file(FILE *fptr, char *cmd_strs[])
 		fToken = strtok_r(NULL, SEP_CHARS, &strtok_context);
 	}
 
-	free(buffer);
+	wsa_free(buffer);
 
 	return next;
 }
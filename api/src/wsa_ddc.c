@@ -0,0 +1,876 @@
+///
+/// @file
+/// The digital down-converter. See wsa_ddc.h.
+///
+/// Samples are taken WSA_DDC_CHUNK at a time through the oscillator into the first stage, and
+/// each stage's outputs become the next one's input. The oscillator is a float phasor for each of
+/// four samples in turn, turned four steps at a time. The phasors are set again every WSA_DDC_SPAN
+/// samples from phasors in double, and those from the exact phase every WSA_DDC_CHUNK samples,
+/// counted from the reset rather than from each push, so a stream gives the same outputs however
+/// it is split into pushes. A stage keeps its input in xi and xq, the
+/// last taps - 1 samples before the new ones, and works out every output whose window is whole:
+/// the window of the next output starts at xi[pos]. What is left before the next window is dropped
+/// once the chunk has been through.
+///
+/// A halfband stage filters with h, taps of them, and keeps every other output. Its taps at even
+/// distances from the centre are 0 but for the centre, so it works as two filters: the even taps
+/// over the even samples, and the centre tap, alone, over the odd ones. The windows are split into
+/// even and odd samples first so each runs over samples next to each other.
+///
+/// A resampler stage interpolates by L and decimates by M with one filter h of L * taps at L times
+/// the input rate. Output k has phase p = k M % L and needs only the taps p + L j, so each phase is
+/// a filter of its own, stored reversed to run forwards over the window:
+///
+///     y[k] = sum_j g_p[j] x[s + j],   g_p[j] = L h[p + L (taps - 1 - j)]
+///
+/// where the window starts at s = floor(k M / L) - (taps - 1). The next output's phase and
+/// window follow by adding M to the phase and carrying whole L into pos.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <string.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include "wsa_lib.h"
+#include "wsa_dsp.h"
+#include "wsa_error.h"
+#include "wsa_debug.h"
+#include "wsa_alloc.h"
+#include "wsa_ddc.h"
+
+/// Samples taken through the stages at a time.
+#define WSA_DDC_CHUNK 4096
+
+/// Samples the float phasors are turned for before they are set again from the double ones.
+#define WSA_DDC_SPAN 256
+
+/// Rejection of what would alias into the band, in dB.
+#define WSA_DDC_ATTENUATION 90.0
+
+/// Fewest taps in a halfband filter.
+#define WSA_DDC_MIN_HALFBAND_TAPS 7
+
+/// Most taps in any filter.
+#define WSA_DDC_MAX_TAPS 65536
+
+/// Taps rounded up to a multiple of 4, for wsa_ddc_dot().
+#define WSA_DDC_PAD(taps) (((taps) + 3) & ~3u)
+
+struct wsa_ddc_stage {
+    uint32_t up;					///< L, 1 for a halfband
+    uint32_t down;					///< M, 2 for a halfband
+    uint8_t halfband;
+    uint32_t taps;					///< Per phase, and a multiple of 4, for a resampler
+    float *g;						///< The filter: for a halfband, its centre tap and then its even taps; else g_p for each phase, taps apart
+    float *xi;
+    float *xq;
+    float *ei;						///< A halfband's windows split into even and odd samples
+    float *eq;
+    float *oi;
+    float *oq;
+    uint32_t len;
+    uint32_t size;
+    uint32_t pos;					///< Start of the next output's window
+    uint32_t phase;					///< Phase of the next output
+};
+
+struct wsa_ddc {
+    struct wsa_ddc_config config;
+    double output_rate;
+    double step;					///< Oscillator cycles per sample
+    double block_step;				///< Oscillator cycles per WSA_DDC_CHUNK samples, less whole cycles
+    double phase;					///< Oscillator phase at the next time it is set again, in cycles
+    double ai[4];					///< Phasors of the four samples starting the next span
+    double aq[4];
+    double ti;						///< Their turn, WSA_DDC_SPAN steps
+    double tq;
+    float ri[4];					///< Phasors of the next four samples
+    float rq[4];
+    float si;						///< Their turn, four steps
+    float sq;
+    uint32_t left;					///< Samples until the next span
+    uint32_t spans;					///< Spans until the oscillator is set again
+
+    struct wsa_ddc_stage stages[WSA_DDC_MAX_HALFBANDS + 1];
+    uint32_t nstages;
+};
+
+/// Samples to mix: normalized floats, or a packet's integers, normalized as they are read.
+struct wsa_ddc_input {
+    float const *fi;				///< Normalized I samples, or NULL for a packet's
+    float const *fq;				///< Normalized Q samples, or NULL for real data
+    uint32_t stream_id;				///< The packet's stream, as for normalize_iq_data()
+    int16_t const *i16;
+    int16_t const *q16;
+    int32_t const *i32;
+    float scale;					///< 1 / the normalization factor, a power of 2
+};
+
+
+///
+/// Modified Bessel function of the first kind, order 0, for the Kaiser window.
+///
+static double wsa_ddc_bessel_i0( double x )
+{
+    double sum = 1.0;
+    double term = 1.0;
+    int k;
+
+    for (k = 1; k < 200 && term > sum * 1e-12; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+
+///
+/// Number of taps a Kaiser-windowed lowpass needs to get from passband to stopband in
+/// \p transition, in cycles per sample, with WSA_DDC_ATTENUATION of rejection.
+///
+static uint32_t wsa_ddc_taps_for( double transition )
+{
+    double n = (WSA_DDC_ATTENUATION - 7.95) / (14.36 * transition) + 1;
+
+    return (n < WSA_DDC_MAX_TAPS) ? (uint32_t)ceil(n) : WSA_DDC_MAX_TAPS;
+}
+
+
+///
+/// Design a Kaiser-windowed sinc lowpass of \p n taps cutting off at \p cutoff cycles per sample,
+/// with a gain of \p gain at 0 Hz.
+///
+static void wsa_ddc_design( double *h, uint32_t n, double cutoff, double gain )
+{
+    double beta = 0.1102 * (WSA_DDC_ATTENUATION - 8.7);
+    double i0_beta = wsa_ddc_bessel_i0(beta);
+    double sum = 0;
+    double t;
+    double r;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        t = (double)i - (n - 1) / 2.0;
+        h[i] = (t == 0) ? 2 * cutoff : sin(2 * M_PI * cutoff * t) / (M_PI * t);
+        r = (n > 1) ? 2.0 * i / (n - 1) - 1 : 0;
+        h[i] *= wsa_ddc_bessel_i0(beta * sqrt(1 - r * r)) / i0_beta;
+        sum += h[i];
+    }
+    for (i = 0; i < n; i++) {
+        h[i] *= gain / sum;
+    }
+}
+
+
+///
+/// Rejection of a symmetric filter, \p n taps of \p h, from \p stop cycles per sample up to half
+/// the sample rate: the least, in dB, over a grid of 16 points per tap.
+///
+static double wsa_ddc_rejection( double const *h, uint32_t n, double stop )
+{
+    double worst = 0;
+    double f;
+    double a;
+    uint32_t points = 16 * n;
+    uint32_t k;
+    uint32_t i;
+
+    for (k = 0; k <= points; k++) {
+        f = stop + (0.5 - stop) * k / points;
+        a = 0;
+        for (i = 0; i < n; i++) {
+            a += h[i] * cos(2 * M_PI * f * ((double)i - (n - 1) / 2.0));
+        }
+        worst = (fabs(a) > worst) ? fabs(a) : worst;
+    }
+
+    return (worst > 0) ? -20 * log10(worst) : 1000;
+}
+
+
+///
+/// The closest L / M to \p ratio, in (0, 1], with L up to WSA_DDC_MAX_PHASES: the last
+/// continued-fraction convergent that fits.
+///
+static void wsa_ddc_ratio( double ratio, uint32_t *up, uint32_t *down )
+{
+    double x = ratio;
+    double a;
+    uint64_t h0 = 0, h1 = 1;		// numerators
+    uint64_t k0 = 1, k1 = 0;		// denominators
+    uint64_t h2;
+    uint64_t k2;
+    int i;
+
+    *up = 1;
+    *down = (uint32_t)floor(1 / ratio + 0.5);
+    for (i = 0; i < 64; i++) {
+        a = floor(x);
+        h2 = (uint64_t)a * h1 + h0;
+        k2 = (uint64_t)a * k1 + k0;
+        if (h2 > WSA_DDC_MAX_PHASES || k2 > 0xffffffffULL) {
+            break;
+        }
+        if (h2 > 0) {
+            *up = (uint32_t)h2;
+            *down = (uint32_t)k2;
+        }
+        h0 = h1;
+        h1 = h2;
+        k0 = k1;
+        k1 = k2;
+        if (x - a < 1e-9 || fabs(ratio - (double)h2 / (double)k2) < 1e-12 * ratio) {
+            break;
+        }
+        x = 1 / (x - a);
+    }
+}
+
+
+///
+/// Set up a stage's filter, h of \p n taps, and its buffers, for \p input samples at most at a
+/// time.
+///
+static int16_t wsa_ddc_stage_init( struct wsa_ddc_stage *stage, double const *h, uint32_t n, uint32_t input )
+{
+    uint32_t pad;
+    uint32_t p;
+    uint32_t j;
+    uint32_t k;
+
+    stage->g = wsa_malloc_aligned(sizeof(float) * (stage->up * stage->taps + 4), WSA_ALLOC_ALIGN);
+    stage->size = stage->taps - 1 + input;
+    stage->xi = wsa_malloc_aligned(sizeof(float) * stage->size, WSA_ALLOC_ALIGN);
+    stage->xq = wsa_malloc_aligned(sizeof(float) * stage->size, WSA_ALLOC_ALIGN);
+    if (!stage->g || !stage->xi || !stage->xq) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+
+    if (stage->halfband) {
+        stage->ei = wsa_malloc_aligned(sizeof(float) * (stage->size / 2 + 4), WSA_ALLOC_ALIGN);
+        stage->eq = wsa_malloc_aligned(sizeof(float) * (stage->size / 2 + 4), WSA_ALLOC_ALIGN);
+        stage->oi = wsa_malloc_aligned(sizeof(float) * (stage->size / 2 + 1), WSA_ALLOC_ALIGN);
+        stage->oq = wsa_malloc_aligned(sizeof(float) * (stage->size / 2 + 1), WSA_ALLOC_ALIGN);
+        if (!stage->ei || !stage->eq || !stage->oi || !stage->oq) {
+            return WSA_ERR_MALLOCFAILED;
+        }
+        // the centre, then the even taps after zeros to a multiple of 4, which meet zeros at the
+        // start of the even samples
+        pad = WSA_DDC_PAD((n + 1) / 2) - (n + 1) / 2;
+        memset(stage->g, 0, sizeof(float) * (1 + pad));
+        memset(stage->ei, 0, sizeof(float) * pad);
+        memset(stage->eq, 0, sizeof(float) * pad);
+        stage->g[0] = (float)h[(n - 1) / 2];
+        for (j = 0; j < (n + 1) / 2; j++) {
+            stage->g[1 + pad + j] = (float)h[2 * j];
+        }
+    } else {
+        for (p = 0; p < stage->up; p++) {
+            // taps may be more than n / L, to a multiple of 4; the first are then 0
+            for (j = 0; j < stage->taps; j++) {
+                k = p + stage->up * (stage->taps - 1 - j);
+                stage->g[p * stage->taps + j] = (k < n) ? (float)h[k] : 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+///
+/// Forget a stage's input: the windows start over on zeros.
+///
+static void wsa_ddc_stage_reset( struct wsa_ddc_stage *stage )
+{
+    memset(stage->xi, 0, sizeof(float) * (stage->taps - 1));
+    memset(stage->xq, 0, sizeof(float) * (stage->taps - 1));
+    stage->len = stage->taps - 1;
+    stage->pos = 0;
+    stage->phase = 0;
+}
+
+
+///
+/// Filter the I and Q samples from \p xi and \p xq with the \p taps of \p g, a multiple of 4.
+///
+/// Four taps at a time, each summed in a local of its own, so each add waits only on the one four
+/// taps back rather than on the one before. The channelizer and the IQ corrector sum the same way.
+///
+static void wsa_ddc_dot( float const *g, float const *xi, float const *xq, uint32_t taps, float *yi, float *yq )
+{
+    float i0 = 0, i1 = 0, i2 = 0, i3 = 0;
+    float q0 = 0, q1 = 0, q2 = 0, q3 = 0;
+    uint32_t j;
+
+    for (j = 0; j < taps; j += 4, g += 4, xi += 4, xq += 4) {
+        i0 += g[0] * xi[0];
+        i1 += g[1] * xi[1];
+        i2 += g[2] * xi[2];
+        i3 += g[3] * xi[3];
+        q0 += g[0] * xq[0];
+        q1 += g[1] * xq[1];
+        q2 += g[2] * xq[2];
+        q3 += g[3] * xq[3];
+    }
+    *yi = (i0 + i1) + (i2 + i3);
+    *yq = (q0 + q1) + (q2 + q3);
+}
+
+
+///
+/// Filter and decimate by 2 every whole window in a halfband stage's input.
+///
+/// @returns The number of outputs written.
+///
+static uint32_t wsa_ddc_halfband( struct wsa_ddc_stage *stage, float *out_i, float *out_q )
+{
+    uint32_t even = (stage->taps + 1) / 2;
+    uint32_t pad = WSA_DDC_PAD(even) - even;
+    uint32_t centre = (stage->taps - 1) / 2;
+    float const *g = stage->g;
+    float const *xi = stage->xi + stage->pos;
+    float const *xq = stage->xq + stage->pos;
+    uint32_t count;
+    uint32_t n;
+    uint32_t k;
+
+    if (stage->pos + stage->taps > stage->len) {
+        return 0;
+    }
+    count = (stage->len - stage->pos - stage->taps) / 2 + 1;
+
+    // Split the windows into even and odd samples. Output n is then the even taps over the
+    // even samples from n, and the centre tap, the only odd one, times odd sample n + centre / 2.
+    for (k = 0; k < count - 1 + even; k++) {
+        stage->ei[pad + k] = xi[2 * k];
+        stage->eq[pad + k] = xq[2 * k];
+    }
+    for (k = 0; k < count + centre / 2; k++) {
+        stage->oi[k] = xi[2 * k + 1];
+        stage->oq[k] = xq[2 * k + 1];
+    }
+
+    for (n = 0; n < count; n++) {
+        wsa_ddc_dot(g + 1, stage->ei + n, stage->eq + n, pad + even, &out_i[n], &out_q[n]);
+        out_i[n] += g[0] * stage->oi[n + centre / 2];
+        out_q[n] += g[0] * stage->oq[n + centre / 2];
+    }
+
+    stage->pos += 2 * count;
+
+    return count;
+}
+
+
+///
+/// Resample every whole window in a resampler stage's input.
+///
+/// @returns The number of outputs written.
+///
+static uint32_t wsa_ddc_resample( struct wsa_ddc_stage *stage, float *out_i, float *out_q )
+{
+    uint32_t taps = stage->taps;
+    float const *g;
+    float const *xi;
+    float const *xq;
+    uint32_t n = 0;
+
+    while (stage->pos + taps <= stage->len) {
+        g = stage->g + stage->phase * taps;
+        xi = stage->xi + stage->pos;
+        xq = stage->xq + stage->pos;
+
+        wsa_ddc_dot(g, xi, xq, taps, &out_i[n], &out_q[n]);
+        n++;
+
+        stage->phase += stage->down;
+        stage->pos += stage->phase / stage->up;
+        stage->phase %= stage->up;
+    }
+
+    return n;
+}
+
+
+///
+/// Run a stage over its input, and drop the samples before the next window.
+///
+/// @returns The number of outputs written.
+///
+static uint32_t wsa_ddc_stage_run( struct wsa_ddc_stage *stage, float *out_i, float *out_q )
+{
+    uint32_t n;
+
+    n = stage->halfband ? wsa_ddc_halfband(stage, out_i, out_q) : wsa_ddc_resample(stage, out_i, out_q);
+
+    if (stage->pos >= stage->len) {
+        // a resampler of one tap per phase may step past what it has
+        stage->pos -= stage->len;
+        stage->len = 0;
+    } else if (stage->pos > 0) {
+        stage->len -= stage->pos;
+        memmove(stage->xi, stage->xi + stage->pos, sizeof(float) * stage->len);
+        memmove(stage->xq, stage->xq + stage->pos, sizeof(float) * stage->len);
+        stage->pos = 0;
+    }
+
+    return n;
+}
+
+
+///
+/// Create a down-converter.
+///
+/// @param[in] config The input rate, band and output rate.
+/// @param[out] ddc The new down-converter.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_ddc_alloc( struct wsa_ddc_config const *config, struct wsa_ddc **ddc )
+{
+    struct wsa_ddc *d;
+    struct wsa_ddc_stage *stage;
+    double bandwidth;
+    double rate;
+    double *h;
+    uint32_t input;
+    uint32_t n;
+    int16_t result;
+
+    if (config == NULL || ddc == NULL || !(config->sample_rate > 0) || !(config->output_rate > 0) ||
+        config->output_rate > config->sample_rate) {
+        return WSA_ERR_INVINPUT;
+    }
+    bandwidth = (config->bandwidth > 0) ? config->bandwidth : 0.8 * config->output_rate;
+    if (bandwidth >= config->output_rate || fabs(config->offset) + bandwidth / 2 > config->sample_rate / 2) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    d = wsa_malloc(sizeof(struct wsa_ddc));
+    if (d == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+    memset(d, 0, sizeof(struct wsa_ddc));
+    d->config = *config;
+    d->config.bandwidth = bandwidth;
+    d->step = -config->offset / config->sample_rate;
+    d->block_step = d->step * WSA_DDC_CHUNK - floor(d->step * WSA_DDC_CHUNK);
+    d->ti = cos(2 * M_PI * WSA_DDC_SPAN * d->step);
+    d->tq = sin(2 * M_PI * WSA_DDC_SPAN * d->step);
+    d->si = (float)cos(2 * M_PI * 4 * d->step);
+    d->sq = (float)sin(2 * M_PI * 4 * d->step);
+
+    h = wsa_malloc(sizeof(double) * WSA_DDC_MAX_TAPS);
+    if (h == NULL) {
+        wsa_ddc_free(d);
+        return WSA_ERR_MALLOCFAILED;
+    }
+
+    // halfbands while the rate is twice the output rate or more: pass up to bandwidth / 2, and
+    // stop from rate / 2 - bandwidth / 2, what lands above the band once decimated
+    rate = config->sample_rate;
+    input = WSA_DDC_CHUNK;
+    result = 0;
+    while (rate >= 2 * config->output_rate * (1 - 1e-12) && d->nstages < WSA_DDC_MAX_HALFBANDS) {
+        stage = &d->stages[d->nstages++];
+        stage->halfband = 1;
+        stage->up = 1;
+        stage->down = 2;
+        n = wsa_ddc_taps_for(0.5 - bandwidth / rate);
+        n = (n < WSA_DDC_MIN_HALFBAND_TAPS) ? WSA_DDC_MIN_HALFBAND_TAPS : n;
+        stage->taps = n + (3 - n % 4 + 4) % 4;			// 4 k + 3, so the outermost taps are not 0
+
+        // The estimate falls short for filters this short, so add taps until the design is seen
+        // to reject enough.
+        for (;;) {
+            if (stage->taps > WSA_DDC_MAX_TAPS) {
+                result = WSA_ERR_INVINPUT;
+                break;
+            }
+            wsa_ddc_design(h, stage->taps, 0.25, 1.0);
+            if (wsa_ddc_rejection(h, stage->taps, 0.5 - bandwidth / (2 * rate)) >= WSA_DDC_ATTENUATION) {
+                break;
+            }
+            stage->taps += 4;
+        }
+        if (result < 0) {
+            break;
+        }
+        result = wsa_ddc_stage_init(stage, h, stage->taps, input);
+        if (result < 0) {
+            break;
+        }
+        input = input / 2 + 1;
+        rate /= 2;
+    }
+
+    // then the rest of the way by L / M, with a filter at L times the rate: pass up to
+    // bandwidth / 2, and stop from the output rate less that
+    d->output_rate = rate;
+    if (result == 0 && rate > config->output_rate * (1 + 1e-12)) {
+        stage = &d->stages[d->nstages++];
+        wsa_ddc_ratio(config->output_rate / rate, &stage->up, &stage->down);
+        d->output_rate = rate * stage->up / stage->down;
+        n = wsa_ddc_taps_for((d->output_rate - bandwidth) / (rate * stage->up));
+        n = (n + stage->up - 1) / stage->up * stage->up;
+        stage->taps = WSA_DDC_PAD(n / stage->up);
+        if ((uint64_t)stage->taps * stage->up > WSA_DDC_MAX_TAPS) {
+            result = WSA_ERR_INVINPUT;
+        } else {
+            wsa_ddc_design(h, n, d->output_rate / (2 * rate * stage->up), stage->up);
+            result = wsa_ddc_stage_init(stage, h, n, input);
+        }
+    }
+
+    wsa_free(h);
+    if (result < 0) {
+        wsa_ddc_free(d);
+        return result;
+    }
+    wsa_ddc_reset(d);
+
+    doutf(DMED, "DDC: %.0f Hz at %.0f, %u stages to %.3f samples/s\n", config->offset, config->sample_rate,
+          (unsigned)d->nstages, d->output_rate);
+
+    *ddc = d;
+
+    return 0;
+}
+
+
+///
+/// Free a down-converter.
+///
+void wsa_ddc_free( struct wsa_ddc *ddc )
+{
+    uint32_t i;
+
+    if (ddc == NULL) {
+        return;
+    }
+
+    for (i = 0; i < ddc->nstages; i++) {
+        wsa_free(ddc->stages[i].g);
+        wsa_free(ddc->stages[i].xi);
+        wsa_free(ddc->stages[i].xq);
+        wsa_free(ddc->stages[i].ei);
+        wsa_free(ddc->stages[i].eq);
+        wsa_free(ddc->stages[i].oi);
+        wsa_free(ddc->stages[i].oq);
+    }
+    wsa_free(ddc);
+}
+
+
+///
+/// Forget the samples pushed so far, to start a new stream, as after a break. The filters start
+/// over on zeros, and the oscillator at phase 0.
+///
+void wsa_ddc_reset( struct wsa_ddc *ddc )
+{
+    uint32_t i;
+
+    for (i = 0; i < ddc->nstages; i++) {
+        wsa_ddc_stage_reset(&ddc->stages[i]);
+    }
+    ddc->phase = 0;
+    ddc->left = 0;
+    ddc->spans = 0;
+}
+
+
+///
+/// Get the output rate, in samples per second: the one asked for, or the closest the resampler
+/// can do.
+///
+double wsa_ddc_output_rate( struct wsa_ddc const *ddc )
+{
+    return ddc->output_rate;
+}
+
+
+///
+/// Get the most outputs a push of a number of samples may give, to size its buffers.
+///
+int32_t wsa_ddc_max_output( struct wsa_ddc const *ddc, int32_t samples )
+{
+    uint64_t n = (samples > 0) ? (uint64_t)samples : 0;
+    uint32_t i;
+
+    for (i = 0; i < ddc->nstages; i++) {
+        n = n * ddc->stages[i].up / ddc->stages[i].down + 1;
+    }
+
+    return (n < 0x7fffffff) ? (int32_t)n : 0x7fffffff;
+}
+
+
+///
+/// Read \p n samples from \p k on, normalized.
+///
+static void wsa_ddc_load( struct wsa_ddc_input const *in, uint32_t k, uint32_t n, float *xi, float *xq )
+{
+    float const scale = in->scale;
+    uint32_t j;
+
+    if (in->fi) {
+        for (j = 0; j < n; j++) {
+            xi[j] = in->fi[k + j];
+            xq[j] = in->fq ? in->fq[k + j] : 0;
+        }
+        return;
+    }
+
+    // Multiplying by a power of 2 gives just what normalize_iq_data() does by dividing.
+    switch (in->stream_id) {
+    case I16Q16_DATA_STREAM_ID:
+        for (j = 0; j < n; j++) {
+            xi[j] = (float)in->i16[k + j] * scale;
+            xq[j] = (float)in->q16[k + j] * scale;
+        }
+        break;
+    case I16_DATA_STREAM_ID:
+        for (j = 0; j < n; j++) {
+            xi[j] = (float)in->i16[k + j] * scale;
+            xq[j] = 0;
+        }
+        break;
+    default:
+        for (j = 0; j < n; j++) {
+            xi[j] = (float)in->i32[k + j] * scale;
+            xq[j] = 0;
+        }
+        break;
+    }
+}
+
+
+///
+/// Mix a sample with its phasor, and turn the phasor on four samples.
+///
+static void wsa_ddc_mix_one( float xi, float xq, float si, float sq, float *ri, float *rq, float *yi, float *yq )
+{
+    float i = *ri;
+    float q = *rq;
+
+    *yi = xi * i - xq * q;
+    *yq = xi * q + xq * i;
+    *ri = i * si - q * sq;
+    *rq = i * sq + q * si;
+}
+
+
+///
+/// Mix \p n samples from \p from on to the first stage's input, or straight to the output if there
+/// are no stages.
+///
+/// A float phasor loses about 3e-8 of its length and angle with each turn, so over a span the
+/// oscillator stays within -110 dB of exact, where over a chunk it would come to -90 dB.
+///
+static void wsa_ddc_mix( struct wsa_ddc *ddc, struct wsa_ddc_input const *in, uint32_t from, uint32_t n,
+                         float *to_i, float *to_q )
+{
+    double *ai = ddc->ai;
+    double *aq = ddc->aq;
+    float *ri = ddc->ri;
+    float *rq = ddc->rq;
+    float const si = ddc->si;
+    float const sq = ddc->sq;
+    float xi[WSA_DDC_SPAN];
+    float xq[WSA_DDC_SPAN];
+    float li[4];
+    float lq[4];
+    float pi[4];
+    float pq[4];
+    double u;
+    uint32_t run;
+    uint32_t end;
+    uint32_t k;
+    uint32_t m;
+    uint32_t j;
+
+    if (ddc->step == 0) {
+        wsa_ddc_load(in, from, n, to_i, to_q);
+        return;
+    }
+
+    for (k = 0; k < n; k = end) {
+        // Set the phasors again, at the same samples of the stream however it is pushed.
+        if (ddc->left == 0) {
+            if (ddc->spans == 0) {
+                for (j = 0; j < 4; j++) {
+                    ai[j] = cos(2 * M_PI * (ddc->phase + j * ddc->step));
+                    aq[j] = sin(2 * M_PI * (ddc->phase + j * ddc->step));
+                }
+                ddc->phase += ddc->block_step;
+                ddc->phase -= floor(ddc->phase);
+                ddc->spans = WSA_DDC_CHUNK / WSA_DDC_SPAN;
+            }
+            for (j = 0; j < 4; j++) {
+                ri[j] = (float)ai[j];
+                rq[j] = (float)aq[j];
+                u = ai[j] * ddc->ti - aq[j] * ddc->tq;
+                aq[j] = ai[j] * ddc->tq + aq[j] * ddc->ti;
+                ai[j] = u;
+            }
+            ddc->spans--;
+            ddc->left = WSA_DDC_SPAN;
+        }
+        run = (n - k < ddc->left) ? n - k : ddc->left;
+        end = k + run;
+        ddc->left -= run;
+
+        // Four samples at a time, each with a phasor of its own, so no sample waits on the one
+        // before it. The phasors are held in locals over the run, so they stay in registers.
+        wsa_ddc_load(in, from + k, run, xi, xq);
+        memcpy(pi, ri, sizeof(pi));
+        memcpy(pq, rq, sizeof(pq));
+        for (m = 0; m + 4 <= run; m += 4) {
+            wsa_ddc_mix_one(xi[m], xq[m], si, sq, &pi[0], &pq[0], &to_i[k + m], &to_q[k + m]);
+            wsa_ddc_mix_one(xi[m + 1], xq[m + 1], si, sq, &pi[1], &pq[1], &to_i[k + m + 1], &to_q[k + m + 1]);
+            wsa_ddc_mix_one(xi[m + 2], xq[m + 2], si, sq, &pi[2], &pq[2], &to_i[k + m + 2], &to_q[k + m + 2]);
+            wsa_ddc_mix_one(xi[m + 3], xq[m + 3], si, sq, &pi[3], &pq[3], &to_i[k + m + 3], &to_q[k + m + 3]);
+        }
+        memcpy(ri, pi, sizeof(pi));
+        memcpy(rq, pq, sizeof(pq));
+
+        // The last few, after which the phasors are moved round to start from the next sample.
+        if (m < run) {
+            run -= m;
+            for (j = 0; j < run; j++) {
+                wsa_ddc_mix_one(xi[m + j], xq[m + j], si, sq, &ri[j], &rq[j], &to_i[k + m + j], &to_q[k + m + j]);
+            }
+            for (j = 0; j < 4; j++) {
+                li[j] = ri[(j + run) % 4];
+                lq[j] = rq[(j + run) % 4];
+            }
+            memcpy(ri, li, sizeof(li));
+            memcpy(rq, lq, sizeof(lq));
+        }
+    }
+}
+
+
+///
+/// Down-convert samples, WSA_DDC_CHUNK at a time through the oscillator and the stages.
+///
+/// @returns The number of outputs written.
+///
+static int32_t wsa_ddc_run( struct wsa_ddc *ddc, struct wsa_ddc_input const *in, int32_t samples,
+                            float *out_i, float *out_q )
+{
+    struct wsa_ddc_stage *stage;
+    struct wsa_ddc_stage *next;
+    uint32_t total = 0;
+    uint32_t done;
+    uint32_t chunk;
+    uint32_t n;
+    uint32_t i;
+
+    for (done = 0; done < (uint32_t)samples; done += chunk) {
+        chunk = ((uint32_t)samples - done < WSA_DDC_CHUNK) ? (uint32_t)samples - done : WSA_DDC_CHUNK;
+
+        if (ddc->nstages == 0) {
+            wsa_ddc_mix(ddc, in, done, chunk, out_i + total, out_q + total);
+            total += chunk;
+            continue;
+        }
+
+        stage = &ddc->stages[0];
+        wsa_ddc_mix(ddc, in, done, chunk, stage->xi + stage->len, stage->xq + stage->len);
+        stage->len += chunk;
+
+        for (i = 0; i < ddc->nstages; i++) {
+            stage = &ddc->stages[i];
+            if (i + 1 < ddc->nstages) {
+                next = &ddc->stages[i + 1];
+                n = wsa_ddc_stage_run(stage, next->xi + next->len, next->xq + next->len);
+                next->len += n;
+            } else {
+                total += wsa_ddc_stage_run(stage, out_i + total, out_q + total);
+            }
+        }
+    }
+
+    return (int32_t)total;
+}
+
+
+///
+/// Down-convert samples, writing the outputs they complete.
+///
+/// @param[in] ddc The down-converter.
+/// @param[in] idata I samples, normalized.
+/// @param[in] qdata Q samples, normalized, or NULL for real (I-only) data.
+/// @param[in] samples Number of samples.
+/// @param[out] out_i Receives the I outputs, wsa_ddc_max_output() of them at most.
+/// @param[out] out_q Receives the Q outputs.
+///
+/// @returns The number of outputs written, or a negative error code.
+///
+int32_t wsa_ddc_push( struct wsa_ddc *ddc, float const *idata, float const *qdata, int32_t samples,
+                      float *out_i, float *out_q )
+{
+    struct wsa_ddc_input in;
+
+    if (ddc == NULL || idata == NULL || samples < 0 || out_i == NULL || out_q == NULL) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    memset(&in, 0, sizeof(in));
+    in.fi = idata;
+    in.fq = qdata;
+
+    return wsa_ddc_run(ddc, &in, samples, out_i, out_q);
+}
+
+
+///
+/// Down-convert the samples of a packet as wsa_read_vrt_packet() gives them, normalizing them as
+/// normalize_iq_data() does. I-only samples are real, so for them \b offset is from 0 Hz of the
+/// sampled signal rather than the capture's centre.
+///
+/// The samples are normalized as the oscillator reads them, rather than in a pass of their own.
+///
+/// @param[in] ddc The down-converter.
+/// @param[in] stream_id The packet's stream: I16Q16_DATA_STREAM_ID, I16_DATA_STREAM_ID or
+///                      I32_DATA_STREAM_ID.
+/// @param[in] i16_buffer I samples of 16 bit data.
+/// @param[in] q16_buffer Q samples of I16Q16 data.
+/// @param[in] i32_buffer I samples of 32 bit data.
+/// @param[in] samples Number of samples.
+/// @param[out] out_i Receives the I outputs, wsa_ddc_max_output() of them at most.
+/// @param[out] out_q Receives the Q outputs.
+///
+/// @returns The number of outputs written, or a negative error code.
+///
+int32_t wsa_ddc_push_packet( struct wsa_ddc *ddc, uint32_t stream_id, int16_t *i16_buffer, int16_t *q16_buffer,
+                             int32_t *i32_buffer, int32_t samples, float *out_i, float *out_q )
+{
+    struct wsa_ddc_input in;
+    kiss_fft_scalar factor;
+
+    if (ddc == NULL || samples < 0 || out_i == NULL || out_q == NULL) {
+        return WSA_ERR_INVINPUT;
+    }
+    if ((stream_id == I16Q16_DATA_STREAM_ID && (i16_buffer == NULL || q16_buffer == NULL)) ||
+        (stream_id == I16_DATA_STREAM_ID && i16_buffer == NULL) ||
+        (stream_id != I16Q16_DATA_STREAM_ID && stream_id != I16_DATA_STREAM_ID && i32_buffer == NULL)) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    get_normalization_factor(stream_id, &factor);
+
+    memset(&in, 0, sizeof(in));
+    in.stream_id = stream_id;
+    in.i16 = i16_buffer;
+    in.q16 = q16_buffer;
+    in.i32 = i32_buffer;
+    in.scale = 1.0f / factor;
+
+    return wsa_ddc_run(ddc, &in, samples, out_i, out_q);
+}
@@ -8,37 +8,394 @@
 #include <time.h>
 #include "wsa_api.h"
 #include "wsa_debug.h"
+#include "wsa_atomic.h"
+#include "wsa_clock.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
-static int    debuglevel = DEBUGLEVEL;
+
+uint32_t volatile wsa_debug_level = DEBUGLEVEL;
 static void * debugcallbackpvoid = 0;
-static void (*debugcallbackfunc)(void * pvoid, char const * pstring) = 0; 
+static void (*debugcallbackfunc)(void * pvoid, char const * pstring) = 0;
 
+// May be called from any thread, while others log.
 void wsa_debuglevel(int level)
 {
-  debuglevel = level;
+  wsa_atomic_store_u32(&wsa_debug_level, level < DNO ? DNO : (uint32_t) level);
 }
 
+// Not thread-safe: set the callback before any other thread uses the library.
 void wsa_debugcallback(void(*callback)(void * pvoid, char const * pstring), void * pvoid)
 {
   debugcallbackfunc  = callback;
   debugcallbackpvoid = pvoid;
 }
 
+
+//*****************************************************************************
+// Log ring
+//
+// Any number of threads append to a fixed ring of slots; one flusher thread
+// drains it to the log file. Positions count up forever (wrapping at 2^32) and
+// map to slot (pos % WSA_LOG_RING_SLOTS). Each slot's seq tells which lap of
+// the ring it belongs to and whether it is free or holds a message, so the
+// zeroed ring needs no initialisation and no lock is ever taken:
+//
+//   seq == LOG_SLOT_FREE(pos)  the slot may be claimed for position pos
+//   seq == LOG_SLOT_FULL(pos)  the message for position pos is ready to write
+//
+// A writer claims a position by advancing log_head with a compare-and-swap,
+// formats into the slot, then marks it full. The flusher writes slots out in
+// order and marks each free for the next lap.
+//
+// When the ring is empty the flusher sets log_sleeping and waits on a
+// condition variable. The writer that clears log_sleeping again, i.e. the one
+// that takes the ring from empty to non-empty, signals it; no other writer
+// takes the lock.
+//*****************************************************************************
+
+#define LOG_SLOT_FREE(pos) (((uint32_t)(pos) / WSA_LOG_RING_SLOTS) * 2)
+#define LOG_SLOT_FULL(pos) (LOG_SLOT_FREE(pos) + 1)
+
+enum wsa_log_state {
+	LOG_IDLE = 0,		// flusher not started yet
+	LOG_STARTING,		// one thread is starting it
+	LOG_RUNNING,
+	LOG_STOPPED			// shut down, or could not be started; messages are discarded
+};
+
+struct wsa_log_slot {
+	uint32_t volatile seq;
+	int level;
+	uint64_t ns;
+	char text[WSA_LOG_MSG_MAX];
+};
+
+static struct wsa_log_slot log_ring[WSA_LOG_RING_SLOTS];
+static uint32_t volatile log_head = 0;		// next position to claim
+static uint32_t log_tail = 0;				// next position to write; flusher only
+static uint32_t volatile log_written = 0;	// positions before this are on disk
+static uint32_t volatile log_dropped = 0;	// messages lost to a full ring
+static uint32_t volatile log_state = LOG_IDLE;
+static uint32_t volatile log_stop = 0;
+static uint32_t volatile log_sleeping = 0;	// flusher is waiting for a message
+
+// wall clock time, in ns since the epoch, matching wsa_clock_ns() == log_base_mono
+static uint64_t log_base_mono = 0;
+static uint64_t log_base_wall = 0;
+
+#ifdef _WIN32
+static HANDLE log_thread;
+static CRITICAL_SECTION log_lock;
+static CONDITION_VARIABLE log_cond;
+#else
+static pthread_t log_thread;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
+
+static void log_sleep_ms(unsigned int ms)
+{
+#ifdef _WIN32
+	Sleep(ms);
+#else
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+	nanosleep(&ts, NULL);
+#endif
+}
+
+
+static void log_lock_take(void)
+{
+#ifdef _WIN32
+	EnterCriticalSection(&log_lock);
+#else
+	pthread_mutex_lock(&log_lock);
+#endif
+}
+
+
+static void log_lock_release(void)
+{
+#ifdef _WIN32
+	LeaveCriticalSection(&log_lock);
+#else
+	pthread_mutex_unlock(&log_lock);
+#endif
+}
+
+
+// Wake the flusher if it is waiting. Call after publishing a message or the
+// stop request; only the caller that clears log_sleeping takes the lock.
+static void log_wake(void)
+{
+	// the store just made must be seen before log_sleeping is read
+	wsa_memory_barrier();
+
+	if (wsa_atomic_load_u32(&log_sleeping) && wsa_atomic_cas_u32(&log_sleeping, 1, 0)) {
+		log_lock_take();
+#ifdef _WIN32
+		WakeConditionVariable(&log_cond);
+#else
+		pthread_cond_signal(&log_cond);
+#endif
+		log_lock_release();
+	}
+}
+
+
+// Wait for log_wake(), unless a message or the stop request is already there.
+static void log_wait(void)
+{
+	log_lock_take();
+
+	wsa_atomic_store_u32(&log_sleeping, 1);
+	wsa_memory_barrier();
+	if (wsa_atomic_load_u32(&log_ring[log_tail % WSA_LOG_RING_SLOTS].seq) == LOG_SLOT_FULL(log_tail) ||
+			wsa_atomic_load_u32(&log_stop)) {
+		wsa_atomic_store_u32(&log_sleeping, 0);
+	}
+
+	while (wsa_atomic_load_u32(&log_sleeping)) {
+#ifdef _WIN32
+		SleepConditionVariableCS(&log_cond, &log_lock, INFINITE);
+#else
+		pthread_cond_wait(&log_cond, &log_lock);
+#endif
+	}
+
+	log_lock_release();
+}
+
+
+// Write one message, converting its monotonic timestamp to local time. The
+// broken-down time is only recomputed when the second changes.
+static void log_write_line(FILE *file, int level, uint64_t ns, const char *text)
+{
+	static time_t last_sec = (time_t)-1;
+	static struct tm tm_cache;
+	uint64_t wall;
+	time_t sec;
+
+	wall = log_base_wall + (uint64_t)((int64_t)(ns - log_base_mono));
+	sec = (time_t)(wall / 1000000000ULL);
+
+	if (sec != last_sec) {
+#ifdef _WIN32
+		localtime_s(&tm_cache, &sec);
+#else
+		localtime_r(&sec, &tm_cache);
+#endif
+		last_sec = sec;
+	}
+
+	fprintf(file, "[%d-%02d-%02d %02d:%02d:%02d.%03u] [Level %d] %s",
+		tm_cache.tm_year + 1900,
+		tm_cache.tm_mon + 1,
+		tm_cache.tm_mday,
+		tm_cache.tm_hour,
+		tm_cache.tm_min,
+		tm_cache.tm_sec,
+		(unsigned int)((wall / 1000000ULL) % 1000),
+		level,
+		text);
+}
+
+
+// Write out every message that is ready, then flush the file once.
+// Returns the number of messages taken from the ring.
+static uint32_t log_drain(FILE **file)
+{
+	struct wsa_log_slot *slot;
+	uint32_t count = 0;
+	uint32_t dropped;
+
+	if (*file == NULL) {
+		*file = fopen(WSA_API_LOG_FILE, "a");
+	}
+
+	for (;;) {
+		slot = &log_ring[log_tail % WSA_LOG_RING_SLOTS];
+		if (wsa_atomic_load_u32(&slot->seq) != LOG_SLOT_FULL(log_tail)) {
+			break;
+		}
+
+		if (*file) {
+			log_write_line(*file, slot->level, slot->ns, slot->text);
+		}
+
+		wsa_atomic_store_u32(&slot->seq, LOG_SLOT_FREE(log_tail + WSA_LOG_RING_SLOTS));
+		log_tail++;
+		count++;
+	}
+
+	do {
+		dropped = wsa_atomic_load_u32(&log_dropped);
+	} while (dropped && !wsa_atomic_cas_u32(&log_dropped, dropped, 0));
+
+	if (dropped && *file) {
+		log_write_line(*file, DHIGH, wsa_clock_ns(), "");
+		fprintf(*file, "%u log messages dropped, the log ring was full\n", dropped);
+	}
+
+	if ((count || dropped) && *file) {
+		fflush(*file);
+	}
+	wsa_atomic_store_u32(&log_written, log_tail);
+
+	return count;
+}
+
+
+#ifdef _WIN32
+static DWORD WINAPI log_flusher(LPVOID arg)
+#else
+static void *log_flusher(void *arg)
+#endif
+{
+	FILE *file = NULL;
+
+	(void)arg;
+
+	for (;;) {
+		if (log_drain(&file) == 0) {
+			if (wsa_atomic_load_u32(&log_stop)) {
+				break;
+			}
+			log_wait();
+		}
+	}
+
+	// pick up anything that raced with the stop request
+	log_drain(&file);
+	if (file) {
+		fclose(file);
+	}
+
+	return 0;
+}
+
+
+// Stop the flusher at exit once it has written everything queued.
+static void log_shutdown(void)
+{
+	if (wsa_atomic_load_u32(&log_state) != LOG_RUNNING) {
+		return;
+	}
+
+	wsa_atomic_store_u32(&log_stop, 1);
+	log_wake();
+#ifdef _WIN32
+	WaitForSingleObject(log_thread, 1000);
+	CloseHandle(log_thread);
+#else
+	pthread_join(log_thread, NULL);
+#endif
+	wsa_atomic_store_u32(&log_state, LOG_STOPPED);
+}
+
+
+// Start the flusher on first use. Threads that log while it is starting just
+// queue their messages.
+static void log_start(void)
+{
+	int ok;
+#ifndef _WIN32
+	struct timespec ts;
+#endif
+
+	if (!wsa_atomic_cas_u32(&log_state, LOG_IDLE, LOG_STARTING)) {
+		return;
+	}
+
+	log_base_mono = wsa_clock_ns();
+#ifdef _WIN32
+	log_base_wall = (uint64_t)time(NULL) * 1000000000ULL;
+	InitializeCriticalSection(&log_lock);
+	InitializeConditionVariable(&log_cond);
+	log_thread = CreateThread(NULL, 0, log_flusher, NULL, 0, NULL);
+	ok = (log_thread != NULL);
+#else
+	clock_gettime(CLOCK_REALTIME, &ts);
+	log_base_wall = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+	ok = (pthread_create(&log_thread, NULL, log_flusher, NULL) == 0);
+#endif
+
+	if (ok) {
+		atexit(log_shutdown);
+	}
+	wsa_atomic_store_u32(&log_state, ok ? LOG_RUNNING : LOG_STOPPED);
+}
+
+
+// Queue one message. Returns the number of characters queued, or 0 if the
+// message was dropped.
+static int log_enqueue(int level, const char *fmt, va_list ap)
+{
+	struct wsa_log_slot *slot;
+	uint32_t pos;
+	int n;
+
+	for (;;) {
+		pos = wsa_atomic_load_u32(&log_head);
+		slot = &log_ring[pos % WSA_LOG_RING_SLOTS];
+
+		if (wsa_atomic_load_u32(&slot->seq) == LOG_SLOT_FREE(pos)) {
+			if (wsa_atomic_cas_u32(&log_head, pos, pos + 1)) {
+				break;
+			}
+		} else if (wsa_atomic_load_u32(&log_head) == pos) {
+			// the slot still holds a message from the last lap: full
+			wsa_atomic_add_u32(&log_dropped, 1);
+			return 0;
+		}
+	}
+
+	slot->level = level;
+	slot->ns = wsa_clock_ns();
+	n = vsnprintf(slot->text, sizeof(slot->text), fmt, ap);
+	slot->text[sizeof(slot->text) - 1] = 0;
+
+	wsa_atomic_store_u32(&slot->seq, LOG_SLOT_FULL(pos));
+	log_wake();
+
+	return n;
+}
+
+
+/**
+ * Wait until every message logged so far is written to the log file.
+ */
+void wsa_debug_flush(void)
+{
+	uint32_t target = wsa_atomic_load_u32(&log_head);
+
+	while ((int32_t)(wsa_atomic_load_u32(&log_written) - target) < 0 &&
+			wsa_atomic_load_u32(&log_state) == LOG_RUNNING) {
+		log_sleep_ms(1);
+	}
+}
+
+
 int wsa_doutf(int level, const char *fmt, ...)
 {
 	va_list ap;
-	FILE* debugFile;
-	time_t rawtime;
-	struct tm * timeinfo;
-    char buffer[256];
-	int n;
+	char buffer[WSA_LOG_MSG_MAX];
+	int n = 0;
 
 	// don't print if debug level is too low
-	if (level > debuglevel) {
+	if (level < DNO || (uint32_t) level > wsa_atomic_load_u32(&wsa_debug_level)) {
 		return 0;
-    }
-	
+	}
+
 	if (ENABLE_PRINTING) {
 		if (debugcallbackfunc) {
 			va_start(ap, fmt);
@@ -56,23 +413,13 @@ int wsa_doutf(int level, const char *fmt, ...)
 	}
 
 	if (ENABLE_LOG_FILE) {
-		debugFile = fopen(WSA_API_LOG_FILE, "a");
-	
-		if (debugFile) {
-			time(&rawtime);
-			timeinfo = localtime(&rawtime);
+		if (wsa_atomic_load_u32(&log_state) == LOG_IDLE) {
+			log_start();
+		}
 
+		if (wsa_atomic_load_u32(&log_state) != LOG_STOPPED) {
 			va_start(ap, fmt);
-			fprintf(debugFile, "[%d-%02d-%02d %02d:%02d:%02d] [Level %d] ", 
-				timeinfo->tm_year + 1900, 
-				timeinfo->tm_mon + 1, 
-				timeinfo->tm_mday, 
-				timeinfo->tm_hour, 
-				timeinfo->tm_min, 
-				timeinfo->tm_sec,
-				level);
-			vfprintf(debugFile, fmt, ap);
-			fclose(debugFile);
+			n = log_enqueue(level, fmt, ap);
 			va_end(ap);
 		}
 	}
@@ -33,7 +33,6 @@ kiss_fft_scalar normalize_scalar(kiss_fft_scalar value, kiss_fft_scalar maxval)
 	return value / maxval;
 }
 
-void get_normalization_factor(uint32_t const stream_id, kiss_fft_scalar  * normalization_factor);
 void get_normalization_factor(uint32_t const stream_id, kiss_fft_scalar  * normalization_factor)
 {
 
@@ -117,8 +116,8 @@ void correct_dc_offset(int32_t samples_per_packet,
 
 	for (i=0; i < samples_per_packet; i++)
 	{
-		idata[i] = idata[i] / i_average;
-		qdata[i] = qdata[i] / i_average;
+		idata[i] = idata[i] - i_average;
+		qdata[i] = qdata[i] - q_average;
 	}
 
 
@@ -213,7 +212,7 @@ int rfft(kiss_fft_scalar *idata, kiss_fft_cpx *fftdata, int len)
 	kiss_fft_cpx *iq;
 	kiss_fft_cpx tmpval;
 
-	iq = malloc(sizeof(kiss_fft_cpx) * len);
+	iq = wsa_malloc_aligned(sizeof(kiss_fft_cpx) * len, WSA_ALLOC_ALIGN);
 	if (iq == NULL) {
 		fprintf(stderr, "error: out of memory during rfft alloc\n");
 		return -EDSPNOMEM;
@@ -227,8 +226,8 @@ int rfft(kiss_fft_scalar *idata, kiss_fft_cpx *fftdata, int len)
 
 	fftcfg = kiss_fft_alloc(len, 0, 0, 0);
 	kiss_fft(fftcfg, iq, fftdata);
-	free(fftcfg);
-	free(iq);
+	kiss_fft_free(fftcfg);
+	wsa_free(iq);
 
 	// perform fft shift
 	n = len >> 1;
@@ -0,0 +1,364 @@
+///
+/// @file
+/// The DC offset and IQ imbalance corrector. See wsa_iqcorr.h.
+///
+/// The estimates are the running means of I, Q, I^2, Q^2 and I Q, from which the DC offsets and
+/// the powers and correlation of I and Q about them follow. With those, Q is made orthogonal to I
+/// (Gram-Schmidt) and scaled to its power:
+///
+///     I' = I - dc_i
+///     Q' = c (Q - dc_q) - a c (I - dc_i),   a = cov / var_i,   c = sqrt(var_i / (var_q - a cov))
+///
+/// which comes to Q' = c Q + d I + e, so a sample takes a subtraction and three multiply-adds.
+///
+/// A packet's sums are kept in float in four lanes over WSA_IQCORR_BLOCK samples at a time, and
+/// added up in double between blocks, so they stay exact enough over packets of any length.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <string.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include "wsa_error.h"
+#include "wsa_debug.h"
+#include "wsa_alloc.h"
+#include "wsa_iqcorr.h"
+
+/// Samples summed in float before adding to the double sums.
+#define WSA_IQCORR_BLOCK 1024
+
+/// The sums of a packet: I, Q, I^2, Q^2 and I Q.
+enum wsa_iqcorr_moment {
+    WSA_IQCORR_I,
+    WSA_IQCORR_Q,
+    WSA_IQCORR_II,
+    WSA_IQCORR_QQ,
+    WSA_IQCORR_IQ,
+    WSA_IQCORR_MOMENTS
+};
+
+struct wsa_iqcorr {
+    struct wsa_iqcorr_config config;
+    uint64_t samples;					///< Samples pushed since the last reset
+    double mean[WSA_IQCORR_MOMENTS];	///< Running means
+
+    // the correction, from the means
+    float dc_i;
+    float c;
+    float d;
+    float e;
+
+    float lanes[4 * WSA_IQCORR_MOMENTS];	///< A block's sums, four lanes of each
+};
+
+
+///
+/// Sum the moments of \p samples, into \p sums. For real data, pass idata again as \p qdata.
+///
+static void wsa_iqcorr_sum( struct wsa_iqcorr *iqcorr, float const *idata, float const *qdata, int32_t samples,
+                            double *sums )
+{
+    float *lanes = iqcorr->lanes;
+    int32_t block;
+    int32_t end;
+    int32_t k;
+    int32_t m;
+
+    memset(sums, 0, sizeof(double) * WSA_IQCORR_MOMENTS);
+
+    for (block = 0; block < samples; block = end) {
+        // Four samples at a time, each summed in locals of its own as in wsa_ddc_dot() (wsa_ddc.c).
+        float i0 = 0, i1 = 0, i2 = 0, i3 = 0;
+        float q0 = 0, q1 = 0, q2 = 0, q3 = 0;
+        float ii0 = 0, ii1 = 0, ii2 = 0, ii3 = 0;
+        float qq0 = 0, qq1 = 0, qq2 = 0, qq3 = 0;
+        float iq0 = 0, iq1 = 0, iq2 = 0, iq3 = 0;
+        float const *x = idata + block;
+        float const *y = qdata + block;
+
+        end = (samples - block > WSA_IQCORR_BLOCK) ? block + WSA_IQCORR_BLOCK : samples;
+        for (k = block; k + 4 <= end; k += 4, x += 4, y += 4) {
+            i0 += x[0];
+            i1 += x[1];
+            i2 += x[2];
+            i3 += x[3];
+            q0 += y[0];
+            q1 += y[1];
+            q2 += y[2];
+            q3 += y[3];
+            ii0 += x[0] * x[0];
+            ii1 += x[1] * x[1];
+            ii2 += x[2] * x[2];
+            ii3 += x[3] * x[3];
+            qq0 += y[0] * y[0];
+            qq1 += y[1] * y[1];
+            qq2 += y[2] * y[2];
+            qq3 += y[3] * y[3];
+            iq0 += x[0] * y[0];
+            iq1 += x[1] * y[1];
+            iq2 += x[2] * y[2];
+            iq3 += x[3] * y[3];
+        }
+        lanes[0] = i0;
+        lanes[1] = i1;
+        lanes[2] = i2;
+        lanes[3] = i3;
+        lanes[4] = q0;
+        lanes[5] = q1;
+        lanes[6] = q2;
+        lanes[7] = q3;
+        lanes[8] = ii0;
+        lanes[9] = ii1;
+        lanes[10] = ii2;
+        lanes[11] = ii3;
+        lanes[12] = qq0;
+        lanes[13] = qq1;
+        lanes[14] = qq2;
+        lanes[15] = qq3;
+        lanes[16] = iq0;
+        lanes[17] = iq1;
+        lanes[18] = iq2;
+        lanes[19] = iq3;
+
+        for (m = 0; m < WSA_IQCORR_MOMENTS; m++) {
+            sums[m] += ((double)lanes[4 * m] + lanes[4 * m + 1]) + ((double)lanes[4 * m + 2] + lanes[4 * m + 3]);
+        }
+
+        // the last few samples of the packet
+        for (; k < end; k++, x++, y++) {
+            sums[WSA_IQCORR_I] += x[0];
+            sums[WSA_IQCORR_Q] += y[0];
+            sums[WSA_IQCORR_II] += x[0] * x[0];
+            sums[WSA_IQCORR_QQ] += y[0] * y[0];
+            sums[WSA_IQCORR_IQ] += x[0] * y[0];
+        }
+    }
+}
+
+
+///
+/// Correct \p samples of I and Q in place: I' = I - dc_i, Q' = c Q + d I + e.
+///
+/// Four samples at a time, each loaded before any is stored, so the compiler packs them into
+/// vectors without having to prove that I and Q do not overlap.
+///
+static void wsa_iqcorr_apply( struct wsa_iqcorr const *iqcorr, float *idata, float *qdata, int32_t samples )
+{
+    float const dc_i = iqcorr->dc_i;
+    float const c = iqcorr->c;
+    float const d = iqcorr->d;
+    float const e = iqcorr->e;
+    float *end = idata + samples;
+    float *x = idata;
+    float *y = qdata;
+    float i0, i1, i2, i3;
+    float q0, q1, q2, q3;
+
+    for (; end - x >= 4; x += 4, y += 4) {
+        i0 = x[0];
+        i1 = x[1];
+        i2 = x[2];
+        i3 = x[3];
+        q0 = y[0];
+        q1 = y[1];
+        q2 = y[2];
+        q3 = y[3];
+        x[0] = i0 - dc_i;
+        x[1] = i1 - dc_i;
+        x[2] = i2 - dc_i;
+        x[3] = i3 - dc_i;
+        y[0] = c * q0 + d * i0 + e;
+        y[1] = c * q1 + d * i1 + e;
+        y[2] = c * q2 + d * i2 + e;
+        y[3] = c * q3 + d * i3 + e;
+    }
+    for (; x < end; x++, y++) {
+        i0 = x[0];
+        x[0] = i0 - dc_i;
+        y[0] = c * y[0] + d * i0 + e;
+    }
+}
+
+
+///
+/// Take the DC offset out of \p samples of real data, in place.
+///
+static void wsa_iqcorr_apply_dc( struct wsa_iqcorr const *iqcorr, float *idata, int32_t samples )
+{
+    float const dc_i = iqcorr->dc_i;
+    float *end = idata + samples;
+    float *x = idata;
+
+    for (; end - x >= 4; x += 4) {
+        x[0] -= dc_i;
+        x[1] -= dc_i;
+        x[2] -= dc_i;
+        x[3] -= dc_i;
+    }
+    for (; x < end; x++) {
+        x[0] -= dc_i;
+    }
+}
+
+
+///
+/// Work out the correction, dc_i, c, d and e, from the running means.
+///
+static void wsa_iqcorr_update( struct wsa_iqcorr *iqcorr, uint8_t complex )
+{
+    double const *mean = iqcorr->mean;
+    double var_i = mean[WSA_IQCORR_II] - mean[WSA_IQCORR_I] * mean[WSA_IQCORR_I];
+    double var_q = mean[WSA_IQCORR_QQ] - mean[WSA_IQCORR_Q] * mean[WSA_IQCORR_Q];
+    double cov = mean[WSA_IQCORR_IQ] - mean[WSA_IQCORR_I] * mean[WSA_IQCORR_Q];
+    double a;
+    double rest;
+    double c = 1;
+    double d = 0;
+
+    // balance only when there is a Q that is not all I, or there is nothing to scale by
+    if (complex && !iqcorr->config.dc_only && var_i > 0) {
+        a = cov / var_i;
+        rest = var_q - a * cov;
+        if (rest > var_q * 1e-6) {
+            c = sqrt(var_i / rest);
+            d = -a * c;
+        }
+    }
+
+    iqcorr->dc_i = (float)mean[WSA_IQCORR_I];
+    iqcorr->c = (float)c;
+    iqcorr->d = (float)d;
+    iqcorr->e = (float)(-c * mean[WSA_IQCORR_Q] - d * mean[WSA_IQCORR_I]);
+}
+
+
+///
+/// Create a corrector.
+///
+/// @param[in] config The time constant and whether to balance I and Q, or NULL for the defaults.
+/// @param[out] iqcorr The new corrector.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_iqcorr_alloc( struct wsa_iqcorr_config const *config, struct wsa_iqcorr **iqcorr )
+{
+    struct wsa_iqcorr *q;
+
+    if (iqcorr == NULL) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    q = wsa_malloc(sizeof(struct wsa_iqcorr));
+    if (q == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+    memset(q, 0, sizeof(struct wsa_iqcorr));
+    if (config != NULL) {
+        q->config = *config;
+    }
+    if (q->config.time_constant == 0) {
+        q->config.time_constant = WSA_IQCORR_DEFAULT_TIME_CONSTANT;
+    }
+    wsa_iqcorr_reset(q);
+
+    doutf(DMED, "IQ correction: time constant %u samples%s\n", (unsigned)q->config.time_constant,
+          q->config.dc_only ? ", DC only" : "");
+
+    *iqcorr = q;
+
+    return 0;
+}
+
+
+///
+/// Free a corrector.
+///
+void wsa_iqcorr_free( struct wsa_iqcorr *iqcorr )
+{
+    wsa_free(iqcorr);
+}
+
+
+///
+/// Forget the estimates, as after retuning; the next packet sets them outright.
+///
+void wsa_iqcorr_reset( struct wsa_iqcorr *iqcorr )
+{
+    iqcorr->samples = 0;
+    memset(iqcorr->mean, 0, sizeof(iqcorr->mean));
+    wsa_iqcorr_update(iqcorr, 0);
+}
+
+
+///
+/// Update the estimates from a packet's samples, and correct them in place.
+///
+/// @param[in] iqcorr The corrector.
+/// @param[in,out] idata I samples, normalized.
+/// @param[in,out] qdata Q samples, normalized, or NULL for real (I-only) data.
+/// @param[in] samples Number of samples.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_iqcorr_push( struct wsa_iqcorr *iqcorr, float *idata, float *qdata, int32_t samples )
+{
+    double sums[WSA_IQCORR_MOMENTS];
+    double keep;
+    int32_t m;
+
+    if (iqcorr == NULL || idata == NULL || samples < 0) {
+        return WSA_ERR_INVINPUT;
+    }
+    if (samples == 0) {
+        return 0;
+    }
+
+    // move the means towards the packet's by its share of the time constant
+    wsa_iqcorr_sum(iqcorr, idata, qdata ? qdata : idata, samples, sums);
+    if (qdata == NULL) {
+        sums[WSA_IQCORR_Q] = 0;
+        sums[WSA_IQCORR_QQ] = 0;
+        sums[WSA_IQCORR_IQ] = 0;
+    }
+    keep = (iqcorr->samples > 0) ? exp(-(double)samples / iqcorr->config.time_constant) : 0;
+    for (m = 0; m < WSA_IQCORR_MOMENTS; m++) {
+        iqcorr->mean[m] = keep * iqcorr->mean[m] + (1 - keep) * sums[m] / samples;
+    }
+    iqcorr->samples += (uint64_t)samples;
+    wsa_iqcorr_update(iqcorr, qdata != NULL);
+
+    if (qdata) {
+        wsa_iqcorr_apply(iqcorr, idata, qdata, samples);
+    } else {
+        wsa_iqcorr_apply_dc(iqcorr, idata, samples);
+    }
+
+    return 0;
+}
+
+
+///
+/// Get the estimates a corrector is working with.
+///
+void wsa_iqcorr_estimate( struct wsa_iqcorr const *iqcorr, struct wsa_iqcorr_estimate *estimate )
+{
+    double const *mean = iqcorr->mean;
+    double var_i = mean[WSA_IQCORR_II] - mean[WSA_IQCORR_I] * mean[WSA_IQCORR_I];
+    double var_q = mean[WSA_IQCORR_QQ] - mean[WSA_IQCORR_Q] * mean[WSA_IQCORR_Q];
+    double cov = mean[WSA_IQCORR_IQ] - mean[WSA_IQCORR_I] * mean[WSA_IQCORR_Q];
+    double s;
+
+    memset(estimate, 0, sizeof(struct wsa_iqcorr_estimate));
+    estimate->samples = iqcorr->samples;
+    estimate->dc_i = mean[WSA_IQCORR_I];
+    estimate->dc_q = mean[WSA_IQCORR_Q];
+    estimate->gain = 1;
+    if (var_i > 0 && var_q > 0) {
+        estimate->gain = sqrt(var_q / var_i);
+        s = cov / sqrt(var_i * var_q);
+        s = (s > 1) ? 1 : (s < -1) ? -1 : s;
+        estimate->phase = asin(s) * 180 / M_PI;
+    }
+}
@@ -6,6 +6,9 @@
 #include "wsa_error.h"
 #include "wsa_api.h"
 #include "wsa_lib.h"
+#include "wsa_clock.h"
+#include "wsa_replay.h"
+#include "wsa_transport.h"
 
 #ifdef _WIN32
 # define strtok_r strtok_s
@@ -325,7 +328,7 @@ int16_t wsa_query_error(struct wsa_device *dev, char *output)
 	struct wsa_resp resp;
 
 	wsa_send_query(dev, "SYST:ERR?\n", &resp);
-	doutf(DLOW, "SYST:ERR <= %s", resp);
+	doutf(DLOW, "SYST:ERR <= %s", resp.output);
 	if (resp.status < 0)
 	{
 		strcpy(output, _wsa_get_err_msg((int16_t) resp.status));
@@ -352,6 +355,89 @@ int16_t wsa_query_error(struct wsa_device *dev, char *output)
 // *****
 
 
+/**
+ * Open a recording to replay as the device, see wsa_replay.h.
+ *
+ * @param dev - A pointer to the WSA device structure.
+ * @param spec - The interface string after "FILE::", i.e. the path with
+ * any "::REALTIME" and "::LOOP" options after it.
+ *
+ * @return 0 on success, or a negative number on error.
+ */
+static int16_t _wsa_connect_replay(struct wsa_device *dev, char const *spec)
+{
+	int16_t result;
+	uint32_t flags = 0;
+	char path[MAX_STR_LEN];
+	char *opt;
+	char *p;
+	struct wsa_replay *replay;
+
+	if (strlen(spec) == 0 || strlen(spec) >= sizeof(path))
+		return WSA_ERR_INVINTFMETHOD;
+	strcpy(path, spec);
+
+	// peel the options off the end; the path itself may hold colons
+	while (1) {
+		opt = NULL;
+		for (p = strstr(path, "::"); p != NULL; p = strstr(p + 1, "::"))
+			opt = p;
+		if (opt == NULL)
+			break;
+
+		if (strcmp(opt + 2, WSA_REPLAY_REALTIME_STRING) == 0)
+			flags |= WSA_REPLAY_REALTIME;
+		else if (strcmp(opt + 2, WSA_REPLAY_LOOP_STRING) == 0)
+			flags |= WSA_REPLAY_LOOP;
+		else
+			break;
+		*opt = '\0';
+	}
+
+	result = wsa_replay_open(path, flags, &replay);
+	if (result < 0) {
+		doutf(DHIGH, "Error %d: %s \"%s\".\n", result, _wsa_get_err_msg(result), path);
+		return result;
+	}
+
+	return wsa_connect_transport(dev, &wsa_replay_transport, replay);
+}
+
+
+/**
+ * Connect to a device through the given transport, see wsa_transport.h.
+ * wsa_connect() calls this once it has opened a TCP connection or a
+ * recording; call it directly for any other transport, such as
+ * wsa_mem_transport.
+ *
+ * @param dev - A pointer to the WSA device structure to be connected.
+ * @param ops - The transport's operations.
+ * @param ctx - The transport's context, which the device then owns: it is
+ * closed on wsa_disconnect(), or here if the device does not answer.
+ *
+ * @return 0 on success, or a negative number on error.
+ */
+int16_t wsa_connect_transport(struct wsa_device *dev, struct wsa_transport_ops const *ops, void *ctx)
+{
+	int16_t result;
+
+	dev->transport = ops;
+	dev->transport_ctx = ctx;
+	strcpy(dev->descr.intf_type, ops->name);
+	wsa_stream_track_reset(dev);
+	dev->probe_pending = 0;
+
+	result = _wsa_open(dev);
+	if (result < 0) {
+		ops->close(ctx);
+		dev->transport = NULL;
+		dev->transport_ctx = NULL;
+	}
+
+	return result;
+}
+
+
 /**
  * Connect to a WSA through the specified interface method \b intf_method,
  * and communicate control commands in the format of the given command 
@@ -378,6 +464,8 @@ int16_t wsa_query_error(struct wsa_device *dev, char *output)
  * the required ports eventually, then you can enter the ports in the format
  * and the \e \b order as specified. \n
  * Example: "TCPIP::192.168.1.1" or "TCPIP::192.168.1.1::37001,37001"
+ * - With a recording, use: "FILE::<path>[::REALTIME][::LOOP]", see 
+ * wsa_replay.h.
  * 
  * @return 0 on success, or a negative number on error.
  */
@@ -386,6 +474,7 @@ int16_t wsa_connect(struct wsa_device *dev, char const *cmd_syntax, char *intf_m
 	int16_t result = 0;			// result returned from a function
 	char *temp_str;		// temporary store a string
     char * strtok_context = 0;
+	char intf_copy[256];	// tokenized, so the caller's string is left alone
 	char intf_type[10];
 	char ports_str[20];
 	char wsa_addr[200];		// store the WSA IP address
@@ -395,14 +484,32 @@ int16_t wsa_connect(struct wsa_device *dev, char const *cmd_syntax, char *intf_m
 	uint8_t is_tcpip = FALSE;	// flag to indicate a TCPIP connection method
 	int32_t colons = 0;
 
+	// start the statistics afresh for this connection
+	memset(&dev->stats, 0, sizeof(dev->stats));
+	dev->transport = NULL;
+	dev->transport_ctx = NULL;
+
+	// A recording is opened here, before its path is split at the colons
+	if (strncmp(intf_method, WSA_REPLAY_INTF "::", strlen(WSA_REPLAY_INTF "::")) == 0)
+		return _wsa_connect_replay(dev, intf_method + strlen(WSA_REPLAY_INTF "::"));
+
 	// initialed the strings
 	strcpy(intf_type, "");
 	strcpy(wsa_addr, "");
 	strcpy(ports_str, "");
 
+	if (strlen(intf_method) >= sizeof(intf_copy)) {
+		return WSA_ERR_INVINTFMETHOD;
+	}
+	strcpy(intf_copy, intf_method);
+
 	// Gets the interface strings
-	temp_str = strtok_r(intf_method, ":", &strtok_context);
+	temp_str = strtok_r(intf_copy, ":", &strtok_context);
 	while (temp_str != NULL) {
+		if (strlen(temp_str) >= (colons == 0 ? sizeof(intf_type) :
+				colons == 1 ? sizeof(wsa_addr) : sizeof(ports_str))) {
+			return WSA_ERR_INVINTFMETHOD;
+		}
 		if (colons == 0)	 strcpy(intf_type, temp_str);
 		else if (colons == 1)	 strcpy(wsa_addr, temp_str);
 		else if (colons == 2)	 strcpy(ports_str, temp_str);
@@ -461,10 +568,16 @@ int16_t wsa_connect(struct wsa_device *dev, char const *cmd_syntax, char *intf_m
 		if (strlen(ports_str) > 0)	{
 			// get control port
 			temp_str = strtok_r(ports_str, ",", &strtok_context);
+			if (temp_str == NULL || strlen(temp_str) >= sizeof(ctrl_port)) {
+				return WSA_ERR_INVINTFMETHOD;
+			}
 			strcpy(ctrl_port, temp_str);
 			
 			// get data port
 			temp_str = strtok_r(NULL, ",", &strtok_context);
+			if (temp_str == NULL || strlen(temp_str) >= sizeof(data_port)) {
+				return WSA_ERR_INVINTFMETHOD;
+			}
 			strcpy(data_port, temp_str);
 		} else {
 			strcpy(ctrl_port, CTRL_PORT);
@@ -484,7 +597,11 @@ int16_t wsa_connect(struct wsa_device *dev, char const *cmd_syntax, char *intf_m
 			return result;
         }
 
-		strcpy(dev->descr.intf_type, "TCPIP");
+		// data reads wait in wsa_sock_wait_until(), never in recv()
+		result = wsa_sock_set_nonblocking(dev->sock.data);
+		if (result < 0) {
+			return result;
+        }
 	}
 	
 	// TODO Add other connection methods here...
@@ -492,7 +609,7 @@ int16_t wsa_connect(struct wsa_device *dev, char const *cmd_syntax, char *intf_m
 	// *****
 	// Check for any errors exist in the WSA
 	// *****
-	result = _wsa_open(dev);
+	result = wsa_connect_transport(dev, &wsa_tcp_transport, &dev->sock);
 	
 	return result;
 }
@@ -507,18 +624,13 @@ int16_t wsa_connect(struct wsa_device *dev, char const *cmd_syntax, char *intf_m
  */
 int16_t wsa_disconnect(struct wsa_device *dev)
 {
-	int16_t result = 0;			// result returned from a function
-	
-	//TODO close based on connection type
-	// right now do only TCPIP client
-	if (strcmp(dev->descr.intf_type, "TCPIP") == 0) {
-		result = wsa_close_sock(dev->sock.cmd);
-		result = wsa_close_sock(dev->sock.data);
-
-		wsa_destroy_client();
+	if (dev->transport != NULL) {
+		dev->transport->close(dev->transport_ctx);
+		dev->transport = NULL;
+		dev->transport_ctx = NULL;
 	}
 
-	return result;
+	return 0;
 }
 
 
@@ -571,22 +683,22 @@ int16_t wsa_send_command(struct wsa_device *dev, char const *command)
 	}
 
     // TODO: check WSA version/model # 
-	if (strcmp(dev->descr.intf_type, "USB") == 0) 
-	{	
-		doutf(DLOW, "wsa_send_command: unsupported USB device\n");
-		return WSA_ERR_USBNOTAVBL;
+	if (dev->transport == NULL)
+	{
+		doutf(DLOW, "wsa_send_command: device is not connected\n");
+		return WSA_ERR_WSANOTRDY;
 	}
-	else if (strcmp(dev->descr.intf_type, "TCPIP") == 0) 
+	else
 	{
 		while (1) 
 		{
 			// Making the assumption that we will not send more bytes
 			// than can fit into int16_t
 			// TODO: revisit this and move bytes_txed into the parameter list
-			bytes_txed = (int16_t) wsa_sock_send(dev->sock.cmd, command, len);
+			bytes_txed = (int16_t) dev->transport->send(dev->transport_ctx, command, len);
 			if (bytes_txed < 0)
 			{
-				doutf(DHIGH, "wsa_send_command: wsa_sock_send returned %d\n", bytes_txed);
+				doutf(DHIGH, "wsa_send_command: send returned %d\n", bytes_txed);
 				return bytes_txed;
 			}
 			else if (bytes_txed < len) 
@@ -666,7 +778,7 @@ int16_t wsa_send_command_file(struct wsa_device *dev, char const *file_name)
     // Allocate memory
     for (i = 0; i < MAX_FILE_LINES; i++)
 	{
-        cmd_strs[i] = (char *) malloc(sizeof(char) * MAX_STR_LEN);
+        cmd_strs[i] = (char *) wsa_malloc(sizeof(char) * MAX_STR_LEN);
 		if (cmd_strs[i] == NULL)
 		{
 			doutf(DHIGH, "In wsa_send_command_file: failed to allocate memory\n");
@@ -725,7 +837,7 @@ int16_t wsa_send_command_file(struct wsa_device *dev, char const *file_name)
 
     // Free memory
     for (i = 0; i < MAX_FILE_LINES; i++)
-        free(cmd_strs[i]);
+        wsa_free(cmd_strs[i]);
 
     return result;
 }
@@ -743,6 +855,8 @@ int16_t wsa_send_command_file(struct wsa_device *dev, char const *file_name)
 *
 * @return 0 upon successful or a negative value
 */
+static void _wsa_discard_probe_reply(struct wsa_device *dev);
+
 int16_t wsa_send_query(struct wsa_device *dev, char const *command, struct wsa_resp * resp)
 {
 	int16_t bytes_got = 0;
@@ -750,22 +864,24 @@ int16_t wsa_send_query(struct wsa_device *dev, char const *command, struct wsa_r
 	int32_t bytes_received = 0;
 	uint8_t resend_cnt = 0;
 	int32_t len = (int32_t)strlen(command);
-	int32_t loop_count = 0;
+	uint64_t t0 = wsa_clock_ns();
 	// set defaults
 	strcpy(resp->output, "");
 	resp->status = 0;
 
-	if (strcmp(dev->descr.intf_type, "USB") == 0) { 
-		resp->status = WSA_ERR_USBNOTAVBL;
-		strcpy(resp->output, _wsa_get_err_msg(WSA_ERR_USBNOTAVBL));
+	if (dev->transport == NULL) {
+		resp->status = WSA_ERR_WSANOTRDY;
+		strcpy(resp->output, _wsa_get_err_msg(WSA_ERR_WSANOTRDY));
 	}
-	else if (strcmp(dev->descr.intf_type, "TCPIP") == 0) {
+	else {
+		_wsa_discard_probe_reply(dev);
+
 		while (1) {
 			// Send the query command out
 			// Making the assumption that we will not send more bytes
 			// than can fit into int16_t
 			// TODO: revisit this and move bytes_txed into the parameter list
-			bytes_got = (int16_t) wsa_sock_send(dev->sock.cmd, command, len);
+			bytes_got = (int16_t) dev->transport->send(dev->transport_ctx, command, len);
 			if (bytes_got < 0) {
 				resp->status = bytes_got;
 				strcpy(resp->output, _wsa_get_err_msg(bytes_got));
@@ -786,19 +902,15 @@ int16_t wsa_send_query(struct wsa_device *dev, char const *command, struct wsa_r
 			// Read back the output
 			else 
 			{
-				recv_result = -1;
-				while (recv_result != 0 && loop_count < 5) 
-				{
-					recv_result = wsa_sock_recv(dev->sock.cmd, 
-							(uint8_t *) resp->output, 
-							MAX_STR_LEN, TIMEOUT, 
-							&bytes_received);
-
-					loop_count++;
-				}
+				recv_result = _wsa_recv_until(dev, WSA_CHANNEL_CMD,
+						(uint8_t *) resp->output, MAX_STR_LEN,
+						wsa_clock_ns() + (uint64_t) TIMEOUT * 1000000ULL,
+						&bytes_received);
 				break;
 			}
 		}
+		wsa_stats_count(&dev->stats, WSA_STAT_SCPI_QUERIES, 1);
+		wsa_stats_time(&dev->stats, WSA_STAT_SCPI_RTT, wsa_clock_ns() - t0);
 		if (resp->output[bytes_received - 1] == '\n'){
 			resp->output[bytes_received - 1] = '\0';
 		}
@@ -851,6 +963,294 @@ const char *wsa_get_error_msg(int16_t err_code)
 }
 
 
+/**
+ * Read what arrives on a channel of the device's transport, up to \b size
+ * bytes, waiting until \b deadline_ns for at least one.  Data is read
+ * before waiting, as at speed it is usually there already; a reply is
+ * waited for first.
+ *
+ * @param dev - A pointer to the WSA device structure.
+ * @param channel - WSA_CHANNEL_CMD or WSA_CHANNEL_DATA.
+ * @param buf - Where to store the bytes.
+ * @param size - The most bytes to read.
+ * @param deadline_ns - When to give up, on the wsa_clock_ns() clock.
+ * @param received - Pointer to int32_t storing number of bytes read
+ *
+ * @return 0 on success, WSA_ERR_SOCKETNODATA if nothing arrived by the
+ * deadline, or another negative value on error.
+ */
+int16_t _wsa_recv_until(struct wsa_device *dev, enum wsa_channel channel, uint8_t *buf,
+		int32_t size, uint64_t deadline_ns, int32_t *received)
+{
+	struct wsa_transport_ops const *ops = dev->transport;
+	int16_t result;
+
+	*received = 0;
+	if (ops == NULL)
+		return WSA_ERR_WSANOTRDY;
+
+	if (channel == WSA_CHANNEL_DATA) {
+		result = ops->recv(dev->transport_ctx, channel, buf, size, received, &dev->stats);
+		if (result < 0 || *received > 0)
+			return result;
+	}
+
+	// a wake-up with nothing to read just waits again
+	do {
+		result = ops->poll(dev->transport_ctx, channel, deadline_ns, &dev->stats);
+		if (result < 0)
+			return result;
+
+		result = ops->recv(dev->transport_ctx, channel, buf, size, received, &dev->stats);
+	} while (result == 0 && *received == 0);
+
+	return result;
+}
+
+
+/**
+ * Read exactly \b size bytes from the data channel by \b deadline_ns.
+ *
+ * @return 0 on success, or as _wsa_recv_until() on error, with \b total
+ * holding the bytes read so far.
+ */
+static int16_t _wsa_recv_data(struct wsa_device *dev, uint8_t *buf, int32_t size,
+		uint64_t deadline_ns, int32_t *total)
+{
+	int16_t result;
+	int32_t received;
+
+	*total = 0;
+	while (*total < size) {
+		result = _wsa_recv_until(dev, WSA_CHANNEL_DATA, buf + *total, size - *total,
+			deadline_ns, &received);
+		*total += received;
+		if (result < 0)
+			return result;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Read and throw away the reply to a status query that _wsa_probe_device()
+ * gave up on, waiting for it up to the usual query timeout, so that it is
+ * not taken for the reply to the next query.
+ *
+ * @param dev - A pointer to the WSA device structure.
+ */
+static void _wsa_discard_probe_reply(struct wsa_device *dev)
+{
+	char reply[MAX_STR_LEN];
+	int32_t bytes_received = 0;
+
+	if (!dev->probe_pending)
+		return;
+	dev->probe_pending = 0;
+
+	if (_wsa_recv_until(dev, WSA_CHANNEL_CMD, (uint8_t *) reply, sizeof(reply),
+			wsa_clock_ns() + (uint64_t) TIMEOUT * 1000000ULL, &bytes_received) == 0)
+		doutf(DMED, "Discarded a late reply to a status query\n");
+}
+
+
+/**
+ * Check that a device whose data has stalled is still there, by sending it
+ * a status query over the control channel and waiting for the reply until
+ * \b deadline_ns.  If it does not come, the query is left outstanding and
+ * its reply is discarded before the next query is sent.
+ *
+ * @param dev - A pointer to the WSA device structure.
+ * @param deadline_ns - When to give up, on the wsa_clock_ns() clock.
+ *
+ * @return 0 if the device answered, or WSA_ERR_DEVICE_NO_RESPONSE.
+ */
+static int16_t _wsa_probe_device(struct wsa_device *dev, uint64_t deadline_ns)
+{
+	char reply[MAX_STR_LEN];
+	int32_t bytes_received = 0;
+	int32_t len = (int32_t) strlen("*STB?\n");
+
+	_wsa_discard_probe_reply(dev);
+
+	wsa_stats_count(&dev->stats, WSA_STAT_SCPI_QUERIES, 1);
+
+	if (dev->transport->send(dev->transport_ctx, "*STB?\n", len) < len)
+		return WSA_ERR_DEVICE_NO_RESPONSE;
+	dev->probe_pending = 1;
+
+	if (_wsa_recv_until(dev, WSA_CHANNEL_CMD, (uint8_t *) reply, sizeof(reply),
+			deadline_ns, &bytes_received) < 0) {
+		doutf(DHIGH, "Device did not answer a status query while its data was stalled\n");
+		return WSA_ERR_DEVICE_NO_RESPONSE;
+	}
+	dev->probe_pending = 0;
+
+	doutf(DMED, "Data stalled, but the device answered a status query\n");
+
+	return 0;
+}
+
+
+/**
+ * Read \b buf_size bytes from the data channel by \b deadline_ns.  If not a
+ * byte has arrived by \b probe_ns, the device is checked with _wsa_probe_device()
+ * before waiting out the rest of the time, so a dead device is reported
+ * within the deadline without opening any extra connection.
+ *
+ * @param dev - A pointer to the WSA device structure.
+ * @param rx_buf_ptr - Where to store the bytes.
+ * @param buf_size - The number of bytes to read.
+ * @param probe_ns - When to check on the device, on the wsa_clock_ns() clock.
+ * @param deadline_ns - When to give up, on the wsa_clock_ns() clock.
+ * @param total_bytes - Pointer to int32_t storing number of bytes read
+ *
+ * @return 0 on success, WSA_ERR_SOCKETNODATA if the device answers but sends
+ * no data by the deadline, WSA_ERR_DEVICE_NO_RESPONSE if it does not answer,
+ * or another negative value on error.
+ */
+int16_t _wsa_recv_data_checked(struct wsa_device *dev, uint8_t *rx_buf_ptr,
+		int32_t buf_size, uint64_t probe_ns, uint64_t deadline_ns, int32_t *total_bytes)
+{
+	int16_t result;
+	int32_t bytes_received = 0;
+
+	*total_bytes = 0;
+
+	if (probe_ns < deadline_ns) {
+		result = _wsa_recv_data(dev, rx_buf_ptr, buf_size, probe_ns, &bytes_received);
+		*total_bytes = bytes_received;
+		if (result != WSA_ERR_SOCKETNODATA)
+			return result;
+
+		// if part of the data came, the device is there and the rest is on its way
+		if (bytes_received == 0) {
+			wsa_stats_count(&dev->stats, WSA_STAT_STALLS, 1);
+			result = _wsa_probe_device(dev, deadline_ns);
+			if (result < 0)
+				return result;
+		}
+	}
+
+	result = _wsa_recv_data(dev, rx_buf_ptr + *total_bytes,
+		buf_size - *total_bytes, deadline_ns, &bytes_received);
+	*total_bytes += bytes_received;
+
+	return result;
+}
+
+
+/**
+ * Forget what is expected next of every stream, as after a connection is
+ * made or data is thrown away.  The next packet of each stream starts it
+ * afresh, with no gap.
+ *
+ * @param dev - A pointer to the WSA device structure.
+ */
+void wsa_stream_track_reset(struct wsa_device *dev)
+{
+	memset(dev->track, 0, sizeof(dev->track));
+}
+
+
+/**
+ * Check a packet against what its stream led us to expect, set the gap
+ * fields of its \b header, count any gap in the device's statistics, and
+ * expect the packet after it.
+ *
+ * The packet count of each stream should go up by one each packet.  The
+ * timestamp of an IF packet should follow the last one's by its samples;
+ * the time per sample is learned from the first two packets in a row, and
+ * is learned again after each context packet, as that marks a new capture
+ * or new settings.  A timestamp more than a sample off is a gap.
+ *
+ * @param dev - A pointer to the WSA device structure.
+ * @param header - The packet's header, with its count and time decoded.
+ * @param samples - The number of samples in an IF packet, or 0.
+ */
+static void _wsa_track_packet(struct wsa_device *dev,
+		struct wsa_vrt_packet_header *header, uint32_t samples)
+{
+	struct wsa_stream_track *track = NULL;
+	int64_t elapsed;
+	int64_t expected;
+	uint8_t ahead;
+	int i;
+
+	header->gap = 0;
+	header->dropped = 0;
+
+	for (i = 0; i < WSA_TRACKED_STREAMS; i++) {
+		if (dev->track[i].stream_id == header->stream_id) {
+			track = &dev->track[i];
+			break;
+		}
+		if (dev->track[i].stream_id == 0) {
+			track = &dev->track[i];
+			track->stream_id = header->stream_id;
+			track->next_count = header->pkt_count;
+			break;
+		}
+	}
+	if (track == NULL)
+		return;
+
+	// counts run 0 to 15: a little ahead is a loss, a little behind is out of order
+	ahead = (uint8_t) ((header->pkt_count - track->next_count) & MAX_VRT_PKT_COUNT);
+	if (ahead != 0 && ahead <= MAX_VRT_PKT_COUNT / 2) {
+		header->gap |= WSA_GAP_DROPPED;
+		header->dropped = ahead;
+		wsa_stats_count(&dev->stats, WSA_STAT_DROPPED, ahead);
+	}
+	else if (ahead != 0) {
+		header->gap |= WSA_GAP_REORDERED;
+		wsa_stats_count(&dev->stats, WSA_STAT_REORDERED, 1);
+	}
+	if (!(header->gap & WSA_GAP_REORDERED))
+		track->next_count = (uint8_t) ((header->pkt_count + 1) & MAX_VRT_PKT_COUNT);
+
+	if (samples == 0) {
+		// a new capture, or new settings: the data streams start their clocks again
+		if (header->packet_type != IF_PACKET_TYPE) {
+			for (i = 0; i < WSA_TRACKED_STREAMS; i++) {
+				dev->track[i].timed = 0;
+				dev->track[i].psec_per_sample = 0;
+			}
+		}
+		return;
+	}
+
+	if (track->timed && !(header->gap & WSA_GAP_REORDERED)) {
+		elapsed = ((int64_t) header->time_stamp.sec - (int64_t) track->last_sec) * 1000000000000LL +
+			((int64_t) header->time_stamp.psec - (int64_t) track->last_psec);
+
+		if (track->psec_per_sample == 0) {
+			if (!(header->gap & WSA_GAP_DROPPED) && elapsed > 0)
+				track->psec_per_sample = (uint64_t) elapsed / track->last_samples;
+		}
+		else {
+			expected = (int64_t) (track->psec_per_sample * track->last_samples);
+			if (elapsed > expected + (int64_t) track->psec_per_sample) {
+				header->gap |= WSA_GAP_LATE;
+				wsa_stats_count(&dev->stats, WSA_STAT_LATE, 1);
+			}
+			else if (elapsed < expected - (int64_t) track->psec_per_sample) {
+				header->gap |= WSA_GAP_EARLY;
+				wsa_stats_count(&dev->stats, WSA_STAT_EARLY, 1);
+			}
+		}
+	}
+
+	if (!(header->gap & WSA_GAP_REORDERED)) {
+		track->timed = 1;
+		track->last_sec = header->time_stamp.sec;
+		track->last_psec = header->time_stamp.psec;
+		track->last_samples = samples;
+	}
+}
+
+
 /**
  * Reads one VRT packet containing raw IQ data or a Context Packet.
  *if a Context Packet is detected, the information inside the packet will be returned
@@ -892,6 +1292,17 @@ const char *wsa_get_error_msg(int16_t err_code)
  * wsa_send_command(dev, "TRACE:SPPACKET 1024\n");
  * @endcode
  *
+ * Each packet's count and, for IF packets, timestamp are checked against
+ * the packets of its stream before it.  The \b gap and \b dropped fields of
+ * the header report any gap just before the packet, and it is counted in
+ * the device's statistics (WSA_STAT_DROPPED, WSA_STAT_REORDERED,
+ * WSA_STAT_LATE, WSA_STAT_EARLY), so a stream with none of these was
+ * received whole.
+ *
+ * Where the transport holds its packets in memory, as a replayed recording
+ * does (see wsa_replay.h), the packet is parsed where it lies rather than
+ * received into a buffer.
+ *
  * @param device - A pointer to the WSA device structure.
  * @param header - A pointer to \b wsa_vrt_packet_header structure to store 
  *		the VRT header information
@@ -909,7 +1320,10 @@ const char *wsa_get_error_msg(int16_t err_code)
  *		(i.e. sizeof(\b data_buffer) = \b samples_per_packet * 4 bytes per sample).
  * @param samples_per_packet - A 16-bit unsigned integer sample size (i.e. number of
  *		{I, Q} sample pairs) per VRT packet to be captured.
- * @param timeout - An unsigned 32-bit integer containing the timeout (in miliseconds).
+ * @param timeout - An unsigned 32-bit integer containing the timeout (in miliseconds)
+ *		for the whole packet.  If no data has arrived halfway through it, the
+ *		device is sent a status query, and WSA_ERR_DEVICE_NO_RESPONSE is
+ *		returned if it does not answer in the time left.
  *
  * @return  0 on success or a negative value on error
  */
@@ -927,6 +1341,13 @@ int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device,
 
 	uint8_t *vrt_packet_buffer;
 	int32_t vrt_packet_bytes;
+
+	// what was allocated, if the packet was received into a buffer
+	uint8_t *header_alloc = NULL;
+	uint8_t *packet_alloc = NULL;
+
+	uint8_t const *in_place = NULL;
+	uint32_t in_place_bytes = 0;
 	
 	uint32_t stream_identifier_word = 0;
 	
@@ -941,11 +1362,16 @@ int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device,
 
 	uint16_t copy_size;
 
+	uint64_t probe_ns;
+	uint64_t deadline_ns;
+
 	// reset header
 	header->pkt_count = 0;
 	header->samples_per_packet = 0;
 	header->time_stamp.sec = 0;
 	header->time_stamp.psec = 0;
+	header->gap = 0;
+	header->dropped = 0;
 
 	// *****
 	// Setup, allocate buffer memory and fetch the first 2 header words
@@ -955,21 +1381,36 @@ int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device,
 	// packet size and packet type
 	vrt_header_bytes = 2 * BYTES_PER_VRT_WORD;
 	
-	// allocate space for the header buffer
-	vrt_header_buffer = (uint8_t *) malloc(vrt_header_bytes * sizeof(uint8_t));
-	if (vrt_header_buffer == NULL)
-		return WSA_ERR_MALLOCFAILED;
+	deadline_ns = wsa_clock_ns() + (uint64_t) timeout * 1000000ULL;
+	probe_ns = deadline_ns - (uint64_t) timeout * 500000ULL;
 
-	// retrieve the first two words of the packet to determine if the packet contains IQ data or context data
-	socket_receive_result = wsa_sock_recv_data(
-		device->sock.data, vrt_header_buffer, vrt_header_bytes, timeout, &bytes_received, WSA_ARE_YOU_DEAD_Q
-	);
+	if (device->transport == NULL) {
+		return WSA_ERR_WSANOTRDY;
+	}
+	else if (device->transport->next_packet != NULL) {
+		// the packet is parsed where it lies, in the transport's memory
+		socket_receive_result = device->transport->next_packet(device->transport_ctx,
+			deadline_ns, &in_place, &in_place_bytes);
+		bytes_received = (int32_t) in_place_bytes;
+		vrt_header_buffer = (uint8_t *) in_place;
+	}
+	else {
+		// allocate space for the header buffer
+		vrt_header_buffer = (uint8_t *) wsa_malloc(vrt_header_bytes * sizeof(uint8_t));
+		if (vrt_header_buffer == NULL)
+			return WSA_ERR_MALLOCFAILED;
+		header_alloc = vrt_header_buffer;
+
+		// retrieve the first two words of the packet to determine if the packet contains IQ data or context data
+		socket_receive_result = _wsa_recv_data_checked(device, vrt_header_buffer, vrt_header_bytes,
+			probe_ns, deadline_ns, &bytes_received);
+	}
 
 	doutf(DLOW, "In wsa_read_vrt_packet_raw: wsa_sock_recv_data read %d bytes, returned %hd\n", bytes_received, socket_receive_result);
 
 	if (socket_receive_result < 0) {
 		doutf(DHIGH, "Error in wsa_read_vrt_packet_raw:  %s\n", wsa_get_error_msg(socket_receive_result));
-		free(vrt_header_buffer);
+		wsa_free(header_alloc);
 
 		return socket_receive_result;
 	}
@@ -993,7 +1434,7 @@ int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device,
 	if (!((vrt_header_buffer[1] & 0xC0) >> 6)) 
 	{
 		doutf(DHIGH, "ERROR: Second timestamp is not of UTC type.\n");
-		free(vrt_header_buffer);
+		wsa_free(header_alloc);
 		return WSA_ERR_INVTIMESTAMP;
 	}
 		
@@ -1013,7 +1454,7 @@ int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device,
 		(stream_identifier_word != I16_DATA_STREAM_ID) &&
 		(stream_identifier_word != I32_DATA_STREAM_ID))
 	{
-		free(vrt_header_buffer);
+		wsa_free(header_alloc);
 		return WSA_ERR_NOTIQFRAME;
 	}
 	header->stream_id = stream_identifier_word;
@@ -1022,26 +1463,39 @@ int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device,
 	// set up and get the remaining words of each different type of packet accordingly
 	// *****
 	
-	// allocate memory for the vrt packet without the first two words
 	vrt_packet_bytes = BYTES_PER_VRT_WORD * (packet_size - 2);
-	vrt_packet_buffer = (uint8_t *) malloc(vrt_packet_bytes * sizeof(uint8_t));
-	if (vrt_packet_buffer == NULL)
+	if (in_place != NULL)
 	{
-		free(vrt_header_buffer);
-		return WSA_ERR_MALLOCFAILED;
+		// the rest of the packet is already there
+		vrt_packet_buffer = vrt_header_buffer + vrt_header_bytes;
 	}
-
-	socket_receive_result = wsa_sock_recv_data(device->sock.data, 
-		vrt_packet_buffer, vrt_packet_bytes, timeout, &bytes_received, WSA_ARE_YOU_DEAD_Q);
-	doutf(DLOW, "In wsa_read_vrt_packet_raw: wsa_sock_recv_data returned %hd\n", socket_receive_result);
-	if (socket_receive_result < 0)
+	else
 	{
-		doutf(DHIGH, "Error in wsa_read_vrt_packet_raw:  %s\n", 
-			wsa_get_error_msg(socket_receive_result));
-		free(vrt_packet_buffer);
-		free(vrt_header_buffer);
+		// allocate memory for the vrt packet without the first two words
+		vrt_packet_buffer = (uint8_t *) wsa_malloc(vrt_packet_bytes * sizeof(uint8_t));
+		if (vrt_packet_buffer == NULL)
+		{
+			wsa_free(header_alloc);
+			return WSA_ERR_MALLOCFAILED;
+		}
+		packet_alloc = vrt_packet_buffer;
+
+		// the rest normally follows at once; give it half the time left before checking on the device
+		probe_ns = wsa_clock_ns();
+		if (probe_ns < deadline_ns)
+			probe_ns += (deadline_ns - probe_ns) / 2;
+		socket_receive_result = _wsa_recv_data_checked(device, vrt_packet_buffer, vrt_packet_bytes,
+			probe_ns, deadline_ns, &bytes_received);
+		doutf(DLOW, "In wsa_read_vrt_packet_raw: wsa_sock_recv_data returned %hd\n", socket_receive_result);
+		if (socket_receive_result < 0)
+		{
+			doutf(DHIGH, "Error in wsa_read_vrt_packet_raw:  %s\n", 
+				wsa_get_error_msg(socket_receive_result));
+			wsa_free(packet_alloc);
+			wsa_free(header_alloc);
 
-		return socket_receive_result;
+			return socket_receive_result;
+		}
 	}
 
 	// Get the second timestamp
@@ -1137,6 +1591,11 @@ int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device,
 			trailer->sample_loss_indicator =
 				((trailer_word >> 24) & 0x1) ? ((trailer_word >> 12) & 0x1) : 0;
 
+			if (trailer->sample_loss_indicator)
+				wsa_stats_count(&device->stats, WSA_STAT_SAMPLE_LOSS, 1);
+			if (trailer->over_range_indicator)
+				wsa_stats_count(&device->stats, WSA_STAT_OVER_RANGE, 1);
+
 			doutf(DLOW, "Valid_data: %d\n", trailer->valid_data_indicator);
 			doutf(DLOW, "Ref-lock: %d\n", trailer->ref_lock_indicator);
 			doutf(DLOW, "Over-range: %d\n", trailer->over_range_indicator);
@@ -1145,8 +1604,15 @@ int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device,
 	}
 	if (stream_identifier_word == I16_DATA_STREAM_ID)
 		header->samples_per_packet = header->samples_per_packet * 2;
-	free(vrt_packet_buffer);
-	free(vrt_header_buffer);
+
+	_wsa_track_packet(device, header,
+		header->packet_type == IF_PACKET_TYPE ? header->samples_per_packet : 0);
+
+	wsa_free(packet_alloc);
+	wsa_free(header_alloc);
+
+	wsa_stats_count(&device->stats, WSA_STAT_PACKETS, 1);
+	wsa_stats_count(&device->stats, WSA_STAT_BYTES, (uint64_t) packet_size * BYTES_PER_VRT_WORD);
 
 	return 0;	
 }
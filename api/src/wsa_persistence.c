@@ -0,0 +1,328 @@
+///
+/// @file
+/// The persistence histogram. See wsa_persistence.h.
+///
+/// Cells hold hits scaled by \b weight, which grows by 1 / decay with every spectrum, so a hit n
+/// spectra old counts decay^n of a new one once divided by the current weight. \b total is the sum
+/// of the weights of all spectra, in the same scale, so a cell over it is the share of spectra that
+/// hit it. When the weight passes WSA_PERSISTENCE_RESCALE the cells and total are divided by it and
+/// it starts again from 1. With no decay the weight stays 1 and is never scaled back, so the cells
+/// are doubles: a float cell would stop counting at 2^24 hits, a few minutes of a steady signal,
+/// while the total went on growing.
+///
+/// Tile t holds rows [16 * (t / tiles_across), + 16) and columns [16 * (t % tiles_across), + 16),
+/// row by row, in 2 KiB.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <string.h>
+
+#include "wsa_lib.h"
+#include "wsa_error.h"
+#include "wsa_alloc.h"
+#include "wsa_persistence.h"
+
+/// Columns and rows on a side of a tile.
+#define WSA_PERSISTENCE_TILE 16
+
+/// Cells in a tile.
+#define WSA_PERSISTENCE_TILE_CELLS (WSA_PERSISTENCE_TILE * WSA_PERSISTENCE_TILE)
+
+/// Weight past which the cells are scaled back.
+#define WSA_PERSISTENCE_RESCALE 1e18
+
+struct wsa_persistence {
+    uint32_t width;
+    uint32_t height;
+    float max_dbm;
+    float rows_per_db;
+    double growth;						///< 1 / decay
+    uint32_t tiles_across;
+    double *cells;
+    double weight;						///< Weight of a hit now
+    double total;						///< Weight of every spectrum pushed
+
+    uint32_t bins;						///< Spectrum length column_cell is for
+    uint32_t *column_cell;				///< Cell offset of each bin's column, in row 0
+    uint32_t *cell;						///< Cell hit by each bin of the spectrum being pushed
+};
+
+
+///
+/// Number of cells, including those of the tiles past the last row and column.
+///
+static size_t wsa_persistence_cells( struct wsa_persistence const *p )
+{
+    return (size_t)WSA_PERSISTENCE_TILE_CELLS * p->tiles_across *
+           ((p->height + WSA_PERSISTENCE_TILE - 1) / WSA_PERSISTENCE_TILE);
+}
+
+
+///
+/// Offset of the cell in column 0 of a row.
+///
+static uint32_t wsa_persistence_row_cell( struct wsa_persistence const *p, uint32_t row )
+{
+    return (row / WSA_PERSISTENCE_TILE) * p->tiles_across * WSA_PERSISTENCE_TILE_CELLS +
+           (row % WSA_PERSISTENCE_TILE) * WSA_PERSISTENCE_TILE;
+}
+
+
+///
+/// Offset of the cell in row 0 of a column.
+///
+static uint32_t wsa_persistence_column_cell( uint32_t column )
+{
+    return (column / WSA_PERSISTENCE_TILE) * WSA_PERSISTENCE_TILE_CELLS + column % WSA_PERSISTENCE_TILE;
+}
+
+
+///
+/// Map each bin of a spectrum of \b bins to its column's cells, once per spectrum length.
+///
+static int16_t wsa_persistence_map( struct wsa_persistence *p, uint32_t bins )
+{
+    uint32_t b;
+
+    if (bins == p->bins) {
+        return 0;
+    }
+
+    wsa_free(p->column_cell);
+    wsa_free(p->cell);
+    p->bins = 0;
+    p->column_cell = wsa_malloc_aligned(sizeof(uint32_t) * bins, WSA_ALLOC_ALIGN);
+    p->cell = wsa_malloc_aligned(sizeof(uint32_t) * bins, WSA_ALLOC_ALIGN);
+    if (p->column_cell == NULL || p->cell == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+
+    for (b = 0; b < bins; b++) {
+        p->column_cell[b] = wsa_persistence_column_cell((uint32_t)(((uint64_t)b * p->width) / bins));
+    }
+    p->bins = bins;
+
+    return 0;
+}
+
+
+///
+/// Create a persistence histogram, empty.
+///
+/// @param[in] config The size, amplitude range and decay.
+/// @param[out] persistence The new histogram, taking about 8 * width * height bytes.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_persistence_alloc( struct wsa_persistence_config const *config, struct wsa_persistence **persistence )
+{
+    struct wsa_persistence *p;
+
+    if (config == NULL || persistence == NULL || config->width < 1 || config->height < 1 ||
+        !(config->max_dbm > config->min_dbm) || !(config->decay > 0.0f && config->decay <= 1.0f)) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    p = wsa_malloc(sizeof(struct wsa_persistence));
+    if (p == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+    memset(p, 0, sizeof(struct wsa_persistence));
+    p->width = config->width;
+    p->height = config->height;
+    p->max_dbm = config->max_dbm;
+    p->rows_per_db = (float)config->height / (config->max_dbm - config->min_dbm);
+    p->growth = 1.0 / config->decay;
+
+    p->tiles_across = (config->width + WSA_PERSISTENCE_TILE - 1) / WSA_PERSISTENCE_TILE;
+    p->cells = wsa_malloc_aligned(sizeof(double) * wsa_persistence_cells(p), WSA_ALLOC_ALIGN);
+    if (p->cells == NULL) {
+        wsa_persistence_free(p);
+        return WSA_ERR_MALLOCFAILED;
+    }
+    wsa_persistence_reset(p);
+
+    *persistence = p;
+
+    return 0;
+}
+
+
+///
+/// Free a persistence histogram.
+///
+void wsa_persistence_free( struct wsa_persistence *persistence )
+{
+    if (persistence == NULL) {
+        return;
+    }
+
+    wsa_free(persistence->cells);
+    wsa_free(persistence->column_cell);
+    wsa_free(persistence->cell);
+    wsa_free(persistence);
+}
+
+
+///
+/// Clear every hit, as after wsa_persistence_alloc().
+///
+void wsa_persistence_reset( struct wsa_persistence *persistence )
+{
+    memset(persistence->cells, 0, sizeof(double) * wsa_persistence_cells(persistence));
+    persistence->weight = 1.0;
+    persistence->total = 0.0;
+}
+
+
+///
+/// Add the hits of one spectrum and fade the ones before it.
+///
+/// @param[in] persistence The histogram.
+/// @param[in] spectrum The spectrum, in dBm.
+/// @param[in] bins Number of values in the spectrum, best at least the width.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_persistence_push( struct wsa_persistence *persistence, float const *spectrum, uint32_t bins )
+{
+    struct wsa_persistence *p = persistence;
+    uint32_t const *column_cell;
+    uint32_t *cell;
+    uint32_t tile_row_cells;
+    uint32_t r;
+    double *cells;
+    double weight;
+    float top;
+    float rows_per_db;
+    float bottom;
+    float row;
+    size_t b;
+    size_t n;
+    int16_t result;
+
+    if (p == NULL || spectrum == NULL || bins == 0) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    result = wsa_persistence_map(p, bins);
+    if (result < 0) {
+        return result;
+    }
+
+    if (p->weight > WSA_PERSISTENCE_RESCALE) {
+        n = wsa_persistence_cells(p);
+        weight = 1.0 / p->weight;
+        for (b = 0; b < n; b++) {
+            p->cells[b] *= weight;
+        }
+        p->total /= p->weight;
+        p->weight = 1.0;
+    }
+
+    // Find every cell first, in a loop free of branches and stores to the histogram so it can be
+    // vectorised, and then add the hits. NaN and -inf land in the bottom row, +inf in the top.
+    // The row offset is wsa_persistence_row_cell() with everything it reads held in locals.
+    column_cell = p->column_cell;
+    cell = p->cell;
+    top = p->max_dbm;
+    rows_per_db = p->rows_per_db;
+    bottom = (float)(p->height - 1);
+    tile_row_cells = p->tiles_across * WSA_PERSISTENCE_TILE_CELLS;
+    for (b = 0; b < bins; b++) {
+        row = (top - spectrum[b]) * rows_per_db;
+        row = row < bottom ? row : bottom;
+        row = row > 0.0f ? row : 0.0f;
+        r = (uint32_t)row;
+        cell[b] = column_cell[b] + (r / WSA_PERSISTENCE_TILE) * tile_row_cells + (r % WSA_PERSISTENCE_TILE) * WSA_PERSISTENCE_TILE;
+    }
+
+    cells = p->cells;
+    weight = p->weight;
+    for (b = 0; b < bins; b++) {
+        cells[cell[b]] += weight;
+    }
+
+    p->total += p->weight;
+    p->weight *= p->growth;
+
+    return 0;
+}
+
+
+///
+/// Add the spectrum of the latest wsa_capture_power_spectrum(). Where only the display trace is
+/// kept, the trace is added instead.
+///
+/// @param[in] persistence The histogram.
+/// @param[in] cfg The power spectrum configuration the capture was made with.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_persistence_push_spectrum( struct wsa_persistence *persistence, struct wsa_power_spectrum_config const *cfg )
+{
+    if (cfg == NULL) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    if (cfg->buf) {
+        return wsa_persistence_push(persistence, cfg->buf, cfg->buflen);
+    }
+
+    return wsa_persistence_push(persistence, cfg->trace, cfg->tracelen);
+}
+
+
+///
+/// Add a real-time spectrum. This has the form of wsa_rtsa_config::spectrum, so a histogram may
+/// be fed by setting it as the engine's callback, with the histogram as its arg.
+///
+void wsa_persistence_rtsa_spectrum( void *persistence, struct wsa_rtsa_spectrum const *spectrum, float const *power )
+{
+    wsa_persistence_push(persistence, power, (uint32_t)spectrum->bins);
+}
+
+
+///
+/// Get the histogram as an image.
+///
+/// Each value is the share of spectra that hit the cell, the latest counting most: 1 for a cell
+/// hit by one bin of every spectrum, with no decay or a steady signal. Where there are more bins
+/// than columns, the bins of a column add up.
+///
+/// @param[in] persistence The histogram.
+/// @param[out] image Receives height rows of width values, row 0 at the top of the amplitude
+/// range.
+///
+/// @returns The largest value, to scale colours by, or 0 if nothing has been pushed.
+///
+float wsa_persistence_read( struct wsa_persistence *persistence, float *image )
+{
+    struct wsa_persistence *p = persistence;
+    double const *cells;
+    double scale;
+    float top;
+    uint32_t r;
+    uint32_t c;
+
+    if (p->total <= 0.0) {
+        memset(image, 0, sizeof(float) * p->width * p->height);
+        return 0.0f;
+    }
+
+    scale = 1.0 / p->total;
+    top = 0.0f;
+    for (r = 0; r < p->height; r++) {
+        cells = p->cells + wsa_persistence_row_cell(p, r);
+        for (c = 0; c < p->width; c++) {
+            image[c] = (float)(cells[wsa_persistence_column_cell(c)] * scale);
+            if (image[c] > top) {
+                top = image[c];
+            }
+        }
+        image += p->width;
+    }
+
+    return top;
+}
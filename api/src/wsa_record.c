@@ -0,0 +1,388 @@
+///
+/// @file
+/// Recording the raw VRT stream to a file, with a packet index. See wsa_record.h.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_client.h"
+#include "wsa_error.h"
+#include "wsa_debug.h"
+#include "wsa_alloc.h"
+#include "wsa_atomic.h"
+#include "wsa_clock.h"
+#include "wsa_record.h"
+#include "wsa_transport.h"
+
+#ifdef _WIN32
+#define fileno _fileno
+#endif
+
+/// Bytes of each packet read into user space: the header word, stream id and timestamps.
+#define WSA_RECORD_HEADER_BYTES (VRT_HEADER_SIZE * BYTES_PER_VRT_WORD)
+
+/// Alignment of the copy buffer, a page, so its writes need no bounce buffer for direct I/O.
+#define WSA_RECORD_BUFFER_ALIGN 4096
+
+struct wsa_recorder {
+    struct wsa_device *dev;
+    FILE *data;						///< The recording, unbuffered
+    FILE *index;
+    struct wsa_splice splice;		///< Packets not yet written, if zero_copy
+    uint8_t zero_copy;
+    uint8_t *buf;					///< Packets not yet written, if not zero_copy
+    uint32_t fill;					///< Bytes in buf
+    uint64_t offset;				///< Bytes in the recording, including those in buf
+    uint64_t volatile packets;		///< Totals, readable from other threads
+    uint64_t volatile bytes;
+    uint32_t volatile stop;
+};
+
+
+///
+/// Read a big-endian 32-bit word.
+///
+static uint32_t wsa_record_word( uint8_t const *p )
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+
+///
+/// Write out the packets not yet in the recording, and the index so far.
+///
+static int16_t wsa_record_flush( struct wsa_recorder *rec )
+{
+    if (rec->zero_copy) {
+        if (wsa_sock_splice_flush(&rec->splice) < 0) {
+            return WSA_ERR_FILEWRITEFAILED;
+        }
+    } else if (rec->fill > 0) {
+        if (fwrite(rec->buf, 1, rec->fill, rec->data) != rec->fill) {
+            return WSA_ERR_FILEWRITEFAILED;
+        }
+        rec->fill = 0;
+    }
+
+    if (fflush(rec->index) != 0) {
+        return WSA_ERR_FILEWRITEFAILED;
+    }
+
+    return 0;
+}
+
+
+///
+/// Drop a packet that was only partly spliced, so the recording ends on a packet boundary.
+///
+static void wsa_record_truncate( struct wsa_recorder *rec )
+{
+    wsa_sock_splice_flush(&rec->splice);
+#ifndef _WIN32
+    if (ftruncate(fileno(rec->data), (off_t)rec->offset) == 0) {
+        fseek(rec->data, 0, SEEK_END);
+    }
+#endif
+}
+
+
+///
+/// Throw away the rest of a packet cut short by a timeout or with a size too small to be true,
+/// and whatever is queued behind it, so the next read starts on a packet boundary. What is thrown
+/// away is not recorded.
+///
+static void wsa_record_resync( struct wsa_device *dev )
+{
+    doutf(DMED, "In wsa_record_packet: lost the packet boundary, flushing the data channel\n");
+    wsa_clean_data_socket(dev);
+}
+
+
+///
+/// Record one packet.
+///
+static int16_t wsa_record_packet( struct wsa_recorder *rec, uint32_t timeout )
+{
+    struct wsa_device *dev = rec->dev;
+    struct wsa_record_index_entry entry;
+    uint8_t header[WSA_RECORD_HEADER_BYTES];
+    uint8_t *dest = header;
+    uint64_t deadline_ns;
+    uint64_t probe_ns;
+    uint32_t packet_bytes;
+    uint32_t packet_size;
+    int32_t bytes_received = 0;
+    int16_t result;
+
+    deadline_ns = wsa_clock_ns() + (uint64_t)timeout * 1000000ULL;
+    probe_ns = deadline_ns - (uint64_t)timeout * 500000ULL;
+
+    // Every packet the device sends has at least the five header words. In copy mode they go
+    // straight into the buffer, which always has room for the largest packet.
+    if (!rec->zero_copy) {
+        if (rec->fill + 65536 * BYTES_PER_VRT_WORD > WSA_RECORD_BUFFER_SIZE) {
+            result = wsa_record_flush(rec);
+            if (result < 0) {
+                return result;
+            }
+        }
+        dest = rec->buf + rec->fill;
+    }
+
+    result = _wsa_recv_data_checked(dev, dest, WSA_RECORD_HEADER_BYTES, probe_ns, deadline_ns, &bytes_received);
+    if (result < 0) {
+        if (bytes_received > 0) {
+            wsa_record_resync(dev);
+        }
+        return result;
+    }
+
+    packet_size = ((uint32_t)dest[2] << 8) | (uint32_t)dest[3];
+    if (packet_size < VRT_HEADER_SIZE) {
+        doutf(DHIGH, "In wsa_record_packet: packet of %u words is too short\n", packet_size);
+        // the size is wrong, so the next packet cannot be found from it
+        wsa_record_resync(dev);
+        return WSA_ERR_VRTPACKETSIZE;
+    }
+    packet_bytes = packet_size * BYTES_PER_VRT_WORD;
+
+    entry.offset = rec->offset;
+    entry.stream_id = wsa_record_word(dest + 4);
+    entry.sec = wsa_record_word(dest + 8);
+    entry.psec = (dest[1] & 0x30) ? ((uint64_t)wsa_record_word(dest + 12) << 32) | wsa_record_word(dest + 16) : 0;
+
+    if (rec->zero_copy) {
+        result = wsa_sock_splice_put(&rec->splice, header, WSA_RECORD_HEADER_BYTES);
+        if (result >= 0) {
+            result = wsa_sock_splice(&rec->splice, dev->sock.data, (int32_t)(packet_bytes - WSA_RECORD_HEADER_BYTES),
+                                     deadline_ns, &dev->stats);
+        }
+        if (result < 0) {
+            wsa_record_truncate(rec);
+            wsa_record_resync(dev);
+            return result;
+        }
+    } else {
+        // the rest follows the header, so it is not worth a probe
+        result = _wsa_recv_data_checked(dev, dest + WSA_RECORD_HEADER_BYTES,
+                                        (int32_t)(packet_bytes - WSA_RECORD_HEADER_BYTES), deadline_ns,
+                                        deadline_ns, &bytes_received);
+        if (result < 0) {
+            wsa_record_resync(dev);
+            return result;
+        }
+    }
+
+    // A packet only goes into the recording once its index entry is written, so each has one.
+    if (fwrite(&entry, sizeof(entry), 1, rec->index) != 1) {
+        if (rec->zero_copy) {
+            wsa_record_truncate(rec);
+        }
+        return WSA_ERR_FILEWRITEFAILED;
+    }
+    if (!rec->zero_copy) {
+        rec->fill += packet_bytes;
+    }
+
+    rec->offset += packet_bytes;
+    wsa_atomic_add_u64(&rec->packets, 1);
+    wsa_atomic_add_u64(&rec->bytes, packet_bytes);
+    wsa_stats_count(&dev->stats, WSA_STAT_PACKETS, 1);
+    wsa_stats_count(&dev->stats, WSA_STAT_BYTES, packet_bytes);
+
+    return 0;
+}
+
+
+///
+/// Create a recording, and its index, from a device's data channel.
+///
+/// Start the device streaming or sweeping, then call wsa_recorder_run() to record. Nothing else
+/// may read the device's data channel while the recorder is in use. Any transport can be recorded
+/// from, a replay included, but only TCP can be spliced.
+///
+/// @param[in] dev The device, which must stay open until the recorder is freed.
+/// @param[in] path The file to record to, which is replaced if it exists.
+/// @param[in] flags Options, WSA_RECORD_SPLICE or 0.
+/// @param[out] recorder The new recorder.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_recorder_alloc( struct wsa_device *dev, char const *path, uint32_t flags, struct wsa_recorder **recorder )
+{
+    struct wsa_recorder *rec;
+    char index_path[1024];
+
+    if (dev == NULL || path == NULL || recorder == NULL) {
+        return WSA_ERR_INVINPUT;
+    }
+    if (dev->transport == NULL) {
+        return WSA_ERR_WSANOTRDY;
+    }
+    if (strlen(path) + strlen(WSA_RECORD_INDEX_SUFFIX) >= sizeof(index_path)) {
+        return WSA_ERR_INVINPUT;
+    }
+    sprintf(index_path, "%s%s", path, WSA_RECORD_INDEX_SUFFIX);
+
+    rec = wsa_malloc(sizeof(struct wsa_recorder));
+    if (rec == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+    memset(rec, 0, sizeof(struct wsa_recorder));
+    rec->dev = dev;
+    rec->splice.pipe_fds[0] = -1;
+    rec->splice.pipe_fds[1] = -1;
+
+    rec->data = fopen(path, "wb");
+    if (rec->data == NULL) {
+        wsa_free(rec);
+        return WSA_ERR_FILECREATEFAILED;
+    }
+    // writes are already large, or spliced behind stdio's back
+    setvbuf(rec->data, NULL, _IONBF, 0);
+
+    rec->index = fopen(index_path, "wb");
+    if (rec->index == NULL) {
+        fclose(rec->data);
+        wsa_free(rec);
+        return WSA_ERR_FILECREATEFAILED;
+    }
+    if (fwrite(WSA_RECORD_INDEX_MAGIC, 1, WSA_RECORD_INDEX_MAGIC_LEN, rec->index) != WSA_RECORD_INDEX_MAGIC_LEN) {
+        wsa_recorder_free(rec);
+        return WSA_ERR_FILEWRITEFAILED;
+    }
+
+    // splicing needs the socket underneath
+    if ((flags & WSA_RECORD_SPLICE) && dev->transport == &wsa_tcp_transport &&
+        wsa_sock_splice_open(&rec->splice, fileno(rec->data)) == 0) {
+        rec->zero_copy = 1;
+    } else {
+        rec->buf = wsa_malloc_aligned(WSA_RECORD_BUFFER_SIZE, WSA_RECORD_BUFFER_ALIGN);
+        if (rec->buf == NULL) {
+            wsa_recorder_free(rec);
+            return WSA_ERR_MALLOCFAILED;
+        }
+    }
+
+    doutf(DMED, "Recording to %s, %s\n", path, rec->zero_copy ? "spliced" : "copied");
+
+    *recorder = rec;
+
+    return 0;
+}
+
+
+///
+/// Record packets until a number have been recorded, wsa_recorder_stop() is called, or an error.
+///
+/// Everything recorded is written out before this returns, so it may be called again to carry
+/// on, e.g. after a timeout while the device was idle. If the timeout cuts a packet short, the
+/// part received is left out of the recording, and the data channel is flushed with
+/// wsa_clean_data_socket() so that a later call starts on a packet boundary; the packets flushed
+/// are lost.
+///
+/// @param[in] recorder The recorder.
+/// @param[in] max_packets How many packets to record, or 0 for no limit.
+/// @param[in] timeout How long to wait for each packet, in milliseconds. As with
+///                    wsa_read_vrt_packet_raw(), the device is sent a status query if nothing has
+///                    arrived halfway through. A stop request is seen within this time.
+///
+/// @returns 0 on success or when stopped, otherwise a negative error code:
+///          WSA_ERR_SOCKETNODATA if no packet came in time, WSA_ERR_DEVICE_NO_RESPONSE if the
+///          device did not answer either.
+///
+int16_t wsa_recorder_run( struct wsa_recorder *recorder, uint64_t max_packets, uint32_t timeout )
+{
+    uint64_t count = 0;
+    int16_t result = 0;
+    int16_t flush_result;
+
+    while ((max_packets == 0 || count < max_packets) && !wsa_atomic_load_u32(&recorder->stop)) {
+        result = wsa_record_packet(recorder, timeout);
+        if (result < 0) {
+            break;
+        }
+        count++;
+    }
+
+    flush_result = wsa_record_flush(recorder);
+
+    return result < 0 ? result : flush_result;
+}
+
+
+///
+/// Ask wsa_recorder_run() to return after the packet it is recording. May be called from any
+/// thread, or a signal handler.
+///
+void wsa_recorder_stop( struct wsa_recorder *recorder )
+{
+    wsa_atomic_store_u32(&recorder->stop, 1);
+}
+
+
+///
+/// Get how much has been recorded. May be called from any thread while recording.
+///
+/// @param[in] recorder The recorder.
+/// @param[out] packets The number of packets recorded, or NULL.
+/// @param[out] bytes The number of bytes recorded, or NULL.
+///
+void wsa_recorder_totals( struct wsa_recorder *recorder, uint64_t *packets, uint64_t *bytes )
+{
+    if (packets) {
+        *packets = wsa_atomic_load_u64(&recorder->packets);
+    }
+    if (bytes) {
+        *bytes = wsa_atomic_load_u64(&recorder->bytes);
+    }
+}
+
+
+///
+/// Check whether the recorder splices the data rather than copying it.
+///
+uint8_t wsa_recorder_zero_copy( struct wsa_recorder const *recorder )
+{
+    return recorder->zero_copy;
+}
+
+
+///
+/// Finish a recording and free the recorder.
+///
+/// @returns 0 on success, or WSA_ERR_FILEWRITEFAILED if the files could not be completed.
+///
+int16_t wsa_recorder_free( struct wsa_recorder *recorder )
+{
+    int16_t result = 0;
+
+    if (recorder == NULL) {
+        return 0;
+    }
+
+    if (recorder->buf || recorder->zero_copy) {
+        result = wsa_record_flush(recorder);
+    }
+    wsa_sock_splice_close(&recorder->splice);
+
+    if (fclose(recorder->data) != 0) {
+        result = WSA_ERR_FILEWRITEFAILED;
+    }
+    if (fclose(recorder->index) != 0) {
+        result = WSA_ERR_FILEWRITEFAILED;
+    }
+
+    wsa_free(recorder->buf);
+    wsa_free(recorder);
+
+    return result;
+}
@@ -0,0 +1,698 @@
+///
+/// @file
+/// Serving a VRT recording from a memory-mapped file as a device. See wsa_replay.h.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "wsa_lib.h"
+#include "wsa_client.h"
+#include "wsa_error.h"
+#include "wsa_debug.h"
+#include "wsa_alloc.h"
+#include "wsa_clock.h"
+#include "wsa_replay.h"
+#include "wsa_transport.h"
+
+#define WSA_REPLAY_MAX_SETTINGS 64		///< Distinct settings remembered
+#define WSA_REPLAY_KEY_LEN 32
+#define WSA_REPLAY_VALUE_LEN 128
+
+/// What the replay is letting through.
+enum wsa_replay_capture {
+    WSA_REPLAY_CAPTURE_NONE,
+    WSA_REPLAY_CAPTURE_BLOCK,
+    WSA_REPLAY_CAPTURE_STREAM,
+    WSA_REPLAY_CAPTURE_SWEEP
+};
+
+/// A setting, stored as it was sent.
+struct wsa_replay_setting {
+    char key[WSA_REPLAY_KEY_LEN];		///< Canonical header, see wsa_replay_canonical_header()
+    char value[WSA_REPLAY_VALUE_LEN];
+};
+
+struct wsa_replay {
+    uint8_t const *base;				///< The mapped recording
+    size_t size;
+    size_t pos;							///< Offset of the next packet
+    uint32_t flags;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+
+    enum wsa_replay_capture capture;
+    uint32_t block_left;				///< Data packets left in a block capture
+
+    uint8_t anchored;					///< Pacing: a packet time and the clock reading it matches
+    uint32_t anchor_sec;
+    uint64_t anchor_psec;
+    uint64_t anchor_ns;
+
+    uint32_t sweep_entries;
+    uint32_t setting_count;
+    struct wsa_replay_setting settings[WSA_REPLAY_MAX_SETTINGS];
+
+    uint8_t bad_command;				///< A command could not be parsed; told by the next SYST:ERR?
+    char reply[MAX_STR_LEN];			///< The answer to the last query, ended by a newline
+    int32_t reply_len;
+    int32_t reply_read;
+
+    uint8_t const *pending;				///< A packet taken from the recording but not all read
+    uint32_t pending_bytes;
+    uint32_t pending_read;
+};
+
+
+///
+/// Read a big-endian 32-bit word.
+///
+static uint32_t wsa_replay_word( uint8_t const *p )
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+
+static void wsa_replay_sleep_ns( uint64_t ns )
+{
+#ifdef _WIN32
+    Sleep((DWORD)((ns + 999999) / 1000000));
+#else
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(ns / 1000000000ULL);
+    ts.tv_nsec = (long)(ns % 1000000000ULL);
+    nanosleep(&ts, NULL);
+#endif
+}
+
+
+///
+/// Reduce a SCPI header to a canonical form, as wsasim does: each node upper cased and cut to its
+/// short form, so "SWEEP:LIST:START" and ":SWE:LIST:STAR" compare equal.
+///
+static void wsa_replay_canonical_header( char const *in, size_t len, char *out, size_t out_size )
+{
+    size_t i = 0;
+    size_t o = 0;
+    size_t node_start;
+    size_t node_len;
+    size_t keep;
+
+    if (len > 0 && in[0] == ':') {
+        i++;
+    }
+
+    while (i < len && o + 1 < out_size) {
+        node_start = i;
+        while (i < len && in[i] != ':') {
+            i++;
+        }
+        node_len = i - node_start;
+
+        // the short form is four characters, or three if the fourth is a vowel
+        keep = node_len;
+        if (node_len > 4) {
+            keep = strchr("AEIOU", toupper((unsigned char)in[node_start + 3])) ? 3 : 4;
+        }
+        while (keep-- > 0 && o + 1 < out_size) {
+            out[o++] = (char)toupper((unsigned char)in[node_start++]);
+        }
+
+        if (i < len && o + 1 < out_size) {
+            out[o++] = ':';
+            i++;
+        }
+    }
+    out[o] = '\0';
+}
+
+
+///
+/// Copy a string into a fixed-size field, cutting it short if it does not fit.
+///
+static void wsa_replay_copy( char *dst, size_t size, char const *src )
+{
+    size_t len = strlen(src);
+
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+
+static struct wsa_replay_setting *wsa_replay_find( struct wsa_replay *replay, char const *key )
+{
+    uint32_t i;
+
+    for (i = 0; i < replay->setting_count; i++) {
+        if (strcmp(replay->settings[i].key, key) == 0) {
+            return &replay->settings[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+static void wsa_replay_store( struct wsa_replay *replay, char const *key, char const *value )
+{
+    struct wsa_replay_setting *setting = wsa_replay_find(replay, key);
+
+    if (setting == NULL) {
+        if (replay->setting_count == WSA_REPLAY_MAX_SETTINGS) {
+            doutf(DMED, "Replay: no room to remember %s\n", key);
+            return;
+        }
+        setting = &replay->settings[replay->setting_count++];
+        wsa_replay_copy(setting->key, sizeof(setting->key), key);
+    }
+
+    wsa_replay_copy(setting->value, sizeof(setting->value), value);
+}
+
+
+///
+/// Let packets through, from the extension packet carrying the start id if one is given.
+///
+/// @param[in] args Arguments of the start command, possibly a start id.
+/// @param[in] mask Indicator bit of the id in the extension packet.
+///
+static void wsa_replay_start( struct wsa_replay *replay, enum wsa_replay_capture capture, char const *args,
+                              uint32_t mask )
+{
+    char *end;
+    unsigned long id;
+    size_t pos;
+    uint32_t words;
+    uint32_t indicator;
+    uint8_t const *p;
+
+    replay->capture = capture;
+    replay->anchored = 0;
+
+    id = strtoul(args, &end, 10);
+    if (end == args) {
+        return;
+    }
+
+    for (pos = replay->pos; pos + VRT_HEADER_SIZE * BYTES_PER_VRT_WORD <= replay->size;
+         pos += (size_t)words * BYTES_PER_VRT_WORD) {
+        p = replay->base + pos;
+        words = ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+        if (words < VRT_HEADER_SIZE || pos + (size_t)words * BYTES_PER_VRT_WORD > replay->size) {
+            break;
+        }
+        if (wsa_replay_word(p + 4) != EXTENSION_STREAM_ID || words < VRT_HEADER_SIZE + 2) {
+            continue;
+        }
+
+        // the sweep start id comes first when both are present
+        indicator = wsa_replay_word(p + VRT_HEADER_SIZE * BYTES_PER_VRT_WORD);
+        p += (VRT_HEADER_SIZE + 1) * BYTES_PER_VRT_WORD;
+        if (mask == STREAM_START_ID_INDICATOR_MASK && (indicator & SWEEP_START_ID_INDICATOR_MASK)) {
+            p += BYTES_PER_VRT_WORD;
+        }
+        if ((indicator & mask) && (size_t)(p - replay->base) + BYTES_PER_VRT_WORD <= pos +
+            (size_t)words * BYTES_PER_VRT_WORD && wsa_replay_word(p) == (uint32_t)id) {
+            replay->pos = pos;
+            return;
+        }
+    }
+
+    doutf(DMED, "Replay: start id %lu is not in the recording, carrying on from offset %lu\n", id,
+          (unsigned long)replay->pos);
+}
+
+
+///
+/// Open a recording to replay.
+///
+/// @param[in] path The recording.
+/// @param[in] flags WSA_REPLAY_REALTIME, WSA_REPLAY_LOOP, or 0.
+/// @param[out] replay The new replay.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_replay_open( char const *path, uint32_t flags, struct wsa_replay **replay )
+{
+    struct wsa_replay *r;
+#ifdef _WIN32
+    LARGE_INTEGER size;
+#else
+    struct stat st;
+    void *base;
+    int fd;
+#endif
+
+    r = wsa_malloc(sizeof(struct wsa_replay));
+    if (r == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+    memset(r, 0, sizeof(struct wsa_replay));
+    r->flags = flags;
+
+#ifdef _WIN32
+    r->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                          FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (r->file == INVALID_HANDLE_VALUE) {
+        wsa_free(r);
+        return WSA_ERR_FILEOPENFAILED;
+    }
+    if (!GetFileSizeEx(r->file, &size)) {
+        CloseHandle(r->file);
+        wsa_free(r);
+        return WSA_ERR_FILEREADFAILED;
+    }
+    r->size = (size_t)size.QuadPart;
+    if (r->size > 0) {
+        r->mapping = CreateFileMappingA(r->file, NULL, PAGE_READONLY, 0, 0, NULL);
+        r->base = r->mapping ? MapViewOfFile(r->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+        if (r->base == NULL) {
+            if (r->mapping) {
+                CloseHandle(r->mapping);
+            }
+            CloseHandle(r->file);
+            wsa_free(r);
+            return WSA_ERR_FILEREADFAILED;
+        }
+    }
+#else
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        wsa_free(r);
+        return WSA_ERR_FILEOPENFAILED;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        wsa_free(r);
+        return WSA_ERR_FILEREADFAILED;
+    }
+    r->size = (size_t)st.st_size;
+    if (r->size > 0) {
+        base = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+            close(fd);
+            wsa_free(r);
+            return WSA_ERR_FILEREADFAILED;
+        }
+        // read front to back; let the kernel read ahead
+        madvise(base, r->size, MADV_SEQUENTIAL);
+        r->base = base;
+    }
+    // the mapping holds its own reference to the file
+    close(fd);
+#endif
+
+    doutf(DMED, "Replaying %s, %lu bytes%s%s\n", path, (unsigned long)r->size,
+          (flags & WSA_REPLAY_REALTIME) ? ", in real time" : "", (flags & WSA_REPLAY_LOOP) ? ", looped" : "");
+
+    *replay = r;
+
+    return 0;
+}
+
+
+///
+/// Unmap the recording and free the replay.
+///
+void wsa_replay_close( struct wsa_replay *replay )
+{
+    if (replay == NULL) {
+        return;
+    }
+
+#ifdef _WIN32
+    if (replay->base) {
+        UnmapViewOfFile(replay->base);
+        CloseHandle(replay->mapping);
+    }
+    CloseHandle(replay->file);
+#else
+    if (replay->base) {
+        munmap((void *)replay->base, replay->size);
+    }
+#endif
+
+    wsa_free(replay);
+}
+
+
+///
+/// Carry out a SCPI command or answer a query.
+///
+/// @param[in] replay The replay.
+/// @param[in] command One command, e.g. "FREQ:CENT 2400 MHz\n" or "FREQ:CENT?\n".
+/// @param[out] reply Buffer for the answer to a query, ended by a newline.
+/// @param[in] reply_size Size of the reply buffer.
+///
+/// @returns The length of the reply, 0 for a command, or WSA_ERR_CMDINVALID if it cannot be parsed.
+///
+static int16_t wsa_replay_command( struct wsa_replay *replay, char const *command, char *reply, int32_t reply_size )
+{
+    struct wsa_replay_setting *setting;
+    char key[WSA_REPLAY_KEY_LEN];
+    char value[WSA_REPLAY_VALUE_LEN];
+    char const *answer = NULL;
+    char number[16];
+    size_t hlen;
+    size_t vlen;
+    uint8_t query;
+
+    while (*command == ' ') {
+        command++;
+    }
+    hlen = strcspn(command, " \r\n");
+    if (hlen == 0) {
+        return WSA_ERR_CMDINVALID;
+    }
+    query = (command[hlen - 1] == '?');
+    wsa_replay_canonical_header(command, query ? hlen - 1 : hlen, key, sizeof(key));
+
+    command += hlen;
+    while (*command == ' ') {
+        command++;
+    }
+    vlen = strcspn(command, "\r\n");
+    while (vlen > 0 && command[vlen - 1] == ' ') {
+        vlen--;
+    }
+    if (vlen >= sizeof(value)) {
+        vlen = sizeof(value) - 1;
+    }
+    memcpy(value, command, vlen);
+    value[vlen] = '\0';
+
+    // Captures: these go through whether sent as commands or queries.
+    if (strcmp(key, "TRAC:BLOC:DATA") == 0) {
+        setting = wsa_replay_find(replay, "TRAC:BLOC:PACK");
+        replay->block_left = setting ? (uint32_t)strtoul(setting->value, NULL, 10) : 1;
+        if (replay->block_left == 0) {
+            replay->block_left = 1;
+        }
+        wsa_replay_start(replay, WSA_REPLAY_CAPTURE_BLOCK, "", 0);
+        return 0;
+    } else if (strcmp(key, "TRAC:STR:STAR") == 0) {
+        wsa_replay_start(replay, WSA_REPLAY_CAPTURE_STREAM, value, STREAM_START_ID_INDICATOR_MASK);
+        return 0;
+    } else if (strcmp(key, "SWE:LIST:STAR") == 0) {
+        wsa_replay_start(replay, WSA_REPLAY_CAPTURE_SWEEP, value, SWEEP_START_ID_INDICATOR_MASK);
+        return 0;
+    } else if (strcmp(key, "TRAC:STR:STOP") == 0 || strcmp(key, "SWE:LIST:STOP") == 0 ||
+               strcmp(key, "SYST:ABOR") == 0) {
+        replay->capture = WSA_REPLAY_CAPTURE_NONE;
+        return 0;
+    }
+
+    if (!query) {
+        if (strcmp(key, "*RST") == 0) {
+            replay->capture = WSA_REPLAY_CAPTURE_NONE;
+            replay->setting_count = 0;
+            replay->sweep_entries = 0;
+        } else if (strcmp(key, "SWE:ENTR:SAVE") == 0) {
+            replay->sweep_entries++;
+        } else if (strcmp(key, "SWE:ENTR:DEL") == 0) {
+            replay->sweep_entries = (replay->sweep_entries > 0 && strcmp(value, "ALL") != 0) ?
+                                    replay->sweep_entries - 1 : 0;
+        } else if (strcmp(key, "*CLS") != 0 && strcmp(key, "SYST:FLUS") != 0 && strcmp(key, "SWE:ENTR:NEW") != 0) {
+            wsa_replay_store(replay, key, value);
+        }
+        return 0;
+    }
+
+    if (strcmp(key, "*IDN") == 0) {
+        answer = WSA_REPLAY_IDN;
+    } else if (strcmp(key, "*STB") == 0 || strcmp(key, "*ESR") == 0) {
+        answer = "0";
+    } else if (strcmp(key, "SYST:ERR") == 0) {
+        answer = replay->bad_command ? "-102,\"Syntax error\"" : "0,\"No error\"";
+        replay->bad_command = 0;
+    } else if (strcmp(key, "SYST:CAPT:MODE") == 0) {
+        answer = (replay->capture == WSA_REPLAY_CAPTURE_SWEEP) ? WSA_SWEEP_CAPTURE_MODE :
+                 ((replay->capture == WSA_REPLAY_CAPTURE_STREAM) ? WSA_STREAM_CAPTURE_MODE : WSA_BLOCK_CAPTURE_MODE);
+    } else if (strcmp(key, "SWE:LIST:STAT") == 0) {
+        answer = (replay->capture == WSA_REPLAY_CAPTURE_SWEEP) ? WSA_SWEEP_STATE_RUNNING : WSA_SWEEP_STATE_STOPPED;
+    } else if (strcmp(key, "SWE:ENTR:COUN") == 0) {
+        sprintf(number, "%lu", (unsigned long)replay->sweep_entries);
+        answer = number;
+    } else if (strcmp(key, "SYST:LOCK:REQ") == 0 || strcmp(key, "SYST:LOCK:HAVE") == 0 ||
+               strcmp(key, "LOCK:REF") == 0 || strcmp(key, "LOCK:RF") == 0) {
+        answer = "1";
+    } else {
+        setting = wsa_replay_find(replay, key);
+        answer = setting ? setting->value : "0";
+    }
+
+    strncpy(reply, answer, (size_t)reply_size - 2);
+    reply[reply_size - 2] = '\0';
+    strcat(reply, "\n");
+
+    return (int16_t)strlen(reply);
+}
+
+
+///
+/// Get the next packet of the capture in progress.
+///
+/// The packet is returned in place, in the mapping, and is valid until the replay is closed.
+///
+/// @param[in] replay The replay.
+/// @param[in] deadline_ns When to give up waiting for a packet to come due, on the
+///                        wsa_clock_ns() clock. Only real-time replays wait.
+/// @param[out] packet The packet, starting at its header word.
+/// @param[out] packet_bytes Its size.
+///
+/// @returns 0 on success, WSA_ERR_SOCKETNODATA if no capture is running, the recording has
+///          ended or the next packet is not due by the deadline, or WSA_ERR_VRTPACKETSIZE if the
+///          recording is damaged.
+///
+static int16_t wsa_replay_next( struct wsa_replay *replay, uint64_t deadline_ns, uint8_t const **packet,
+                                uint32_t *packet_bytes )
+{
+    uint8_t const *p;
+    uint32_t words;
+    uint32_t sec;
+    uint64_t psec;
+    int64_t offset_ns;
+    uint64_t due_ns;
+    uint64_t now;
+
+    if (replay->capture == WSA_REPLAY_CAPTURE_NONE) {
+        return WSA_ERR_SOCKETNODATA;
+    }
+
+    // A partial packet at the end, as when a recording was cut short, counts as the end.
+    if (replay->pos + VRT_HEADER_SIZE * BYTES_PER_VRT_WORD > replay->size ||
+        replay->pos + (size_t)(((uint32_t)replay->base[replay->pos + 2] << 8) | replay->base[replay->pos + 3]) *
+        BYTES_PER_VRT_WORD > replay->size) {
+        if (!(replay->flags & WSA_REPLAY_LOOP) || replay->pos == 0) {
+            return WSA_ERR_SOCKETNODATA;
+        }
+        replay->pos = 0;
+        replay->anchored = 0;
+        return wsa_replay_next(replay, deadline_ns, packet, packet_bytes);
+    }
+
+    p = replay->base + replay->pos;
+    words = ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+    if (words < VRT_HEADER_SIZE + VRT_TRAILER_SIZE) {
+        doutf(DHIGH, "Replay: packet of %u words at offset %lu is too short\n", words, (unsigned long)replay->pos);
+        return WSA_ERR_VRTPACKETSIZE;
+    }
+
+    if (replay->flags & WSA_REPLAY_REALTIME) {
+        sec = wsa_replay_word(p + 8);
+        psec = (p[1] & 0x30) ? ((uint64_t)wsa_replay_word(p + 12) << 32) | wsa_replay_word(p + 16) : 0;
+        offset_ns = ((int64_t)sec - (int64_t)replay->anchor_sec) * 1000000000LL +
+                    ((int64_t)psec - (int64_t)replay->anchor_psec) / 1000;
+        now = wsa_clock_ns();
+
+        // time starts with the capture, and again if the recording jumps back
+        if (!replay->anchored || offset_ns < 0) {
+            replay->anchored = 1;
+            replay->anchor_sec = sec;
+            replay->anchor_psec = psec;
+            replay->anchor_ns = now;
+            offset_ns = 0;
+        }
+
+        due_ns = replay->anchor_ns + (uint64_t)offset_ns;
+        if (due_ns > now) {
+            if (due_ns > deadline_ns) {
+                if (deadline_ns > now) {
+                    wsa_replay_sleep_ns(deadline_ns - now);
+                }
+                return WSA_ERR_SOCKETNODATA;
+            }
+            wsa_replay_sleep_ns(due_ns - now);
+        }
+    }
+
+    *packet = p;
+    *packet_bytes = words * BYTES_PER_VRT_WORD;
+    replay->pos += *packet_bytes;
+
+    if (replay->capture == WSA_REPLAY_CAPTURE_BLOCK && (p[0] >> 4) == IF_PACKET_TYPE && --replay->block_left == 0) {
+        replay->capture = WSA_REPLAY_CAPTURE_NONE;
+    }
+
+    return 0;
+}
+
+
+///
+/// Carry out the command, keeping the answer to a query to be read back.
+///
+static int32_t wsa_replay_send( void *ctx, char const *buf, int32_t len )
+{
+    struct wsa_replay *replay = ctx;
+    int16_t result;
+
+    result = wsa_replay_command(replay, buf, replay->reply, sizeof(replay->reply));
+    if (result < 0) {
+        replay->bad_command = 1;
+        result = 0;
+    }
+    // an answer not read is replaced by the next
+    if (result > 0) {
+        replay->reply_len = result;
+        replay->reply_read = 0;
+    }
+
+    return len;
+}
+
+
+static int16_t wsa_replay_recv( void *ctx, enum wsa_channel channel, uint8_t *buf, int32_t size, int32_t *received,
+                                struct wsa_stats *stats )
+{
+    struct wsa_replay *replay = ctx;
+    int16_t result;
+    int32_t n;
+
+    *received = 0;
+    if (stats) {
+        wsa_stats_count(stats, WSA_STAT_RECV_CALLS, 1);
+    }
+
+    if (channel == WSA_CHANNEL_CMD) {
+        n = replay->reply_len - replay->reply_read;
+        if (n > size) {
+            n = size;
+        }
+        memcpy(buf, replay->reply + replay->reply_read, (size_t)n);
+        replay->reply_read += n;
+        *received = n;
+        return 0;
+    }
+
+    if (replay->pending == NULL) {
+        result = wsa_replay_next(replay, 0, &replay->pending, &replay->pending_bytes);
+        if (result == WSA_ERR_SOCKETNODATA) {
+            return 0;
+        } else if (result < 0) {
+            return result;
+        }
+        replay->pending_read = 0;
+    }
+
+    n = (int32_t)(replay->pending_bytes - replay->pending_read);
+    if (n > size) {
+        n = size;
+    }
+    memcpy(buf, replay->pending + replay->pending_read, (size_t)n);
+    replay->pending_read += (uint32_t)n;
+    if (replay->pending_read == replay->pending_bytes) {
+        replay->pending = NULL;
+    }
+    *received = n;
+
+    return 0;
+}
+
+
+///
+/// Answers are made as their queries are sent, and a packet is either due by the deadline or
+/// not, so neither channel is waited on beyond that.
+///
+static int16_t wsa_replay_poll( void *ctx, enum wsa_channel channel, uint64_t deadline_ns, struct wsa_stats *stats )
+{
+    struct wsa_replay *replay = ctx;
+    int16_t result = 0;
+
+    if (channel == WSA_CHANNEL_CMD) {
+        if (replay->reply_read == replay->reply_len) {
+            result = WSA_ERR_SOCKETNODATA;
+        }
+    } else if (replay->pending == NULL) {
+        result = wsa_replay_next(replay, deadline_ns, &replay->pending, &replay->pending_bytes);
+        replay->pending_read = 0;
+        if (result < 0) {
+            replay->pending = NULL;
+        }
+    }
+
+    if (result == WSA_ERR_SOCKETNODATA && stats) {
+        wsa_stats_count(stats, WSA_STAT_TIMEOUTS, 1);
+    }
+
+    return result;
+}
+
+
+///
+/// The next packet, in place in the mapping. A packet partly read through recv() is dropped.
+///
+static int16_t wsa_replay_next_packet( void *ctx, uint64_t deadline_ns, uint8_t const **packet,
+                                       uint32_t *packet_bytes )
+{
+    struct wsa_replay *replay = ctx;
+
+    if (replay->pending != NULL) {
+        if (replay->pending_read == 0) {
+            *packet = replay->pending;
+            *packet_bytes = replay->pending_bytes;
+            replay->pending = NULL;
+            return 0;
+        }
+        doutf(DMED, "Replay: dropping the %lu bytes left of a packet\n",
+              (unsigned long)(replay->pending_bytes - replay->pending_read));
+        replay->pending = NULL;
+    }
+
+    return wsa_replay_next(replay, deadline_ns, packet, packet_bytes);
+}
+
+
+static void wsa_replay_transport_close( void *ctx )
+{
+    wsa_replay_close(ctx);
+}
+
+
+/// A recording served as a device. The context is the struct wsa_replay from wsa_replay_open().
+struct wsa_transport_ops const wsa_replay_transport = {
+    WSA_REPLAY_INTF,
+    wsa_replay_send,
+    wsa_replay_recv,
+    wsa_replay_poll,
+    wsa_replay_next_packet,
+    wsa_replay_transport_close
+};
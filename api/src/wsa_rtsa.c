@@ -0,0 +1,731 @@
+///
+/// @file
+/// The real-time spectrum engine. See wsa_rtsa.h.
+///
+/// The thread running wsa_rtsa_run() reads and decodes the packets, appends their samples to a
+/// buffer, and copies out each window as soon as it is whole. The windows are queued to the
+/// workers as jobs numbered in order; job n lives in jobs[n % njobs], so a job is free again once
+/// the job njobs before it has been handed to the callback. The workers window and transform the
+/// samples and mark the job done; the reading thread hands the done jobs over in order.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <string.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "kiss_fft.h"
+#include "wsa_lib.h"
+#include "wsa_dsp.h"
+#include "wsa_error.h"
+#include "wsa_debug.h"
+#include "wsa_alloc.h"
+#include "wsa_atomic.h"
+#include "wsa_iqcorr.h"
+#include "wsa_rtsa.h"
+
+/// Largest packet payload read, in VRT words.
+#define WSA_RTSA_PACKET_WORDS 65535
+
+/// Most samples one packet decodes to: I16 data packs two samples in a word.
+#define WSA_RTSA_PACKET_SAMPLES (2 * WSA_RTSA_PACKET_WORDS)
+
+#define WSA_RTSA_PSEC_PER_SEC 1000000000000LL
+
+struct wsa_rtsa_job {
+    struct wsa_rtsa_spectrum info;
+    kiss_fft_cpx *in;				///< The window's samples, fft_size of them
+    float *power;					///< The spectrum
+    uint8_t done;					///< Guarded by the engine's lock
+};
+
+struct wsa_rtsa_worker {
+    struct wsa_rtsa *rtsa;
+    kiss_fft_cfg fft;
+    kiss_fft_cpx *out;
+#ifdef _WIN32
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+    uint8_t started;
+};
+
+struct wsa_rtsa {
+    struct wsa_device *dev;
+    struct wsa_rtsa_config config;
+    float *window;					///< Hanning coefficients
+    float power_offset;				///< dB added to each power value: the reference level, less the FFT's gain
+
+    // the packet being read, and its decoded samples
+    uint8_t *packet;
+    int16_t *i16;
+    int16_t *q16;
+    int32_t *i32;
+    kiss_fft_scalar *idata;
+    kiss_fft_scalar *qdata;
+    struct wsa_iqcorr *iqcorr;		///< DC offset and IQ imbalance corrector, if config.iq_correction
+
+    // Samples not yet behind every window: pend[0] is sample number pend_first. Samples are
+    // numbered from 0 in the order they are received.
+    kiss_fft_cpx *pend;
+    int32_t pend_len;
+    int32_t pend_size;
+    uint64_t pend_first;
+    uint64_t next_start;			///< First sample of the next window
+    uint64_t received;				///< Samples received, and so the number of the next
+    uint8_t gap;					///< WSA_GAP_* flags of a break not yet reported in a spectrum
+
+    // The latest packet's first sample and time, and the time between samples once it is known.
+    // Every sample since the last break is timed from these.
+    uint8_t timed;
+    uint32_t stream_id;
+    uint64_t anchor_sample;
+    int32_t anchor_samples;			///< Samples in the latest packet
+    struct wsa_time anchor_time;
+    uint64_t psec_per_sample;
+
+    // The jobs. submitted is written by the reading thread only, under the lock; taken and quit
+    // are guarded by the lock; delivered belongs to the reading thread.
+    struct wsa_rtsa_job *jobs;
+    uint32_t njobs;
+    uint64_t submitted;
+    uint64_t taken;
+    uint64_t delivered;
+    uint8_t quit;
+
+    struct wsa_rtsa_worker *workers;	///< config.workers of them, or one used inline if there are none
+    uint32_t nworkers;					///< Threads started
+#ifdef _WIN32
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE queued;		///< A job was submitted, or quit was set
+    CONDITION_VARIABLE finished;	///< A job is done
+#else
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    pthread_cond_t finished;
+#endif
+    uint8_t locks_made;
+
+    uint64_t volatile packets;		///< Totals, readable from other threads
+    uint64_t volatile samples;
+    uint64_t volatile spectra;
+    uint64_t volatile breaks;
+    uint64_t volatile dropped_samples;
+    uint32_t volatile stop;
+};
+
+
+static void wsa_rtsa_lock( struct wsa_rtsa *rtsa )
+{
+#ifdef _WIN32
+    EnterCriticalSection(&rtsa->lock);
+#else
+    pthread_mutex_lock(&rtsa->lock);
+#endif
+}
+
+
+static void wsa_rtsa_unlock( struct wsa_rtsa *rtsa )
+{
+#ifdef _WIN32
+    LeaveCriticalSection(&rtsa->lock);
+#else
+    pthread_mutex_unlock(&rtsa->lock);
+#endif
+}
+
+
+#ifdef _WIN32
+static void wsa_rtsa_wait( struct wsa_rtsa *rtsa, CONDITION_VARIABLE *cond )
+{
+    SleepConditionVariableCS(cond, &rtsa->lock, INFINITE);
+}
+#else
+static void wsa_rtsa_wait( struct wsa_rtsa *rtsa, pthread_cond_t *cond )
+{
+    pthread_cond_wait(cond, &rtsa->lock);
+}
+#endif
+
+
+///
+/// Window and transform a job's samples, and convert them to power as wsa_compute_fft() does:
+/// 0 Hz in the middle, or for I-only data just the upper, positive, half.
+///
+static void wsa_rtsa_compute( struct wsa_rtsa *rtsa, struct wsa_rtsa_worker *worker, struct wsa_rtsa_job *job )
+{
+    int32_t n = rtsa->config.fft_size;
+    int32_t bins = job->info.bins;
+    kiss_fft_cpx *in = job->in;
+    kiss_fft_scalar power;
+    int32_t b, k;
+
+    for (k = 0; k < n; k++) {
+        in[k].r *= rtsa->window[k];
+        in[k].i *= rtsa->window[k];
+    }
+
+    kiss_fft(worker->fft, in, worker->out);
+
+    for (b = 0; b < bins; b++) {
+        k = rtsa->config.spectral_inversion ? bins - 1 - b : b;
+        if (bins == n) {
+            k = (k + n / 2) % n;
+        }
+        // 20 log10(|X| / n), without the square root
+        power = worker->out[k].r * worker->out[k].r + worker->out[k].i * worker->out[k].i;
+        job->power[b] = 10 * log10f(power) + rtsa->power_offset;
+    }
+}
+
+
+#ifdef _WIN32
+static DWORD WINAPI wsa_rtsa_worker_main( LPVOID arg )
+#else
+static void *wsa_rtsa_worker_main( void *arg )
+#endif
+{
+    struct wsa_rtsa_worker *worker = arg;
+    struct wsa_rtsa *rtsa = worker->rtsa;
+    struct wsa_rtsa_job *job;
+
+    wsa_rtsa_lock(rtsa);
+    while (!rtsa->quit) {
+        if (rtsa->taken == rtsa->submitted) {
+            wsa_rtsa_wait(rtsa, &rtsa->queued);
+            continue;
+        }
+        job = &rtsa->jobs[rtsa->taken % rtsa->njobs];
+        rtsa->taken++;
+        wsa_rtsa_unlock(rtsa);
+
+        wsa_rtsa_compute(rtsa, worker, job);
+
+        wsa_rtsa_lock(rtsa);
+        job->done = 1;
+#ifdef _WIN32
+        WakeConditionVariable(&rtsa->finished);
+#else
+        pthread_cond_signal(&rtsa->finished);
+#endif
+    }
+    wsa_rtsa_unlock(rtsa);
+
+    return 0;
+}
+
+
+///
+/// Hand the done jobs to the callback in order, waiting for those before job \p until.
+///
+static void wsa_rtsa_deliver( struct wsa_rtsa *rtsa, uint64_t until )
+{
+    struct wsa_rtsa_job *job;
+    uint8_t done;
+
+    while (rtsa->delivered < rtsa->submitted) {
+        job = &rtsa->jobs[rtsa->delivered % rtsa->njobs];
+
+        wsa_rtsa_lock(rtsa);
+        while (!job->done && rtsa->delivered < until) {
+            wsa_rtsa_wait(rtsa, &rtsa->finished);
+        }
+        done = job->done;
+        wsa_rtsa_unlock(rtsa);
+        if (!done) {
+            return;
+        }
+
+        if (rtsa->config.spectrum) {
+            rtsa->config.spectrum(rtsa->config.arg, &job->info, job->power);
+        }
+        rtsa->delivered++;
+        wsa_atomic_add_u64(&rtsa->spectra, 1);
+    }
+}
+
+
+///
+/// Get the time of a sample since the last break, counting on from the latest packet.
+///
+static void wsa_rtsa_time_at( struct wsa_rtsa const *rtsa, uint64_t sample, struct wsa_time *time )
+{
+    int64_t psec;
+    int64_t sec;
+
+    psec = (int64_t)rtsa->anchor_time.psec + (int64_t)(sample - rtsa->anchor_sample) * (int64_t)rtsa->psec_per_sample;
+    sec = psec / WSA_RTSA_PSEC_PER_SEC;
+    psec %= WSA_RTSA_PSEC_PER_SEC;
+    if (psec < 0) {
+        psec += WSA_RTSA_PSEC_PER_SEC;
+        sec--;
+    }
+
+    time->sec = (uint32_t)((int64_t)rtsa->anchor_time.sec + sec);
+    time->psec = (uint64_t)psec;
+}
+
+
+///
+/// Queue every window that is whole, up to job number \p limit if it is not 0, then drop the
+/// samples no window still needs.
+///
+static void wsa_rtsa_cut( struct wsa_rtsa *rtsa, uint64_t limit )
+{
+    int32_t n = rtsa->config.fft_size;
+    struct wsa_rtsa_job *job;
+    int32_t offset;
+
+    while (limit == 0 || rtsa->submitted < limit) {
+        offset = (int32_t)(rtsa->next_start - rtsa->pend_first);
+        if (offset + n > rtsa->pend_len) {
+            break;
+        }
+        // until two packets have come, only a window starting at a packet has a time
+        if (rtsa->psec_per_sample == 0 && rtsa->next_start != rtsa->anchor_sample) {
+            break;
+        }
+
+        if (rtsa->submitted - rtsa->delivered == rtsa->njobs) {
+            wsa_rtsa_deliver(rtsa, rtsa->delivered + 1);
+        }
+        job = &rtsa->jobs[rtsa->submitted % rtsa->njobs];
+
+        memcpy(job->in, rtsa->pend + offset, sizeof(kiss_fft_cpx) * n);
+        job->info.number = rtsa->submitted;
+        job->info.first_sample = rtsa->next_start;
+        wsa_rtsa_time_at(rtsa, rtsa->next_start, &job->info.time_stamp);
+        job->info.stream_id = rtsa->stream_id;
+        job->info.bins = (rtsa->stream_id == I16Q16_DATA_STREAM_ID) ? n : n / 2;
+        job->info.gap = rtsa->gap;
+        rtsa->gap = 0;
+        rtsa->next_start += rtsa->config.hop;
+
+        if (rtsa->nworkers == 0) {
+            wsa_rtsa_compute(rtsa, &rtsa->workers[0], job);
+            job->done = 1;
+            rtsa->submitted++;
+            continue;
+        }
+
+        wsa_rtsa_lock(rtsa);
+        job->done = 0;
+        rtsa->submitted++;
+#ifdef _WIN32
+        WakeConditionVariable(&rtsa->queued);
+#else
+        pthread_cond_signal(&rtsa->queued);
+#endif
+        wsa_rtsa_unlock(rtsa);
+    }
+
+    offset = (int32_t)(rtsa->next_start - rtsa->pend_first);
+    if (offset > rtsa->pend_len) {
+        offset = rtsa->pend_len;
+    }
+    memmove(rtsa->pend, rtsa->pend + offset, sizeof(kiss_fft_cpx) * (rtsa->pend_len - offset));
+    rtsa->pend_len -= offset;
+    rtsa->pend_first += offset;
+}
+
+
+///
+/// Check that an IF packet follows on from the last, and add its samples.
+///
+static int16_t wsa_rtsa_append( struct wsa_rtsa *rtsa, struct wsa_vrt_packet_header const *header,
+                                struct wsa_vrt_packet_trailer const *trailer )
+{
+    int32_t samples = (int32_t)header->samples_per_packet;
+    uint8_t gap = header->gap;
+    uint64_t lost = 0;
+    int64_t elapsed = 0;
+    int64_t expected;
+    kiss_fft_cpx *grown;
+    int32_t size;
+    int32_t i;
+
+    if (rtsa->timed) {
+        elapsed = ((int64_t)header->time_stamp.sec - (int64_t)rtsa->anchor_time.sec) * WSA_RTSA_PSEC_PER_SEC +
+            ((int64_t)header->time_stamp.psec - (int64_t)rtsa->anchor_time.psec);
+
+        // the packet counts only show what is lost a packet at a time; the timestamps show it all
+        if (rtsa->psec_per_sample > 0) {
+            expected = (int64_t)rtsa->psec_per_sample * rtsa->anchor_samples;
+            if (elapsed > expected + (int64_t)rtsa->psec_per_sample) {
+                gap |= WSA_GAP_LATE;
+                lost = (uint64_t)((elapsed - expected + (int64_t)rtsa->psec_per_sample / 2) /
+                                  (int64_t)rtsa->psec_per_sample);
+            } else if (elapsed < expected - (int64_t)rtsa->psec_per_sample) {
+                gap |= WSA_GAP_EARLY;
+            }
+        } else if (header->dropped > 0) {
+            lost = (uint64_t)header->dropped * rtsa->anchor_samples;
+        }
+        if (trailer->sample_loss_indicator) {
+            gap |= WSA_GAP_DROPPED;
+        }
+        if (header->stream_id != rtsa->stream_id) {
+            gap |= WSA_GAP_REORDERED;
+        }
+
+        if (gap) {
+            doutf(DMED, "Real-time spectrum: stream broken before sample %llu (gap 0x%x, %llu lost)\n",
+                  (unsigned long long)rtsa->received, gap, (unsigned long long)lost);
+            wsa_atomic_add_u64(&rtsa->breaks, 1);
+            wsa_atomic_add_u64(&rtsa->dropped_samples, lost);
+            rtsa->gap |= gap;
+            rtsa->timed = 0;
+        } else if (rtsa->psec_per_sample == 0 && elapsed > 0) {
+            rtsa->psec_per_sample = (uint64_t)elapsed / (uint64_t)rtsa->anchor_samples;
+        }
+    }
+
+    if (!rtsa->timed) {
+        // start again from this packet
+        rtsa->pend_len = 0;
+        rtsa->pend_first = rtsa->received;
+        rtsa->next_start = rtsa->received;
+        rtsa->psec_per_sample = 0;
+        rtsa->stream_id = header->stream_id;
+        rtsa->timed = 1;
+    }
+
+    if (rtsa->pend_len + samples > rtsa->pend_size) {
+        size = 2 * (rtsa->pend_len + samples) + rtsa->config.fft_size;
+        grown = wsa_malloc_aligned(sizeof(kiss_fft_cpx) * size, WSA_ALLOC_ALIGN);
+        if (grown == NULL) {
+            return WSA_ERR_MALLOCFAILED;
+        }
+        memcpy(grown, rtsa->pend, sizeof(kiss_fft_cpx) * rtsa->pend_len);
+        wsa_free(rtsa->pend);
+        rtsa->pend = grown;
+        rtsa->pend_size = size;
+    }
+
+    normalize_iq_data(samples, header->stream_id, rtsa->i16, rtsa->q16, rtsa->i32, rtsa->idata, rtsa->qdata);
+    if (rtsa->iqcorr) {
+        wsa_iqcorr_push(rtsa->iqcorr, rtsa->idata, (header->stream_id == I16Q16_DATA_STREAM_ID) ? rtsa->qdata : NULL,
+                        samples);
+    }
+    for (i = 0; i < samples; i++) {
+        rtsa->pend[rtsa->pend_len + i].r = rtsa->idata[i];
+        rtsa->pend[rtsa->pend_len + i].i = rtsa->qdata[i];
+    }
+    rtsa->pend_len += samples;
+
+    rtsa->anchor_sample = rtsa->received;
+    rtsa->anchor_samples = samples;
+    rtsa->anchor_time = header->time_stamp;
+    rtsa->received += samples;
+
+    wsa_atomic_add_u64(&rtsa->packets, 1);
+    wsa_atomic_add_u64(&rtsa->samples, (uint64_t)samples);
+
+    return 0;
+}
+
+
+///
+/// Read and decode the next packet. Returns 1 for an IF packet, 0 for another, or a negative
+/// error.
+///
+static int16_t wsa_rtsa_read( struct wsa_rtsa *rtsa, struct wsa_vrt_packet_header *header,
+                              struct wsa_vrt_packet_trailer *trailer, uint32_t timeout )
+{
+    struct wsa_receiver_packet receiver;
+    struct wsa_digitizer_packet digitizer;
+    struct wsa_extension_packet extension;
+    int32_t samples;
+    int16_t result;
+
+    result = wsa_read_vrt_packet_raw(rtsa->dev, header, trailer, &receiver, &digitizer, &extension, rtsa->packet,
+                                     WSA_RTSA_PACKET_WORDS, timeout);
+    if (result < 0) {
+        return result;
+    }
+    if (header->packet_type != IF_PACKET_TYPE) {
+        return 0;
+    }
+
+    samples = (int32_t)header->samples_per_packet;
+    if (header->stream_id == I16Q16_DATA_STREAM_ID) {
+        wsa_decode_zif_frame(rtsa->packet, samples, rtsa->i16, rtsa->q16, samples);
+    } else if (header->stream_id == I16_DATA_STREAM_ID || header->stream_id == I32_DATA_STREAM_ID) {
+        wsa_decode_i_only_frame(header->stream_id, rtsa->packet, samples, rtsa->i16, rtsa->i32, samples);
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+///
+/// Set up a real-time spectrum engine. The worker threads start now and wait for work.
+///
+/// @param[in] dev The device, which should be set up to stream but not yet streaming.
+/// @param[in] config The settings; copied.
+/// @param[out] rtsa The new engine.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_rtsa_alloc( struct wsa_device *dev, struct wsa_rtsa_config const *config, struct wsa_rtsa **rtsa )
+{
+    struct wsa_rtsa *r;
+    struct wsa_rtsa_worker *worker;
+    int32_t n;
+    uint32_t workers;
+    uint32_t i;
+    int ok;
+
+    if (dev == NULL || config == NULL || rtsa == NULL || config->fft_size < 2 || config->fft_size % 2 != 0 ||
+        config->hop < 1 || config->hop > config->fft_size || config->workers > WSA_RTSA_MAX_WORKERS) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    r = wsa_malloc(sizeof(struct wsa_rtsa));
+    if (r == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+    memset(r, 0, sizeof(struct wsa_rtsa));
+    r->dev = dev;
+    r->config = *config;
+    n = config->fft_size;
+
+    r->njobs = config->queue;
+    if (r->njobs == 0) {
+        r->njobs = (config->workers > 0 ? config->workers : 1) * WSA_RTSA_QUEUE_PER_WORKER;
+    }
+    if (r->njobs < config->workers + 1) {
+        r->njobs = config->workers + 1;
+    }
+
+#ifdef _WIN32
+    InitializeCriticalSection(&r->lock);
+    InitializeConditionVariable(&r->queued);
+    InitializeConditionVariable(&r->finished);
+#else
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->queued, NULL);
+    pthread_cond_init(&r->finished, NULL);
+#endif
+    r->locks_made = 1;
+
+    r->window = wsa_malloc_aligned(sizeof(float) * n, WSA_ALLOC_ALIGN);
+    r->packet = wsa_malloc_aligned(WSA_RTSA_PACKET_WORDS * BYTES_PER_VRT_WORD, WSA_ALLOC_ALIGN);
+    r->i16 = wsa_malloc_aligned(sizeof(int16_t) * WSA_RTSA_PACKET_SAMPLES, WSA_ALLOC_ALIGN);
+    r->q16 = wsa_malloc_aligned(sizeof(int16_t) * WSA_RTSA_PACKET_SAMPLES, WSA_ALLOC_ALIGN);
+    r->i32 = wsa_malloc_aligned(sizeof(int32_t) * WSA_RTSA_PACKET_SAMPLES, WSA_ALLOC_ALIGN);
+    r->idata = wsa_malloc_aligned(sizeof(kiss_fft_scalar) * WSA_RTSA_PACKET_SAMPLES, WSA_ALLOC_ALIGN);
+    r->qdata = wsa_malloc_aligned(sizeof(kiss_fft_scalar) * WSA_RTSA_PACKET_SAMPLES, WSA_ALLOC_ALIGN);
+    r->jobs = wsa_malloc(sizeof(struct wsa_rtsa_job) * r->njobs);
+    workers = (config->workers > 0) ? config->workers : 1;
+    r->workers = wsa_malloc(sizeof(struct wsa_rtsa_worker) * workers);
+    if (!r->window || !r->packet || !r->i16 || !r->q16 || !r->i32 || !r->idata || !r->qdata || !r->jobs ||
+        !r->workers) {
+        wsa_rtsa_free(r);
+        return WSA_ERR_MALLOCFAILED;
+    }
+    memset(r->jobs, 0, sizeof(struct wsa_rtsa_job) * r->njobs);
+    memset(r->workers, 0, sizeof(struct wsa_rtsa_worker) * workers);
+    if (config->iq_correction && wsa_iqcorr_alloc(NULL, &r->iqcorr) < 0) {
+        wsa_rtsa_free(r);
+        return WSA_ERR_MALLOCFAILED;
+    }
+
+    r->power_offset = (float)config->reference_level - (float)(20 * log10((double)n)) - KISS_FFT_OFFSET;
+    for (i = 0; i < (uint32_t)n; i++) {
+        r->window[i] = (float)(0.5 * (1 - cos(2 * M_PI * i / (n - 1))));
+    }
+
+    for (i = 0; i < r->njobs; i++) {
+        r->jobs[i].in = wsa_malloc_aligned(sizeof(kiss_fft_cpx) * n, WSA_ALLOC_ALIGN);
+        r->jobs[i].power = wsa_malloc_aligned(sizeof(float) * n, WSA_ALLOC_ALIGN);
+        if (!r->jobs[i].in || !r->jobs[i].power) {
+            wsa_rtsa_free(r);
+            return WSA_ERR_MALLOCFAILED;
+        }
+    }
+
+    for (i = 0; i < workers; i++) {
+        worker = &r->workers[i];
+        worker->rtsa = r;
+        worker->fft = kiss_fft_alloc(n, 0, 0, 0);
+        worker->out = wsa_malloc_aligned(sizeof(kiss_fft_cpx) * n, WSA_ALLOC_ALIGN);
+        if (!worker->fft || !worker->out) {
+            wsa_rtsa_free(r);
+            return WSA_ERR_MALLOCFAILED;
+        }
+    }
+
+    for (i = 0; i < config->workers; i++) {
+        worker = &r->workers[i];
+#ifdef _WIN32
+        worker->thread = CreateThread(NULL, 0, wsa_rtsa_worker_main, worker, 0, NULL);
+        ok = (worker->thread != NULL);
+#else
+        ok = (pthread_create(&worker->thread, NULL, wsa_rtsa_worker_main, worker) == 0);
+#endif
+        if (!ok) {
+            wsa_rtsa_free(r);
+            return WSA_ERR_THREADFAILED;
+        }
+        worker->started = 1;
+        r->nworkers++;
+    }
+
+    doutf(DMED, "Real-time spectrum: %d point FFTs every %d samples, %u workers, %u in flight\n",
+          (int)n, (int)config->hop, (unsigned)config->workers, (unsigned)r->njobs);
+
+    *rtsa = r;
+
+    return 0;
+}
+
+
+///
+/// Read the stream and hand over spectra until a number have been, wsa_rtsa_stop() is called,
+/// or an error.
+///
+/// Every spectrum queued is handed over before this returns, and samples not yet in one are
+/// kept, so it may be called again to carry on.
+///
+/// @param[in] rtsa The engine.
+/// @param[in] max_spectra How many spectra to hand over, or 0 for no limit.
+/// @param[in] timeout How long to wait for each packet, in milliseconds, as for
+///                    wsa_read_vrt_packet_raw(). A stop request is seen within this time.
+///
+/// @returns 0 on success or when stopped, otherwise a negative error code.
+///
+int16_t wsa_rtsa_run( struct wsa_rtsa *rtsa, uint64_t max_spectra, uint32_t timeout )
+{
+    struct wsa_vrt_packet_header header;
+    struct wsa_vrt_packet_trailer trailer;
+    uint64_t limit = (max_spectra > 0) ? rtsa->submitted + max_spectra : 0;
+    int16_t result = 0;
+
+    // windows left whole by the last call come first
+    wsa_rtsa_cut(rtsa, limit);
+
+    while ((limit == 0 || rtsa->submitted < limit) && !wsa_atomic_load_u32(&rtsa->stop)) {
+        result = wsa_rtsa_read(rtsa, &header, &trailer, timeout);
+        if (result < 0) {
+            break;
+        }
+        if (result == 0) {
+            continue;
+        }
+
+        result = wsa_rtsa_append(rtsa, &header, &trailer);
+        if (result < 0) {
+            break;
+        }
+        wsa_rtsa_cut(rtsa, limit);
+        wsa_rtsa_deliver(rtsa, 0);
+    }
+
+    wsa_rtsa_deliver(rtsa, rtsa->submitted);
+
+    return (result < 0) ? result : 0;
+}
+
+
+///
+/// Ask wsa_rtsa_run() to return after the packet it is reading. May be called from any thread,
+/// the callback, or a signal handler.
+///
+void wsa_rtsa_stop( struct wsa_rtsa *rtsa )
+{
+    wsa_atomic_store_u32(&rtsa->stop, 1);
+}
+
+
+///
+/// Get the counts since the engine was made. May be called from any thread while it runs.
+///
+void wsa_rtsa_totals( struct wsa_rtsa *rtsa, struct wsa_rtsa_totals *totals )
+{
+    totals->packets = wsa_atomic_load_u64(&rtsa->packets);
+    totals->samples = wsa_atomic_load_u64(&rtsa->samples);
+    totals->spectra = wsa_atomic_load_u64(&rtsa->spectra);
+    totals->breaks = wsa_atomic_load_u64(&rtsa->breaks);
+    totals->dropped_samples = wsa_atomic_load_u64(&rtsa->dropped_samples);
+}
+
+
+///
+/// Stop the worker threads and free the engine. wsa_rtsa_run() must have returned.
+///
+void wsa_rtsa_free( struct wsa_rtsa *rtsa )
+{
+    uint32_t workers;
+    uint32_t i;
+
+    if (rtsa == NULL) {
+        return;
+    }
+
+    if (rtsa->locks_made) {
+        wsa_rtsa_lock(rtsa);
+        rtsa->quit = 1;
+#ifdef _WIN32
+        WakeAllConditionVariable(&rtsa->queued);
+#else
+        pthread_cond_broadcast(&rtsa->queued);
+#endif
+        wsa_rtsa_unlock(rtsa);
+    }
+
+    workers = (rtsa->config.workers > 0) ? rtsa->config.workers : 1;
+    if (rtsa->workers) {
+        for (i = 0; i < workers; i++) {
+            if (rtsa->workers[i].started) {
+#ifdef _WIN32
+                WaitForSingleObject(rtsa->workers[i].thread, INFINITE);
+                CloseHandle(rtsa->workers[i].thread);
+#else
+                pthread_join(rtsa->workers[i].thread, NULL);
+#endif
+            }
+            kiss_fft_free(rtsa->workers[i].fft);
+            wsa_free(rtsa->workers[i].out);
+        }
+        wsa_free(rtsa->workers);
+    }
+
+    if (rtsa->jobs) {
+        for (i = 0; i < rtsa->njobs; i++) {
+            wsa_free(rtsa->jobs[i].in);
+            wsa_free(rtsa->jobs[i].power);
+        }
+        wsa_free(rtsa->jobs);
+    }
+
+    if (rtsa->locks_made) {
+#ifdef _WIN32
+        DeleteCriticalSection(&rtsa->lock);
+#else
+        pthread_mutex_destroy(&rtsa->lock);
+        pthread_cond_destroy(&rtsa->queued);
+        pthread_cond_destroy(&rtsa->finished);
+#endif
+    }
+
+    wsa_free(rtsa->window);
+    wsa_free(rtsa->packet);
+    wsa_free(rtsa->i16);
+    wsa_free(rtsa->q16);
+    wsa_free(rtsa->i32);
+    wsa_free(rtsa->idata);
+    wsa_free(rtsa->qdata);
+    wsa_iqcorr_free(rtsa->iqcorr);
+    wsa_free(rtsa->pend);
+    wsa_free(rtsa);
+}
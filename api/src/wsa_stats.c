@@ -0,0 +1,172 @@
+///
+/// @file
+/// Reading and resetting the per-device statistics kept in struct wsa_device.
+///
+/// The counters themselves are updated inline, see wsa_stats.h.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <string.h>
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_error.h"
+#include "wsa_stats.h"
+
+
+/// Names of the counters, by enum wsa_stats_counter.
+static const char * const wsa_stats_counter_names[WSA_STAT_COUNTERS] = {
+    "packets",
+    "bytes",
+    "recv_calls",
+    "select_waits",
+    "timeouts",
+    "stalls",
+    "scpi_queries",
+    "sample_loss",
+    "over_range",
+    "dropped",
+    "reordered",
+    "late",
+    "early"
+};
+
+/// Names of the timers, by enum wsa_stats_timer.
+static const char * const wsa_stats_timer_names[WSA_STAT_TIMERS] = {
+    "select",
+    "scpi_rtt",
+    "decode",
+    "window",
+    "fft",
+    "log"
+};
+
+
+///
+/// Copy one 64-bit value out of the live block, clearing it if asked.
+///
+static uint64_t wsa_stats_take( uint64_t volatile *value, uint8_t reset )
+{
+    return reset ? wsa_atomic_exchange_u64(value, 0) : wsa_atomic_load_u64(value);
+}
+
+
+///
+/// Take a copy of a device's statistics.
+///
+/// Each value is read atomically, but the copy is not a single snapshot: events recorded while it
+/// is taken may be counted in some values and not others. This may be called from any thread.
+///
+/// @param[in] dev The device.
+/// @param[out] stats Where to copy the statistics.
+/// @param[in] reset If non-zero, each value is cleared as it is read, so no event is lost or
+///                  counted twice between successive reads.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_stats_read( struct wsa_device *dev, struct wsa_stats *stats, uint8_t reset )
+{
+    int i, j;
+
+    if (dev == NULL || stats == NULL) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    for (i = 0; i < WSA_STAT_COUNTERS; i++) {
+        stats->counter[i] = wsa_stats_take(&dev->stats.counter[i], reset);
+    }
+    for (i = 0; i < WSA_STAT_TIMERS; i++) {
+        stats->timer_total_ns[i] = wsa_stats_take(&dev->stats.timer_total_ns[i], reset);
+        for (j = 0; j < WSA_STATS_HIST_BUCKETS; j++) {
+            stats->timer_hist[i][j] = wsa_stats_take(&dev->stats.timer_hist[i][j], reset);
+        }
+    }
+
+    return 0;
+}
+
+
+///
+/// Clear a device's statistics.
+///
+/// @param[in] dev The device.
+///
+void wsa_stats_reset( struct wsa_device *dev )
+{
+    struct wsa_stats discard;
+
+    wsa_stats_read(dev, &discard, 1);
+}
+
+
+///
+/// Get the name of a counter, i.e. for printing.
+///
+/// @returns The name, or "unknown".
+///
+const char *wsa_stats_counter_name( enum wsa_stats_counter counter )
+{
+    if ((int)counter < 0 || counter >= WSA_STAT_COUNTERS) {
+        return "unknown";
+    }
+
+    return wsa_stats_counter_names[counter];
+}
+
+
+///
+/// Get the name of a timer, i.e. for printing.
+///
+/// @returns The name, or "unknown".
+///
+const char *wsa_stats_timer_name( enum wsa_stats_timer timer )
+{
+    if ((int)timer < 0 || timer >= WSA_STAT_TIMERS) {
+        return "unknown";
+    }
+
+    return wsa_stats_timer_names[timer];
+}
+
+
+///
+/// Estimate a percentile of a timer from its histogram.
+///
+/// The result is the upper bound of the bucket holding the percentile, so it is within a factor
+/// of two above the true value.
+///
+/// @param[in] stats Statistics copied by wsa_stats_read().
+/// @param[in] timer The timer.
+/// @param[in] percent The percentile, from 0 to 100.
+///
+/// @returns The duration in nanoseconds, or 0 if nothing has been recorded.
+///
+uint64_t wsa_stats_timer_percentile( struct wsa_stats const *stats, enum wsa_stats_timer timer, double percent )
+{
+    uint64_t total = 0;
+    uint64_t seen = 0;
+    double target;
+    int j;
+
+    if ((int)timer < 0 || timer >= WSA_STAT_TIMERS) {
+        return 0;
+    }
+
+    for (j = 0; j < WSA_STATS_HIST_BUCKETS; j++) {
+        total += stats->timer_hist[timer][j];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    target = (double)total * percent / 100.0;
+    for (j = 0; j < WSA_STATS_HIST_BUCKETS - 1; j++) {
+        seen += stats->timer_hist[timer][j];
+        if ((double)seen >= target) {
+            break;
+        }
+    }
+
+    return (2ULL << j) - 1;
+}
@@ -38,6 +38,8 @@
 #include "wsa_dsp.h"
 #include "wsa_debug.h"
 #include "wsa_error.h"
+#include "wsa_atomic.h"
+#include "wsa_clock.h"
 
 // #define FIXED_POINT 32
 #include "kiss_fft.h"
@@ -77,6 +79,7 @@
 #define EINVCAPTSIZE (3)			///< NOTUSED
 #define ESWEEPNOMEM (4)				///< NOTUSED
 #define EBADPARAM (5)				///< Bad device or sweep configuration parameter
+#define ESWEEPDAMAGED (6)			///< A continuous sweep lost packets or ran short, so it is not published
 
 #define TIMEOUT_5S (5000)			///< Timeout used in reading packets.
 
@@ -87,7 +90,7 @@
 /// @{
 
 /// Table of device properties for each operating mode.
-static struct wsa_sweep_device_properties_t wsa_sweep_device_properties[] = {
+static const struct wsa_sweep_device_properties_t wsa_sweep_device_properties[] = {
 
     // Legend for Each Entry
     // {
@@ -209,7 +212,7 @@ struct wsa_sweep_plan *wsa_sweep_plan_entry_new(uint64_t fcstart, uint64_t fcsto
 {
     struct wsa_sweep_plan *plan;
 
-    plan = malloc(sizeof(struct wsa_sweep_plan));
+    plan = wsa_malloc(sizeof(struct wsa_sweep_plan));
     if (plan == NULL)
         return NULL;
 
@@ -220,6 +223,7 @@ struct wsa_sweep_plan *wsa_sweep_plan_entry_new(uint64_t fcstart, uint64_t fcsto
     plan->spp = spp;
     plan->ppb = ppb;
     plan->dd_mode = dd_mode;
+    plan->only_dd = FALSE;
 
     return plan;
 }
@@ -231,9 +235,9 @@ struct wsa_sweep_plan *wsa_sweep_plan_entry_new(uint64_t fcstart, uint64_t fcsto
 /// @param[in] mode A character string holding the desired device mode.
 /// @return A pointer to the properties structure, or NULL if the mode is not supported.
 ///
-static struct wsa_sweep_device_properties_t *wsa_get_sweep_device_properties( uint32_t mode )
+static const struct wsa_sweep_device_properties_t *wsa_get_sweep_device_properties( uint32_t mode )
 {
-    struct wsa_sweep_device_properties_t *ptr;
+    const struct wsa_sweep_device_properties_t *ptr;
 
     for (ptr = wsa_sweep_device_properties; ptr->mode; ptr++) {
         if (ptr->mode == mode)
@@ -261,23 +265,31 @@ static struct wsa_sweep_device_properties_t *wsa_get_sweep_device_properties( ui
 ///
 /// @note
 /// 1. Only SH, SHN modes are supported right now, with no decimation.
-/// 2. The following elements of *pscfg are output:
+/// 2. Each band in pscfg->bands becomes one sweep plan entry. The bands below the DD cutoff share one DD
+///    block, taken ahead of the first of them; the collector splits it into each band's bins.
+/// 3. The following elements of *pscfg are output:
 ///		- samples_per_packet
 ///		- packets_per_block
 ///		- only_dd
 ///		- sweep_plan
 ///		- packet_total
+///		- fstart_actual, fstop_actual
+///		- fstart_actual, fstop_actual, block_offset, block_count, dd_mode and only_dd of each band
 ///
 static int16_t wsa_plan_sweep( struct wsa_sweep_device *sweep_device, struct wsa_power_spectrum_config *pscfg )
 {
-    struct wsa_sweep_device_properties_t *mode_props = NULL;
-    struct wsa_descriptor dev_props = sweep_device->real_device->descr;
-    struct wsa_sweep_plan *our_plan = NULL;
+    const struct wsa_sweep_device_properties_t *mode_props = NULL;
+    struct wsa_descriptor dev_props;
+    struct wsa_sweep_band *band;
+    struct wsa_sweep_plan *entry;
+    struct wsa_sweep_plan **tail;
 
     uint64_t fcstart;
     uint64_t fcstop;
     uint64_t block_count;
+    uint64_t total_blocks;
 
+    uint32_t b;
     uint32_t fstep;
     uint32_t half_usable_bw;
     uint32_t required_points;
@@ -285,31 +297,39 @@ static int16_t wsa_plan_sweep( struct wsa_sweep_device *sweep_device, struct wsa
     uint32_t actual_ppb;
 
     uint8_t need_dd_mode = FALSE;
-
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "%s", "REQUEST");
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Start freq (fstart): %12llu Hz", pscfg->fstart);
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Stop freq (fstop):   %12llu Hz", pscfg->fstop);
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "RBW:                 %12llu Hz", pscfg->rbw);
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Rcvr mode:           %s", mode_const_to_string(pscfg->mode));
+    uint8_t dd_planned = FALSE;
 
     // 1. Sanity check input parameters.
 
     // Null pointers
-    if (!sweep_device || !pscfg) {
+    if (!sweep_device || !pscfg || !pscfg->bands || (pscfg->band_count == 0)) {
         DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "%s", "?? Bad device or bad sweep config.");
         return (-EBADPARAM);
     }
 
-    // Nonsense frequency range
-    if (pscfg->fstop < (pscfg->fstart + pscfg->rbw)) {
-        DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "%s", "?? Bad frequency range.");
-        return (-EFREQOUTOFRANGE);
-    }
+    dev_props = sweep_device->real_device->descr;
+
+    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "%s", "REQUEST");
+    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Band count:          %12u", (unsigned)pscfg->band_count);
+    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Start freq (fstart): %12llu Hz", pscfg->fstart);
+    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Stop freq (fstop):   %12llu Hz", pscfg->fstop);
+    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "RBW:                 %12llu Hz", pscfg->rbw);
+    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Rcvr mode:           %s", mode_const_to_string(pscfg->mode));
+
+    for (b = 0; b < pscfg->band_count; b++) {
+        band = &pscfg->bands[b];
+
+        // Nonsense frequency range
+        if (band->fstop < (band->fstart + pscfg->rbw)) {
+            DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "?? Bad frequency range in band %u.", (unsigned)b);
+            return (-EFREQOUTOFRANGE);
+        }
 
-    // Check that frequency parameters are in range for the device.
-    if ((pscfg->fstart < dev_props.min_tune_freq) || (pscfg->fstop > dev_props.max_tune_freq)) {
-        DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "%s", "?? Frequency range exceeds device capability.");
-        return (WSA_ERR_INV_SWEEP_FREQ);
+        // Check that frequency parameters are in range for the device.
+        if ((band->fstart < dev_props.min_tune_freq) || (band->fstop > dev_props.max_tune_freq)) {
+            DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "%s", "?? Frequency range exceeds device capability.");
+            return (WSA_ERR_INV_SWEEP_FREQ);
+        }
     }
 
     // 2. Calculate sweep parameters.
@@ -323,7 +343,7 @@ static int16_t wsa_plan_sweep( struct wsa_sweep_device *sweep_device, struct wsa
     // Get points per sweep segment.
 	// Round up ensure we get at least RBW resolution.
     required_points = (mode_props->full_bw + (uint32_t)pscfg->rbw - 1) / (uint32_t)pscfg->rbw;
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Original points per segment: %lu", required_points);
+    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Original points per segment: %u", (unsigned)required_points);
 
     // TODO: Compensate for width of FFT window function. E.g. if window width is 4 bins, we need rbw = rbw / 4.
 	//       Defer until next generation API so we don't affect all the other software that does this the same way.
@@ -335,11 +355,11 @@ static int16_t wsa_plan_sweep( struct wsa_sweep_device *sweep_device, struct wsa
     // This means only real data, so double the FFT size.
     required_points *= 2;
 
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Final points per segment: %lu", required_points);
+    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Final points per segment: %u", (unsigned)required_points);
 
     //
     // Now we need to calculate the following parameters:
-    // - number of sweep list entries
+    // - number of sweep list entries (one per band)
     // - for each entry:
     //    - start frequency
     //    - stop frequency
@@ -364,84 +384,122 @@ static int16_t wsa_plan_sweep( struct wsa_sweep_device *sweep_device, struct wsa
     pscfg->samples_per_packet = actual_spp;
     pscfg->packets_per_block = actual_ppb;
 
-    // Compute start and stop frequencies, step size.
-
     half_usable_bw = mode_props->usable_bw / 2;
 
-    ///
-    // @note
-    // In SH, SHN modes, the tuning frequency is at the 35 MHz point in the baseband, and there is
-    // half_usable_bw on either side of this.
+    // Step size
+    // Set step size to device's usable bandwidth.
+    // Then quantize to tuning resolution so our final fstep might be a bit smaller.
+    fstep = mode_props->usable_bw;
+    fstep = (fstep / (uint64_t)mode_props->tuning_resolution) * (uint64_t)mode_props->tuning_resolution;
 
-    // 1) Start frequency -- depends on whether we need DD mode.
-    if (pscfg->fstart < mode_props->min_tunable) {
-        need_dd_mode = TRUE;
+    // Plan each band as its own sweep entry.
+    total_blocks = 0;
+    pscfg->only_dd = TRUE;
+    pscfg->sweep_plan = NULL;
+    tail = &pscfg->sweep_plan;
 
-        // fcstart is for the non-DD segments.
-        fcstart = mode_props->min_tunable + half_usable_bw;
+    for (b = 0; b < pscfg->band_count; b++) {
+        band = &pscfg->bands[b];
 
-    } else {
-        need_dd_mode = FALSE;
-		fcstart = pscfg->fstart + half_usable_bw;
-    }
+        ///
+        // @note
+        // In SH, SHN modes, the tuning frequency is at the 35 MHz point in the baseband, and there is
+        // half_usable_bw on either side of this.
 
-	// But fstart_actual is the requested start frequency, whether DD mode or not.
-	pscfg->fstart_actual = pscfg->fstart;
+        // 1) Start frequency -- depends on whether we need DD mode.
+        if (band->fstart < mode_props->min_tunable) {
+            need_dd_mode = TRUE;
 
-    // Round down by tuning resolution to prevent any gap.
-	fcstart = (fcstart / (uint64_t)mode_props->tuning_resolution) * (uint64_t)mode_props->tuning_resolution;
+            // fcstart is for the non-DD segments.
+            fcstart = mode_props->min_tunable + half_usable_bw;
 
-	// Same for our actual start frequency.
-	pscfg->fstart_actual = (pscfg->fstart_actual / (uint64_t)mode_props->tuning_resolution) * (uint64_t)mode_props->tuning_resolution;
+        } else {
+            need_dd_mode = FALSE;
+            fcstart = band->fstart + half_usable_bw;
+        }
 
-    // 2) Step size
-    // Set step size to device's usable bandwidth.
-    // Then quantize to tuning resolution so our final fstep might be a bit smaller.
-    fstep = mode_props->usable_bw;
-    fstep = (fstep / (uint64_t)mode_props->tuning_resolution) * (uint64_t)mode_props->tuning_resolution;
+        // Round down by tuning resolution to prevent any gap.
+        fcstart = (fcstart / (uint64_t)mode_props->tuning_resolution) * (uint64_t)mode_props->tuning_resolution;
 
-    // 3) Stop frequency -- the centre frequency that's the first multiple of fstep above fcstart that
-    // exceeds the requested stop frequency. This will ensure we don't miss the last little bit of the spectrum.
-	fcstop = fcstart + (((pscfg->fstop - fcstart) + (uint64_t)fstep - 1ULL) / (uint64_t)fstep) * (uint64_t)fstep;
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, " Rounded up fcstop: %llu", fcstop);
+        // But fstart_actual is the requested start frequency, whether DD mode or not, rounded the same way.
+        band->fstart_actual = (band->fstart / (uint64_t)mode_props->tuning_resolution) * (uint64_t)mode_props->tuning_resolution;
 
-    // Constrain fcstop.
-    // Among other things, if we need DD mode and fstop was < 50MHz, start might now be greater than stop.
-    // Also, if fcstop exceeds maximum tunable frequency, back it off by one step.
-	fcstop = (fcstop < fcstart) ? fcstart : fcstop;
-    if (fcstop >= dev_props.max_tune_freq) {
-        fcstop -= fstep;
-    }
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Constrained fcstop: %llu", fcstop);
+        // 2) Stop frequency -- the centre frequency that's the first multiple of fstep above fcstart that
+        // exceeds the requested stop frequency. This will ensure we don't miss the last little bit of the spectrum.
+        fcstop = fcstart + (((band->fstop - fcstart) + (uint64_t)fstep - 1ULL) / (uint64_t)fstep) * (uint64_t)fstep;
+        DEBUG_PRINTF(DEBUG_SWEEP_PLAN, " Rounded up fcstop: %llu", fcstop);
+
+        // Constrain fcstop.
+        // Among other things, if we need DD mode and fstop was < 50MHz, start might now be greater than stop.
+        // Also, if fcstop exceeds maximum tunable frequency, back it off by one step.
+        fcstop = (fcstop < fcstart) ? fcstart : fcstop;
+        if (fcstop >= dev_props.max_tune_freq) {
+            fcstop -= fstep;
+        }
+        DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Constrained fcstop: %llu", fcstop);
 
-	pscfg->fstop_actual = fcstop + half_usable_bw;
+        band->fstop_actual = fcstop + half_usable_bw;
 
-    // Check if we will only get DD mode data.
-    pscfg->only_dd = (need_dd_mode && (pscfg->fstop < mode_props->min_tunable)) ? TRUE : FALSE;
+        // Check if we will only get DD mode data for this band.
+        band->dd_mode = need_dd_mode;
+        band->only_dd = (need_dd_mode && (band->fstop < mode_props->min_tunable)) ? TRUE : FALSE;
+        if (band->only_dd) {
+            band->fstop_actual = band->fstop;
+        } else {
+            pscfg->only_dd = FALSE;
+        }
 
-    // Create sweep plan entry.
-	pscfg->sweep_plan = wsa_sweep_plan_entry_new(fcstart, fcstop, fstep, actual_spp, actual_ppb, need_dd_mode);
+        // Create sweep plan entry.
+        // Only the first band below the DD cutoff asks for the DD block; the others are cut from it too.
+        entry = wsa_sweep_plan_entry_new(fcstart, fcstop, fstep, actual_spp, actual_ppb, need_dd_mode && !dd_planned);
+        if (entry == NULL) {
+            return WSA_ERR_MALLOCFAILED;
+        }
+        entry->only_dd = band->only_dd;
+        *tail = entry;
+        tail = &entry->next_entry;
+
+        // Calculate number of data blocks for the band.
+        // A DD-only band produces just its DD block, as the SH entry is never saved, and none at all
+        // if an earlier band already took the DD block.
+        if (band->only_dd) {
+            block_count = dd_planned ? 0 : 1;
+        } else {
+            block_count = 1 + (fcstop - fcstart) / (uint64_t)fstep;
+            if (need_dd_mode && !dd_planned) {
+                // Assume DD mode will use one block.
+                // TODO: Verify DD mode only needs one block.
+                block_count++;
+            }
+        }
+        band->block_offset = (uint32_t)total_blocks;
+        band->block_count = (uint32_t)block_count;
+        total_blocks += block_count;
+        if (need_dd_mode) {
+            dd_planned = TRUE;
+        }
 
-    // Calculate total number of data blocks and thus packet total (a multiple of number of blocks).
-    block_count = 1 + (fcstop - fcstart) / (uint64_t)fstep;
-    if (need_dd_mode) {
-        // Assume DD mode will use one block.
-        // TODO: Verify DD mode only needs one block.
-        block_count++;
+        // Dump info on what we did if the correct flags are set.
+        DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "AS CONFIGURED, BAND %u", (unsigned)b);
+        DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Start freq (fcstart):  %12llu Hz", fcstart);
+        DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Stop freq (fcstop):    %12llu Hz", fcstop);
+        DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Step count:            %12llu", block_count);
+        DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "DD segment needed:     %s", need_dd_mode ? "YES" : "NO");
+        DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "DD only?               %s", band->only_dd ? "YES" : "NO");
     }
-    pscfg->packet_total = (uint32_t)block_count * actual_ppb;
 
-    // Dump info on what we did if the correct flags are set.
+    // The overall range is the envelope of the bands.
+    pscfg->fstart_actual = pscfg->bands[0].fstart_actual;
+    pscfg->fstop_actual = pscfg->bands[pscfg->band_count - 1].fstop_actual;
+
+    // Packet total is a multiple of number of blocks.
+    pscfg->packet_total = (uint32_t)total_blocks * actual_ppb;
+
     DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "%s", "AS CONFIGURED");
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Start freq (fcstart):  %12llu Hz", fcstart);
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Stop freq (fcstop):    %12llu Hz", fcstop);
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Step size (fstep):     %12lu Hz", fstep);
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "SPP:                   %12lu", pscfg->samples_per_packet);
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "PPB:                   %12lu", pscfg->packets_per_block);
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Step count:            %12llu", block_count);
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "DD segment needed:     %s", need_dd_mode ? "YES" : "NO");
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "DD only?               %s", pscfg->only_dd ? "YES" : "NO");
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Total packets:         %12lu", pscfg->packet_total);
+    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Step size (fstep):     %12u Hz", (unsigned)fstep);
+    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "SPP:                   %12u", (unsigned)pscfg->samples_per_packet);
+    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "PPB:                   %12u", (unsigned)pscfg->packets_per_block);
+    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "Total packets:         %12u", (unsigned)pscfg->packet_total);
 
     return (0);
 }
@@ -499,20 +557,20 @@ static int16_t wsa_sweep_plan_load( struct wsa_sweep_device *wsasweepdev, struct
         result = wsa_send_scpi(wsadev, atten_cmd);
     }
 
-    // if DD mode is required, create one sweep entry with DD mode.
-    if (cfg->sweep_plan->dd_mode == 1) {
-        result = wsa_set_sweep_rfe_input_mode(wsadev, dd);
-        result = wsa_set_sweep_samples_per_packet(wsadev, (int32_t)(plan_entry->spp));
-        result = wsa_set_sweep_packets_per_block(wsadev, (int32_t)(plan_entry->ppb));
-        result = wsa_sweep_entry_save(wsadev, 0);
-    }
-
-    // Set sweep-wide settings.
-    result = wsa_set_sweep_rfe_input_mode(wsadev, mode_const_to_string(cfg->mode));
-
     // Loop over sweep plan, converting to sweep entries and save.
     for (plan_entry = cfg->sweep_plan; plan_entry; plan_entry = plan_entry->next_entry) {
 
+        // If DD mode is required, create one sweep entry with DD mode ahead of the entry.
+        if (plan_entry->dd_mode == 1) {
+            result = wsa_set_sweep_rfe_input_mode(wsadev, dd);
+            result = wsa_set_sweep_samples_per_packet(wsadev, (int32_t)(plan_entry->spp));
+            result = wsa_set_sweep_packets_per_block(wsadev, (int32_t)(plan_entry->ppb));
+            result = wsa_sweep_entry_save(wsadev, 0);
+        }
+
+        // Set the mode for the entry itself.
+        result = wsa_set_sweep_rfe_input_mode(wsadev, mode_const_to_string(cfg->mode));
+
         // Set settings and check the errors.
         result = wsa_set_sweep_freq(wsadev, (uint64_t)plan_entry->fcstart, (uint64_t)plan_entry->fcstop);
         doutf(DMED, "wsa_sweep_plan_load: Setting sweep entry start freq: %llu, stop %llu \n", plan_entry->fcstart, plan_entry->fcstop);
@@ -523,7 +581,7 @@ static int16_t wsa_sweep_plan_load( struct wsa_sweep_device *wsasweepdev, struct
         }
 
         result = wsa_set_sweep_freq_step(wsadev, (uint64_t)plan_entry->fstep);
-        DEBUG_PRINTF(DEBUG_SWEEP_CFG, "Sweep step: %lu", plan_entry->fstep);
+        DEBUG_PRINTF(DEBUG_SWEEP_CFG, "Sweep step: %u", (unsigned)plan_entry->fstep);
         if (result < 0) {
             fprintf(stderr, "ERROR fstep\n");
         }
@@ -539,7 +597,7 @@ static int16_t wsa_sweep_plan_load( struct wsa_sweep_device *wsasweepdev, struct
         }
 
         // Save to end of list.
-        if (cfg->only_dd != 1) {
+        if (plan_entry->only_dd != 1) {
             result = wsa_sweep_entry_save(wsadev, 0);
 			if (result < 0) {
 				fprintf(stderr, "ERROR save\n");
@@ -550,142 +608,374 @@ static int16_t wsa_sweep_plan_load( struct wsa_sweep_device *wsasweepdev, struct
 }
 
 
-/// @}
 ///
-/// \name Public Functions
-/// @{
+/// Reset the display trace before a new capture.
+///
+/// @param[in,out] cfg The power spectrum configuration holding the trace.
+///
+static void wsa_trace_reset( struct wsa_power_spectrum_config *cfg )
+{
+    uint32_t p;
 
-struct wsa_sweep_device *wsa_sweep_device_new( struct wsa_device *device )
+    for (p = 0; p < cfg->tracelen; p++) {
+        cfg->trace[p] = POISONED_BUFFER_VALUE;
+        cfg->trace_count[p] = 0;
+    }
+    cfg->trace_next_bin = 0;
+    cfg->trace_pending = NULL;
+    cfg->trace_pending_count = 0;
+}
+
+
+///
+/// Fold a run of freshly written spectrum bins into the display trace.
+///
+/// Bins are expected in increasing order, as blocks are written out. A bin that has already
+/// been folded in is skipped, so the average detector never counts a bin twice.
+///
+/// @param[in,out] cfg The power spectrum configuration holding the trace.
+/// @param[in] first_bin Index in the full-resolution spectrum of values[0].
+/// @param[in] values The spectrum values in dBm.
+/// @param[in] count Number of values.
+///
+static void wsa_trace_fold( struct wsa_power_spectrum_config *cfg, uint32_t first_bin, float const *values, uint32_t count )
 {
-    struct wsa_sweep_device *sweepdev;
+    uint32_t bin = first_bin;
+    uint32_t const end = first_bin + count;
+    uint32_t point;
+    uint32_t point_end;
+    float v;
+
+    // Skip anything already folded in by an earlier, overlapping block.
+    if (bin < cfg->trace_next_bin) {
+        values += cfg->trace_next_bin - bin;
+        bin = cfg->trace_next_bin;
+    }
+    if (bin >= end) {
+        return;
+    }
 
-    // Allocate memory for our object.
-    sweepdev = malloc(sizeof(struct wsa_sweep_device));
-    if (sweepdev == NULL)
-        return NULL;
+    point = (uint32_t)(((uint64_t)bin * cfg->tracelen) / cfg->buflen);
 
-    // Initialize the structure.
-    sweepdev->real_device = device;
+    while (bin < end) {
 
-    return sweepdev;
-}
+        // First bin of the next trace point, i.e. ceil((point + 1) * buflen / tracelen).
+        point_end = (uint32_t)(((uint64_t)(point + 1) * cfg->buflen + cfg->tracelen - 1) / cfg->tracelen);
+        if (point_end > end) {
+            point_end = end;
+        }
 
+        switch (cfg->trace_detector) {
 
-void wsa_sweep_device_free( struct wsa_sweep_device *sweepdev )
-{
-    // Free the memory of the sweep device, (but not the real device, it came from the parent).
-    free(sweepdev);
-}
+        case WSA_TRACE_DETECTOR_PEAK:
+            for (; bin < point_end; bin++) {
+                v = *values++;
+                if ((cfg->trace_count[point] == 0) || (v > cfg->trace[point])) {
+                    cfg->trace[point] = v;
+                }
+                cfg->trace_count[point]++;
+            }
+            break;
 
+        case WSA_TRACE_DETECTOR_NEG_PEAK:
+            for (; bin < point_end; bin++) {
+                v = *values++;
+                if ((cfg->trace_count[point] == 0) || (v < cfg->trace[point])) {
+                    cfg->trace[point] = v;
+                }
+                cfg->trace_count[point]++;
+            }
+            break;
 
-void wsa_sweep_device_set_attenuator( struct wsa_sweep_device *sweep_device, unsigned int val )
-{
-    sweep_device->device_settings.attenuator = (uint8_t)val;
+        case WSA_TRACE_DETECTOR_SAMPLE:
+            // Bins arrive in order, so the first one seen is the first bin of the point.
+            if (cfg->trace_count[point] == 0) {
+                cfg->trace[point] = *values;
+            }
+            cfg->trace_count[point] += point_end - bin;
+            values += point_end - bin;
+            bin = point_end;
+            break;
+
+        case WSA_TRACE_DETECTOR_AVERAGE:
+            // Accumulate linear power here; wsa_trace_finish() converts back to dBm.
+            if (cfg->trace_count[point] == 0) {
+                cfg->trace[point] = 0.0f;
+            }
+            for (; bin < point_end; bin++) {
+                cfg->trace[point] += (float)pow(10.0, *values++ / 10.0);
+                cfg->trace_count[point]++;
+            }
+            break;
+
+        default:
+            return;
+        }
+
+        point++;
+    }
+
+    cfg->trace_next_bin = end;
 }
 
 
-unsigned int wsa_sweep_device_get_attenuator( struct wsa_sweep_device *sweep_device )
+///
+/// Fold a block into the display trace once the next block shows how much of it survives.
+///
+/// Neighbouring blocks overlap by a few bins, and the later block's values are the ones the
+/// spectrum buffer keeps. So a block is held back until the next one arrives, and only its
+/// bins below the next block's first bin are folded in; wsa_trace_finish() folds the last one.
+/// The held block's values must stay put until then.
+///
+/// @param[in,out] cfg The power spectrum configuration holding the trace.
+/// @param[in] first_bin Index in the full-resolution spectrum of values[0].
+/// @param[in] values The spectrum values in dBm.
+/// @param[in] count Number of values.
+///
+static void wsa_trace_defer( struct wsa_power_spectrum_config *cfg, uint32_t first_bin, float const *values, uint32_t count )
 {
-    return sweep_device->device_settings.attenuator;
+    uint32_t keep;
+
+    if (cfg->trace_pending && (first_bin > cfg->trace_pending_bin)) {
+        keep = first_bin - cfg->trace_pending_bin;
+        if (keep > cfg->trace_pending_count) {
+            keep = cfg->trace_pending_count;
+        }
+        wsa_trace_fold(cfg, cfg->trace_pending_bin, cfg->trace_pending, keep);
+    }
+
+    cfg->trace_pending = values;
+    cfg->trace_pending_bin = first_bin;
+    cfg->trace_pending_count = count;
 }
 
 
-int16_t wsa_power_spectrum_alloc( struct wsa_sweep_device *sweep_device, uint64_t fstart, uint64_t fstop,
-                                  uint32_t rbw, char const *mode, struct wsa_power_spectrum_config **pscfgptr )
+///
+/// Complete the display trace after a capture.
+///
+/// @param[in,out] cfg The power spectrum configuration holding the trace.
+///
+static void wsa_trace_finish( struct wsa_power_spectrum_config *cfg )
 {
-    struct wsa_power_spectrum_config *pscfg;
-    int16_t result;
+    uint32_t p;
 
-    uint32_t calculated_rbw = 0;
+    if (cfg->trace_pending) {
+        wsa_trace_fold(cfg, cfg->trace_pending_bin, cfg->trace_pending, cfg->trace_pending_count);
+        cfg->trace_pending = NULL;
+    }
 
-    pscfg = malloc(sizeof(struct wsa_power_spectrum_config));
-    if (pscfg == NULL) {
-        doutf(DHIGH, "wsa_power_spectrum_alloc: Failed to initialize struct wsa_power_spectrum_config\n");
-        return -15;
+    for (p = 0; p < cfg->tracelen; p++) {
+        if (cfg->trace_count[p] == 0) {
+            cfg->trace[p] = POISONED_BUFFER_VALUE;
+        } else if (cfg->trace_detector == WSA_TRACE_DETECTOR_AVERAGE) {
+            cfg->trace[p] = (float)(10.0 * log10(cfg->trace[p] / (float)cfg->trace_count[p]));
+        }
     }
+}
 
-    // Initialize a few things.
-    pscfg->sweep_plan = NULL;
-    pscfg->buf = NULL;
 
-    // Copy the sweep settings into the sweep configuration object.
-    pscfg->mode = mode_string_to_const(mode);
-    pscfg->fstart = fstart;
-    pscfg->fstop = fstop;
-    pscfg->rbw = (uint32_t)rbw;
+///
+/// Allocate a zoom pyramid for a spectrum buffer of the given length.
+///
+/// @param[in] buflen Length of the spectrum buffer.
+///
+/// @return A pointer to the allocated pyramid, or NULL if the allocation failed.
+///
+static struct wsa_spectrum_pyramid *wsa_pyramid_new( uint32_t buflen )
+{
+    struct wsa_spectrum_pyramid *pyr;
+    uint32_t len;
+    uint32_t k;
+    uint32_t nodes;
 
-    // Find a way to collect the data.
-    result = wsa_plan_sweep(sweep_device, pscfg);
-    if (result < 0) {
-        return result;
+    pyr = wsa_malloc(sizeof(struct wsa_spectrum_pyramid));
+    if (pyr == NULL) {
+        return NULL;
     }
 
-    // Now allocate enough buffer for the spectrum.
-	pscfg->buflen = (uint32_t)(((float)(pscfg->fstop_actual - pscfg->fstart_actual)) / ((float)(pscfg->rbw)));
+    // Count the levels: each one halves the previous, rounding up, down to a single node.
+    pyr->levels = 1;
+    for (len = buflen; len > 1; len = (len + 1) / 2) {
+        pyr->levels++;
+    }
 
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "actual fstart = %llu, actual fstop = %llu, rbw = %llu", pscfg->fstart_actual, pscfg->fstop_actual, pscfg->rbw);
-    doutf(DHIGH, "wsa_power_spectrum_alloc: Calculated Buffer length to be: %d\n", pscfg->buflen);
-    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "buflen = %lu", pscfg->buflen);
+    pyr->level_len = wsa_malloc(sizeof(uint32_t) * pyr->levels);
+    pyr->level_offset = wsa_malloc(sizeof(uint32_t) * pyr->levels);
+    if (pyr->level_len == NULL || pyr->level_offset == NULL) {
+        wsa_free(pyr->level_len);
+        wsa_free(pyr->level_offset);
+        wsa_free(pyr);
+        return NULL;
+    }
 
-    // Allocate data to the buffer.
-    pscfg->buf = malloc(sizeof(float) * pscfg->buflen);
+    // Level 0 is the spectrum buffer itself, so node storage starts with level 1.
+    nodes = 0;
+    pyr->level_len[0] = buflen;
+    pyr->level_offset[0] = 0;
+    for (k = 1; k < pyr->levels; k++) {
+        pyr->level_len[k] = (pyr->level_len[k - 1] + 1) / 2;
+        pyr->level_offset[k] = nodes;
+        nodes += pyr->level_len[k];
+    }
 
-    if (pscfg->buf == NULL) {
-        DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "?? Malloc failed for pscfg->buf");
-        free(pscfg);
-        return -1;
+    pyr->min = wsa_malloc(sizeof(float) * (nodes ? nodes : 1));
+    pyr->max = wsa_malloc(sizeof(float) * (nodes ? nodes : 1));
+    pyr->sum = wsa_malloc(sizeof(float) * (nodes ? nodes : 1));
+    if (pyr->min == NULL || pyr->max == NULL || pyr->sum == NULL) {
+        wsa_free(pyr->min);
+        wsa_free(pyr->max);
+        wsa_free(pyr->sum);
+        wsa_free(pyr->level_len);
+        wsa_free(pyr->level_offset);
+        wsa_free(pyr);
+        return NULL;
     }
 
-    *pscfgptr = pscfg;
-    return 0;
+    return pyr;
 }
 
 
-void wsa_power_spectrum_free( struct wsa_power_spectrum_config *cfg )
+///
+/// Free a zoom pyramid.
+///
+/// @param[in] pyr The pyramid to free, may be NULL.
+///
+static void wsa_pyramid_free( struct wsa_spectrum_pyramid *pyr )
 {
-    struct wsa_sweep_plan *plan, *next;
+    if (pyr == NULL) {
+        return;
+    }
 
-    // Free the plan, if there is one.
-    plan = cfg->sweep_plan;
-    for (;;) {
+    wsa_free(pyr->min);
+    wsa_free(pyr->max);
+    wsa_free(pyr->sum);
+    wsa_free(pyr->level_len);
+    wsa_free(pyr->level_offset);
+    wsa_free(pyr);
+}
 
-        // List is null terminated.
-        if (plan == NULL)
-            break;
 
-        // Store next pointer before freeing.
-        next = plan->next_entry;
+///
+/// Rebuild the pyramid nodes above a run of freshly written spectrum bins.
+///
+/// Each level only touches the parents of the nodes changed in the level below,
+/// so the cost is proportional to the number of bins written.
+///
+/// @param[in,out] pyr The pyramid to update.
+/// @param[in] buf The spectrum buffer (level 0).
+/// @param[in] first_bin Index of the first bin written.
+/// @param[in] count Number of bins written.
+///
+static void wsa_pyramid_update( struct wsa_spectrum_pyramid *pyr, float const *buf, uint32_t first_bin, uint32_t count )
+{
+    float const *cmin, *cmax, *csum;	// Child level
+    float *pmin, *pmax, *psum;			// Parent level
+    uint32_t lo, hi;
+    uint32_t k, j;
+    uint32_t c;
+
+    if (count == 0) {
+        return;
+    }
 
-        // Free the memory.
-        free(plan);
+    lo = first_bin;
+    hi = first_bin + count - 1;
+
+    cmin = buf;
+    cmax = buf;
+    csum = buf;
+
+    for (k = 1; k < pyr->levels; k++) {
+
+        lo >>= 1;
+        hi >>= 1;
+
+        pmin = pyr->min + pyr->level_offset[k];
+        pmax = pyr->max + pyr->level_offset[k];
+        psum = pyr->sum + pyr->level_offset[k];
+
+        for (j = lo; j <= hi; j++) {
+            c = 2 * j;
+            if (c + 1 < pyr->level_len[k - 1]) {
+                pmin[j] = (cmin[c] < cmin[c + 1]) ? cmin[c] : cmin[c + 1];
+                pmax[j] = (cmax[c] > cmax[c + 1]) ? cmax[c] : cmax[c + 1];
+                psum[j] = csum[c] + csum[c + 1];
+            } else {
+                // Odd node out at the end of the level.
+                pmin[j] = cmin[c];
+                pmax[j] = cmax[c];
+                psum[j] = csum[c];
+            }
+        }
 
-        // Go to the next item.
-        plan = next;
+        cmin = pmin;
+        cmax = pmax;
+        csum = psum;
     }
+}
 
-    // Free the buffer.
-    if (cfg->buf) {
-        free(cfg->buf);
+
+///
+/// Pass a run of freshly written spectrum bins to whatever derived views are enabled.
+///
+/// @param[in,out] cfg The power spectrum configuration being captured.
+/// @param[in] first_bin Index in the full-resolution spectrum of values[0].
+/// @param[in] values The spectrum values in dBm, either in cfg->buf or in scratch space.
+/// @param[in] count Number of values.
+///
+static void wsa_block_written( struct wsa_power_spectrum_config *cfg, uint32_t first_bin, float const *values, uint32_t count )
+{
+    if (cfg->trace) {
+        wsa_trace_defer(cfg, first_bin, values, count);
     }
 
-    // Free the struct.
-    free(cfg);
+    if (cfg->pyramid && cfg->buf) {
+        wsa_pyramid_update(cfg->pyramid, cfg->buf, first_bin, count);
+    }
 }
 
 
-int16_t wsa_configure_sweep(struct wsa_sweep_device *sweep_device, struct wsa_power_spectrum_config *pscfg)
+///
+/// Convert a bin index in the power spectrum buffer to its frequency.
+///
+/// @param[in] band The band the bin belongs to.
+/// @param[in] bin The bin index in the whole buffer, up to and including the end of the band.
+///
+/// @return The frequency in Hz.
+///
+static uint64_t wsa_bin_to_freq( struct wsa_sweep_band const *band, uint32_t bin )
 {
-    int16_t result = 0;
-
-    // Load the sweep plan.
-    result = wsa_sweep_plan_load(sweep_device, pscfg);
+    if (band->bin_count == 0) {
+        return band->fstart_actual;
+    }
 
-    return result;
+    return band->fstart_actual + (uint64_t)((double)(bin - band->bin_offset) * (double)(band->fstop_actual - band->fstart_actual)
+                                            / (double)band->bin_count);
 }
 
 
-int16_t wsa_capture_power_spectrum(struct wsa_sweep_device *sweep_device,
-                                   struct wsa_power_spectrum_config *cfg, float **buf)
+///
+/// Collect the packets of one sweep from a device that is already sweeping, and assemble the power spectrum.
+///
+/// @param[in] sweep_device The sweep device to read from.
+/// @param[in,out] cfg The power spectrum configuration to use.
+/// @param[out] out Where to write the full-resolution spectrum (cfg->buflen values), or NULL to keep none.
+/// @param[in] update_views Non-zero to also update the display trace and zoom pyramid; out must then be cfg->buf.
+/// @param[out] first_ts Timestamp of the first data packet of the sweep, or NULL if not wanted.
+/// @param[out] last_ts Timestamp of the last data packet of the sweep, or NULL if not wanted.
+/// @param[out] segments Receives cfg->segment_count block metadata entries, or NULL if not wanted.
+/// @param[in,out] ring In continuous mode, the ring whose sweep start id marks where each sweep begins; NULL for a
+///                     single sweep.
+///
+/// In continuous mode, packets are skipped until the extension packet carrying the ring's sweep start id, so every
+/// sweep is lined up on the device's own marker rather than on a packet count. A sweep that shows a gap in any
+/// stream (see WSA_GAP_*), or is cut short by the next sweep's marker, is given up as -ESWEEPDAMAGED.
+///
+/// @returns A negative error code if an error occurred, otherwise zero to indicate success.
+///
+static int16_t wsa_collect_sweep( struct wsa_sweep_device *sweep_device, struct wsa_power_spectrum_config *cfg, float *out,
+                                  uint8_t update_views, struct wsa_time *first_ts, struct wsa_time *last_ts,
+                                  struct wsa_spectrum_segment *segments, struct wsa_spectrum_ring *ring )
 {
 
     uint32_t const spectrum_samples = cfg->samples_per_packet * cfg->packet_total;		// Samples in the whole spectrum
@@ -693,12 +983,18 @@ int16_t wsa_capture_power_spectrum(struct wsa_sweep_device *sweep_device,
 
     struct wsa_device * const dev = sweep_device->real_device;
 
-    struct wsa_sweep_device_properties_t *prop;			// Device properties for mode of sweep
-    struct wsa_sweep_device_properties_t *dd_prop;		// Device properties for DD mode
+    const struct wsa_sweep_device_properties_t *prop;			// Device properties for mode of sweep
+    const struct wsa_sweep_device_properties_t *dd_prop;		// Device properties for DD mode
 
     kiss_fft_scalar *idata;		// Input to FFT
     kiss_fft_cpx *fftout;		// Output from FFT
     kiss_fft_scalar tmpscalar;
+    float *blockbuf = NULL;		// Scratch output for two blocks when only a trace is kept
+    uint32_t scratch = 0;		// Which half of blockbuf the next block goes to
+    float *dst;					// Where the current block's spectrum is written
+    struct wsa_spectrum_segment *seg = NULL;	// Metadata for the current block
+    struct wsa_sweep_band *band = cfg->bands;	// Band the current block belongs to
+    uint32_t band_end;							// One past the band's last bin
 
     struct wsa_vrt_packet_header header;
     struct wsa_vrt_packet_trailer trailer;
@@ -724,26 +1020,49 @@ int16_t wsa_capture_power_spectrum(struct wsa_sweep_device *sweep_device,
     uint32_t offset;
     uint32_t tmp_u32;
     uint32_t total_samples = 0;
+    uint32_t block_index;
+    uint32_t seg_skip;			// Segments of the shared DD block beyond its first
 
     int16_t result;
     int16_t dd_packet = 0;
 
-    // Allocate space for each data buffer.
-    // TODO: Check for malloc() returning NULL everywhere, even though this should never happen.
-    tmp_buffer = (int16_t *)malloc(sizeof(int16_t) * cfg->samples_per_packet);			// Buffer to hold one packet's data.
-    idata = (kiss_fft_scalar *)malloc(sizeof(kiss_fft_scalar) * block_samples);			// Buffer to hold one block (time domain).
-    fftout = (kiss_fft_cpx *)malloc(sizeof(kiss_fft_cpx) * block_samples);				// Buffer to hold one block (freq domain).
-    doutf(DMED, "wsa_capture_power_spectrum: Created data buffers, block size is %lu\n", block_samples);
+    struct wsa_sweep_timing * const timing = cfg->timing;	// Stage times, if wanted
+    uint64_t t0 = 0;
+    uint64_t elapsed;
 
-    // Assign the caller's convenience pointer.
-    if (*buf) {
-        *buf = cfg->buf;
+    // Allocate space for each data buffer.
+    tmp_buffer = (int16_t *)wsa_malloc(sizeof(int16_t) * cfg->samples_per_packet);			// Buffer to hold one packet's data.
+    idata = (kiss_fft_scalar *)wsa_malloc_aligned(sizeof(kiss_fft_scalar) * block_samples, WSA_ALLOC_ALIGN);			// Buffer to hold one block (time domain).
+    fftout = (kiss_fft_cpx *)wsa_malloc_aligned(sizeof(kiss_fft_cpx) * block_samples, WSA_ALLOC_ALIGN);				// Buffer to hold one block (freq domain).
+    if (out == NULL) {
+        // Two halves, so the block the trace is holding back survives the next one (see wsa_trace_defer()).
+        blockbuf = (float *)wsa_malloc_aligned(sizeof(float) * block_samples, WSA_ALLOC_ALIGN);
     }
+    if (!tmp_buffer || !idata || !fftout || (out == NULL && !blockbuf)) {
+        doutf(DHIGH, "wsa_collect_sweep: out of memory for block buffers\n");
+        wsa_free(fftout);
+        wsa_free(idata);
+        wsa_free(tmp_buffer);
+        wsa_free(blockbuf);
+        return WSA_ERR_MALLOCFAILED;
+    }
+    doutf(DMED, "wsa_capture_power_spectrum: Created data buffers, block size is %u\n", (unsigned)block_samples);
 
     // Poison our buffer.
     // Buflen is the length of the complete power spectrum buffer, i.e. (fstop - fstart) / rbw.
-    for (i = 0; i < cfg->buflen; i++) {
-        cfg->buf[i] = POISONED_BUFFER_VALUE;
+    if (out) {
+        for (i = 0; i < cfg->buflen; i++) {
+            out[i] = POISONED_BUFFER_VALUE;
+        }
+    }
+    if (update_views && cfg->trace) {
+        wsa_trace_reset(cfg);
+    }
+    if (segments) {
+        memset(segments, 0, sizeof(struct wsa_spectrum_segment) * cfg->segment_count);
+    }
+    if (update_views && cfg->pyramid && cfg->buf) {
+        wsa_pyramid_update(cfg->pyramid, cfg->buf, 0, cfg->buflen);
     }
 
     // Get device properties for this mode.
@@ -751,25 +1070,21 @@ int16_t wsa_capture_power_spectrum(struct wsa_sweep_device *sweep_device,
     if (prop == NULL) {
         doutf(DHIGH, "Unsupported RFE mode: %d - %s\n", cfg->mode, mode_const_to_string(cfg->mode));
 		// Fixed possible memory leak. 20171124 <rick.low@thinkrf.com>
-		free(fftout);
-		free(idata);
-		free(tmp_buffer);
+		wsa_free(fftout);
+		wsa_free(idata);
+		wsa_free(tmp_buffer);
+		wsa_free(blockbuf);
         return -EUNSUPPORTED;
     }
 
     // Get the properties for DD mode.
     dd_prop = wsa_get_sweep_device_properties(MODE_DD);
 
-    // Start the sweep.
-    result = wsa_sweep_start(sweep_device->real_device);
-	if (result < 0) {
-		doutf(DHIGH, "wsa_sweep_start() returned error %d\n", result);
-		free(fftout);
-		free(idata);
-		free(tmp_buffer);
-		return result;
-	}
-    doutf(DMED, "wsa_capture_power_spectrum() Sweep started.\n");
+    // Every band below the DD cutoff is cut from the one DD block, into a segment of its own.
+    seg_skip = 0;
+    while ((seg_skip + 1 < cfg->band_count) && cfg->bands[seg_skip + 1].dd_mode) {
+        seg_skip++;
+    }
 
     // PROCESS PACKETS OF INTEREST
 
@@ -779,13 +1094,26 @@ int16_t wsa_capture_power_spectrum(struct wsa_sweep_device *sweep_device,
 
     do {
 
+        // Move on to the next band once we're past the blocks of this one.
+        // Blocks arrive in sweep list order, i.e. band by band.
+        block_index = total_packet_count / cfg->packets_per_block;
+        while ((band + 1 < cfg->bands + cfg->band_count) &&
+               (block_index >= band->block_offset + band->block_count)) {
+            band++;
+        }
+        band_end = band->bin_offset + band->bin_count;
+
         // Check if we're expecting a DD mode block.
-        // It will be the first block.
-        dd_packet = ((total_packet_count < cfg->packets_per_block) && (cfg->sweep_plan->dd_mode == 1)) ? 1 : 0;
+        // Only the lowest bands need one, so it is always the first block of the sweep.
+        dd_packet = ((block_index == 0) && (cfg->bands[0].dd_mode == 1)) ? 1 : 0;
 
         // Read the next packet.
-		result = wsa_read_vrt_packet(dev, &header, &trailer, &receiver, &digitizer, &sweep,
-			tmp_buffer, q16_buffer, i32_buffer, cfg->samples_per_packet, TIMEOUT_5S);
+		result = wsa_read_vrt_packet_timed(dev, &header, &trailer, &receiver, &digitizer, &sweep,
+			tmp_buffer, q16_buffer, i32_buffer, cfg->samples_per_packet, TIMEOUT_5S,
+			timing ? &timing->wait_ns : NULL, timing ? &timing->decode_ns : NULL);
+        if (timing) {
+            timing->packets++;
+        }
 
 		if (result < 0) {
 
@@ -793,15 +1121,45 @@ int16_t wsa_capture_power_spectrum(struct wsa_sweep_device *sweep_device,
             doutf(DHIGH, "wsa_read_vrt_packet() returned error %d\n", result);
 
  			// Fixed possible memory leak. 20171124 <rick.low@thinkrf.com>
-			free(fftout);
-			free(idata);
-			free(tmp_buffer);
+			wsa_free(fftout);
+			wsa_free(idata);
+			wsa_free(tmp_buffer);
+			wsa_free(blockbuf);
 
 			// We will return with the work incomplete.
 			// The caller should detect the error code and take action.
 			return result;
         }
 
+        // In continuous mode, line the sweep up on the device's sweep start marker.
+        if (ring) {
+            if ((header.packet_type == EXTENSION_PACKET_TYPE) &&
+                ((sweep.indicator_field & SWEEP_START_ID_INDICATOR_MASK) == SWEEP_START_ID_INDICATOR_MASK) &&
+                (sweep.sweep_start_id == ring->start_id)) {
+                if (ring->synced) {
+                    // The next sweep has begun before this one was complete; the marker is its start.
+                    doutf(DMED, "wsa_collect_sweep: sweep cut short after %u of %u data packets\n",
+                          (unsigned)total_packet_count, (unsigned)cfg->packet_total);
+                    result = -ESWEEPDAMAGED;
+                    break;
+                }
+                ring->synced = 1;
+                continue;
+            }
+            if (!ring->synced) {
+                // The rest of a sweep already given up on.
+                continue;
+            }
+            if (header.gap) {
+                // Skip to the next marker rather than assemble a spectrum from the wrong blocks.
+                doutf(DMED, "wsa_collect_sweep: gap 0x%x in stream 0x%x, sweep dropped\n",
+                      (unsigned)header.gap, (unsigned)header.stream_id);
+                ring->synced = 0;
+                result = -ESWEEPDAMAGED;
+                break;
+            }
+        }
+
         //  Watch for the receiver context packets we need...
         if ((header.packet_type == CONTEXT_PACKET_TYPE) && (header.stream_id == RECEIVER_STREAM_ID)) {
 
@@ -810,11 +1168,11 @@ int16_t wsa_capture_power_spectrum(struct wsa_sweep_device *sweep_device,
                 pkt_fcenter = (uint64_t)receiver.freq;
 
 				// Clamp the centre frequency in case we get one that is out of range.
-				if (pkt_fcenter < cfg->fstart_actual) {
-					pkt_fcenter = cfg->fstart_actual;
+				if (pkt_fcenter < band->fstart_actual) {
+					pkt_fcenter = band->fstart_actual;
 				}
-				else if (pkt_fcenter > cfg->fstop_actual) {
-					pkt_fcenter = cfg->fstop_actual;
+				else if (pkt_fcenter > band->fstop_actual) {
+					pkt_fcenter = band->fstop_actual;
 				}
 
                 // TODO Check that this center frequency does not ever change over one block.
@@ -835,17 +1193,45 @@ int16_t wsa_capture_power_spectrum(struct wsa_sweep_device *sweep_device,
 
             pkt_reflevel = (float)digitizer.reference_level;
 
+            if (first_ts && (total_packet_count == 0)) {
+                *first_ts = header.time_stamp;
+            }
+            if (last_ts) {
+                *last_ts = header.time_stamp;
+            }
+
+            // Keep the block's metadata as its packets go by.
+            tmp_u32 = (block_index > 0) ? block_index + seg_skip : 0;
+            if (segments && (tmp_u32 < cfg->segment_count)) {
+                seg = &segments[tmp_u32];
+                if (packet_count_this_block == 0) {
+                    seg->timestamp = header.time_stamp;
+                    seg->fcenter = pkt_fcenter;
+                }
+                seg->over_range |= trailer.over_range_indicator;
+                seg->sample_loss |= trailer.sample_loss_indicator;
+                seg->spectral_inversion |= trailer.spectral_inversion_indicator;
+            } else {
+                seg = NULL;
+            }
+
             // Move incoming data into the FFT input buffer at the correct
             // location and convert to range [-1.0, +1.0].
+            if (timing) {
+                t0 = wsa_clock_ns();
+            }
             offset = packet_count_this_block * cfg->samples_per_packet;
             for (i = 0; i < (int)cfg->samples_per_packet; i++) {
                 idata[offset + i] = (float)tmp_buffer[i] / 8192.0f;			// TODO: Check this math is done correctly.
             }
+            if (timing) {
+                timing->decode_ns += wsa_clock_ns() - t0;
+            }
 
             packet_count_this_block++;
             total_packet_count++;
 
-            DEBUG_PRINTF(DEBUG_COLLECT, "Received data packet %lu at %llu Hz.", total_packet_count, pkt_fcenter);
+            DEBUG_PRINTF(DEBUG_COLLECT, "Received data packet %u at %llu Hz.", (unsigned)total_packet_count, pkt_fcenter);
 
             // If we're done a block, process it.
             if (packet_count_this_block >= cfg->packets_per_block) {
@@ -853,7 +1239,7 @@ int16_t wsa_capture_power_spectrum(struct wsa_sweep_device *sweep_device,
                 packet_count_this_block = 0;
 
                 samples_per_block = header.samples_per_packet * cfg->packets_per_block;
-                DEBUG_PRINTF(DEBUG_COLLECT, "Processing a block, length = %lu samples.", samples_per_block);
+                DEBUG_PRINTF(DEBUG_COLLECT, "Processing a block, length = %u samples.", (unsigned)samples_per_block);
 
                 // TODO: Remove the need to keep two sets of books?
                 // Cfg->samples_per_packet should be identical to header.samples_per_packet.
@@ -864,109 +1250,162 @@ int16_t wsa_capture_power_spectrum(struct wsa_sweep_device *sweep_device,
                 // Window and normalize the data. We only support Hanning window for now.
                 // TODO: Speed up windowing if possible.
                 // TODO: Add more window types.
+                t0 = wsa_clock_ns();
                 window_hanning_scalar_array(idata, samples_per_block);
+                elapsed = wsa_clock_ns() - t0;
+                wsa_stats_time(&dev->stats, WSA_STAT_WINDOW_TIME, elapsed);
+                if (timing) {
+                    timing->window_ns += elapsed;
+                }
 
                 // Transform to frequency domain.
                 // TODO: Check how we can speed up the FFT.
                 // TODO: Check if we can zero-pad after windowing and use only radix-2 FFTs.
+                t0 = wsa_clock_ns();
                 rfft(idata, fftout, samples_per_block);
+                elapsed = wsa_clock_ns() - t0;
+                wsa_stats_time(&dev->stats, WSA_STAT_FFT_TIME, elapsed);
+                if (timing) {
+                    timing->fft_ns += elapsed;
+                    timing->blocks++;
+                }
 
                 // Real input data, so only half the FFT output data is needed.
                 // We doubled this up back in wsa_plan_sweep() when we realized we were only going to use SH or SHN modes.
                 fftlen = samples_per_block / 2;
-                DEBUG_PRINTF(DEBUG_COLLECT, "FFT length = %lu", fftlen);
+                DEBUG_PRINTF(DEBUG_COLLECT, "FFT length = %u", (unsigned)fftlen);
 
-                // Extract the correct slice of spectrum data.
-                if (0 == dd_packet) {
+                // A DD block is split between all the bands below the DD cutoff, each into its own bins
+                // and segment, so go round once per band for it.
+                for (;;) {
 
-                    // Non-DD Mode
+                    // Extract the correct slice of spectrum data.
+                    if (0 == dd_packet) {
 
-                    // Calculate indices of the slice of data we want.
-                    if (trailer.spectral_inversion_indicator) {
+                        // Non-DD Mode
 
-                        // Spectral inversion, so reverse the data.
-                        reverse_cpx(fftout, fftlen);		// At this point fftlen is only the lower half of the spectrum data.
+                        // Calculate indices of the slice of data we want.
+                        if (trailer.spectral_inversion_indicator) {
 
-                        // Now the start index is the width of the upper skirt band up from the bottom,
-                        // and the end is the width of the lower skirt band up down from the upper end.
-                        // E.g. with full BW = 62.5 MHz, lower edge at 15 and upper edge at 55,
-                        //     - start index is (62.5 - 55) / 62.5 X data length, and
-                        //     - stop index is (62.5 - 15 / 62.5) X data length.
-                        // Use rounding, not truncation.
-                        istart = (uint32_t)(((float)fftlen + 0.5f) * (float)(prop->full_bw - prop->usable_right) / (float)prop->full_bw);
-                        istop = (uint32_t)(((float)fftlen + 0.5f) * (float)(prop->full_bw - prop->usable_left) / (float)prop->full_bw);
-                        DEBUG_PRINTF(DEBUG_COLLECT, "Non-DD, inverted spectrum. istart = %u, istop = %u", istart, istop);
+                            // Spectral inversion, so reverse the data.
+                            reverse_cpx(fftout, fftlen);		// At this point fftlen is only the lower half of the spectrum data.
 
-                    } else {
+                            // Now the start index is the width of the upper skirt band up from the bottom,
+                            // and the end is the width of the lower skirt band up down from the upper end.
+                            // E.g. with full BW = 62.5 MHz, lower edge at 15 and upper edge at 55,
+                            //     - start index is (62.5 - 55) / 62.5 X data length, and
+                            //     - stop index is (62.5 - 15 / 62.5) X data length.
+                            // Use rounding, not truncation.
+                            istart = (uint32_t)(((float)fftlen + 0.5f) * (float)(prop->full_bw - prop->usable_right) / (float)prop->full_bw);
+                            istop = (uint32_t)(((float)fftlen + 0.5f) * (float)(prop->full_bw - prop->usable_left) / (float)prop->full_bw);
+                            DEBUG_PRINTF(DEBUG_COLLECT, "Non-DD, inverted spectrum. istart = %u, istop = %u", (unsigned)istart, (unsigned)istop);
 
-                        // Normal data, so the start is "usable_left" up from the bottom,
-                        // and the end is "usable_right" down from the top.
-                        // Use rounding, not truncation.
-                        istart = (uint32_t)(((float)fftlen + 0.5f) * (float)prop->usable_left / (float)prop->full_bw);
-                        istop = (uint32_t)(((float)fftlen + 0.5f) * (float)prop->usable_right / (float)prop->full_bw);
+                        } else {
 
-                        DEBUG_PRINTF(DEBUG_COLLECT, "Non-DD, normal spectrum. istart = %lu, istop = %lu", istart, istop);
+                            // Normal data, so the start is "usable_left" up from the bottom,
+                            // and the end is "usable_right" down from the top.
+                            // Use rounding, not truncation.
+                            istart = (uint32_t)(((float)fftlen + 0.5f) * (float)prop->usable_left / (float)prop->full_bw);
+                            istop = (uint32_t)(((float)fftlen + 0.5f) * (float)prop->usable_right / (float)prop->full_bw);
 
-                    }
+                            DEBUG_PRINTF(DEBUG_COLLECT, "Non-DD, normal spectrum. istart = %u, istop = %u", (unsigned)istart, (unsigned)istop);
+
+                        }
+
+                        ilen = istop - istart;
+                        assert(ilen < fftlen);
+                        DEBUG_PRINTF(DEBUG_COLLECT, "ilen = %u", (unsigned)ilen);
+
+                        // Now calculate where that slice has to go in the power spectrum output buffer,
+                        // based on the centre frequency of this block reported by the device.
+                        // We will probably overwrite some previously written data and that is OK.
+                        // Make sure we don't underflow with the first buffer.
+                        //
+                        tmp_float = (float)(pkt_fcenter - band->fstart_actual) / (float)(band->fstop_actual - band->fstart_actual);	// Fraction of the band
+                        tmp_float *= (float)(band->bin_count);													// Fraction of the band's bins
+                        tmp_u32 = (uint32_t)(tmp_float + 0.5f);													// Rounded up
+                        if (tmp_u32 < (ilen / 2)) {
+                            buf_offset = band->bin_offset;
+                        } else {
+                            buf_offset = band->bin_offset + tmp_u32 - ilen / 2;		// We just computed offset of centre of packet. Find offset of lower edge.
+                        }
+
+                        assert((buf_offset >= 0) && (buf_offset < cfg->buflen));
 
-                    ilen = istop - istart;
-                    assert(ilen < fftlen);
-                    DEBUG_PRINTF(DEBUG_COLLECT, "ilen = %lu", ilen);
-
-                    // Now calculate where that slice has to go in the power spectrum output buffer,
-                    // based on the centre frequency of this block reported by the device.
-                    // We will probably overwrite some previously written data and that is OK.
-                    // Make sure we don't underflow with the first buffer.
-                    //
-                    tmp_float = (float)(pkt_fcenter - cfg->fstart_actual) / (float)(cfg->fstop_actual - cfg->fstart_actual);		// Fraction of the sweep
-                    tmp_float *= (float)(cfg->buflen);														// Fraction of the buffer
-                    tmp_u32 = (uint32_t)(tmp_float + 0.5f);													// Rounded up
-                    if (tmp_u32 < (ilen / 2)) {
-                        buf_offset = 0;
                     } else {
-                        buf_offset = tmp_u32 - ilen / 2;		// We just computed offset of centre of packet. Find offset of lower edge.
-                    }
 
-                    assert((buf_offset >= 0) && (buf_offset < cfg->buflen));
+                        // DD Mode
 
-				} else {
+                        istart = (uint32_t)(((float)fftlen + 0.5f) * (float)band->fstart / (float)prop->full_bw);
+
+                        // Fstart is the original start freq for the band, unlike fcstart.
+
+                        // If fstop is higher than the upper edge of DD band (50MHz), then for
+                        // a DD mode segment, just take data up to that band edge.
+                        // This point in the FFT data will be 50 MHz / 62.5 MHz, or at 0.8 of the buffer.
+                        if (band->fstop > prop->min_tunable) {
+                            istop = (uint32_t)(0.8f * ((float)fftlen + 0.5f));
+                        } else {
+                            istop = (uint32_t)(((float)fftlen + 0.5f) * (float)band->fstop / (float)prop->full_bw);
+                        }
 
-                    // DD Mode
+                        ilen = istop - istart;
+                        assert(ilen < fftlen);
 
-                    istart = (uint32_t)(((float)fftlen + 0.5f) * (float)cfg->fstart / (float)prop->full_bw);
+                        buf_offset = band->bin_offset;		// Target for DD mode spectral data is always the first part of the band.
+                        DEBUG_PRINTF(DEBUG_COLLECT, "DD, normal spectrum. istart = %u, istop = %u, ilen = %u", (unsigned)istart, (unsigned)istop, (unsigned)ilen);
 
-                    // Fstart is the original start freq for the sweep, unlike fcstart.
+                    }
 
-                    // If fstop is higher than the upper edge of DD band (50MHz), then for
-                    // a DD mode segment, just take data up to that band edge.
-                    // This point in the FFT data will be 50 MHz / 62.5 MHz, or at 0.8 of the buffer.
-                    if (cfg->fstop > prop->min_tunable) {
-                        istop = (uint32_t)(0.8f * ((float)fftlen + 0.5f));
+                    // For the usable section, convert to power, apply reflevel and copy into buffer.
+                    // Loop until end of input data or end of the band's part of the output buffer, whichever comes first.
+                    // Without a full-resolution buffer the block goes to scratch space and only feeds the trace.
+                    t0 = wsa_clock_ns();
+                    if (out) {
+                        dst = out + buf_offset;
                     } else {
-                        istop = (uint32_t)(((float)fftlen + 0.5f) * (float)cfg->fstop / (float)prop->full_bw);
+                        dst = blockbuf + scratch * (block_samples / 2);
+                        scratch ^= 1;
+                    }
+                    for (i = 0; ((i < ilen) && (buf_offset + i < band_end)); i++) {
+                        tmpscalar = cpx_to_power(fftout[i + istart]) / samples_per_block;
+                        tmpscalar = 2 * power_to_logpower(tmpscalar);
+                        dst[i] = tmpscalar + pkt_reflevel - (float)KISS_FFT_OFFSET;
+                    }
+                    elapsed = wsa_clock_ns() - t0;
+                    wsa_stats_time(&dev->stats, WSA_STAT_LOG_TIME, elapsed);
+                    if (timing) {
+                        timing->log_ns += elapsed;
                     }
 
-                    ilen = istop - istart;
-                    assert(ilen < fftlen);
+                    if (update_views) {
+                        wsa_block_written(cfg, buf_offset, dst, i);
+                    }
 
-                    buf_offset = 0;				// Target for DD mode spectral data is always the first part of the output buffer.
-                    DEBUG_PRINTF(DEBUG_COLLECT, "DD, normal spectrum. istart = %lu, istop = %lu, ilen = %lu", istart, istop, ilen);
+                    if (seg) {
+                        seg->bin_offset = buf_offset;
+                        seg->bin_count = i;
+                        seg->fstart = wsa_bin_to_freq(band, buf_offset);
+                        seg->fstop = wsa_bin_to_freq(band, buf_offset + i);
+                        seg->reflevel = pkt_reflevel;
+                    }
 
-                }
+                    // Keep track of total number of spectrum samples (bins).
+                    // TODO: Confirm assumption of monotonically increasing buf_offset, with no holes in the spectral data, i.e. blocks have
+                    //       steadily increasing centre frequency, and new data always overwrites a bit of the old or exactly abuts.
+                    total_samples = buf_offset + i;
 
-                // For the usable section, convert to power, apply reflevel and copy into buffer.
-                // Loop until end of input data or end of output buffer, whichever comes first.
-                for (i = 0; ((i < ilen) && (buf_offset + i < cfg->buflen)); i++) {
-                    tmpscalar = cpx_to_power(fftout[i + istart]) / samples_per_block;
-                    tmpscalar = 2 * power_to_logpower(tmpscalar);
-                    cfg->buf[buf_offset + i] = tmpscalar + pkt_reflevel - (float)KISS_FFT_OFFSET;
+                    if (!dd_packet || (band + 1 >= cfg->bands + cfg->band_count) || !band[1].dd_mode) {
+                        break;
+                    }
+                    band++;
+                    band_end = band->bin_offset + band->bin_count;
+                    if (seg) {
+                        seg[1] = seg[0];
+                        seg++;
+                    }
                 }
 
-                // Keep track of total number of spectrum samples (bins).
-                // TODO: Confirm assumption of monotonically increasing buf_offset, with no holes in the spectral data, i.e. blocks have
-                //       steadily increasing centre frequency, and new data always overwrites a bit of the old or exactly abuts.
-                total_samples = buf_offset + i;
-
             }	// endif (ppb count == PPB)
 
         }	// dnd if (header type == IF_PACKET_TYPE)
@@ -977,7 +1416,28 @@ int16_t wsa_capture_power_spectrum(struct wsa_sweep_device *sweep_device,
 
     } while (total_packet_count < cfg->packet_total);
 
-    DEBUG_PRINTF(DEBUG_COLLECT, "total_samples = %lu", total_samples);
+    if (result == -ESWEEPDAMAGED) {
+        wsa_free(fftout);
+        wsa_free(idata);
+        wsa_free(tmp_buffer);
+        wsa_free(blockbuf);
+        return result;
+    }
+
+    // The next sweep waits for its own marker.
+    if (ring) {
+        ring->synced = 0;
+    }
+
+    DEBUG_PRINTF(DEBUG_COLLECT, "total_samples = %u", (unsigned)total_samples);
+
+    if (timing) {
+        timing->sweeps++;
+    }
+
+    if (update_views && cfg->trace) {
+        wsa_trace_finish(cfg);
+    }
 
 	//*** Heavyweight resync don@bearanascence.com 16Nov17
 	{
@@ -993,7 +1453,7 @@ int16_t wsa_capture_power_spectrum(struct wsa_sweep_device *sweep_device,
 	//*** end of heavyweight resync
 
 	//*** Poison-search in buffer don@bearanascence.com 16Nov17
-	{
+	if (out) {
 		// if total_samples != cfg->buflen, we know we are in trouble...
 		int iPoisonFound = 0;	// Total poison values found
 		int iPoisonRunStart = 0;	// Start index of most recently found run
@@ -1001,7 +1461,7 @@ int16_t wsa_capture_power_spectrum(struct wsa_sweep_device *sweep_device,
 		int bInPoison = 0;	// Interpret boolean
         unsigned int i;
 		for (i = 0; i < cfg->buflen; i++) {
-			if (POISONED_BUFFER_VALUE == cfg->buf[i]) {
+			if (POISONED_BUFFER_VALUE == out[i]) {
 				iPoisonFound++;
 				if (0 == bInPoison) {
 					bInPoison = 1;
@@ -1020,15 +1480,734 @@ int16_t wsa_capture_power_spectrum(struct wsa_sweep_device *sweep_device,
 	}
 	//*** End of poison-search
 
-    free(fftout);
-    free(idata);
-    free(tmp_buffer);
+    wsa_free(fftout);
+    wsa_free(idata);
+    wsa_free(tmp_buffer);
+    wsa_free(blockbuf);
 
-	doutf(DMED, "wsa_capture_power_spectrum() Sweep finished with no errors.\n");
+	doutf(DMED, "wsa_collect_sweep() Sweep finished with no errors.\n");
 
 	return 0;
 }
 
+
+///
+/// Free a ring of spectrum frames.
+///
+/// @param[in] ring The ring to free, may be NULL.
+///
+static void wsa_spectrum_ring_free( struct wsa_spectrum_ring *ring )
+{
+    if (ring == NULL) {
+        return;
+    }
+
+    wsa_free(ring->data);
+    wsa_free(ring->info);
+    wsa_free((void *)ring->seq);
+    wsa_free(ring->segments);
+    wsa_free(ring);
+}
+
+
+///
+/// Allocate a ring of spectrum frames.
+///
+/// @param[in] nframes Number of frames.
+/// @param[in] buflen Number of values in each frame.
+/// @param[in] segment_count Number of block metadata entries in each frame.
+///
+/// @return A pointer to the allocated ring, or NULL if the allocation failed.
+///
+static struct wsa_spectrum_ring *wsa_spectrum_ring_new( uint32_t nframes, uint32_t buflen, uint32_t segment_count )
+{
+    struct wsa_spectrum_ring *ring;
+    uint32_t f;
+
+    ring = wsa_malloc(sizeof(struct wsa_spectrum_ring));
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    ring->nframes = nframes;
+    ring->data = wsa_malloc_aligned(sizeof(float) * (size_t)nframes * buflen, WSA_ALLOC_ALIGN);
+    ring->info = wsa_malloc(sizeof(struct wsa_spectrum_frame_info) * nframes);
+    ring->seq = wsa_malloc(sizeof(uint32_t) * nframes);
+    ring->segments = wsa_malloc(sizeof(struct wsa_spectrum_segment) * (size_t)nframes * (segment_count ? segment_count : 1));
+    ring->completed = 0;
+    ring->damaged = 0;
+    ring->next_sweep = 0;
+    ring->start_id = 0;
+    ring->synced = 0;
+
+    if (ring->data == NULL || ring->info == NULL || ring->seq == NULL || ring->segments == NULL) {
+        wsa_spectrum_ring_free(ring);
+        return NULL;
+    }
+
+    for (f = 0; f < nframes; f++) {
+        ring->seq[f] = 0;
+        memset(&ring->info[f], 0, sizeof(struct wsa_spectrum_frame_info));
+    }
+
+    return ring;
+}
+
+
+/// @}
+///
+/// \name Public Functions
+/// @{
+
+struct wsa_sweep_device *wsa_sweep_device_new( struct wsa_device *device )
+{
+    struct wsa_sweep_device *sweepdev;
+
+    // Allocate memory for our object.
+    sweepdev = wsa_malloc(sizeof(struct wsa_sweep_device));
+    if (sweepdev == NULL)
+        return NULL;
+
+    // Initialize the structure.
+    sweepdev->real_device = device;
+
+    return sweepdev;
+}
+
+
+void wsa_sweep_device_free( struct wsa_sweep_device *sweepdev )
+{
+    // Free the memory of the sweep device, (but not the real device, it came from the parent).
+    wsa_free(sweepdev);
+}
+
+
+void wsa_sweep_device_set_attenuator( struct wsa_sweep_device *sweep_device, unsigned int val )
+{
+    sweep_device->device_settings.attenuator = (uint8_t)val;
+}
+
+
+unsigned int wsa_sweep_device_get_attenuator( struct wsa_sweep_device *sweep_device )
+{
+    return sweep_device->device_settings.attenuator;
+}
+
+
+int16_t wsa_power_spectrum_alloc( struct wsa_sweep_device *sweep_device, uint64_t fstart, uint64_t fstop,
+                                  uint32_t rbw, char const *mode, struct wsa_power_spectrum_config **pscfgptr )
+{
+    struct wsa_sweep_band band;
+
+    // A contiguous sweep is a multi-band sweep with one band.
+    memset(&band, 0, sizeof(band));
+    band.fstart = fstart;
+    band.fstop = fstop;
+
+    return wsa_power_spectrum_alloc_bands(sweep_device, &band, 1, rbw, mode, pscfgptr);
+}
+
+
+int16_t wsa_power_spectrum_alloc_bands( struct wsa_sweep_device *sweep_device, struct wsa_sweep_band const *bands,
+                                        uint32_t band_count, uint32_t rbw, char const *mode,
+                                        struct wsa_power_spectrum_config **pscfgptr )
+{
+    struct wsa_power_spectrum_config *pscfg;
+    struct wsa_sweep_band *band;
+    int16_t result;
+    uint32_t b;
+
+    if (bands == NULL || band_count == 0 || rbw == 0) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    // Bands must be in increasing order and must not overlap.
+    for (b = 1; b < band_count; b++) {
+        if (bands[b].fstart < bands[b - 1].fstop) {
+            DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "?? Band %u overlaps or precedes the band before it.", (unsigned)b);
+            return WSA_ERR_INVINPUT;
+        }
+    }
+
+    pscfg = wsa_malloc(sizeof(struct wsa_power_spectrum_config));
+    if (pscfg == NULL) {
+        doutf(DHIGH, "wsa_power_spectrum_alloc: Failed to initialize struct wsa_power_spectrum_config\n");
+        return -15;
+    }
+
+    // Initialize a few things.
+    pscfg->sweep_plan = NULL;
+    pscfg->buf = NULL;
+    pscfg->trace = NULL;
+    pscfg->tracelen = 0;
+    pscfg->trace_detector = WSA_TRACE_DETECTOR_PEAK;
+    pscfg->trace_count = NULL;
+    pscfg->trace_next_bin = 0;
+    pscfg->trace_pending = NULL;
+    pscfg->trace_pending_bin = 0;
+    pscfg->trace_pending_count = 0;
+    pscfg->pyramid = NULL;
+    pscfg->ring = NULL;
+    pscfg->timing = NULL;
+    pscfg->segments = NULL;
+    pscfg->segment_count = 0;
+
+    // Copy the sweep settings into the sweep configuration object.
+    pscfg->bands = wsa_malloc(sizeof(struct wsa_sweep_band) * band_count);
+    if (pscfg->bands == NULL) {
+        wsa_free(pscfg);
+        return WSA_ERR_MALLOCFAILED;
+    }
+    memcpy(pscfg->bands, bands, sizeof(struct wsa_sweep_band) * band_count);
+    pscfg->band_count = band_count;
+
+    pscfg->mode = mode_string_to_const(mode);
+    pscfg->fstart = bands[0].fstart;
+    pscfg->fstop = bands[band_count - 1].fstop;
+    pscfg->rbw = (uint32_t)rbw;
+
+    // Find a way to collect the data.
+    result = wsa_plan_sweep(sweep_device, pscfg);
+    if (result < 0) {
+        wsa_power_spectrum_free(pscfg);
+        return result;
+    }
+
+    // Now allocate enough buffer for the spectrum, with the bands back to back.
+    pscfg->buflen = 0;
+    for (b = 0; b < band_count; b++) {
+        band = &pscfg->bands[b];
+        band->bin_offset = pscfg->buflen;
+        band->bin_count = (uint32_t)(((float)(band->fstop_actual - band->fstart_actual)) / ((float)(pscfg->rbw)));
+        pscfg->buflen += band->bin_count;
+        DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "band %u: actual fstart = %llu, actual fstop = %llu, bins = %u", (unsigned)b,
+                     band->fstart_actual, band->fstop_actual, (unsigned)band->bin_count);
+    }
+
+    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "actual fstart = %llu, actual fstop = %llu, rbw = %llu", pscfg->fstart_actual, pscfg->fstop_actual, pscfg->rbw);
+    doutf(DHIGH, "wsa_power_spectrum_alloc: Calculated Buffer length to be: %u\n", (unsigned)pscfg->buflen);
+    DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "buflen = %u", (unsigned)pscfg->buflen);
+
+    // Allocate data to the buffer.
+    pscfg->buf = wsa_malloc_aligned(sizeof(float) * pscfg->buflen, WSA_ALLOC_ALIGN);
+
+    if (pscfg->buf == NULL) {
+        DEBUG_PRINTF(DEBUG_SWEEP_PLAN, "%s", "?? Malloc failed for pscfg->buf");
+        wsa_power_spectrum_free(pscfg);
+        return -1;
+    }
+
+    // One metadata entry per block, and one more for each further band cut from the shared DD block.
+    pscfg->segment_count = pscfg->packet_total / pscfg->packets_per_block;
+    for (b = 1; (b < band_count) && pscfg->bands[b].dd_mode; b++) {
+        pscfg->segment_count++;
+    }
+    pscfg->segments = wsa_malloc(sizeof(struct wsa_spectrum_segment) * (pscfg->segment_count ? pscfg->segment_count : 1));
+    if (pscfg->segments == NULL) {
+        wsa_power_spectrum_free(pscfg);
+        return WSA_ERR_MALLOCFAILED;
+    }
+    memset(pscfg->segments, 0, sizeof(struct wsa_spectrum_segment) * pscfg->segment_count);
+
+    *pscfgptr = pscfg;
+    return 0;
+}
+
+
+void wsa_power_spectrum_free( struct wsa_power_spectrum_config *cfg )
+{
+    struct wsa_sweep_plan *plan, *next;
+
+    // Free the plan, if there is one.
+    plan = cfg->sweep_plan;
+    for (;;) {
+
+        // List is null terminated.
+        if (plan == NULL)
+            break;
+
+        // Store next pointer before freeing.
+        next = plan->next_entry;
+
+        // Free the memory.
+        wsa_free(plan);
+
+        // Go to the next item.
+        plan = next;
+    }
+
+    // Free the buffer.
+    if (cfg->buf) {
+        wsa_free(cfg->buf);
+    }
+
+    // Free the display trace.
+    if (cfg->trace) {
+        wsa_free(cfg->trace);
+    }
+    if (cfg->trace_count) {
+        wsa_free(cfg->trace_count);
+    }
+
+    // Free the zoom pyramid.
+    wsa_pyramid_free(cfg->pyramid);
+
+    // Free the block metadata.
+    wsa_free(cfg->segments);
+
+    // Free the band list.
+    wsa_free(cfg->bands);
+
+    // Free the continuous mode ring, if it was left running.
+    wsa_spectrum_ring_free(cfg->ring);
+
+    // Free the stage timing.
+    wsa_free(cfg->timing);
+
+    // Free the struct.
+    wsa_free(cfg);
+}
+
+
+int16_t wsa_power_spectrum_set_trace( struct wsa_power_spectrum_config *cfg, uint32_t tracelen,
+                                      uint32_t detector, uint8_t keep_buf )
+{
+    float *trace = NULL;
+    uint32_t *trace_count = NULL;
+
+    if (cfg == NULL || tracelen > cfg->buflen) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    // The zoom pyramid is built over the full-resolution buffer, so it must be kept.
+    if (!keep_buf && (tracelen > 0) && cfg->pyramid) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    if ((tracelen > 0) && (detector < WSA_TRACE_DETECTOR_PEAK || detector > WSA_TRACE_DETECTOR_AVERAGE)) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    // A trace of zero points turns the trace off, and the full-resolution buffer is needed again.
+    if (tracelen == 0) {
+        keep_buf = 1;
+    }
+
+    // Make sure the full-resolution buffer exists if it is wanted.
+    if (keep_buf && (cfg->buf == NULL)) {
+        cfg->buf = wsa_malloc_aligned(sizeof(float) * cfg->buflen, WSA_ALLOC_ALIGN);
+        if (cfg->buf == NULL) {
+            return WSA_ERR_MALLOCFAILED;
+        }
+    }
+
+    if (tracelen > 0) {
+        trace = wsa_malloc_aligned(sizeof(float) * tracelen, WSA_ALLOC_ALIGN);
+        trace_count = wsa_malloc(sizeof(uint32_t) * tracelen);
+        if (trace == NULL || trace_count == NULL) {
+            wsa_free(trace);
+            wsa_free(trace_count);
+            return WSA_ERR_MALLOCFAILED;
+        }
+    }
+
+    if (cfg->trace) {
+        wsa_free(cfg->trace);
+    }
+    if (cfg->trace_count) {
+        wsa_free(cfg->trace_count);
+    }
+
+    cfg->trace = trace;
+    cfg->trace_count = trace_count;
+    cfg->tracelen = tracelen;
+    cfg->trace_detector = detector;
+
+    if (tracelen > 0) {
+        wsa_trace_reset(cfg);
+    }
+
+    if (!keep_buf && cfg->buf) {
+        wsa_free(cfg->buf);
+        cfg->buf = NULL;
+    }
+
+    return 0;
+}
+
+
+int16_t wsa_power_spectrum_set_pyramid( struct wsa_power_spectrum_config *cfg, uint8_t enable )
+{
+    if (cfg == NULL) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    if (!enable) {
+        wsa_pyramid_free(cfg->pyramid);
+        cfg->pyramid = NULL;
+        return 0;
+    }
+
+    if (cfg->buf == NULL || cfg->buflen == 0) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    if (cfg->pyramid == NULL) {
+        cfg->pyramid = wsa_pyramid_new(cfg->buflen);
+        if (cfg->pyramid == NULL) {
+            return WSA_ERR_MALLOCFAILED;
+        }
+    }
+
+    // Bring it in line with whatever is in the buffer now.
+    wsa_pyramid_update(cfg->pyramid, cfg->buf, 0, cfg->buflen);
+
+    return 0;
+}
+
+
+int16_t wsa_power_spectrum_set_timing( struct wsa_power_spectrum_config *cfg, uint8_t enable )
+{
+    if (cfg == NULL) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    if (!enable) {
+        wsa_free(cfg->timing);
+        cfg->timing = NULL;
+        return 0;
+    }
+
+    if (cfg->timing == NULL) {
+        cfg->timing = wsa_malloc(sizeof(struct wsa_sweep_timing));
+        if (cfg->timing == NULL) {
+            return WSA_ERR_MALLOCFAILED;
+        }
+    }
+    memset(cfg->timing, 0, sizeof(struct wsa_sweep_timing));
+
+    return 0;
+}
+
+
+int16_t wsa_power_spectrum_zoom( struct wsa_power_spectrum_config const *cfg, uint32_t first_bin, uint32_t nbins,
+                                 uint32_t pixels, float *min_out, float *max_out, float *mean_out )
+{
+    struct wsa_spectrum_pyramid const *pyr;
+    uint64_t lo, hi;
+    uint64_t step;
+    uint32_t p, k;
+    uint32_t node;
+    uint32_t count;
+    float vmin, vmax, vsum;
+    float nmin, nmax, nsum;
+
+    if (cfg == NULL || cfg->pyramid == NULL || cfg->buf == NULL) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    if (nbins == 0 || pixels == 0 || (uint64_t)first_bin + nbins > cfg->buflen) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    pyr = cfg->pyramid;
+
+    for (p = 0; p < pixels; p++) {
+
+        lo = first_bin + ((uint64_t)p * nbins) / pixels;
+        hi = first_bin + ((uint64_t)(p + 1) * nbins) / pixels;
+        if (hi <= lo) {
+            hi = lo + 1;
+        }
+
+        vmin = vmax = vsum = 0.0f;
+        count = 0;
+
+        // Cover [lo, hi) with the largest aligned nodes that fit.
+        while (lo < hi) {
+
+            k = 0;
+            while ((k + 1 < pyr->levels) && ((lo & ((2ULL << k) - 1)) == 0) && (lo + (2ULL << k) <= hi)) {
+                k++;
+            }
+            step = 1ULL << k;
+
+            if (k == 0) {
+                nmin = nmax = nsum = cfg->buf[lo];
+            } else {
+                node = pyr->level_offset[k] + (uint32_t)(lo >> k);
+                nmin = pyr->min[node];
+                nmax = pyr->max[node];
+                nsum = pyr->sum[node];
+            }
+
+            if (count == 0) {
+                vmin = nmin;
+                vmax = nmax;
+            } else {
+                if (nmin < vmin) vmin = nmin;
+                if (nmax > vmax) vmax = nmax;
+            }
+            vsum += nsum;
+            count += (uint32_t)step;
+            lo += step;
+        }
+
+        if (min_out) {
+            min_out[p] = vmin;
+        }
+        if (max_out) {
+            max_out[p] = vmax;
+        }
+        if (mean_out) {
+            mean_out[p] = vsum / (float)count;
+        }
+    }
+
+    return 0;
+}
+
+
+int16_t wsa_configure_sweep(struct wsa_sweep_device *sweep_device, struct wsa_power_spectrum_config *pscfg)
+{
+    int16_t result = 0;
+    uint64_t t0 = wsa_clock_ns();
+
+    // Load the sweep plan.
+    result = wsa_sweep_plan_load(sweep_device, pscfg);
+
+    if (pscfg->timing) {
+        pscfg->timing->configure_ns += wsa_clock_ns() - t0;
+    }
+
+    return result;
+}
+
+
+int16_t wsa_capture_power_spectrum(struct wsa_sweep_device *sweep_device,
+                                   struct wsa_power_spectrum_config *cfg, float **buf)
+{
+    int16_t result;
+    uint64_t t0;
+
+    // Assign the caller's convenience pointer.
+    if (*buf) {
+        *buf = cfg->buf;
+    }
+
+    // Check the mode before starting anything on the device.
+    if (wsa_get_sweep_device_properties(cfg->mode) == NULL) {
+        doutf(DHIGH, "Unsupported RFE mode: %d - %s\n", cfg->mode, mode_const_to_string(cfg->mode));
+        return -EUNSUPPORTED;
+    }
+
+    // Start the sweep.
+    t0 = wsa_clock_ns();
+    result = wsa_sweep_start(sweep_device->real_device);
+    if (cfg->timing) {
+        cfg->timing->start_ns += wsa_clock_ns() - t0;
+    }
+	if (result < 0) {
+		doutf(DHIGH, "wsa_sweep_start() returned error %d\n", result);
+		return result;
+	}
+    doutf(DMED, "wsa_capture_power_spectrum() Sweep started.\n");
+
+    return wsa_collect_sweep(sweep_device, cfg, cfg->buf, 1, NULL, NULL, cfg->segments, NULL);
+}
+
+
+int16_t wsa_sweep_continuous_start( struct wsa_sweep_device *sweep_device, struct wsa_power_spectrum_config *cfg,
+                                    uint32_t nframes )
+{
+    int16_t result;
+
+    // Readers may be copying the latest frame while the next one is written, so we need at least two.
+    if (cfg == NULL || nframes < 2 || cfg->ring != NULL) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    // Both views live in cfg->buf, which is not written here, and readers on other threads would race their update.
+    if (cfg->trace != NULL || cfg->pyramid != NULL) {
+        return WSA_ERR_SWEEPVIEWSENABLED;
+    }
+
+    if (wsa_get_sweep_device_properties(cfg->mode) == NULL) {
+        doutf(DHIGH, "Unsupported RFE mode: %d - %s\n", cfg->mode, mode_const_to_string(cfg->mode));
+        return -EUNSUPPORTED;
+    }
+
+    cfg->ring = wsa_spectrum_ring_new(nframes, cfg->buflen, cfg->segment_count);
+    if (cfg->ring == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+
+    // A fresh id each run, so a marker left over from an earlier sweep is never taken for ours.
+    cfg->ring->start_id = (uint32_t)(wsa_clock_ns() & 0x7fffffff);
+
+    // Zero iterations tells the device to repeat the sweep list until stopped.
+    result = wsa_set_sweep_iteration(sweep_device->real_device, 0);
+    if (result >= 0) {
+        result = wsa_sweep_start_id(sweep_device->real_device, cfg->ring->start_id);
+    }
+    if (result < 0) {
+        doutf(DHIGH, "wsa_sweep_continuous_start() failed to start sweep: %d\n", result);
+        wsa_spectrum_ring_free(cfg->ring);
+        cfg->ring = NULL;
+        return result;
+    }
+
+    doutf(DMED, "wsa_sweep_continuous_start() Sweep started with %u frames.\n", nframes);
+
+    return 0;
+}
+
+
+int16_t wsa_sweep_continuous_capture( struct wsa_sweep_device *sweep_device, struct wsa_power_spectrum_config *cfg )
+{
+    struct wsa_spectrum_ring *ring;
+    struct wsa_spectrum_frame_info *info;
+    uint32_t frame;
+    int16_t result;
+
+    if (cfg == NULL || cfg->ring == NULL) {
+        return WSA_ERR_SWEEPNOTRUNNING;
+    }
+
+    ring = cfg->ring;
+    frame = (uint32_t)(ring->next_sweep % ring->nframes);
+    info = &ring->info[frame];
+
+    // Odd sequence: the frame is being written.
+    wsa_atomic_add_u32(&ring->seq[frame], 1);
+
+    info->sweep_number = ring->next_sweep;
+    result = wsa_collect_sweep(sweep_device, cfg, ring->data + (size_t)frame * cfg->buflen, 0,
+                               &info->first_timestamp, &info->last_timestamp,
+                               ring->segments + (size_t)frame * cfg->segment_count, ring);
+
+    // A damaged sweep goes back to the caller, which can give up or call again for the next one.
+    if (result == -ESWEEPDAMAGED) {
+        wsa_atomic_add_u32(&ring->damaged, 1);
+        result = WSA_ERR_SWEEPDAMAGED;
+    }
+
+    // Keep readers from taking what is left of a failed sweep for the sweep it was numbered as.
+    if (result < 0) {
+        info->sweep_number = UINT64_MAX;
+    }
+
+    // Even sequence: the frame is stable again.
+    wsa_atomic_add_u32(&ring->seq[frame], 1);
+
+    // A failed sweep is never published, and its sweep number is not reused.
+    ring->next_sweep++;
+    if (result < 0) {
+        return result;
+    }
+
+    wsa_atomic_store_u32(&ring->completed, (uint32_t)ring->next_sweep);
+
+    return 0;
+}
+
+
+int16_t wsa_sweep_continuous_read( struct wsa_power_spectrum_config *cfg, uint32_t age, float *out,
+                                   struct wsa_spectrum_frame_info *info, struct wsa_spectrum_segment *segments )
+{
+    struct wsa_spectrum_ring *ring;
+    struct wsa_spectrum_frame_info frame_info;
+    uint32_t completed;
+    uint32_t wanted;
+    uint32_t frame;
+    uint32_t seq_before, seq_after;
+    int tries;
+
+    if (cfg == NULL || out == NULL) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    ring = cfg->ring;
+    if (ring == NULL) {
+        return WSA_ERR_SWEEPNOTRUNNING;
+    }
+
+    // The frame after the latest one may be mid-write at any time.
+    if (age > ring->nframes - 2) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    for (tries = 0; tries < 8; tries++) {
+
+        completed = wsa_atomic_load_u32(&ring->completed);
+        if (completed <= age) {
+            return WSA_ERR_SWEEPFRAMEUNAVAILABLE;
+        }
+
+        wanted = completed - 1 - age;
+        frame = wanted % ring->nframes;
+
+        seq_before = wsa_atomic_load_u32(&ring->seq[frame]);
+        if (seq_before & 1) {
+            continue;
+        }
+
+        memcpy(out, ring->data + (size_t)frame * cfg->buflen, sizeof(float) * cfg->buflen);
+        frame_info = ring->info[frame];
+        if (segments) {
+            memcpy(segments, ring->segments + (size_t)frame * cfg->segment_count,
+                   sizeof(struct wsa_spectrum_segment) * cfg->segment_count);
+        }
+
+        wsa_memory_barrier();
+        seq_after = wsa_atomic_load_u32(&ring->seq[frame]);
+        if (seq_after != seq_before) {
+            continue;
+        }
+
+        // The frame is intact but may hold a later sweep than the one asked for.
+        if ((uint32_t)frame_info.sweep_number != wanted) {
+            continue;
+        }
+
+        if (info) {
+            *info = frame_info;
+        }
+        return 0;
+    }
+
+    return WSA_ERR_SWEEPFRAMEUNAVAILABLE;
+}
+
+
+int16_t wsa_sweep_continuous_stop( struct wsa_sweep_device *sweep_device, struct wsa_power_spectrum_config *cfg )
+{
+    int16_t result;
+
+    if (cfg == NULL || cfg->ring == NULL) {
+        return WSA_ERR_SWEEPNOTRUNNING;
+    }
+
+    result = wsa_sweep_stop(sweep_device->real_device);
+    if (result < 0) {
+        doutf(DHIGH, "wsa_sweep_continuous_stop() wsa_sweep_stop returned error %d\n", result);
+    }
+
+    // Drop the rest of the sweep in progress, on the device and in the socket, as wsa_sweep_plan_load() does.
+    wsa_flush_data(sweep_device->real_device);
+    wsa_clean_data_socket(sweep_device->real_device);
+
+    // Put the single-sweep setting back so wsa_capture_power_spectrum() works as before.
+    if (wsa_set_sweep_iteration(sweep_device->real_device, 1) < 0 && result >= 0) {
+        result = WSA_ERR_SWEEPSTOPFAIL;
+    }
+
+    wsa_spectrum_ring_free(cfg->ring);
+    cfg->ring = NULL;
+
+    return result;
+}
+
 /// @}				// name Public Functions
 
 /// @}				// group sweep
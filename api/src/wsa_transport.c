@@ -0,0 +1,307 @@
+///
+/// @file
+/// The TCP and in-process memory transports. See wsa_transport.h; the replay transport is in
+/// wsa_replay.c.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <string.h>
+
+#include "wsa_lib.h"
+#include "wsa_client.h"
+#include "wsa_error.h"
+#include "wsa_debug.h"
+#include "wsa_alloc.h"
+#include "wsa_transport.h"
+
+#define WSA_MEM_QUEUE_MIN 65536			///< Smallest allocation of a memory transport queue
+
+
+static int32_t wsa_tcp_fd( void *ctx, enum wsa_channel channel )
+{
+    struct wsa_socket *sock = ctx;
+
+    return (channel == WSA_CHANNEL_DATA) ? sock->data : sock->cmd;
+}
+
+
+static int32_t wsa_tcp_send( void *ctx, char const *buf, int32_t len )
+{
+    return wsa_sock_send(wsa_tcp_fd(ctx, WSA_CHANNEL_CMD), buf, len);
+}
+
+
+///
+/// The data socket is non-blocking. The command socket blocks, but is only read once poll() has
+/// found it has something.
+///
+static int16_t wsa_tcp_recv( void *ctx, enum wsa_channel channel, uint8_t *buf, int32_t size, int32_t *received,
+                             struct wsa_stats *stats )
+{
+    return wsa_sock_recv_now(wsa_tcp_fd(ctx, channel), buf, size, received, stats);
+}
+
+
+static int16_t wsa_tcp_poll( void *ctx, enum wsa_channel channel, uint64_t deadline_ns, struct wsa_stats *stats )
+{
+    return wsa_sock_wait_until(wsa_tcp_fd(ctx, channel), deadline_ns, stats);
+}
+
+
+static void wsa_tcp_close( void *ctx )
+{
+    struct wsa_socket *sock = ctx;
+
+    wsa_close_sock(sock->cmd);
+    wsa_close_sock(sock->data);
+    wsa_destroy_client();
+}
+
+
+/// The device's control and data sockets. The context is the device's struct wsa_socket.
+struct wsa_transport_ops const wsa_tcp_transport = {
+    "TCPIP",
+    wsa_tcp_send,
+    wsa_tcp_recv,
+    wsa_tcp_poll,
+    NULL,
+    wsa_tcp_close
+};
+
+
+/// Bytes on their way to the library: those from head to tail of buf are unread.
+struct wsa_mem_queue {
+    uint8_t *buf;
+    int32_t size;
+    int32_t head;
+    int32_t tail;
+};
+
+struct wsa_mem_link {
+    struct wsa_mem_device device;
+    struct wsa_mem_queue reply;
+    struct wsa_mem_queue data;
+    char line[MAX_STR_LEN];				///< A command line not yet ended
+    int32_t line_len;
+};
+
+
+static int16_t wsa_mem_queue_push( struct wsa_mem_queue *q, void const *buf, int32_t len )
+{
+    uint8_t *grown;
+    int32_t size;
+
+    if (len < 0) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    if (q->tail + len > q->size) {
+        // move what is unread to the front, and make room if that is not enough
+        size = q->size;
+        while (size < q->tail - q->head + len) {
+            size = (size < WSA_MEM_QUEUE_MIN) ? WSA_MEM_QUEUE_MIN : size * 2;
+        }
+        if (size != q->size) {
+            grown = wsa_malloc((size_t)size);
+            if (grown == NULL) {
+                return WSA_ERR_MALLOCFAILED;
+            }
+            if (q->buf) {
+                memcpy(grown, q->buf + q->head, (size_t)(q->tail - q->head));
+                wsa_free(q->buf);
+            }
+            q->buf = grown;
+            q->size = size;
+        } else {
+            memmove(q->buf, q->buf + q->head, (size_t)(q->tail - q->head));
+        }
+        q->tail -= q->head;
+        q->head = 0;
+    }
+
+    memcpy(q->buf + q->tail, buf, (size_t)len);
+    q->tail += len;
+
+    return 0;
+}
+
+
+static int32_t wsa_mem_queue_pop( struct wsa_mem_queue *q, uint8_t *buf, int32_t size )
+{
+    int32_t n = q->tail - q->head;
+
+    if (n > size) {
+        n = size;
+    }
+    memcpy(buf, q->buf + q->head, (size_t)n);
+    q->head += n;
+    if (q->head == q->tail) {
+        q->head = 0;
+        q->tail = 0;
+    }
+
+    return n;
+}
+
+
+///
+/// Hand each complete line to the device's command callback.
+///
+static int32_t wsa_mem_send( void *ctx, char const *buf, int32_t len )
+{
+    struct wsa_mem_link *link = ctx;
+    int16_t result;
+    int32_t i;
+
+    for (i = 0; i < len; i++) {
+        if (buf[i] != '\n') {
+            if (link->line_len + 1 >= (int32_t)sizeof(link->line)) {
+                link->line_len = 0;
+                return WSA_ERR_CMDSENDFAILED;
+            }
+            link->line[link->line_len++] = buf[i];
+            continue;
+        }
+
+        link->line[link->line_len] = '\0';
+        link->line_len = 0;
+        result = link->device.command(link->device.arg, link, link->line);
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    return len;
+}
+
+
+static int16_t wsa_mem_recv( void *ctx, enum wsa_channel channel, uint8_t *buf, int32_t size, int32_t *received,
+                             struct wsa_stats *stats )
+{
+    struct wsa_mem_link *link = ctx;
+
+    *received = wsa_mem_queue_pop((channel == WSA_CHANNEL_DATA) ? &link->data : &link->reply, buf, size);
+    if (stats) {
+        wsa_stats_count(stats, WSA_STAT_RECV_CALLS, 1);
+    }
+
+    return 0;
+}
+
+
+///
+/// A reply is made while its query is sent, so if there is none now, there will be none. Data
+/// that is not queued is asked for.
+///
+static int16_t wsa_mem_poll( void *ctx, enum wsa_channel channel, uint64_t deadline_ns, struct wsa_stats *stats )
+{
+    struct wsa_mem_link *link = ctx;
+    int16_t result;
+
+    if (channel == WSA_CHANNEL_CMD) {
+        result = (link->reply.tail > link->reply.head) ? 0 : WSA_ERR_SOCKETNODATA;
+    } else if (link->data.tail > link->data.head) {
+        result = 0;
+    } else if (link->device.fill == NULL) {
+        result = WSA_ERR_SOCKETNODATA;
+    } else {
+        result = link->device.fill(link->device.arg, link, deadline_ns);
+        if (result >= 0 && link->data.tail == link->data.head) {
+            result = WSA_ERR_SOCKETNODATA;
+        }
+    }
+
+    if (result == WSA_ERR_SOCKETNODATA && stats) {
+        wsa_stats_count(stats, WSA_STAT_TIMEOUTS, 1);
+    }
+
+    return result;
+}
+
+
+static void wsa_mem_close( void *ctx )
+{
+    struct wsa_mem_link *link = ctx;
+
+    wsa_free(link->reply.buf);
+    wsa_free(link->data.buf);
+    wsa_free(link);
+}
+
+
+/// A device played in this process. The context is a struct wsa_mem_link.
+struct wsa_transport_ops const wsa_mem_transport = {
+    "MEM",
+    wsa_mem_send,
+    wsa_mem_recv,
+    wsa_mem_poll,
+    NULL,
+    wsa_mem_close
+};
+
+
+///
+/// Create the link for a memory transport. Connect it with
+/// wsa_connect_transport(dev, &wsa_mem_transport, link), which then owns it.
+///
+/// @param[in] device The callbacks that play the device; copied.
+/// @param[out] link The new link.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_mem_link_alloc( struct wsa_mem_device const *device, struct wsa_mem_link **link )
+{
+    struct wsa_mem_link *l;
+
+    if (device == NULL || device->command == NULL || link == NULL) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    l = wsa_malloc(sizeof(struct wsa_mem_link));
+    if (l == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+    memset(l, 0, sizeof(struct wsa_mem_link));
+    l->device = *device;
+
+    *link = l;
+
+    return 0;
+}
+
+
+///
+/// Answer a query, from the device's command callback.
+///
+/// @param[in] link The link.
+/// @param[in] reply The answer, without the newline that ends it.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_mem_reply( struct wsa_mem_link *link, char const *reply )
+{
+    int16_t result;
+
+    result = wsa_mem_queue_push(&link->reply, reply, (int32_t)strlen(reply));
+    if (result < 0) {
+        return result;
+    }
+
+    return wsa_mem_queue_push(&link->reply, "\n", 1);
+}
+
+
+///
+/// Queue bytes on the data channel, normally whole VRT packets.
+///
+/// @param[in] link The link.
+/// @param[in] buf The bytes.
+/// @param[in] len How many.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_mem_push_data( struct wsa_mem_link *link, void const *buf, int32_t len )
+{
+    return wsa_mem_queue_push(&link->data, buf, len);
+}
@@ -0,0 +1,364 @@
+///
+/// @file
+/// The waterfall ring. See wsa_waterfall.h.
+///
+/// Row n is kept at slot n % nrows and again at slot n % nrows + nrows, so the latest count rows,
+/// count < nrows, always sit together in slots [first % nrows, first % nrows + count). Pushing
+/// row n rewrites the two slots of row n - nrows and no others, so rows from \b first on are intact
+/// for as long as no row from first + nrows on has been started.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <string.h>
+#include <math.h>
+
+#include "wsa_lib.h"
+#include "wsa_error.h"
+#include "wsa_alloc.h"
+#include "wsa_atomic.h"
+#include "wsa_waterfall.h"
+
+struct wsa_waterfall {
+    uint32_t width;
+    uint32_t nrows;
+    uint32_t detector;
+    float *data;						///< 2 * nrows rows of width points
+    struct wsa_waterfall_row *info;		///< 2 * nrows entries
+    uint32_t volatile started;			///< Rows begun; row started - 1 may be mid-write
+    uint32_t volatile completed;		///< Rows written in full
+};
+
+
+///
+/// Reduce a spectrum to a row, with the waterfall's detector. Point p covers the bins b with
+/// p = floor(b * width / bins), as for display traces; where there are more points than bins, a
+/// point with no bin of its own takes the one it falls in.
+///
+static void wsa_waterfall_reduce( struct wsa_waterfall const *wf, float const *spectrum, uint32_t bins, float *row )
+{
+    uint32_t p;
+    uint32_t b;
+    uint32_t start;
+    uint32_t end;
+    float v;
+
+    b = 0;
+    for (p = 0; p < wf->width; p++) {
+        // first bin of the next point, i.e. ceil((p + 1) * bins / width)
+        end = (uint32_t)(((uint64_t)(p + 1) * bins + wf->width - 1) / wf->width);
+        if (end <= b) {
+            row[p] = spectrum[(uint32_t)(((uint64_t)p * bins) / wf->width)];
+            continue;
+        }
+
+        switch (wf->detector) {
+
+        case WSA_TRACE_DETECTOR_PEAK:
+            v = spectrum[b];
+            for (b++; b < end; b++) {
+                if (spectrum[b] > v) {
+                    v = spectrum[b];
+                }
+            }
+            break;
+
+        case WSA_TRACE_DETECTOR_NEG_PEAK:
+            v = spectrum[b];
+            for (b++; b < end; b++) {
+                if (spectrum[b] < v) {
+                    v = spectrum[b];
+                }
+            }
+            break;
+
+        case WSA_TRACE_DETECTOR_SAMPLE:
+            v = spectrum[b];
+            b = end;
+            break;
+
+        default:
+            // average the linear power, as the display trace does
+            v = 0.0f;
+            for (start = b; b < end; b++) {
+                v += (float)pow(10.0, spectrum[b] / 10.0);
+            }
+            v = (float)(10.0 * log10(v / (end - start)));
+            break;
+        }
+
+        row[p] = v;
+    }
+}
+
+
+///
+/// Create a waterfall.
+///
+/// @param[in] width Points in each row, at least 1.
+/// @param[in] nrows Rows kept, at least 2.
+/// @param[in] detector One of the WSA_TRACE_DETECTOR_* values, used to reduce each spectrum to a row.
+/// @param[out] waterfall The new waterfall, taking 2 * nrows * (width * 4 + 32) bytes or so.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_waterfall_alloc( uint32_t width, uint32_t nrows, uint32_t detector, struct wsa_waterfall **waterfall )
+{
+    struct wsa_waterfall *wf;
+
+    if (width < 1 || nrows < 2 || waterfall == NULL ||
+        detector < WSA_TRACE_DETECTOR_PEAK || detector > WSA_TRACE_DETECTOR_AVERAGE) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    wf = wsa_malloc(sizeof(struct wsa_waterfall));
+    if (wf == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+    memset(wf, 0, sizeof(struct wsa_waterfall));
+    wf->width = width;
+    wf->nrows = nrows;
+    wf->detector = detector;
+
+    wf->data = wsa_malloc_aligned(sizeof(float) * 2 * (size_t)nrows * width, WSA_ALLOC_ALIGN);
+    wf->info = wsa_malloc(sizeof(struct wsa_waterfall_row) * 2 * (size_t)nrows);
+    if (wf->data == NULL || wf->info == NULL) {
+        wsa_waterfall_free(wf);
+        return WSA_ERR_MALLOCFAILED;
+    }
+    memset(wf->info, 0, sizeof(struct wsa_waterfall_row) * 2 * (size_t)nrows);
+
+    *waterfall = wf;
+
+    return 0;
+}
+
+
+///
+/// Free a waterfall. Nothing may be pushing to or reading from it.
+///
+void wsa_waterfall_free( struct wsa_waterfall *waterfall )
+{
+    if (waterfall == NULL) {
+        return;
+    }
+
+    wsa_free(waterfall->data);
+    wsa_free(waterfall->info);
+    wsa_free(waterfall);
+}
+
+
+///
+/// Add a spectrum as the newest row, replacing the oldest once the ring is full. Rows must be
+/// pushed from one thread at a time.
+///
+/// @param[in] waterfall The waterfall.
+/// @param[in] spectrum The spectrum, in dBm.
+/// @param[in] bins Number of values in the spectrum.
+/// @param[in] time_stamp Time of the spectrum, or NULL.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_waterfall_push( struct wsa_waterfall *waterfall, float const *spectrum, uint32_t bins,
+                            struct wsa_time const *time_stamp )
+{
+    struct wsa_waterfall *wf = waterfall;
+    struct wsa_waterfall_row *info;
+    uint32_t number;
+    uint32_t slot;
+    float *row;
+    uint32_t p;
+
+    if (wf == NULL || spectrum == NULL || bins == 0) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    number = wf->completed;
+    slot = number % wf->nrows;
+    row = wf->data + (size_t)slot * wf->width;
+    info = &wf->info[slot];
+
+    wsa_atomic_store_u32(&wf->started, number + 1);
+    wsa_memory_barrier();
+
+    wsa_waterfall_reduce(wf, spectrum, bins, row);
+
+    info->number = number;
+    info->bins = bins;
+    if (time_stamp) {
+        info->time_stamp = *time_stamp;
+    } else {
+        info->time_stamp.sec = 0;
+        info->time_stamp.psec = 0;
+    }
+    info->min = row[0];
+    info->max = row[0];
+    for (p = 1; p < wf->width; p++) {
+        if (row[p] < info->min) {
+            info->min = row[p];
+        }
+        if (row[p] > info->max) {
+            info->max = row[p];
+        }
+    }
+
+    memcpy(row + (size_t)wf->nrows * wf->width, row, sizeof(float) * wf->width);
+    wf->info[slot + wf->nrows] = *info;
+
+    wsa_atomic_store_u32(&wf->completed, number + 1);
+
+    return 0;
+}
+
+
+///
+/// Add the spectrum of the latest wsa_capture_power_spectrum() as the newest row, timed by its
+/// first block. Where only the display trace is kept, the trace is added instead.
+///
+/// @param[in] waterfall The waterfall.
+/// @param[in] cfg The power spectrum configuration the capture was made with.
+///
+/// @returns 0 on success, otherwise a negative error code.
+///
+int16_t wsa_waterfall_push_spectrum( struct wsa_waterfall *waterfall, struct wsa_power_spectrum_config const *cfg )
+{
+    struct wsa_time const *time_stamp = NULL;
+
+    if (cfg == NULL) {
+        return WSA_ERR_INVINPUT;
+    }
+
+    if (cfg->segments && cfg->segment_count > 0) {
+        time_stamp = &cfg->segments[0].timestamp;
+    }
+
+    if (cfg->buf) {
+        return wsa_waterfall_push(waterfall, cfg->buf, cfg->buflen, time_stamp);
+    }
+
+    return wsa_waterfall_push(waterfall, cfg->trace, cfg->tracelen, time_stamp);
+}
+
+
+///
+/// Add a real-time spectrum as the newest row. This has the form of wsa_rtsa_config::spectrum,
+/// so a waterfall may be fed by setting it as the engine's callback, with the waterfall as its arg.
+///
+void wsa_waterfall_rtsa_spectrum( void *waterfall, struct wsa_rtsa_spectrum const *spectrum, float const *power )
+{
+    wsa_waterfall_push(waterfall, power, (uint32_t)spectrum->bins, &spectrum->time_stamp);
+}
+
+
+///
+/// Get the latest rows, in place. May be called from any thread while rows are pushed.
+///
+/// The rows are width points apart, oldest first, and stay where they are until overwritten.
+/// After reading them, check with wsa_waterfall_intact() that none was.
+///
+/// @param[in] waterfall The waterfall.
+/// @param[in] count How many rows, at most nrows - 1, as the row after the latest may be mid-write.
+/// @param[out] rows The oldest of the rows given.
+/// @param[out] info About each row given, oldest first, or NULL.
+/// @param[out] first Number of the oldest row given, for wsa_waterfall_intact(), or NULL.
+///
+/// @returns The number of rows given: count, or fewer if fewer have been pushed.
+///
+uint32_t wsa_waterfall_latest( struct wsa_waterfall *waterfall, uint32_t count, float const **rows,
+                               struct wsa_waterfall_row const **info, uint32_t *first )
+{
+    struct wsa_waterfall *wf = waterfall;
+    uint32_t completed;
+    uint32_t slot;
+
+    completed = wsa_atomic_load_u32(&wf->completed);
+    if (count > wf->nrows - 1) {
+        count = wf->nrows - 1;
+    }
+    if (count > completed) {
+        count = completed;
+    }
+
+    slot = (completed - count) % wf->nrows;
+    *rows = wf->data + (size_t)slot * wf->width;
+    if (info) {
+        *info = &wf->info[slot];
+    }
+    if (first) {
+        *first = completed - count;
+    }
+
+    return count;
+}
+
+
+///
+/// Check that rows given by wsa_waterfall_latest() have not been replaced since.
+///
+/// @param[in] waterfall The waterfall.
+/// @param[in] first Number of the oldest row given.
+///
+/// @returns Non-zero if every row given is as it was, 0 if any may have been overwritten.
+///
+uint8_t wsa_waterfall_intact( struct wsa_waterfall *waterfall, uint32_t first )
+{
+    wsa_memory_barrier();
+
+    return (uint32_t)(wsa_atomic_load_u32(&waterfall->started) - first) <= waterfall->nrows;
+}
+
+
+///
+/// Get the smallest and largest points of the latest rows, to scale their colours. May be called
+/// from any thread while rows are pushed.
+///
+/// @param[in] waterfall The waterfall.
+/// @param[in] count How many of the latest rows, at most nrows - 1.
+/// @param[out] min The smallest point, in dBm.
+/// @param[out] max The largest point, in dBm.
+///
+/// @returns 0 on success, or WSA_ERR_INVINPUT if no row has been pushed.
+///
+int16_t wsa_waterfall_range( struct wsa_waterfall *waterfall, uint32_t count, float *min, float *max )
+{
+    struct wsa_waterfall_row const *info;
+    float const *rows;
+    uint32_t first;
+    uint32_t n;
+    uint32_t i;
+    float lo;
+    float hi;
+
+    do {
+        n = wsa_waterfall_latest(waterfall, count, &rows, &info, &first);
+        if (n == 0) {
+            return WSA_ERR_INVINPUT;
+        }
+
+        lo = info[0].min;
+        hi = info[0].max;
+        for (i = 1; i < n; i++) {
+            if (info[i].min < lo) {
+                lo = info[i].min;
+            }
+            if (info[i].max > hi) {
+                hi = info[i].max;
+            }
+        }
+    } while (!wsa_waterfall_intact(waterfall, first));
+
+    *min = lo;
+    *max = hi;
+
+    return 0;
+}
+
+
+///
+/// Get the number of points in each row.
+///
+uint32_t wsa_waterfall_width( struct wsa_waterfall const *waterfall )
+{
+    return waterfall->width;
+}
@@ -0,0 +1,367 @@
+///
+/// @ingroup bench
+///
+/// @{
+///
+
+///
+/// @file
+/// wsabench_channelizer: polyphase channelizer throughput.
+///
+/// A block of wideband IQ, tones over noise, is pushed through a channelizer in packet-sized
+/// pieces, as it would come from normalize_iq_data(), for each number of channels and workers
+/// asked for. Every channel's ring is read after each piece so the readers' copying is counted
+/// too. For comparison, the same channels are worked out one at a time by direct down-conversion,
+/// mixing, filtering with the same prototype and decimating, as a down-converter per channel
+/// would; this is only done for the smaller channel counts, as its cost grows with the square.
+///
+/// One line is printed per run, as CSV (default) or JSON lines. The columns are:
+/// \li method: channelizer or ddc
+/// \li channels, workers: the set up
+/// \li msamples: input samples pushed, in millions
+/// \li msps: input samples per second, in millions, best of the repetitions
+/// \li ns_per_sample: time per input sample, best of the repetitions
+///
+/// Run with --help for the options.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "wsa_lib.h"
+#include "wsa_channelizer.h"
+#include "wsa_clock.h"
+
+#define BENCH_DEFAULT_SAMPLES 4000000	///< Default input samples per run
+#define BENCH_DEFAULT_REPS 3			///< Default repetitions per run
+#define BENCH_PIECE 16384				///< Samples pushed at a time, as one packet
+#define BENCH_DDC_MAX_CHANNELS 64		///< Largest channel count also run as one down-converter per channel
+#define BENCH_MAX_LIST 16
+
+/// Output formats.
+enum bench_format {
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON
+};
+
+
+///
+/// Small deterministic generator, so every run sees the same input.
+///
+static uint32_t bench_rand( uint32_t *state )
+{
+    *state = *state * 1664525u + 1013904223u;
+
+    return *state >> 8;
+}
+
+
+///
+/// Fill the input with a few tones over noise.
+///
+static void bench_fill( float *idata, float *qdata, uint32_t samples )
+{
+    static double const tones[] = { 0.01, -0.137, 0.31, -0.42 };
+    uint32_t state = 0x5eed;
+    uint32_t i;
+    size_t t;
+    double phase;
+
+    for (i = 0; i < samples; i++) {
+        idata[i] = ((float)(bench_rand(&state) & 0xffff) / 65536.0f - 0.5f) * 0.01f;
+        qdata[i] = ((float)(bench_rand(&state) & 0xffff) / 65536.0f - 0.5f) * 0.01f;
+        for (t = 0; t < sizeof(tones) / sizeof(tones[0]); t++) {
+            phase = 2 * M_PI * fmod(tones[t] * i, 1.0);
+            idata[i] += (float)(0.2 * cos(phase));
+            qdata[i] += (float)(0.2 * sin(phase));
+        }
+    }
+}
+
+
+///
+/// Push the input through a channelizer, reading every channel after each piece.
+///
+/// @return Time taken in ns, or 0 on failure.
+///
+static uint64_t bench_channelizer( float const *idata, float const *qdata, uint32_t samples, uint32_t channels,
+                                   uint32_t workers, float *out_i, float *out_q, float *sink )
+{
+    struct wsa_channelizer_config config;
+    struct wsa_channelizer *ch;
+    uint64_t *positions;
+    uint64_t t0;
+    uint64_t elapsed;
+    uint32_t done;
+    uint32_t piece;
+    uint32_t k;
+    uint32_t n;
+
+    memset(&config, 0, sizeof(config));
+    config.channels = channels;
+    config.workers = workers;
+    config.ring = 2 * BENCH_PIECE;
+    if (wsa_channelizer_alloc(&config, &ch) < 0) {
+        return 0;
+    }
+    positions = calloc(channels, sizeof(uint64_t));
+    if (positions == NULL) {
+        wsa_channelizer_free(ch);
+        return 0;
+    }
+
+    t0 = wsa_clock_ns();
+    for (done = 0; done < samples; done += piece) {
+        piece = (samples - done < BENCH_PIECE) ? samples - done : BENCH_PIECE;
+        wsa_channelizer_push(ch, idata + done, qdata + done, (int32_t)piece);
+        for (k = 0; k < channels; k++) {
+            n = wsa_channelizer_read(ch, k, &positions[k], out_i, out_q, BENCH_PIECE);
+            if (n > 0) {
+                *sink += out_i[n - 1];
+            }
+        }
+    }
+    elapsed = wsa_clock_ns() - t0;
+
+    free(positions);
+    wsa_channelizer_free(ch);
+
+    return elapsed;
+}
+
+
+///
+/// Work out the same channels one at a time, each by mixing, filtering and decimating.
+///
+/// @return Time taken in ns, or 0 on failure.
+///
+static uint64_t bench_ddc( float const *idata, float const *qdata, uint32_t samples, uint32_t channels,
+                           float *out_i, float *out_q, float *sink )
+{
+    uint32_t length = channels * WSA_CHANNELIZER_TAPS;
+    float *h;
+    float *ci;
+    float *cq;
+    double sum;
+    double t;
+    uint64_t t0;
+    uint64_t elapsed;
+    uint32_t outputs;
+    uint32_t k;
+    uint32_t n;
+    uint32_t i;
+    uint32_t s;
+    float yi;
+    float yq;
+
+    // the channelizer's default prototype
+    h = malloc(sizeof(float) * length);
+    ci = malloc(sizeof(float) * channels);
+    cq = malloc(sizeof(float) * channels);
+    if (!h || !ci || !cq) {
+        free(h);
+        free(ci);
+        free(cq);
+        return 0;
+    }
+    sum = 0;
+    for (i = 0; i < length; i++) {
+        t = ((double)i - (length - 1) / 2.0) / channels;
+        h[i] = (float)((t == 0) ? 1.0 : sin(M_PI * t) / (M_PI * t));
+        h[i] *= (float)(0.42 - 0.5 * cos(2 * M_PI * i / (length - 1)) + 0.08 * cos(4 * M_PI * i / (length - 1)));
+        sum += h[i];
+    }
+    for (i = 0; i < length; i++) {
+        h[i] = (float)(h[i] / sum);
+    }
+
+    t0 = wsa_clock_ns();
+    outputs = (samples - length) / channels;
+    for (k = 0; k < channels; k++) {
+        // the oscillator repeats every M samples, so it is a table
+        for (i = 0; i < channels; i++) {
+            ci[i] = (float)cos(-2 * M_PI * (double)k * i / channels);
+            cq[i] = (float)sin(-2 * M_PI * (double)k * i / channels);
+        }
+        for (n = 0; n < outputs && n < BENCH_PIECE; n++) {
+            s = (n + WSA_CHANNELIZER_TAPS) * channels - 1;
+            yi = 0;
+            yq = 0;
+            for (i = 0; i < length; i++) {
+                yi += h[i] * (idata[s - i] * ci[(s - i) % channels] - qdata[s - i] * cq[(s - i) % channels]);
+                yq += h[i] * (idata[s - i] * cq[(s - i) % channels] + qdata[s - i] * ci[(s - i) % channels]);
+            }
+            out_i[n] = yi;
+            out_q[n] = yq;
+        }
+        *sink += out_i[0];
+    }
+    elapsed = wsa_clock_ns() - t0;
+
+    free(h);
+    free(ci);
+    free(cq);
+
+    // scale to the whole input where the outputs were cut short
+    if (outputs > BENCH_PIECE) {
+        elapsed = (uint64_t)((double)elapsed * outputs / BENCH_PIECE);
+    }
+
+    return elapsed;
+}
+
+
+static void bench_print( char const *method, uint32_t channels, uint32_t workers, uint32_t samples, uint64_t best,
+                         enum bench_format format )
+{
+    if (format == BENCH_FORMAT_JSON) {
+        printf("{\"method\":\"%s\",\"channels\":%u,\"workers\":%u,\"msamples\":%.3f,\"msps\":%.2f,\"ns_per_sample\":%.3f}\n",
+               method, (unsigned)channels, (unsigned)workers, samples / 1e6, samples * 1e3 / (double)best,
+               (double)best / samples);
+    } else {
+        printf("%s,%u,%u,%.3f,%.2f,%.3f\n", method, (unsigned)channels, (unsigned)workers, samples / 1e6,
+               samples * 1e3 / (double)best, (double)best / samples);
+    }
+    fflush(stdout);
+}
+
+
+static int bench_parse_list( char *arg, uint32_t *list, int *count )
+{
+    char *tok;
+
+    *count = 0;
+    for (tok = strtok(arg, ","); tok && *count < BENCH_MAX_LIST; tok = strtok(NULL, ",")) {
+        list[(*count)++] = (uint32_t)strtoul(tok, NULL, 10);
+    }
+
+    return *count > 0 ? 0 : -1;
+}
+
+
+static void bench_usage( char const *prog )
+{
+    printf("usage: %s [options]\n"
+           "  --channels N[,N...] channel counts (default 16,64,256,1024)\n"
+           "  --workers N[,N...]  worker threads (default 0,2)\n"
+           "  --samples N         input samples per run (default %d)\n"
+           "  --reps N            repetitions per run, best reported (default %d)\n"
+           "  --no-ddc            skip the down-converter per channel comparison\n"
+           "  --json              JSON lines instead of CSV\n",
+           prog, BENCH_DEFAULT_SAMPLES, BENCH_DEFAULT_REPS);
+}
+
+
+int main( int argc, char **argv )
+{
+    uint32_t channels[BENCH_MAX_LIST] = { 16, 64, 256, 1024 };
+    uint32_t workers[BENCH_MAX_LIST] = { 0, 2 };
+    int nchannels = 4;
+    int nworkers = 2;
+    uint32_t samples = BENCH_DEFAULT_SAMPLES;
+    int reps = BENCH_DEFAULT_REPS;
+    uint8_t ddc = 1;
+    enum bench_format format = BENCH_FORMAT_CSV;
+    float *idata;
+    float *qdata;
+    float *out_i;
+    float *out_q;
+    float sink = 0;
+    uint64_t best;
+    uint64_t t;
+    int failed = 0;
+    int c;
+    int w;
+    int r;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--channels") && i + 1 < argc) {
+            if (bench_parse_list(argv[++i], channels, &nchannels) < 0) {
+                bench_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--workers") && i + 1 < argc) {
+            if (bench_parse_list(argv[++i], workers, &nworkers) < 0) {
+                bench_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--samples") && i + 1 < argc) {
+            samples = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--reps") && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--no-ddc")) {
+            ddc = 0;
+        } else if (!strcmp(argv[i], "--json")) {
+            format = BENCH_FORMAT_JSON;
+        } else {
+            bench_usage(argv[0]);
+            return strcmp(argv[i], "--help") ? 1 : 0;
+        }
+    }
+    if (reps < 1) {
+        reps = 1;
+    }
+
+    idata = malloc(sizeof(float) * samples);
+    qdata = malloc(sizeof(float) * samples);
+    out_i = malloc(sizeof(float) * BENCH_PIECE);
+    out_q = malloc(sizeof(float) * BENCH_PIECE);
+    if (!idata || !qdata || !out_i || !out_q) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    bench_fill(idata, qdata, samples);
+
+    if (format == BENCH_FORMAT_CSV) {
+        printf("method,channels,workers,msamples,msps,ns_per_sample\n");
+    }
+
+    for (c = 0; c < nchannels; c++) {
+        for (w = 0; w < nworkers; w++) {
+            best = 0;
+            for (r = 0; r < reps; r++) {
+                t = bench_channelizer(idata, qdata, samples, channels[c], workers[w], out_i, out_q, &sink);
+                if (t == 0) {
+                    fprintf(stderr, "channelizer of %u channels, %u workers failed\n",
+                            (unsigned)channels[c], (unsigned)workers[w]);
+                    failed = 1;
+                    break;
+                }
+                if (best == 0 || t < best) {
+                    best = t;
+                }
+            }
+            if (best > 0) {
+                bench_print("channelizer", channels[c], workers[w], samples, best, format);
+            }
+        }
+
+        if (ddc && channels[c] <= BENCH_DDC_MAX_CHANNELS && samples > channels[c] * WSA_CHANNELIZER_TAPS) {
+            t = bench_ddc(idata, qdata, samples, channels[c], out_i, out_q, &sink);
+            if (t > 0) {
+                bench_print("ddc", channels[c], 0, samples, t, format);
+            }
+        }
+    }
+
+    // Keep the results live; this is never true for the generated input.
+    if (sink == 1234.5f) {
+        fprintf(stderr, "\n");
+    }
+
+    free(idata);
+    free(qdata);
+    free(out_i);
+    free(out_q);
+
+    return failed;
+}
+
+/// @}
@@ -0,0 +1,218 @@
+///
+/// @ingroup bench
+///
+/// @{
+///
+
+///
+/// @file
+/// wsabench_ddc: digital down-converter throughput.
+///
+/// Packets of I16Q16 samples, tones over noise as wsa_read_vrt_packet() would give them, are
+/// down-converted with wsa_ddc_push_packet() to each output rate asked for, from a band 20 MHz
+/// off centre. The input rate is the full stream rate, WSA_IBW sampled at 125 MS/s, so
+/// \b per_core, the input rate over the stream rate, is how many such down-converters one core
+/// keeps up with.
+///
+/// One line is printed per output rate, as CSV (default) or JSON lines. The columns are:
+/// \li output_rate: asked for, and actual, in samples/s
+/// \li msps: input samples per second, in millions, best of the repetitions
+/// \li ns_per_sample: time per input sample, best of the repetitions
+/// \li per_core: msps over the 125 MS/s stream rate
+///
+/// Run with --help for the options.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "wsa_lib.h"
+#include "wsa_ddc.h"
+#include "wsa_clock.h"
+
+#define BENCH_SAMPLE_RATE 125e6			///< The stream's sample rate
+#define BENCH_OFFSET 20e6				///< Centre of the band taken out
+#define BENCH_SPP 16384					///< Samples per packet
+#define BENCH_DEFAULT_PACKETS 400		///< Default packets per run
+#define BENCH_DEFAULT_REPS 3			///< Default repetitions per run
+#define BENCH_MAX_LIST 16
+
+/// Output formats.
+enum bench_format {
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON
+};
+
+
+///
+/// Small deterministic generator, so every run sees the same input.
+///
+static uint32_t bench_rand( uint32_t *state )
+{
+    *state = *state * 1664525u + 1013904223u;
+
+    return *state >> 8;
+}
+
+
+///
+/// Fill a packet's worth of I16Q16 samples with tones, one in the band, over noise.
+///
+static void bench_fill( int16_t *i16, int16_t *q16 )
+{
+    static double const tones[] = { BENCH_OFFSET + 0.1e6, -3.7e6, 41e6 };
+    uint32_t state = 0x5eed;
+    double vi;
+    double vq;
+    size_t t;
+    int i;
+
+    for (i = 0; i < BENCH_SPP; i++) {
+        vi = (double)(bench_rand(&state) & 0xff) - 128;
+        vq = (double)(bench_rand(&state) & 0xff) - 128;
+        for (t = 0; t < sizeof(tones) / sizeof(tones[0]); t++) {
+            vi += 6000 * cos(2 * M_PI * fmod(tones[t] / BENCH_SAMPLE_RATE * i, 1.0));
+            vq += 6000 * sin(2 * M_PI * fmod(tones[t] / BENCH_SAMPLE_RATE * i, 1.0));
+        }
+        i16[i] = (int16_t)vi;
+        q16[i] = (int16_t)vq;
+    }
+}
+
+
+static void bench_usage( char const *prog )
+{
+    printf("usage: %s [options]\n"
+           "  --rate R[,R...]     output rates in samples/s (default 10e6,1e6,100e3,7.3e6)\n"
+           "  --packets N         packets of %d samples per run (default %d)\n"
+           "  --reps N            repetitions per run, best reported (default %d)\n"
+           "  --json              JSON lines instead of CSV\n",
+           prog, BENCH_SPP, BENCH_DEFAULT_PACKETS, BENCH_DEFAULT_REPS);
+}
+
+
+int main( int argc, char **argv )
+{
+    double rates[BENCH_MAX_LIST] = { 10e6, 1e6, 100e3, 7.3e6 };
+    int nrates = 4;
+    int packets = BENCH_DEFAULT_PACKETS;
+    int reps = BENCH_DEFAULT_REPS;
+    enum bench_format format = BENCH_FORMAT_CSV;
+    struct wsa_ddc_config config;
+    struct wsa_ddc *ddc;
+    int16_t *i16;
+    int16_t *q16;
+    float *out_i;
+    float *out_q;
+    float sink = 0;
+    char *tok;
+    uint64_t best;
+    uint64_t t0;
+    uint64_t t;
+    double samples;
+    int32_t n;
+    int failed = 0;
+    int r;
+    int p;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--rate") && i + 1 < argc) {
+            nrates = 0;
+            for (tok = strtok(argv[++i], ","); tok && nrates < BENCH_MAX_LIST; tok = strtok(NULL, ",")) {
+                rates[nrates++] = strtod(tok, NULL);
+            }
+        } else if (!strcmp(argv[i], "--packets") && i + 1 < argc) {
+            packets = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--reps") && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--json")) {
+            format = BENCH_FORMAT_JSON;
+        } else {
+            bench_usage(argv[0]);
+            return strcmp(argv[i], "--help") ? 1 : 0;
+        }
+    }
+    if (reps < 1) {
+        reps = 1;
+    }
+    if (packets < 1) {
+        packets = 1;
+    }
+
+    i16 = malloc(sizeof(int16_t) * BENCH_SPP);
+    q16 = malloc(sizeof(int16_t) * BENCH_SPP);
+    out_i = malloc(sizeof(float) * (BENCH_SPP + 1));
+    out_q = malloc(sizeof(float) * (BENCH_SPP + 1));
+    if (!i16 || !q16 || !out_i || !out_q) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    bench_fill(i16, q16);
+    samples = (double)packets * BENCH_SPP;
+
+    if (format == BENCH_FORMAT_CSV) {
+        printf("output_rate,actual_rate,msps,ns_per_sample,per_core\n");
+    }
+
+    for (i = 0; i < nrates; i++) {
+        memset(&config, 0, sizeof(config));
+        config.sample_rate = BENCH_SAMPLE_RATE;
+        config.offset = BENCH_OFFSET;
+        config.output_rate = rates[i];
+        if (wsa_ddc_alloc(&config, &ddc) < 0) {
+            fprintf(stderr, "no down-converter to %g samples/s\n", rates[i]);
+            failed = 1;
+            continue;
+        }
+
+        best = 0;
+        for (r = 0; r < reps; r++) {
+            wsa_ddc_reset(ddc);
+            t0 = wsa_clock_ns();
+            for (p = 0; p < packets; p++) {
+                n = wsa_ddc_push_packet(ddc, I16Q16_DATA_STREAM_ID, i16, q16, NULL, BENCH_SPP, out_i, out_q);
+                if (n > 0) {
+                    sink += out_i[n - 1];
+                }
+            }
+            t = wsa_clock_ns() - t0;
+            if (best == 0 || t < best) {
+                best = t;
+            }
+        }
+
+        if (format == BENCH_FORMAT_JSON) {
+            printf("{\"output_rate\":%.1f,\"actual_rate\":%.3f,\"msps\":%.2f,\"ns_per_sample\":%.3f,"
+                   "\"per_core\":%.2f}\n",
+                   rates[i], wsa_ddc_output_rate(ddc), samples * 1e3 / (double)best,
+                   (double)best / samples, samples * 1e9 / (double)best / BENCH_SAMPLE_RATE);
+        } else {
+            printf("%.1f,%.3f,%.2f,%.3f,%.2f\n", rates[i], wsa_ddc_output_rate(ddc),
+                   samples * 1e3 / (double)best, (double)best / samples, samples * 1e9 / (double)best / BENCH_SAMPLE_RATE);
+        }
+        fflush(stdout);
+
+        wsa_ddc_free(ddc);
+    }
+
+    // Keep the results live; this is never true for the generated input.
+    if (sink == 1234.5f) {
+        fprintf(stderr, "\n");
+    }
+
+    free(i16);
+    free(q16);
+    free(out_i);
+    free(out_q);
+
+    return failed;
+}
+
+/// @}
@@ -0,0 +1,495 @@
+///
+/// @defgroup bench Benchmarks
+///
+/// Performance measurements of the library, run with "make bench".
+///
+/// @{
+///
+
+///
+/// @file
+/// wsabench_dsp: microbenchmarks for the decode and DSP hot paths.
+///
+/// Each function is timed on one packet's worth of data at every SPP asked for. The input is
+/// generated from a fixed seed so runs are reproducible, each call count is sized to fill a minimum
+/// time, and the best and median of several repetitions are reported, one line per function
+/// and SPP, as CSV (default) or JSON lines.
+///
+/// The columns are:
+/// \li bench, spp: what was measured
+/// \li iterations: calls per repetition
+/// \li ns_per_call, ns_per_sample: median time per call and per input sample
+/// \li ns_per_sample_min: best repetition, per input sample
+/// \li gb_per_s: bytes read and written per call over the median time, in 1e9 bytes/s
+///
+/// Run with --help for the options.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_dsp.h"
+#include "wsa_persistence.h"
+#include "wsa_iqcorr.h"
+#include "kiss_fft.h"
+#include "wsa_clock.h"
+
+#define BENCH_DEFAULT_MIN_MS 20			///< Default minimum time per repetition
+#define BENCH_DEFAULT_REPS 5			///< Default repetitions per measurement
+#define BENCH_MAX_REPS 64
+
+/// Buffers shared by all benchmarks, sized for WSA_MAX_SPP.
+struct bench_ctx {
+    int32_t spp;
+    uint8_t *raw;					///< Big-endian VRT payload
+    int16_t *i16;
+    int16_t *q16;
+    int32_t *i32;
+    float *idata;
+    float *qdata;
+    kiss_fft_cpx *cpx;
+    float *spectrum;				///< dBm values, one per sample
+    struct wsa_persistence *persistence;	///< 1024 x 256 display over -120 to 0 dBm
+    struct wsa_iqcorr *iqcorr;		///< DC offset and IQ imbalance corrector, default settings
+    float sink;						///< Accumulates results so no call is optimized away
+};
+
+/// One benchmark.
+struct bench_def {
+    char const *name;
+    void (*run)(struct bench_ctx *ctx);
+    uint32_t bytes_per_sample;		///< Bytes read and written per input sample
+};
+
+/// Output formats.
+enum bench_format {
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON
+};
+
+
+///
+/// Small deterministic generator, so every run sees the same input.
+///
+static uint32_t bench_rand( uint32_t *state )
+{
+    *state = *state * 1664525u + 1013904223u;
+
+    return *state >> 8;
+}
+
+
+static void bench_decode_zif( struct bench_ctx *ctx )
+{
+    wsa_decode_zif_frame(ctx->raw, ctx->spp, ctx->i16, ctx->q16, ctx->spp);
+    ctx->sink += ctx->i16[ctx->spp - 1];
+}
+
+
+static void bench_decode_i16( struct bench_ctx *ctx )
+{
+    wsa_decode_i_only_frame(I16_DATA_STREAM_ID, ctx->raw, ctx->spp, ctx->i16, ctx->i32, ctx->spp);
+    ctx->sink += ctx->i16[ctx->spp - 1];
+}
+
+
+static void bench_decode_i32( struct bench_ctx *ctx )
+{
+    wsa_decode_i_only_frame(I32_DATA_STREAM_ID, ctx->raw, ctx->spp, ctx->i16, ctx->i32, ctx->spp);
+    ctx->sink += (float)ctx->i32[ctx->spp - 1];
+}
+
+
+static void bench_normalize_i16q16( struct bench_ctx *ctx )
+{
+    normalize_iq_data(ctx->spp, I16Q16_DATA_STREAM_ID, ctx->i16, ctx->q16, ctx->i32, ctx->idata, ctx->qdata);
+    ctx->sink += ctx->idata[ctx->spp - 1];
+}
+
+
+static void bench_normalize_i16( struct bench_ctx *ctx )
+{
+    normalize_iq_data(ctx->spp, I16_DATA_STREAM_ID, ctx->i16, ctx->q16, ctx->i32, ctx->idata, ctx->qdata);
+    ctx->sink += ctx->idata[ctx->spp - 1];
+}
+
+
+static void bench_iqcorr_push( struct bench_ctx *ctx )
+{
+    wsa_iqcorr_push(ctx->iqcorr, ctx->idata, ctx->qdata, ctx->spp);
+    ctx->sink += ctx->qdata[ctx->spp - 1];
+}
+
+
+///
+/// The window works in place, so it is applied to a fresh copy each call; applied over and over to
+/// the same data the values would decay into denormals and the timing would be meaningless.
+///
+static void bench_window_hanning( struct bench_ctx *ctx )
+{
+    memcpy(ctx->idata, ctx->qdata, ctx->spp * sizeof(float));
+    window_hanning_scalar_array(ctx->idata, ctx->spp);
+    ctx->sink += ctx->idata[ctx->spp / 2];
+}
+
+
+static void bench_rfft( struct bench_ctx *ctx )
+{
+    rfft(ctx->idata, ctx->cpx, ctx->spp);
+    ctx->sink += ctx->cpx[0].r;
+}
+
+
+static void bench_compute_fft_i16( struct bench_ctx *ctx )
+{
+    wsa_compute_fft(ctx->spp, ctx->spp / 2, I16_DATA_STREAM_ID, 0, 0, ctx->i16, ctx->q16, ctx->i32, ctx->spectrum);
+    ctx->sink += ctx->spectrum[0];
+}
+
+
+static void bench_compute_fft_i16q16( struct bench_ctx *ctx )
+{
+    wsa_compute_fft(ctx->spp, ctx->spp, I16Q16_DATA_STREAM_ID, 0, 0, ctx->i16, ctx->q16, ctx->i32, ctx->spectrum);
+    ctx->sink += ctx->spectrum[0];
+}
+
+
+///
+/// The conversion from FFT output to dBm done for every block in wsa_collect_sweep().
+///
+static void bench_dbm_convert( struct bench_ctx *ctx )
+{
+    int32_t i;
+    float tmpscalar;
+
+    for (i = 0; i < ctx->spp; i++) {
+        tmpscalar = cpx_to_power(ctx->cpx[i]) / ctx->spp;
+        tmpscalar = 2 * power_to_logpower(tmpscalar);
+        ctx->spectrum[i] = tmpscalar + 0.0f - (float)KISS_FFT_OFFSET;
+    }
+    ctx->sink += ctx->spectrum[ctx->spp - 1];
+}
+
+
+static void bench_psd_peak_find( struct bench_ctx *ctx )
+{
+    uint64_t peak_freq;
+    float peak_power;
+
+    psd_peak_find(2400000000ULL, 2500000000ULL, 0, ctx->spp, ctx->spectrum, &peak_freq, &peak_power);
+    ctx->sink += peak_power;
+}
+
+
+static void bench_psd_channel_power( struct bench_ctx *ctx )
+{
+    float power;
+
+    psd_calculate_channel_power(0, ctx->spp - 1, ctx->spectrum, ctx->spp, &power);
+    ctx->sink += power;
+}
+
+
+static void bench_psd_absolute_power( struct bench_ctx *ctx )
+{
+    float power;
+
+    psd_calculate_absolute_power(0, ctx->spp - 1, ctx->spectrum, ctx->spp, &power);
+    ctx->sink += power;
+}
+
+
+static void bench_persistence_push( struct bench_ctx *ctx )
+{
+    wsa_persistence_push(ctx->persistence, ctx->spectrum, ctx->spp);
+    ctx->sink += ctx->spectrum[0];
+}
+
+
+/// All benchmarks, in pipeline order.
+static struct bench_def const bench_defs[] = {
+    { "decode_zif_frame",			bench_decode_zif,			4 + 4 },
+    { "decode_i_only_frame_i16",	bench_decode_i16,			2 + 2 },
+    { "decode_i_only_frame_i32",	bench_decode_i32,			4 + 4 },
+    { "normalize_iq_data_i16q16",	bench_normalize_i16q16,		4 + 8 },
+    { "normalize_iq_data_i16",		bench_normalize_i16,		2 + 8 },
+    { "iqcorr_push",				bench_iqcorr_push,			8 + 8 },
+    { "window_hanning_scalar_array", bench_window_hanning,		4 + 4 },
+    { "rfft",						bench_rfft,					4 + 8 },
+    { "wsa_compute_fft_i16",		bench_compute_fft_i16,		2 + 2 },
+    { "wsa_compute_fft_i16q16",		bench_compute_fft_i16q16,	4 + 4 },
+    { "dbm_convert",				bench_dbm_convert,			8 + 4 },
+    { "psd_peak_find",				bench_psd_peak_find,		4 },
+    { "psd_calculate_channel_power", bench_psd_channel_power,	4 },
+    { "psd_calculate_absolute_power", bench_psd_absolute_power,	4 },
+    { "persistence_push",			bench_persistence_push,		4 + 4 },
+};
+
+#define BENCH_COUNT (sizeof(bench_defs) / sizeof(bench_defs[0]))
+
+
+///
+/// Fill the buffers with a tone over noise, as a device would deliver it.
+///
+static void bench_fill( struct bench_ctx *ctx )
+{
+    uint32_t state = 0x5eed;
+    int32_t i;
+    int32_t v;
+
+    for (i = 0; i < WSA_MAX_SPP; i++) {
+        v = (int32_t)((i * 37) % 4096) - 2048 + (int32_t)(bench_rand(&state) & 0x3ff) - 512;
+        ctx->raw[4 * i] = (uint8_t)(v >> 8);
+        ctx->raw[4 * i + 1] = (uint8_t)v;
+        ctx->raw[4 * i + 2] = (uint8_t)(-v >> 8);
+        ctx->raw[4 * i + 3] = (uint8_t)-v;
+        ctx->i16[i] = (int16_t)v;
+        ctx->q16[i] = (int16_t)-v;
+        ctx->i32[i] = v << 8;
+        ctx->idata[i] = (float)v / 8192.0f;
+        ctx->qdata[i] = (float)-v / 8192.0f;
+        ctx->cpx[i].r = ctx->idata[i];
+        ctx->cpx[i].i = ctx->qdata[i];
+        ctx->spectrum[i] = -100.0f + (float)(bench_rand(&state) % 6000) / 100.0f;
+    }
+}
+
+
+static int bench_alloc( struct bench_ctx *ctx )
+{
+    struct wsa_persistence_config persistence = { 1024, 256, -120.0f, 0.0f, 0.95f };
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->raw = malloc(WSA_MAX_SPP * 4);
+    ctx->i16 = malloc(WSA_MAX_SPP * sizeof(int16_t));
+    ctx->q16 = malloc(WSA_MAX_SPP * sizeof(int16_t));
+    ctx->i32 = malloc(WSA_MAX_SPP * sizeof(int32_t));
+    ctx->idata = malloc(WSA_MAX_SPP * sizeof(float));
+    ctx->qdata = malloc(WSA_MAX_SPP * sizeof(float));
+    ctx->cpx = malloc(WSA_MAX_SPP * sizeof(kiss_fft_cpx));
+    ctx->spectrum = malloc(WSA_MAX_SPP * sizeof(float));
+    if (wsa_persistence_alloc(&persistence, &ctx->persistence) < 0 || wsa_iqcorr_alloc(NULL, &ctx->iqcorr) < 0) {
+        return -1;
+    }
+
+    return (ctx->raw && ctx->i16 && ctx->q16 && ctx->i32 && ctx->idata && ctx->qdata && ctx->cpx && ctx->spectrum) ? 0 : -1;
+}
+
+
+static void bench_free( struct bench_ctx *ctx )
+{
+    free(ctx->raw);
+    free(ctx->i16);
+    free(ctx->q16);
+    free(ctx->i32);
+    free(ctx->idata);
+    free(ctx->qdata);
+    free(ctx->cpx);
+    free(ctx->spectrum);
+    wsa_persistence_free(ctx->persistence);
+    wsa_iqcorr_free(ctx->iqcorr);
+}
+
+
+static int bench_cmp_u64( void const *a, void const *b )
+{
+    uint64_t x = *(uint64_t const *)a;
+    uint64_t y = *(uint64_t const *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+///
+/// Time one benchmark at the current SPP and print its line.
+///
+/// The call count per repetition is sized from a single warm-up call so each repetition takes at
+/// least \b min_ns. Input buffers are restored before each repetition since some functions work
+/// in place.
+///
+static void bench_measure( struct bench_ctx *ctx, struct bench_def const *def, uint64_t min_ns, int reps, enum bench_format format )
+{
+    uint64_t rep_ns[BENCH_MAX_REPS];
+    uint64_t t0;
+    uint64_t once;
+    uint64_t iterations;
+    uint64_t n;
+    double per_call;
+    double per_sample_min;
+    int r;
+
+    bench_fill(ctx);
+    t0 = wsa_clock_ns();
+    def->run(ctx);
+    once = wsa_clock_ns() - t0;
+    iterations = (once > 0) ? (min_ns + once - 1) / once : min_ns;
+    if (iterations < 1) {
+        iterations = 1;
+    }
+
+    for (r = 0; r < reps; r++) {
+        bench_fill(ctx);
+        t0 = wsa_clock_ns();
+        for (n = 0; n < iterations; n++) {
+            def->run(ctx);
+        }
+        rep_ns[r] = wsa_clock_ns() - t0;
+    }
+    qsort(rep_ns, reps, sizeof(rep_ns[0]), bench_cmp_u64);
+
+    per_call = (double)rep_ns[reps / 2] / (double)iterations;
+    per_sample_min = (double)rep_ns[0] / (double)iterations / (double)ctx->spp;
+
+    if (format == BENCH_FORMAT_JSON) {
+        printf("{\"bench\":\"%s\",\"spp\":%ld,\"iterations\":%llu,\"ns_per_call\":%.1f,\"ns_per_sample\":%.4f,"
+               "\"ns_per_sample_min\":%.4f,\"gb_per_s\":%.4f}\n",
+               def->name, (long)ctx->spp, (unsigned long long)iterations, per_call, per_call / ctx->spp,
+               per_sample_min, (double)def->bytes_per_sample * ctx->spp / per_call);
+    } else {
+        printf("%s,%ld,%llu,%.1f,%.4f,%.4f,%.4f\n",
+               def->name, (long)ctx->spp, (unsigned long long)iterations, per_call, per_call / ctx->spp,
+               per_sample_min, (double)def->bytes_per_sample * ctx->spp / per_call);
+    }
+    fflush(stdout);
+}
+
+
+static void bench_usage( char const *prog )
+{
+    printf("usage: %s [options]\n"
+           "  --all               every SPP the device supports (%d to %d in steps of %d)\n"
+           "  --spp N[,N...]      only these SPPs\n"
+           "  --bench NAME        only benchmarks whose name starts with NAME (repeatable)\n"
+           "  --min-ms N          minimum time per repetition in ms (default %d)\n"
+           "  --reps N            repetitions per measurement, median reported (default %d)\n"
+           "  --json              JSON lines instead of CSV\n"
+           "  --list              list the benchmarks and exit\n",
+           prog, WSA_MIN_SPP, WSA_MAX_SPP, WSA_SPP_MULTIPLE, BENCH_DEFAULT_MIN_MS, BENCH_DEFAULT_REPS);
+}
+
+
+static int bench_selected( char const *name, char **filters, int nfilters )
+{
+    int i;
+
+    if (nfilters == 0) {
+        return 1;
+    }
+    for (i = 0; i < nfilters; i++) {
+        if (strncmp(name, filters[i], strlen(filters[i])) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+int main( int argc, char **argv )
+{
+    // Powers of two up to the largest, plus the maximum itself, unless --all or --spp is given.
+    static int32_t const default_spps[] = { 256, 512, 1024, 2048, 4096, 8192, 16384, 32768, WSA_MAX_SPP };
+    int32_t *spps;
+    int nspps = 0;
+    char **filters;
+    int nfilters = 0;
+    uint64_t min_ns = BENCH_DEFAULT_MIN_MS * 1000000ULL;
+    int reps = BENCH_DEFAULT_REPS;
+    enum bench_format format = BENCH_FORMAT_CSV;
+    uint8_t all = 0;
+    struct bench_ctx ctx;
+    char *tok;
+    size_t b;
+    int i;
+
+    spps = malloc(sizeof(int32_t) * ((WSA_MAX_SPP - WSA_MIN_SPP) / WSA_SPP_MULTIPLE + 1));
+    filters = malloc(sizeof(char *) * argc);
+    if (!spps || !filters) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--all")) {
+            all = 1;
+        } else if (!strcmp(argv[i], "--spp") && i + 1 < argc) {
+            for (tok = strtok(argv[++i], ","); tok && nspps < (WSA_MAX_SPP - WSA_MIN_SPP) / WSA_SPP_MULTIPLE + 1; tok = strtok(NULL, ",")) {
+                spps[nspps] = atoi(tok);
+                if (spps[nspps] < WSA_MIN_SPP || spps[nspps] > WSA_MAX_SPP || spps[nspps] % WSA_SPP_MULTIPLE) {
+                    fprintf(stderr, "unsupported spp %s\n", tok);
+                    return 1;
+                }
+                nspps++;
+            }
+        } else if (!strcmp(argv[i], "--bench") && i + 1 < argc) {
+            filters[nfilters++] = argv[++i];
+        } else if (!strcmp(argv[i], "--min-ms") && i + 1 < argc) {
+            min_ns = strtoull(argv[++i], NULL, 10) * 1000000ULL;
+        } else if (!strcmp(argv[i], "--reps") && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+            if (reps < 1 || reps > BENCH_MAX_REPS) {
+                fprintf(stderr, "--reps must be 1 to %d\n", BENCH_MAX_REPS);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--json")) {
+            format = BENCH_FORMAT_JSON;
+        } else if (!strcmp(argv[i], "--list")) {
+            for (b = 0; b < BENCH_COUNT; b++) {
+                printf("%s\n", bench_defs[b].name);
+            }
+            return 0;
+        } else {
+            bench_usage(argv[0]);
+            return strcmp(argv[i], "--help") ? 1 : 0;
+        }
+    }
+
+    if (all) {
+        for (nspps = 0; WSA_MIN_SPP + nspps * WSA_SPP_MULTIPLE <= WSA_MAX_SPP; nspps++) {
+            spps[nspps] = WSA_MIN_SPP + nspps * WSA_SPP_MULTIPLE;
+        }
+    } else if (nspps == 0) {
+        for (nspps = 0; nspps < (int)(sizeof(default_spps) / sizeof(default_spps[0])); nspps++) {
+            spps[nspps] = default_spps[nspps];
+        }
+    }
+
+    if (bench_alloc(&ctx) < 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    if (format == BENCH_FORMAT_CSV) {
+        printf("bench,spp,iterations,ns_per_call,ns_per_sample,ns_per_sample_min,gb_per_s\n");
+    }
+
+    for (b = 0; b < BENCH_COUNT; b++) {
+        if (!bench_selected(bench_defs[b].name, filters, nfilters)) {
+            continue;
+        }
+        for (i = 0; i < nspps; i++) {
+            ctx.spp = spps[i];
+            bench_measure(&ctx, &bench_defs[b], min_ns, reps, format);
+        }
+    }
+
+    // Keep the results live; this is never true for the generated input.
+    if (ctx.sink == 1234.5f) {
+        fprintf(stderr, "\n");
+    }
+
+    bench_free(&ctx);
+    free(spps);
+    free(filters);
+
+    return 0;
+}
+
+/// @}
@@ -0,0 +1,271 @@
+///
+/// @ingroup bench
+///
+/// @{
+///
+
+///
+/// @file
+/// wsabench_record: raw VRT recording benchmark.
+///
+/// The device is set streaming at each packet size in turn, and a fixed number of packets are
+/// recorded with wsa_recorder_run(), once spliced (where the platform allows it, see
+/// WSA_RECORD_SPLICE) and once copied through the recorder's buffer. The recording is deleted
+/// afterwards.
+///
+/// By default the packets come from wsasim, started on loopback for the run. The simulator
+/// generates every packet, so it, rather than the recorder, usually sets the rate; the CPU time
+/// used by the recorder is the figure to watch. Use --device to measure real hardware.
+///
+/// One line is printed per run, as CSV (default) or JSON lines. The columns are:
+/// \li method: splice or copy
+/// \li spp: samples per packet
+/// \li packets, mbytes: what was recorded
+/// \li mbytes_per_s: recording rate
+/// \li cpu_ms_per_gb: user and system CPU time used per GB recorded
+/// \li cpu_pct: CPU time as a percentage of the elapsed time
+///
+/// Run with --help for the options.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/resource.h>
+#endif
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_record.h"
+#include "wsa_clock.h"
+#include "test_sim.h"
+
+#define BENCH_CTRL_PORT 47111			///< Control port of the simulator started for the run
+#define BENCH_DATA_PORT 47110			///< Data port of the simulator started for the run
+#define BENCH_DEFAULT_PACKETS 20000		///< Default packets recorded per run
+#define BENCH_TIMEOUT_MS 2000			///< Wait for each packet
+#define BENCH_MAX_LIST 16
+
+/// Output formats.
+enum bench_format {
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON
+};
+
+
+///
+/// CPU time used by this process so far, user and system, in nanoseconds.
+///
+static uint64_t bench_cpu_ns( void )
+{
+#ifdef _WIN32
+    return (uint64_t)clock() * (1000000000ULL / CLOCKS_PER_SEC);
+#else
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+
+    return ((uint64_t)ru.ru_utime.tv_sec + (uint64_t)ru.ru_stime.tv_sec) * 1000000000ULL +
+           ((uint64_t)ru.ru_utime.tv_usec + (uint64_t)ru.ru_stime.tv_usec) * 1000ULL;
+#endif
+}
+
+
+///
+/// Record one run and print its line.
+///
+/// @return 0 on success, otherwise the library's error code.
+///
+static int16_t bench_run( struct wsa_device *dev, char const *path, uint32_t flags, int32_t spp, uint64_t packets,
+                          enum bench_format format )
+{
+    struct wsa_recorder *rec = NULL;
+    char const *method;
+    uint64_t recorded = 0;
+    uint64_t bytes = 0;
+    uint64_t t0, cpu0;
+    uint64_t elapsed_ns, cpu_ns;
+    int16_t result;
+    int16_t free_result;
+
+    result = wsa_set_samples_per_packet(dev, spp);
+    if (result < 0) {
+        return result;
+    }
+
+    result = wsa_recorder_alloc(dev, path, flags, &rec);
+    if (result < 0) {
+        return result;
+    }
+    method = wsa_recorder_zero_copy(rec) ? "splice" : "copy";
+
+    result = wsa_stream_start(dev);
+    if (result >= 0) {
+        // the first packet waits out the start of the stream, so it is not timed
+        result = wsa_recorder_run(rec, 1, BENCH_TIMEOUT_MS);
+    }
+
+    t0 = wsa_clock_ns();
+    cpu0 = bench_cpu_ns();
+    if (result >= 0) {
+        result = wsa_recorder_run(rec, packets, BENCH_TIMEOUT_MS);
+    }
+    elapsed_ns = wsa_clock_ns() - t0;
+    cpu_ns = bench_cpu_ns() - cpu0;
+
+    wsa_stream_stop(dev);
+    wsa_flush_data(dev);
+    wsa_clean_data_socket(dev);
+
+    wsa_recorder_totals(rec, &recorded, &bytes);
+    free_result = wsa_recorder_free(rec);
+    if (result >= 0) {
+        result = free_result;
+    }
+    if (result < 0) {
+        return result;
+    }
+
+    // the untimed packet
+    recorded--;
+    bytes = bytes / (recorded + 1) * recorded;
+
+    if (format == BENCH_FORMAT_JSON) {
+        printf("{\"method\":\"%s\",\"spp\":%ld,\"packets\":%llu,\"mbytes\":%.1f,\"mbytes_per_s\":%.1f,"
+               "\"cpu_ms_per_gb\":%.1f,\"cpu_pct\":%.1f}\n",
+               method, (long)spp, (unsigned long long)recorded, bytes / 1e6, bytes / 1e6 / (elapsed_ns / 1e9),
+               cpu_ns / 1e6 / (bytes / 1e9), 100.0 * cpu_ns / elapsed_ns);
+    } else {
+        printf("%s,%ld,%llu,%.1f,%.1f,%.1f,%.1f\n",
+               method, (long)spp, (unsigned long long)recorded, bytes / 1e6, bytes / 1e6 / (elapsed_ns / 1e9),
+               cpu_ns / 1e6 / (bytes / 1e9), 100.0 * cpu_ns / elapsed_ns);
+    }
+    fflush(stdout);
+
+    return 0;
+}
+
+
+static void bench_usage( char const *prog )
+{
+    printf("usage: %s [options]\n"
+           "  --device INTF       measure this device instead of a simulator, i.e. TCPIP::192.168.1.10\n"
+           "  --sim PATH          simulator to start (default: wsasim next to this program)\n"
+           "  --spp N[,N...]      samples per packet to run (default 1024,16384)\n"
+           "  --packets N         packets recorded per run (default %d)\n"
+           "  --file PATH         where to record (default wsabench_record.vrt)\n"
+           "  --json              JSON lines instead of CSV\n",
+           prog, BENCH_DEFAULT_PACKETS);
+}
+
+
+int main( int argc, char **argv )
+{
+    static uint32_t const methods[] = { WSA_RECORD_SPLICE, 0 };
+    int32_t spps[BENCH_MAX_LIST] = { 1024, 16384 };
+    int nspps = 2;
+    uint64_t packets = BENCH_DEFAULT_PACKETS;
+    enum bench_format format = BENCH_FORMAT_CSV;
+    char *device = NULL;
+    char const *path = "wsabench_record.vrt";
+    char index_path[1024];
+    char sim_path[1024];
+    char intf[64];
+    struct wsa_device dev;
+    char *tok;
+    int16_t result;
+    int failed = 0;
+    int i, m, s;
+#ifndef _WIN32
+    pid_t sim = -1;
+#endif
+
+    // The simulator is built into the same directory as the benchmarks.
+    test_sim_path(argv[0], sim_path, sizeof(sim_path));
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--device") && i + 1 < argc) {
+            device = argv[++i];
+        } else if (!strcmp(argv[i], "--sim") && i + 1 < argc) {
+            snprintf(sim_path, sizeof(sim_path), "%s", argv[++i]);
+        } else if (!strcmp(argv[i], "--spp") && i + 1 < argc) {
+            nspps = 0;
+            for (tok = strtok(argv[++i], ","); tok && nspps < BENCH_MAX_LIST; tok = strtok(NULL, ",")) {
+                spps[nspps++] = (int32_t)strtol(tok, NULL, 10);
+            }
+        } else if (!strcmp(argv[i], "--packets") && i + 1 < argc) {
+            packets = strtoull(argv[++i], NULL, 10);
+            if (packets < 1) {
+                packets = 1;
+            }
+        } else if (!strcmp(argv[i], "--file") && i + 1 < argc) {
+            path = argv[++i];
+        } else if (!strcmp(argv[i], "--json")) {
+            format = BENCH_FORMAT_JSON;
+        } else {
+            bench_usage(argv[0]);
+            return strcmp(argv[i], "--help") ? 1 : 0;
+        }
+    }
+
+    if (device) {
+        snprintf(intf, sizeof(intf), "%s", device);
+    } else {
+#ifdef _WIN32
+        fprintf(stderr, "no simulator on this platform, use --device\n");
+        return 1;
+#else
+        sim = test_sim_start(sim_path, BENCH_CTRL_PORT, BENCH_DATA_PORT, NULL);
+        if (sim < 0) {
+            fprintf(stderr, "failed to start simulator %s\n", sim_path);
+            return 1;
+        }
+        snprintf(intf, sizeof(intf), "TCPIP::127.0.0.1::%d,%d", BENCH_CTRL_PORT, BENCH_DATA_PORT);
+#endif
+    }
+
+    result = wsa_open(&dev, intf);
+    if (result < 0) {
+        fprintf(stderr, "wsa_open(%s) failed: %s\n", intf, wsa_get_error_msg(result));
+#ifndef _WIN32
+        test_sim_stop(sim);
+#endif
+        return 1;
+    }
+
+    if (format == BENCH_FORMAT_CSV) {
+        printf("method,spp,packets,mbytes,mbytes_per_s,cpu_ms_per_gb,cpu_pct\n");
+    }
+
+    for (s = 0; s < nspps; s++) {
+        for (m = 0; m < (int)(sizeof(methods) / sizeof(methods[0])); m++) {
+            result = bench_run(&dev, path, methods[m], spps[s], packets, format);
+            if (result < 0) {
+                fprintf(stderr, "spp %ld %s failed: %s\n", (long)spps[s], methods[m] ? "splice" : "copy",
+                        wsa_get_error_msg(result));
+                failed = 1;
+            }
+        }
+    }
+
+    snprintf(index_path, sizeof(index_path), "%s%s", path, WSA_RECORD_INDEX_SUFFIX);
+    remove(path);
+    remove(index_path);
+
+    wsa_close(&dev);
+#ifndef _WIN32
+    test_sim_stop(sim);
+#endif
+
+    return failed;
+}
+
+/// @}
@@ -0,0 +1,404 @@
+///
+/// @ingroup bench
+///
+/// @{
+///
+
+///
+/// @file
+/// wsabench_replay: offline replay benchmark.
+///
+/// A number of power spectrum sweeps are recorded from the device with wsa_recorder_run(), then
+/// the recording is opened as a device ("FILE::<path>", see wsa_replay.h) and read back: once
+/// packet by packet with wsa_read_vrt_packet_raw(), and twice through wsa_capture_power_spectrum()
+/// with the same sweep. The two sweep passes must give the same spectra bit for bit. The
+/// recording is deleted afterwards.
+///
+/// By default the packets come from wsasim, started on loopback for the run. Use --device to
+/// record real hardware.
+///
+/// One line is printed per pass, as CSV (default) or JSON lines. The columns are:
+/// \li pass: record, read, sweep1 or sweep2
+/// \li packets, mbytes: what was recorded or read
+/// \li seconds: elapsed time
+/// \li mbytes_per_s: rate
+/// \li sweeps_per_s: spectra captured per second, for the sweep passes
+/// \li repeatable: 1 if the second sweep pass matched the first, for sweep2
+///
+/// Run with --help for the options.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_error.h"
+#include "wsa_sweep_device.h"
+#include "wsa_record.h"
+#include "wsa_replay.h"
+#include "wsa_clock.h"
+#include "test_sim.h"
+
+#define BENCH_CTRL_PORT 47121			///< Control port of the simulator started for the run
+#define BENCH_DATA_PORT 47120			///< Data port of the simulator started for the run
+#define BENCH_DEFAULT_SWEEPS 50			///< Default sweeps recorded
+#define BENCH_DEFAULT_RBW 100000
+#define BENCH_FSTART (2400 * MHZ)
+#define BENCH_FSTOP (2500 * MHZ)
+#define BENCH_IDLE_MS 1000				///< Quiet time that ends the recording
+
+/// Output formats.
+enum bench_format {
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON
+};
+
+
+static void bench_print( enum bench_format format, char const *pass, uint64_t packets, uint64_t bytes,
+                         uint64_t elapsed_ns, uint32_t sweeps, int repeatable )
+{
+    double seconds = elapsed_ns / 1e9;
+
+    if (format == BENCH_FORMAT_JSON) {
+        printf("{\"pass\":\"%s\",\"packets\":%llu,\"mbytes\":%.1f,\"seconds\":%.3f,\"mbytes_per_s\":%.1f,"
+               "\"sweeps_per_s\":%.1f,\"repeatable\":%d}\n",
+               pass, (unsigned long long)packets, bytes / 1e6, seconds, bytes / 1e6 / seconds,
+               sweeps / seconds, repeatable);
+    } else {
+        printf("%s,%llu,%.1f,%.3f,%.1f,%.1f,%d\n",
+               pass, (unsigned long long)packets, bytes / 1e6, seconds, bytes / 1e6 / seconds,
+               sweeps / seconds, repeatable);
+    }
+    fflush(stdout);
+}
+
+
+///
+/// Set up the sweep on a device, live or replayed.
+///
+static int16_t bench_configure( struct wsa_sweep_device *sweep_device, uint32_t rbw,
+                                struct wsa_power_spectrum_config **cfg )
+{
+    int16_t result;
+
+    result = wsa_power_spectrum_alloc(sweep_device, BENCH_FSTART, BENCH_FSTOP, rbw, "SH", cfg);
+    if (result < 0) {
+        return result;
+    }
+
+    result = wsa_configure_sweep(sweep_device, *cfg);
+    if (result < 0) {
+        wsa_power_spectrum_free(*cfg);
+    }
+
+    return result;
+}
+
+
+///
+/// Record the sweeps from the live device, until it has been quiet for BENCH_IDLE_MS.
+///
+static int16_t bench_record( char const *intf, char const *path, uint32_t rbw, uint32_t sweeps,
+                             enum bench_format format )
+{
+    struct wsa_device dev;
+    struct wsa_sweep_device *sweep_device;
+    struct wsa_power_spectrum_config *cfg;
+    struct wsa_recorder *rec = NULL;
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t t0;
+    int16_t result;
+
+    result = wsa_open(&dev, (char *)intf);
+    if (result < 0) {
+        return result;
+    }
+    sweep_device = wsa_sweep_device_new(&dev);
+
+    result = bench_configure(sweep_device, rbw, &cfg);
+    if (result >= 0) {
+        result = wsa_set_sweep_iteration(&dev, (int32_t)sweeps);
+        if (result >= 0) {
+            result = wsa_recorder_alloc(&dev, path, 0, &rec);
+        }
+        if (result >= 0) {
+            t0 = wsa_clock_ns();
+            result = wsa_sweep_start(&dev);
+            if (result >= 0) {
+                result = wsa_recorder_run(rec, 0, BENCH_IDLE_MS);
+                if (result == WSA_ERR_SOCKETNODATA) {
+                    result = 0;
+                }
+            }
+            wsa_recorder_totals(rec, &packets, &bytes);
+            if (result >= 0) {
+                result = wsa_recorder_free(rec);
+            } else {
+                wsa_recorder_free(rec);
+            }
+            if (result >= 0) {
+                bench_print(format, "record", packets, bytes, wsa_clock_ns() - t0 - BENCH_IDLE_MS * 1000000ULL,
+                            0, 0);
+            }
+        }
+        wsa_power_spectrum_free(cfg);
+    }
+
+    wsa_sweep_device_free(sweep_device);
+    wsa_close(&dev);
+
+    return result;
+}
+
+
+///
+/// Read every packet of the recording with wsa_read_vrt_packet_raw().
+///
+static int16_t bench_read( char const *intf, enum bench_format format )
+{
+    struct wsa_device dev;
+    struct wsa_vrt_packet_header header;
+    struct wsa_vrt_packet_trailer trailer;
+    struct wsa_receiver_packet receiver;
+    struct wsa_digitizer_packet digitizer;
+    struct wsa_extension_packet extension;
+    struct wsa_stats stats;
+    uint8_t *data;
+    uint64_t t0;
+    uint64_t elapsed_ns;
+    int16_t result;
+
+    data = malloc(65536 * BYTES_PER_VRT_WORD);
+    if (data == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+
+    result = wsa_open(&dev, (char *)intf);
+    if (result < 0) {
+        free(data);
+        return result;
+    }
+
+    t0 = wsa_clock_ns();
+    result = wsa_stream_start(&dev);
+    while (result >= 0) {
+        result = wsa_read_vrt_packet_raw(&dev, &header, &trailer, &receiver, &digitizer, &extension,
+                                         data, 65535, 1000);
+    }
+    elapsed_ns = wsa_clock_ns() - t0;
+    if (result == WSA_ERR_SOCKETNODATA) {
+        result = 0;
+    }
+
+    if (result >= 0) {
+        wsa_stats_read(&dev, &stats, 0);
+        bench_print(format, "read", stats.counter[WSA_STAT_PACKETS], stats.counter[WSA_STAT_BYTES], elapsed_ns, 0, 0);
+    }
+
+    wsa_close(&dev);
+    free(data);
+
+    return result;
+}
+
+
+///
+/// Capture the recorded sweeps with wsa_capture_power_spectrum(), keeping the spectra.
+///
+/// @param[in,out] spectra sweeps * bins values, or NULL to allocate it.
+/// @param[in,out] bins Bins per spectrum.
+///
+static int16_t bench_sweep( char const *intf, char const *pass, uint32_t rbw, uint32_t sweeps, float **spectra,
+                            uint32_t *bins, int *repeatable, enum bench_format format )
+{
+    struct wsa_device dev;
+    struct wsa_sweep_device *sweep_device;
+    struct wsa_power_spectrum_config *cfg;
+    struct wsa_stats stats;
+    float *out;
+    float *buf = NULL;
+    uint64_t t0;
+    uint64_t elapsed_ns;
+    uint32_t n;
+    int16_t result;
+
+    result = wsa_open(&dev, (char *)intf);
+    if (result < 0) {
+        return result;
+    }
+    sweep_device = wsa_sweep_device_new(&dev);
+
+    result = bench_configure(sweep_device, rbw, &cfg);
+    if (result < 0) {
+        wsa_sweep_device_free(sweep_device);
+        wsa_close(&dev);
+        return result;
+    }
+
+    out = malloc((size_t)sweeps * cfg->buflen * sizeof(float));
+    if (out == NULL) {
+        result = WSA_ERR_MALLOCFAILED;
+    }
+
+    wsa_stats_read(&dev, &stats, 1);
+    t0 = wsa_clock_ns();
+    for (n = 0; n < sweeps && result >= 0; n++) {
+        result = wsa_capture_power_spectrum(sweep_device, cfg, &buf);
+        if (result >= 0) {
+            memcpy(out + (size_t)n * cfg->buflen, cfg->buf, cfg->buflen * sizeof(float));
+        }
+    }
+    elapsed_ns = wsa_clock_ns() - t0;
+
+    if (result >= 0) {
+        if (*spectra == NULL) {
+            *spectra = out;
+            *bins = cfg->buflen;
+            out = NULL;
+        } else {
+            *repeatable = (*bins == cfg->buflen && memcmp(*spectra, out, (size_t)sweeps * cfg->buflen * sizeof(float)) == 0);
+        }
+        wsa_stats_read(&dev, &stats, 0);
+        bench_print(format, pass, stats.counter[WSA_STAT_PACKETS], stats.counter[WSA_STAT_BYTES], elapsed_ns,
+                    sweeps, *repeatable);
+    }
+
+    free(out);
+    wsa_power_spectrum_free(cfg);
+    wsa_sweep_device_free(sweep_device);
+    wsa_close(&dev);
+
+    return result;
+}
+
+
+static void bench_usage( char const *prog )
+{
+    printf("usage: %s [options]\n"
+           "  --device INTF       record this device instead of a simulator, i.e. TCPIP::192.168.1.10\n"
+           "  --sim PATH          simulator to start (default: wsasim next to this program)\n"
+           "  --sweeps N          sweeps of %llu-%llu MHz to record (default %d)\n"
+           "  --rbw HZ            RBW of the sweeps (default %d)\n"
+           "  --file PATH         where to record (default wsabench_replay.vrt)\n"
+           "  --realtime          replay at the pace of the packet timestamps\n"
+           "  --json              JSON lines instead of CSV\n",
+           prog, (unsigned long long)(BENCH_FSTART / MHZ), (unsigned long long)(BENCH_FSTOP / MHZ),
+           BENCH_DEFAULT_SWEEPS, BENCH_DEFAULT_RBW);
+}
+
+
+int main( int argc, char **argv )
+{
+    uint32_t sweeps = BENCH_DEFAULT_SWEEPS;
+    uint32_t rbw = BENCH_DEFAULT_RBW;
+    enum bench_format format = BENCH_FORMAT_CSV;
+    uint8_t realtime = 0;
+    char *device = NULL;
+    char const *path = "wsabench_replay.vrt";
+    char index_path[1024];
+    char sim_path[1024];
+    char intf[64];
+    char replay_intf[1100];
+    float *spectra = NULL;
+    uint32_t bins = 0;
+    int repeatable = 0;
+    int16_t result;
+    int i;
+#ifndef _WIN32
+    pid_t sim = -1;
+#endif
+
+    // The simulator is built into the same directory as the benchmarks.
+    test_sim_path(argv[0], sim_path, sizeof(sim_path));
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--device") && i + 1 < argc) {
+            device = argv[++i];
+        } else if (!strcmp(argv[i], "--sim") && i + 1 < argc) {
+            snprintf(sim_path, sizeof(sim_path), "%s", argv[++i]);
+        } else if (!strcmp(argv[i], "--sweeps") && i + 1 < argc) {
+            sweeps = (uint32_t)strtoul(argv[++i], NULL, 10);
+            if (sweeps < 1) {
+                sweeps = 1;
+            }
+        } else if (!strcmp(argv[i], "--rbw") && i + 1 < argc) {
+            rbw = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--file") && i + 1 < argc) {
+            path = argv[++i];
+        } else if (!strcmp(argv[i], "--realtime")) {
+            realtime = 1;
+        } else if (!strcmp(argv[i], "--json")) {
+            format = BENCH_FORMAT_JSON;
+        } else {
+            bench_usage(argv[0]);
+            return strcmp(argv[i], "--help") ? 1 : 0;
+        }
+    }
+
+    if (device) {
+        snprintf(intf, sizeof(intf), "%s", device);
+    } else {
+#ifdef _WIN32
+        fprintf(stderr, "no simulator on this platform, use --device\n");
+        return 1;
+#else
+        sim = test_sim_start(sim_path, BENCH_CTRL_PORT, BENCH_DATA_PORT, NULL);
+        if (sim < 0) {
+            fprintf(stderr, "failed to start simulator %s\n", sim_path);
+            return 1;
+        }
+        snprintf(intf, sizeof(intf), "TCPIP::127.0.0.1::%d,%d", BENCH_CTRL_PORT, BENCH_DATA_PORT);
+#endif
+    }
+    snprintf(replay_intf, sizeof(replay_intf), "%s::%s%s", WSA_REPLAY_INTF, path,
+             realtime ? "::" WSA_REPLAY_REALTIME_STRING : "");
+
+    if (format == BENCH_FORMAT_CSV) {
+        printf("pass,packets,mbytes,seconds,mbytes_per_s,sweeps_per_s,repeatable\n");
+    }
+
+    result = bench_record(intf, path, rbw, sweeps, format);
+#ifndef _WIN32
+    test_sim_stop(sim);
+#endif
+    if (result < 0) {
+        fprintf(stderr, "recording %s failed: %s\n", intf, wsa_get_error_msg(result));
+    }
+
+    if (result >= 0) {
+        result = bench_read(replay_intf, format);
+        if (result < 0) {
+            fprintf(stderr, "reading %s failed: %s\n", replay_intf, wsa_get_error_msg(result));
+        }
+    }
+    if (result >= 0) {
+        result = bench_sweep(replay_intf, "sweep1", rbw, sweeps, &spectra, &bins, &repeatable, format);
+    }
+    if (result >= 0) {
+        result = bench_sweep(replay_intf, "sweep2", rbw, sweeps, &spectra, &bins, &repeatable, format);
+    }
+    if (result < 0) {
+        fprintf(stderr, "sweeping %s failed: %s\n", replay_intf, wsa_get_error_msg(result));
+    }
+
+    free(spectra);
+
+    snprintf(index_path, sizeof(index_path), "%s%s", path, WSA_RECORD_INDEX_SUFFIX);
+    remove(path);
+    remove(index_path);
+
+    return (result < 0 || !repeatable) ? 1 : 0;
+}
+
+/// @}
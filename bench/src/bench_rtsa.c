@@ -0,0 +1,649 @@
+///
+/// @ingroup bench
+///
+/// @{
+///
+
+///
+/// @file
+/// wsabench_rtsa: real-time spectrum throughput, and a check that no samples are lost.
+///
+/// The real-time spectrum engine (see wsa_rtsa.h) is run over loopback for each overlap and
+/// number of worker threads:
+/// \li tcp: wsasim, started on loopback for the run, streaming as fast as the engine reads
+/// \li mem: a device played in this process that makes samples in real time at --rate, a tone
+///     with exact timestamps, and that like a real device drops packets once it has more than
+///     --fifo of them waiting to be sent
+/// \li mem-max: the mem device at the highest rate the engine keeps up with, found by doubling
+///     the rate from 1 MS/s until a run fails and then bisecting, with short runs
+///
+/// Every spectrum is checked as it is handed over: spectra are numbered in order, each starts
+/// exactly one hop of samples after the last, its timestamp is the last one's plus the time of
+/// a hop, and, from the mem device, its peak is at the tone. A run passes when these all hold
+/// and the engine reports no breaks in the stream and no dropped samples, which for the mem
+/// device means it kept up with its rate.
+///
+/// The mem pass/fail run needs the rate to keep up with, i.e. the sample rate of the device the
+/// engine is meant for, so it is only made when --rate is given. The program exits non-zero if
+/// a tcp or mem run fails; the mem-max line is a measurement and never fails it.
+///
+/// One line is printed per run, as CSV (default) or JSON lines. The columns are:
+/// \li transport: tcp, mem or mem-max
+/// \li fft, overlap, workers: the engine's settings; overlap in percent
+/// \li rate: the mem device's rate in millions of samples per second, 0 for tcp
+/// \li spectra, msamples: what was handed over and read
+/// \li msamples_per_s, spectra_per_s: rates over the run
+/// \li breaks, dropped_samples: from wsa_rtsa_totals()
+/// \li errors: spectra that failed a check
+/// \li ok: 1 if the run passed
+///
+/// Run with --help for the options.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <sys/types.h>
+#endif
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_error.h"
+#include "wsa_rtsa.h"
+#include "wsa_transport.h"
+#include "wsa_clock.h"
+#include "test_sim.h"
+
+#define BENCH_CTRL_PORT 47141			///< Control port of the simulator started for the run
+#define BENCH_DATA_PORT 47140			///< Data port of the simulator started for the run
+#define BENCH_DEFAULT_SPECTRA 20000		///< Default spectra per run
+#define BENCH_SEARCH_START 1.0			///< First rate tried for mem-max, in millions of samples per second
+#define BENCH_SEARCH_MAX 4096.0			///< Rate at which the mem-max search stops doubling
+#define BENCH_SEARCH_STEPS 6			///< Bisection steps of the mem-max search
+#define BENCH_SEARCH_MS 250				///< Length of each mem-max run, in stream time
+#define BENCH_DEFAULT_FIFO 64			///< Default packets the mem device holds before dropping
+#define BENCH_TIMEOUT_MS 2000			///< Wait for each packet
+#define BENCH_MAX_LIST 16
+#define BENCH_TONE_PERIOD 4096			///< Samples in the mem device's lookup table
+#define BENCH_TONE_CYCLES 320			///< Cycles of the tone in the table
+#define BENCH_EPOCH 1500000000			///< Integer-seconds timestamp of the mem device's first sample
+
+/// Output formats.
+enum bench_format {
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON
+};
+
+/// The device played over the memory transport.
+struct bench_mem_device {
+    int32_t spp;
+    double rate;						///< Samples per second, or 0 to send as fast as read
+    uint32_t fifo;						///< Packets waiting to be sent before the device drops them
+    uint64_t psec_per_sample;
+    uint8_t streaming;
+    uint8_t count;						///< VRT packet count, 0 to 15
+    uint64_t start_ns;					///< When streaming started
+    uint64_t made;						///< Packets made since, sent or dropped
+    uint8_t *packet;					///< One IF data packet of spp samples
+    uint32_t packet_bytes;
+    uint32_t tone[BENCH_TONE_PERIOD];	///< A tone: I and Q of each sample, as sent
+};
+
+/// What a run did.
+struct bench_result {
+    struct wsa_rtsa_totals totals;
+    uint64_t elapsed_ns;
+    uint64_t errors;					///< Spectra that failed a check
+    int ok;
+};
+
+/// What the spectrum callback checks against.
+struct bench_check {
+    int32_t hop;
+    int32_t peak_bin;					///< Bin the tone should peak in, or -1 not to check
+    uint64_t count;						///< Spectra seen
+    struct wsa_rtsa_spectrum last;
+    int64_t hop_psec;					///< Time of a hop, once two spectra have been seen
+    uint64_t errors;
+};
+
+
+static void bench_sleep_ns( uint64_t ns )
+{
+#ifdef _WIN32
+    Sleep((DWORD)(ns / 1000000ULL));
+#else
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(ns / 1000000000ULL);
+    ts.tv_nsec = (long)(ns % 1000000000ULL);
+    nanosleep(&ts, NULL);
+#endif
+}
+
+
+static void bench_put_word( uint8_t *p, uint32_t word )
+{
+    p[0] = (uint8_t)(word >> 24);
+    p[1] = (uint8_t)(word >> 16);
+    p[2] = (uint8_t)(word >> 8);
+    p[3] = (uint8_t)word;
+}
+
+
+///
+/// Build the packet the memory device sends. The header's count and timestamp, and the samples,
+/// are filled in as each is sent.
+///
+static int16_t bench_mem_build( struct bench_mem_device *mem )
+{
+    uint32_t words = (uint32_t)mem->spp + VRT_HEADER_SIZE + VRT_TRAILER_SIZE;
+    uint8_t *p;
+
+    free(mem->packet);
+    mem->packet_bytes = words * BYTES_PER_VRT_WORD;
+    mem->packet = malloc(mem->packet_bytes);
+    if (mem->packet == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+
+    p = mem->packet;
+    p[0] = (uint8_t)((IF_PACKET_TYPE << 4) | 0x04);
+    p[1] = 0x40 | 0x20;
+    p[2] = (uint8_t)(words >> 8);
+    p[3] = (uint8_t)words;
+    bench_put_word(p + 4, I16Q16_DATA_STREAM_ID);
+    bench_put_word(p + (words - 1) * BYTES_PER_VRT_WORD, 0);
+
+    return 0;
+}
+
+
+static int16_t bench_mem_command( void *arg, struct wsa_mem_link *link, char const *command )
+{
+    struct bench_mem_device *mem = arg;
+    char const *reply = "0";
+
+    if (strncmp(command, "TRACE:SPPACKET ", 15) == 0) {
+        mem->spp = (int32_t)strtol(command + 15, NULL, 10);
+        return bench_mem_build(mem);
+    } else if (strcmp(command, "TRACE:STREAM:START") == 0) {
+        mem->streaming = 1;
+        mem->start_ns = wsa_clock_ns();
+        mem->made = 0;
+        return 0;
+    } else if (strcmp(command, "TRACE:STREAM:STOP") == 0 || strcmp(command, "SYSTEM:ABORT") == 0) {
+        mem->streaming = 0;
+        return 0;
+    } else if (command[strlen(command) - 1] != '?') {
+        return 0;
+    }
+
+    if (strcmp(command, "*IDN?") == 0) {
+        reply = "ThinkRF,R5500-427,MEM,1.0";
+    } else if (strcmp(command, "SYST:ERR?") == 0) {
+        reply = "0,\"No error\"";
+    }
+
+    return wsa_mem_reply(link, reply);
+}
+
+
+///
+/// Hand over the next packet once the device would have made it, dropping those that would not
+/// have fit in its buffer.
+///
+static int16_t bench_mem_fill( void *arg, struct wsa_mem_link *link, uint64_t deadline_ns )
+{
+    struct bench_mem_device *mem = arg;
+    uint64_t sample;
+    uint64_t psec;
+    uint64_t due_ns;
+    uint64_t now;
+    uint64_t made_by_now;
+    uint8_t *p;
+    int32_t i;
+
+    if (!mem->streaming || mem->packet == NULL) {
+        return WSA_ERR_SOCKETNODATA;
+    }
+
+    if (mem->rate > 0) {
+        // packet n is made once its last sample is
+        due_ns = mem->start_ns + (uint64_t)((mem->made + 1) * mem->spp * 1e9 / mem->rate);
+        now = wsa_clock_ns();
+        if (now < due_ns) {
+            if (due_ns > deadline_ns) {
+                bench_sleep_ns(deadline_ns > now ? deadline_ns - now : 0);
+                return WSA_ERR_SOCKETNODATA;
+            }
+            bench_sleep_ns(due_ns - now);
+        } else {
+            made_by_now = (uint64_t)((now - mem->start_ns) * mem->rate / 1e9) / (uint64_t)mem->spp;
+            if (made_by_now > mem->made + mem->fifo) {
+                mem->count = (uint8_t)((mem->count + made_by_now - mem->fifo - mem->made) & 0x0f);
+                mem->made = made_by_now - mem->fifo;
+            }
+        }
+    }
+
+    sample = mem->made * (uint64_t)mem->spp;
+    psec = (sample % (1000000000000ULL / mem->psec_per_sample)) * mem->psec_per_sample;
+    p = mem->packet;
+    p[1] = (uint8_t)(0x40 | 0x20 | mem->count);
+    bench_put_word(p + 8, BENCH_EPOCH + (uint32_t)(sample / (1000000000000ULL / mem->psec_per_sample)));
+    bench_put_word(p + 12, (uint32_t)(psec >> 32));
+    bench_put_word(p + 16, (uint32_t)psec);
+    for (i = 0; i < mem->spp; i++) {
+        bench_put_word(p + (VRT_HEADER_SIZE + i) * BYTES_PER_VRT_WORD, mem->tone[(sample + i) % BENCH_TONE_PERIOD]);
+    }
+    mem->count = (uint8_t)((mem->count + 1) & 0x0f);
+    mem->made++;
+
+    return wsa_mem_push_data(link, mem->packet, (int32_t)mem->packet_bytes);
+}
+
+
+static int16_t bench_mem_open( struct wsa_device *dev, struct bench_mem_device *mem )
+{
+    struct wsa_mem_device device;
+    struct wsa_mem_link *link;
+    int16_t result;
+    int32_t i;
+
+    for (i = 0; i < BENCH_TONE_PERIOD; i++) {
+        double phase = 2 * M_PI * BENCH_TONE_CYCLES * i / BENCH_TONE_PERIOD;
+        // dithered, so the spectrum has a noise floor as a real one does
+        int16_t iv = (int16_t)(4096 * cos(phase) + rand() % 5 - 2);
+        int16_t qv = (int16_t)(4096 * sin(phase) + rand() % 5 - 2);
+        mem->tone[i] = ((uint32_t)(uint16_t)iv << 16) | (uint16_t)qv;
+    }
+
+    device.command = bench_mem_command;
+    device.fill = bench_mem_fill;
+    device.arg = mem;
+
+    result = wsa_mem_link_alloc(&device, &link);
+    if (result < 0) {
+        return result;
+    }
+
+    return wsa_connect_transport(dev, &wsa_mem_transport, link);
+}
+
+
+///
+/// Check each spectrum against the one before.
+///
+static void bench_spectrum( void *arg, struct wsa_rtsa_spectrum const *spectrum, float const *power )
+{
+    struct bench_check *check = arg;
+    int64_t elapsed;
+    int32_t peak = 0;
+    int32_t b;
+
+    if (spectrum->number != check->count || spectrum->gap) {
+        check->errors++;
+    }
+
+    if (check->count > 0) {
+        elapsed = ((int64_t)spectrum->time_stamp.sec - (int64_t)check->last.time_stamp.sec) * 1000000000000LL +
+            ((int64_t)spectrum->time_stamp.psec - (int64_t)check->last.time_stamp.psec);
+        if (spectrum->first_sample != check->last.first_sample + (uint64_t)check->hop) {
+            check->errors++;
+        } else if (check->hop_psec == 0) {
+            check->hop_psec = elapsed;
+        } else if (elapsed != check->hop_psec) {
+            check->errors++;
+        }
+    }
+
+    if (check->peak_bin >= 0) {
+        for (b = 1; b < spectrum->bins; b++) {
+            if (power[b] > power[peak]) {
+                peak = b;
+            }
+        }
+        if (peak != check->peak_bin) {
+            check->errors++;
+        }
+    }
+
+    check->last = *spectrum;
+    check->count++;
+}
+
+
+///
+/// Run the engine on a device for a number of spectra.
+///
+/// @return 0 on success, with the outcome in \p run, otherwise the library's error code.
+///
+static int16_t bench_run( struct wsa_device *dev, int32_t fft_size, int32_t overlap, uint32_t workers,
+                          int32_t peak_bin, uint64_t spectra, struct bench_result *run )
+{
+    struct wsa_rtsa_config config;
+    struct wsa_rtsa *rtsa = NULL;
+    struct bench_check check;
+    uint64_t t0;
+    int16_t result;
+
+    memset(&check, 0, sizeof(check));
+    check.hop = fft_size - fft_size * overlap / 100;
+    check.peak_bin = peak_bin;
+
+    memset(&config, 0, sizeof(config));
+    config.fft_size = fft_size;
+    config.hop = check.hop;
+    config.workers = workers;
+    config.spectrum = bench_spectrum;
+    config.arg = &check;
+
+    result = wsa_rtsa_alloc(dev, &config, &rtsa);
+    if (result < 0) {
+        return result;
+    }
+
+    result = wsa_stream_start(dev);
+    t0 = wsa_clock_ns();
+    if (result >= 0) {
+        result = wsa_rtsa_run(rtsa, spectra, BENCH_TIMEOUT_MS);
+    }
+    run->elapsed_ns = wsa_clock_ns() - t0;
+
+    wsa_stream_stop(dev);
+    wsa_flush_data(dev);
+    wsa_clean_data_socket(dev);
+
+    wsa_rtsa_totals(rtsa, &run->totals);
+    wsa_rtsa_free(rtsa);
+    if (result < 0) {
+        return result;
+    }
+
+    run->errors = check.errors;
+    run->ok = (check.errors == 0 && check.count == spectra && run->totals.breaks == 0 &&
+               run->totals.dropped_samples == 0);
+
+    return 0;
+}
+
+
+///
+/// Print a run's line.
+///
+static void bench_print( char const *name, int32_t fft_size, int32_t overlap, uint32_t workers, double rate,
+                         struct bench_result const *run, enum bench_format format )
+{
+    struct wsa_rtsa_totals const *totals = &run->totals;
+    double const seconds = run->elapsed_ns / 1e9;
+
+    if (format == BENCH_FORMAT_JSON) {
+        printf("{\"transport\":\"%s\",\"fft\":%ld,\"overlap\":%ld,\"workers\":%u,\"rate\":%.1f,\"spectra\":%llu,"
+               "\"msamples\":%.1f,\"msamples_per_s\":%.2f,\"spectra_per_s\":%.0f,\"breaks\":%llu,"
+               "\"dropped_samples\":%llu,\"errors\":%llu,\"ok\":%d}\n",
+               name, (long)fft_size, (long)overlap, (unsigned)workers, rate, (unsigned long long)totals->spectra,
+               totals->samples / 1e6, totals->samples / 1e6 / seconds, totals->spectra / seconds,
+               (unsigned long long)totals->breaks, (unsigned long long)totals->dropped_samples,
+               (unsigned long long)run->errors, run->ok);
+    } else {
+        printf("%s,%ld,%ld,%u,%.1f,%llu,%.1f,%.2f,%.0f,%llu,%llu,%llu,%d\n",
+               name, (long)fft_size, (long)overlap, (unsigned)workers, rate, (unsigned long long)totals->spectra,
+               totals->samples / 1e6, totals->samples / 1e6 / seconds, totals->spectra / seconds,
+               (unsigned long long)totals->breaks, (unsigned long long)totals->dropped_samples,
+               (unsigned long long)run->errors, run->ok);
+    }
+    fflush(stdout);
+}
+
+
+///
+/// Set the rate the mem device makes samples at, in millions of samples per second.
+///
+static void bench_mem_set_rate( struct bench_mem_device *mem, double rate )
+{
+    mem->rate = rate * 1e6;
+    mem->psec_per_sample = (rate > 0) ? (uint64_t)(1e6 / rate) : 8000;
+}
+
+
+///
+/// Find the highest rate the engine keeps up with on the mem device, by doubling the rate from
+/// BENCH_SEARCH_START until a run fails, then bisecting. Each run lasts BENCH_SEARCH_MS.
+///
+/// @return 0 on success, with the rate in \p best (0 if even the first run failed) and that run
+///         in \p run, otherwise the library's error code.
+///
+static int16_t bench_search_rate( struct wsa_device *dev, struct bench_mem_device *mem, int32_t fft_size,
+                                  int32_t overlap, uint32_t workers, int32_t peak_bin, double *best,
+                                  struct bench_result *run )
+{
+    struct bench_result tried;
+    double const hop = fft_size - fft_size * overlap / 100;
+    double lo = 0;
+    double hi = 0;
+    double rate;
+    uint64_t spectra;
+    int16_t result;
+    int step = 0;
+
+    memset(run, 0, sizeof(*run));
+    rate = BENCH_SEARCH_START;
+
+    while (rate <= BENCH_SEARCH_MAX) {
+        spectra = (uint64_t)(rate * 1e6 * BENCH_SEARCH_MS / 1000 / hop);
+        bench_mem_set_rate(mem, rate);
+        result = bench_run(dev, fft_size, overlap, workers, peak_bin, spectra < 100 ? 100 : spectra, &tried);
+        if (result < 0) {
+            return result;
+        }
+
+        if (tried.ok) {
+            lo = rate;
+            *run = tried;
+        } else {
+            hi = rate;
+        }
+
+        // Double until the first failure, then halve the gap between the last pass and it.
+        if (hi == 0) {
+            rate *= 2;
+        } else if (lo == 0 || step++ == BENCH_SEARCH_STEPS) {
+            break;
+        } else {
+            rate = (lo + hi) / 2;
+        }
+    }
+
+    *best = lo;
+
+    return 0;
+}
+
+
+static void bench_usage( char const *prog )
+{
+    printf("usage: %s [options]\n"
+           "  --sim PATH            simulator to start (default: wsasim next to this program)\n"
+           "  --fft N               samples per FFT (default 1024)\n"
+           "  --overlap P[,P...]    overlaps to run, in percent (default 50,75)\n"
+           "  --workers N[,N...]    worker threads to run with (default 0,2)\n"
+           "  --spectra N           spectra per run (default %d)\n"
+           "  --spp N               samples per packet (default 1024)\n"
+           "  --rate MSPS           sample rate, in millions, the engine must keep up with on the mem device;\n"
+           "                        without it the mem pass/fail run is skipped\n"
+           "  --fifo N              packets the mem device holds before dropping (default %d)\n"
+           "  --json                JSON lines instead of CSV\n",
+           prog, BENCH_DEFAULT_SPECTRA, BENCH_DEFAULT_FIFO);
+}
+
+
+int main( int argc, char **argv )
+{
+    int32_t overlaps[BENCH_MAX_LIST] = { 50, 75 };
+    int32_t workers[BENCH_MAX_LIST] = { 0, 2 };
+    int noverlaps = 2;
+    int nworkers = 2;
+    int32_t fft_size = 1024;
+    int32_t spp = 1024;
+    uint64_t spectra = BENCH_DEFAULT_SPECTRA;
+    double rate = 0;
+    double best;
+    uint32_t fifo = BENCH_DEFAULT_FIFO;
+    enum bench_format format = BENCH_FORMAT_CSV;
+    struct bench_mem_device mem;
+    char sim_path[1024];
+    char intf[64];
+    struct wsa_device tcp_dev;
+    struct wsa_device mem_dev;
+    uint8_t have_tcp = 0;
+    char *tok;
+    struct bench_result run;
+    int16_t result;
+    int failed = 0;
+    int i, o, w;
+    int32_t peak_bin;
+#ifndef _WIN32
+    pid_t sim = -1;
+#endif
+
+    // The simulator is built into the same directory as the benchmarks.
+    test_sim_path(argv[0], sim_path, sizeof(sim_path));
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--sim") && i + 1 < argc) {
+            snprintf(sim_path, sizeof(sim_path), "%s", argv[++i]);
+        } else if (!strcmp(argv[i], "--fft") && i + 1 < argc) {
+            fft_size = (int32_t)strtol(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--overlap") && i + 1 < argc) {
+            noverlaps = 0;
+            for (tok = strtok(argv[++i], ","); tok && noverlaps < BENCH_MAX_LIST; tok = strtok(NULL, ",")) {
+                overlaps[noverlaps++] = (int32_t)strtol(tok, NULL, 10);
+            }
+        } else if (!strcmp(argv[i], "--workers") && i + 1 < argc) {
+            nworkers = 0;
+            for (tok = strtok(argv[++i], ","); tok && nworkers < BENCH_MAX_LIST; tok = strtok(NULL, ",")) {
+                workers[nworkers++] = (int32_t)strtol(tok, NULL, 10);
+            }
+        } else if (!strcmp(argv[i], "--spectra") && i + 1 < argc) {
+            spectra = strtoull(argv[++i], NULL, 10);
+            if (spectra < 1) {
+                spectra = 1;
+            }
+        } else if (!strcmp(argv[i], "--spp") && i + 1 < argc) {
+            spp = (int32_t)strtol(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--rate") && i + 1 < argc) {
+            rate = strtod(argv[++i], NULL);
+        } else if (!strcmp(argv[i], "--fifo") && i + 1 < argc) {
+            fifo = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--json")) {
+            format = BENCH_FORMAT_JSON;
+        } else {
+            bench_usage(argv[0]);
+            return strcmp(argv[i], "--help") ? 1 : 0;
+        }
+    }
+
+#ifdef _WIN32
+    fprintf(stderr, "no simulator on this platform, skipping the tcp runs\n");
+#else
+    sim = test_sim_start(sim_path, BENCH_CTRL_PORT, BENCH_DATA_PORT, NULL);
+    if (sim < 0) {
+        fprintf(stderr, "failed to start simulator %s, skipping the tcp runs\n", sim_path);
+    } else {
+        snprintf(intf, sizeof(intf), "TCPIP::127.0.0.1::%d,%d", BENCH_CTRL_PORT, BENCH_DATA_PORT);
+        result = wsa_open(&tcp_dev, intf);
+        if (result >= 0) {
+            result = wsa_set_samples_per_packet(&tcp_dev, spp);
+        }
+        if (result < 0) {
+            fprintf(stderr, "wsa_open(%s) failed: %s\n", intf, wsa_get_error_msg(result));
+            failed = 1;
+        } else {
+            have_tcp = 1;
+        }
+    }
+#endif
+
+    if (rate <= 0) {
+        fprintf(stderr, "no --rate given, skipping the mem pass/fail runs\n");
+    }
+
+    memset(&mem, 0, sizeof(mem));
+    mem.fifo = fifo;
+    bench_mem_set_rate(&mem, rate);
+    result = bench_mem_open(&mem_dev, &mem);
+    if (result >= 0) {
+        result = wsa_set_samples_per_packet(&mem_dev, spp);
+    }
+    if (result < 0) {
+        fprintf(stderr, "connecting the memory device failed: %s\n", wsa_get_error_msg(result));
+        failed = 1;
+    }
+
+    if (format == BENCH_FORMAT_CSV) {
+        printf("transport,fft,overlap,workers,rate,spectra,msamples,msamples_per_s,spectra_per_s,breaks,"
+               "dropped_samples,errors,ok\n");
+    }
+
+    peak_bin = fft_size / 2 + fft_size * BENCH_TONE_CYCLES / BENCH_TONE_PERIOD;
+
+    for (w = 0; w < nworkers && !failed; w++) {
+        for (o = 0; o < noverlaps && !failed; o++) {
+            if (have_tcp) {
+                result = bench_run(&tcp_dev, fft_size, overlaps[o], (uint32_t)workers[w], -1, spectra, &run);
+                if (result < 0) {
+                    fprintf(stderr, "tcp run failed: %s\n", wsa_get_error_msg(result));
+                    failed = 1;
+                    break;
+                }
+                bench_print("tcp", fft_size, overlaps[o], (uint32_t)workers[w], 0, &run, format);
+                failed |= !run.ok;
+            }
+
+            if (rate > 0) {
+                bench_mem_set_rate(&mem, rate);
+                result = bench_run(&mem_dev, fft_size, overlaps[o], (uint32_t)workers[w], peak_bin, spectra, &run);
+                if (result < 0) {
+                    fprintf(stderr, "mem run failed: %s\n", wsa_get_error_msg(result));
+                    failed = 1;
+                    break;
+                }
+                bench_print("mem", fft_size, overlaps[o], (uint32_t)workers[w], rate, &run, format);
+                failed |= !run.ok;
+            }
+
+            result = bench_search_rate(&mem_dev, &mem, fft_size, overlaps[o], (uint32_t)workers[w], peak_bin,
+                                       &best, &run);
+            if (result < 0) {
+                fprintf(stderr, "mem-max search failed: %s\n", wsa_get_error_msg(result));
+                failed = 1;
+                break;
+            }
+            bench_print("mem-max", fft_size, overlaps[o], (uint32_t)workers[w], best, &run, format);
+        }
+    }
+
+    wsa_close(&mem_dev);
+    free(mem.packet);
+    if (have_tcp) {
+        wsa_close(&tcp_dev);
+    }
+#ifndef _WIN32
+    test_sim_stop(sim);
+#endif
+
+    return failed;
+}
+
+/// @}
@@ -0,0 +1,333 @@
+///
+/// @ingroup bench
+///
+/// @{
+///
+
+///
+/// @file
+/// wsabench_sweep: end-to-end power spectrum sweep benchmark.
+///
+/// For each mode, span and RBW in the matrix, a power spectrum is allocated and configured, then
+/// captured repeatedly. The stage timing of the sweep device (see wsa_power_spectrum_set_timing())
+/// splits each sweep into starting, network wait, decode, window, FFT and log conversion.
+///
+/// By default the packets come from wsasim, started on loopback for the run, so the numbers show
+/// what the host side costs without a device in the way. Use --device to measure real hardware.
+///
+/// One line is printed per cell of the matrix, as CSV (default) or JSON lines. The columns are:
+/// \li mode, fstart, fstop, rbw: the sweep
+/// \li bins, blocks: spectrum buffer length and blocks (FFTs) per sweep
+/// \li sweeps: number of timed captures
+/// \li configure_ms: time to configure the sweep
+/// \li sweeps_per_s, ghz_per_s: capture rate, and the span covered per second
+/// \li start_ms, wait_ms, decode_ms, window_ms, fft_ms, log_ms, other_ms: mean time per sweep in each stage
+///
+/// With --stats, the device statistics for the whole run (see wsa_stats_read()) are printed to stderr.
+///
+/// Run with --help for the options.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_sweep_device.h"
+#include "wsa_clock.h"
+#include "test_sim.h"
+
+#define BENCH_CTRL_PORT 47101			///< Control port of the simulator started for the run
+#define BENCH_DATA_PORT 47100			///< Data port of the simulator started for the run
+#define BENCH_DEFAULT_SWEEPS 5			///< Default timed captures per cell
+#define BENCH_MAX_LIST 16
+
+#define GHZ (1000 * MHZ)
+
+/// A span to sweep.
+struct bench_span {
+    uint64_t fstart;
+    uint64_t fstop;
+};
+
+/// Spans used for the SH and SHN modes: a channel, a band, and the full range.
+static struct bench_span const bench_sh_spans[] = {
+    { 2400 * MHZ, 2500 * MHZ },
+    { 2 * GHZ, 3 * GHZ },
+    { 100 * MHZ, 8 * GHZ },
+};
+
+/// Spans used for DD mode, which covers only the bottom 50 MHz.
+static struct bench_span const bench_dd_spans[] = {
+    { 9000, 10 * MHZ },
+    { 9000, 50 * MHZ },
+};
+
+/// Output formats.
+enum bench_format {
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON
+};
+
+
+///
+/// Run one cell of the matrix and print its line.
+///
+/// @return 0 on success, otherwise the library's error code.
+///
+static int16_t bench_run_cell( struct wsa_sweep_device *sweep_device, char const *mode, struct bench_span const *span,
+                               uint32_t rbw, uint32_t sweeps, enum bench_format format )
+{
+    struct wsa_power_spectrum_config *cfg = NULL;
+    struct wsa_sweep_timing *t;
+    float *buf = NULL;
+    uint64_t configure_ns;
+    uint64_t t0;
+    uint64_t elapsed_ns;
+    double per_sweep;
+    double other;
+    uint32_t n;
+    int16_t result;
+
+    result = wsa_power_spectrum_alloc(sweep_device, span->fstart, span->fstop, rbw, mode, &cfg);
+    if (result < 0) {
+        return result;
+    }
+
+    result = wsa_power_spectrum_set_timing(cfg, 1);
+    if (result >= 0) {
+        result = wsa_configure_sweep(sweep_device, cfg);
+    }
+
+    // One untimed capture to settle buffers and sockets.
+    if (result >= 0) {
+        result = wsa_capture_power_spectrum(sweep_device, cfg, &buf);
+    }
+    if (result < 0) {
+        wsa_power_spectrum_free(cfg);
+        return result;
+    }
+
+    configure_ns = cfg->timing->configure_ns;
+    wsa_power_spectrum_set_timing(cfg, 1);
+
+    t0 = wsa_clock_ns();
+    for (n = 0; n < sweeps; n++) {
+        result = wsa_capture_power_spectrum(sweep_device, cfg, &buf);
+        if (result < 0) {
+            wsa_power_spectrum_free(cfg);
+            return result;
+        }
+    }
+    elapsed_ns = wsa_clock_ns() - t0;
+
+    t = cfg->timing;
+    per_sweep = (double)elapsed_ns / sweeps / 1e6;
+    other = per_sweep - (double)(t->start_ns + t->wait_ns + t->decode_ns + t->window_ns + t->fft_ns + t->log_ns) / sweeps / 1e6;
+
+    if (format == BENCH_FORMAT_JSON) {
+        printf("{\"mode\":\"%s\",\"fstart\":%llu,\"fstop\":%llu,\"rbw\":%lu,\"bins\":%lu,\"blocks\":%llu,\"sweeps\":%lu,"
+               "\"configure_ms\":%.3f,\"sweeps_per_s\":%.3f,\"ghz_per_s\":%.4f,\"start_ms\":%.3f,\"wait_ms\":%.3f,"
+               "\"decode_ms\":%.3f,\"window_ms\":%.3f,\"fft_ms\":%.3f,\"log_ms\":%.3f,\"other_ms\":%.3f}\n",
+               mode, (unsigned long long)span->fstart, (unsigned long long)span->fstop, (unsigned long)rbw,
+               (unsigned long)cfg->buflen, (unsigned long long)(t->blocks / sweeps), (unsigned long)sweeps,
+               configure_ns / 1e6, 1e3 / per_sweep, (double)(span->fstop - span->fstart) / 1e9 * 1e3 / per_sweep,
+               t->start_ns / 1e6 / sweeps, t->wait_ns / 1e6 / sweeps, t->decode_ns / 1e6 / sweeps,
+               t->window_ns / 1e6 / sweeps, t->fft_ns / 1e6 / sweeps, t->log_ns / 1e6 / sweeps, other);
+    } else {
+        printf("%s,%llu,%llu,%lu,%lu,%llu,%lu,%.3f,%.3f,%.4f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+               mode, (unsigned long long)span->fstart, (unsigned long long)span->fstop, (unsigned long)rbw,
+               (unsigned long)cfg->buflen, (unsigned long long)(t->blocks / sweeps), (unsigned long)sweeps,
+               configure_ns / 1e6, 1e3 / per_sweep, (double)(span->fstop - span->fstart) / 1e9 * 1e3 / per_sweep,
+               t->start_ns / 1e6 / sweeps, t->wait_ns / 1e6 / sweeps, t->decode_ns / 1e6 / sweeps,
+               t->window_ns / 1e6 / sweeps, t->fft_ns / 1e6 / sweeps, t->log_ns / 1e6 / sweeps, other);
+    }
+    fflush(stdout);
+
+    wsa_power_spectrum_free(cfg);
+
+    return 0;
+}
+
+
+///
+/// Print the device statistics to stderr.
+///
+static void bench_print_stats( struct wsa_device *dev )
+{
+    struct wsa_stats stats;
+    uint64_t count;
+    int i, j;
+
+    wsa_stats_read(dev, &stats, 0);
+
+    for (i = 0; i < WSA_STAT_COUNTERS; i++) {
+        fprintf(stderr, "%-14s %llu\n", wsa_stats_counter_name((enum wsa_stats_counter)i),
+                (unsigned long long)stats.counter[i]);
+    }
+    for (i = 0; i < WSA_STAT_TIMERS; i++) {
+        count = 0;
+        for (j = 0; j < WSA_STATS_HIST_BUCKETS; j++) {
+            count += stats.timer_hist[i][j];
+        }
+        fprintf(stderr, "%-14s n %llu mean %.1f us p50 < %.1f us p99 < %.1f us\n",
+                wsa_stats_timer_name((enum wsa_stats_timer)i), (unsigned long long)count,
+                count ? stats.timer_total_ns[i] / 1e3 / count : 0.0,
+                wsa_stats_timer_percentile(&stats, (enum wsa_stats_timer)i, 50) / 1e3,
+                wsa_stats_timer_percentile(&stats, (enum wsa_stats_timer)i, 99) / 1e3);
+    }
+}
+
+
+static void bench_usage( char const *prog )
+{
+    printf("usage: %s [options]\n"
+           "  --device INTF       measure this device instead of a simulator, i.e. TCPIP::192.168.1.10\n"
+           "  --sim PATH          simulator to start (default: wsasim next to this program)\n"
+           "  --mode M[,M...]     modes to run: SH, SHN, DD (default all three)\n"
+           "  --rbw HZ[,HZ...]    RBWs to run (default 100000,10000)\n"
+           "  --sweeps N          timed captures per cell (default %d)\n"
+           "  --json              JSON lines instead of CSV\n"
+           "  --stats             print the device statistics to stderr at the end\n",
+           prog, BENCH_DEFAULT_SWEEPS);
+}
+
+
+int main( int argc, char **argv )
+{
+    static char const *all_modes[] = { "SH", "SHN", "DD" };
+    char const *modes[BENCH_MAX_LIST];
+    uint32_t rbws[BENCH_MAX_LIST] = { 100000, 10000 };
+    int nmodes = 0;
+    int nrbws = 2;
+    uint32_t sweeps = BENCH_DEFAULT_SWEEPS;
+    enum bench_format format = BENCH_FORMAT_CSV;
+    uint8_t print_stats = 0;
+    char *device = NULL;
+    char sim_path[1024];
+    char intf[64];
+    struct wsa_device dev;
+    struct wsa_sweep_device *sweep_device;
+    struct bench_span const *spans;
+    int nspans;
+    char *tok;
+    int16_t result;
+    int failed = 0;
+    int i, m, s, r;
+#ifndef _WIN32
+    pid_t sim = -1;
+#endif
+
+    // The simulator is built into the same directory as the benchmarks.
+    test_sim_path(argv[0], sim_path, sizeof(sim_path));
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--device") && i + 1 < argc) {
+            device = argv[++i];
+        } else if (!strcmp(argv[i], "--sim") && i + 1 < argc) {
+            snprintf(sim_path, sizeof(sim_path), "%s", argv[++i]);
+        } else if (!strcmp(argv[i], "--mode") && i + 1 < argc) {
+            for (tok = strtok(argv[++i], ","); tok && nmodes < BENCH_MAX_LIST; tok = strtok(NULL, ",")) {
+                modes[nmodes++] = tok;
+            }
+        } else if (!strcmp(argv[i], "--rbw") && i + 1 < argc) {
+            nrbws = 0;
+            for (tok = strtok(argv[++i], ","); tok && nrbws < BENCH_MAX_LIST; tok = strtok(NULL, ",")) {
+                rbws[nrbws++] = (uint32_t)strtoul(tok, NULL, 10);
+            }
+        } else if (!strcmp(argv[i], "--sweeps") && i + 1 < argc) {
+            sweeps = (uint32_t)strtoul(argv[++i], NULL, 10);
+            if (sweeps < 1) {
+                sweeps = 1;
+            }
+        } else if (!strcmp(argv[i], "--json")) {
+            format = BENCH_FORMAT_JSON;
+        } else if (!strcmp(argv[i], "--stats")) {
+            print_stats = 1;
+        } else {
+            bench_usage(argv[0]);
+            return strcmp(argv[i], "--help") ? 1 : 0;
+        }
+    }
+
+    if (nmodes == 0) {
+        for (nmodes = 0; nmodes < 3; nmodes++) {
+            modes[nmodes] = all_modes[nmodes];
+        }
+    }
+
+    if (device) {
+        snprintf(intf, sizeof(intf), "%s", device);
+    } else {
+#ifdef _WIN32
+        fprintf(stderr, "no simulator on this platform, use --device\n");
+        return 1;
+#else
+        sim = test_sim_start(sim_path, BENCH_CTRL_PORT, BENCH_DATA_PORT, NULL);
+        if (sim < 0) {
+            fprintf(stderr, "failed to start simulator %s\n", sim_path);
+            return 1;
+        }
+        snprintf(intf, sizeof(intf), "TCPIP::127.0.0.1::%d,%d", BENCH_CTRL_PORT, BENCH_DATA_PORT);
+#endif
+    }
+
+    result = wsa_open(&dev, intf);
+    if (result < 0) {
+        fprintf(stderr, "wsa_open(%s) failed: %s\n", intf, wsa_get_error_msg(result));
+#ifndef _WIN32
+        test_sim_stop(sim);
+#endif
+        return 1;
+    }
+    sweep_device = wsa_sweep_device_new(&dev);
+
+    if (format == BENCH_FORMAT_CSV) {
+        printf("mode,fstart,fstop,rbw,bins,blocks,sweeps,configure_ms,sweeps_per_s,ghz_per_s,"
+               "start_ms,wait_ms,decode_ms,window_ms,fft_ms,log_ms,other_ms\n");
+    }
+
+    for (m = 0; m < nmodes; m++) {
+        if (!strcmp(modes[m], "DD")) {
+            spans = bench_dd_spans;
+            nspans = sizeof(bench_dd_spans) / sizeof(bench_dd_spans[0]);
+        } else {
+            spans = bench_sh_spans;
+            nspans = sizeof(bench_sh_spans) / sizeof(bench_sh_spans[0]);
+        }
+        for (s = 0; s < nspans; s++) {
+            for (r = 0; r < nrbws; r++) {
+                result = bench_run_cell(sweep_device, modes[m], &spans[s], rbws[r], sweeps, format);
+                if (result < 0) {
+                    fprintf(stderr, "%s %llu-%llu Hz rbw %lu failed: %d\n", modes[m],
+                            (unsigned long long)spans[s].fstart, (unsigned long long)spans[s].fstop,
+                            (unsigned long)rbws[r], result);
+                    failed = 1;
+                }
+            }
+        }
+    }
+
+    if (print_stats) {
+        bench_print_stats(&dev);
+    }
+
+    wsa_sweep_device_free(sweep_device);
+    wsa_close(&dev);
+#ifndef _WIN32
+    test_sim_stop(sim);
+#endif
+
+    return failed;
+}
+
+/// @}
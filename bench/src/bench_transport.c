@@ -0,0 +1,419 @@
+///
+/// @ingroup bench
+///
+/// @{
+///
+
+///
+/// @file
+/// wsabench_transport: packet read cost over each transport.
+///
+/// The same stream of IF data packets is read with wsa_read_vrt_packet_raw() over each of the
+/// built-in transports (see wsa_transport.h):
+/// \li tcp: wsasim, started on loopback for the run
+/// \li mem: a device played in this process, which hands over the same packet again and again
+/// \li replay: a recording of the mem run, made with wsa_recorder_run() and deleted afterwards
+///
+/// The mem and replay figures are the library's own cost per packet, with no socket or device
+/// behind it; the difference to tcp is what the sockets and the simulator add.
+///
+/// One line is printed per run, as CSV (default) or JSON lines. The columns are:
+/// \li transport: tcp, mem or replay
+/// \li spp: samples per packet
+/// \li packets, mbytes: what was read
+/// \li mbytes_per_s: read rate
+/// \li us_per_packet: elapsed time per packet
+///
+/// Run with --help for the options.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_error.h"
+#include "wsa_record.h"
+#include "wsa_replay.h"
+#include "wsa_transport.h"
+#include "wsa_clock.h"
+#include "test_sim.h"
+
+#define BENCH_CTRL_PORT 47131			///< Control port of the simulator started for the run
+#define BENCH_DATA_PORT 47130			///< Data port of the simulator started for the run
+#define BENCH_DEFAULT_PACKETS 20000		///< Default packets read per run
+#define BENCH_TIMEOUT_MS 2000			///< Wait for each packet
+#define BENCH_MAX_LIST 16
+
+/// Output formats.
+enum bench_format {
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON
+};
+
+/// The device played over the memory transport.
+struct bench_mem_device {
+    int32_t spp;
+    uint8_t streaming;
+    uint8_t count;						///< VRT packet count, 0 to 15
+    uint8_t *packet;					///< One IF data packet of spp samples
+    uint32_t packet_bytes;
+};
+
+
+static void bench_put_word( uint8_t *p, uint32_t word )
+{
+    p[0] = (uint8_t)(word >> 24);
+    p[1] = (uint8_t)(word >> 16);
+    p[2] = (uint8_t)(word >> 8);
+    p[3] = (uint8_t)word;
+}
+
+
+///
+/// Build the packet the memory device sends: a ramp of samples, with a timestamp and trailer.
+///
+static int16_t bench_mem_build( struct bench_mem_device *mem )
+{
+    uint32_t words = (uint32_t)mem->spp + VRT_HEADER_SIZE + VRT_TRAILER_SIZE;
+    uint8_t *p;
+    int32_t i;
+
+    free(mem->packet);
+    mem->packet_bytes = words * BYTES_PER_VRT_WORD;
+    mem->packet = malloc(mem->packet_bytes);
+    if (mem->packet == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+
+    p = mem->packet;
+    p[0] = (uint8_t)((IF_PACKET_TYPE << 4) | 0x04);
+    p[1] = 0x40 | 0x20;
+    p[2] = (uint8_t)(words >> 8);
+    p[3] = (uint8_t)words;
+    bench_put_word(p + 4, I16Q16_DATA_STREAM_ID);
+    bench_put_word(p + 8, 1000);
+    bench_put_word(p + 12, 0);
+    bench_put_word(p + 16, 0);
+    for (i = 0; i < mem->spp; i++) {
+        bench_put_word(p + (VRT_HEADER_SIZE + i) * BYTES_PER_VRT_WORD, ((uint32_t)i << 16) | ((uint32_t)-i & 0xffff));
+    }
+    bench_put_word(p + (words - 1) * BYTES_PER_VRT_WORD, 0);
+
+    return 0;
+}
+
+
+static int16_t bench_mem_command( void *arg, struct wsa_mem_link *link, char const *command )
+{
+    struct bench_mem_device *mem = arg;
+    char const *reply = "0";
+
+    if (strncmp(command, "TRACE:SPPACKET ", 15) == 0) {
+        mem->spp = (int32_t)strtol(command + 15, NULL, 10);
+        return bench_mem_build(mem);
+    } else if (strcmp(command, "TRACE:STREAM:START") == 0) {
+        mem->streaming = 1;
+        return 0;
+    } else if (strcmp(command, "TRACE:STREAM:STOP") == 0 || strcmp(command, "SYSTEM:ABORT") == 0) {
+        mem->streaming = 0;
+        return 0;
+    } else if (command[strlen(command) - 1] != '?') {
+        return 0;
+    }
+
+    if (strcmp(command, "*IDN?") == 0) {
+        reply = "ThinkRF,R5500-427,MEM,1.0";
+    } else if (strcmp(command, "SYST:ERR?") == 0) {
+        reply = "0,\"No error\"";
+    }
+
+    return wsa_mem_reply(link, reply);
+}
+
+
+///
+/// Hand over the next packet, with the packet count moved on.
+///
+static int16_t bench_mem_fill( void *arg, struct wsa_mem_link *link, uint64_t deadline_ns )
+{
+    struct bench_mem_device *mem = arg;
+
+    (void)deadline_ns;
+    if (!mem->streaming || mem->packet == NULL) {
+        return WSA_ERR_SOCKETNODATA;
+    }
+
+    mem->packet[1] = (uint8_t)(0x40 | 0x20 | mem->count);
+    mem->count = (uint8_t)((mem->count + 1) & 0x0f);
+
+    return wsa_mem_push_data(link, mem->packet, (int32_t)mem->packet_bytes);
+}
+
+
+static int16_t bench_mem_open( struct wsa_device *dev, struct bench_mem_device *mem )
+{
+    struct wsa_mem_device device;
+    struct wsa_mem_link *link;
+    int16_t result;
+
+    device.command = bench_mem_command;
+    device.fill = bench_mem_fill;
+    device.arg = mem;
+
+    result = wsa_mem_link_alloc(&device, &link);
+    if (result < 0) {
+        return result;
+    }
+
+    return wsa_connect_transport(dev, &wsa_mem_transport, link);
+}
+
+
+///
+/// Read packets from a streaming device and print the run's line.
+///
+/// @return 0 on success, otherwise the library's error code.
+///
+static int16_t bench_read( struct wsa_device *dev, char const *name, int32_t spp, uint64_t packets,
+                           enum bench_format format )
+{
+    struct wsa_vrt_packet_header header;
+    struct wsa_vrt_packet_trailer trailer;
+    struct wsa_receiver_packet receiver;
+    struct wsa_digitizer_packet digitizer;
+    struct wsa_extension_packet extension;
+    uint8_t *data;
+    uint64_t read = 0;
+    uint64_t bytes = 0;
+    uint64_t t0;
+    uint64_t elapsed_ns;
+    int16_t result;
+
+    data = malloc(65536 * 4);
+    if (data == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+
+    result = wsa_stream_start(dev);
+
+    t0 = wsa_clock_ns();
+    while (result >= 0 && read < packets) {
+        result = wsa_read_vrt_packet_raw(dev, &header, &trailer, &receiver, &digitizer, &extension, data, 65535,
+                                         BENCH_TIMEOUT_MS);
+        if (result >= 0 && header.packet_type == IF_PACKET_TYPE) {
+            read++;
+            bytes += ((uint64_t)header.samples_per_packet + VRT_HEADER_SIZE + VRT_TRAILER_SIZE) * BYTES_PER_VRT_WORD;
+        }
+    }
+    elapsed_ns = wsa_clock_ns() - t0;
+
+    wsa_stream_stop(dev);
+    wsa_flush_data(dev);
+    wsa_clean_data_socket(dev);
+    free(data);
+
+    // a replay of a short recording ends early
+    if (result == WSA_ERR_SOCKETNODATA && read > 0) {
+        result = 0;
+    }
+    if (result < 0) {
+        return result;
+    }
+
+    if (format == BENCH_FORMAT_JSON) {
+        printf("{\"transport\":\"%s\",\"spp\":%ld,\"packets\":%llu,\"mbytes\":%.1f,\"mbytes_per_s\":%.1f,"
+               "\"us_per_packet\":%.2f}\n",
+               name, (long)spp, (unsigned long long)read, bytes / 1e6, bytes / 1e6 / (elapsed_ns / 1e9),
+               elapsed_ns / 1e3 / read);
+    } else {
+        printf("%s,%ld,%llu,%.1f,%.1f,%.2f\n",
+               name, (long)spp, (unsigned long long)read, bytes / 1e6, bytes / 1e6 / (elapsed_ns / 1e9),
+               elapsed_ns / 1e3 / read);
+    }
+    fflush(stdout);
+
+    return 0;
+}
+
+
+///
+/// Record packets from the memory device, to be replayed.
+///
+static int16_t bench_record( struct wsa_device *dev, char const *path, uint64_t packets )
+{
+    struct wsa_recorder *rec = NULL;
+    int16_t result;
+    int16_t free_result;
+
+    result = wsa_recorder_alloc(dev, path, 0, &rec);
+    if (result < 0) {
+        return result;
+    }
+
+    result = wsa_stream_start(dev);
+    if (result >= 0) {
+        result = wsa_recorder_run(rec, packets, BENCH_TIMEOUT_MS);
+    }
+    wsa_stream_stop(dev);
+    wsa_clean_data_socket(dev);
+
+    free_result = wsa_recorder_free(rec);
+
+    return (result < 0) ? result : free_result;
+}
+
+
+static void bench_usage( char const *prog )
+{
+    printf("usage: %s [options]\n"
+           "  --sim PATH          simulator to start (default: wsasim next to this program)\n"
+           "  --spp N[,N...]      samples per packet to run (default 1024,16384)\n"
+           "  --packets N         packets read per run (default %d)\n"
+           "  --file PATH         where to record for the replay runs (default wsabench_transport.vrt)\n"
+           "  --json              JSON lines instead of CSV\n",
+           prog, BENCH_DEFAULT_PACKETS);
+}
+
+
+int main( int argc, char **argv )
+{
+    int32_t spps[BENCH_MAX_LIST] = { 1024, 16384 };
+    int nspps = 2;
+    uint64_t packets = BENCH_DEFAULT_PACKETS;
+    enum bench_format format = BENCH_FORMAT_CSV;
+    char const *path = "wsabench_transport.vrt";
+    struct bench_mem_device mem;
+    char index_path[1024];
+    char sim_path[1024];
+    char intf[1100];
+    struct wsa_device tcp_dev;
+    struct wsa_device mem_dev;
+    struct wsa_device replay_dev;
+    uint8_t have_tcp = 0;
+    char *tok;
+    int16_t result;
+    int failed = 0;
+    int i, s;
+#ifndef _WIN32
+    pid_t sim = -1;
+#endif
+
+    // The simulator is built into the same directory as the benchmarks.
+    test_sim_path(argv[0], sim_path, sizeof(sim_path));
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--sim") && i + 1 < argc) {
+            snprintf(sim_path, sizeof(sim_path), "%s", argv[++i]);
+        } else if (!strcmp(argv[i], "--spp") && i + 1 < argc) {
+            nspps = 0;
+            for (tok = strtok(argv[++i], ","); tok && nspps < BENCH_MAX_LIST; tok = strtok(NULL, ",")) {
+                spps[nspps++] = (int32_t)strtol(tok, NULL, 10);
+            }
+        } else if (!strcmp(argv[i], "--packets") && i + 1 < argc) {
+            packets = strtoull(argv[++i], NULL, 10);
+            if (packets < 1) {
+                packets = 1;
+            }
+        } else if (!strcmp(argv[i], "--file") && i + 1 < argc) {
+            path = argv[++i];
+        } else if (!strcmp(argv[i], "--json")) {
+            format = BENCH_FORMAT_JSON;
+        } else {
+            bench_usage(argv[0]);
+            return strcmp(argv[i], "--help") ? 1 : 0;
+        }
+    }
+
+#ifdef _WIN32
+    fprintf(stderr, "no simulator on this platform, skipping the tcp runs\n");
+#else
+    sim = test_sim_start(sim_path, BENCH_CTRL_PORT, BENCH_DATA_PORT, NULL);
+    if (sim < 0) {
+        fprintf(stderr, "failed to start simulator %s, skipping the tcp runs\n", sim_path);
+    } else {
+        snprintf(intf, sizeof(intf), "TCPIP::127.0.0.1::%d,%d", BENCH_CTRL_PORT, BENCH_DATA_PORT);
+        result = wsa_open(&tcp_dev, intf);
+        if (result < 0) {
+            fprintf(stderr, "wsa_open(%s) failed: %s\n", intf, wsa_get_error_msg(result));
+            failed = 1;
+        } else {
+            have_tcp = 1;
+        }
+    }
+#endif
+
+    memset(&mem, 0, sizeof(mem));
+    result = bench_mem_open(&mem_dev, &mem);
+    if (result < 0) {
+        fprintf(stderr, "connecting the memory device failed: %s\n", wsa_get_error_msg(result));
+        failed = 1;
+    }
+
+    if (format == BENCH_FORMAT_CSV) {
+        printf("transport,spp,packets,mbytes,mbytes_per_s,us_per_packet\n");
+    }
+
+    for (s = 0; s < nspps && !failed; s++) {
+        if (have_tcp) {
+            result = wsa_set_samples_per_packet(&tcp_dev, spps[s]);
+            if (result >= 0) {
+                result = bench_read(&tcp_dev, "tcp", spps[s], packets, format);
+            }
+            if (result < 0) {
+                fprintf(stderr, "tcp, spp %ld failed: %s\n", (long)spps[s], wsa_get_error_msg(result));
+                failed = 1;
+            }
+        }
+
+        result = wsa_set_samples_per_packet(&mem_dev, spps[s]);
+        if (result >= 0) {
+            result = bench_read(&mem_dev, "mem", spps[s], packets, format);
+        }
+        if (result < 0) {
+            fprintf(stderr, "mem, spp %ld failed: %s\n", (long)spps[s], wsa_get_error_msg(result));
+            failed = 1;
+            break;
+        }
+
+        result = bench_record(&mem_dev, path, packets);
+        if (result >= 0) {
+            snprintf(intf, sizeof(intf), "FILE::%s", path);
+            result = wsa_open(&replay_dev, intf);
+            if (result >= 0) {
+                result = bench_read(&replay_dev, "replay", spps[s], packets, format);
+                wsa_close(&replay_dev);
+            }
+        }
+        if (result < 0) {
+            fprintf(stderr, "replay, spp %ld failed: %s\n", (long)spps[s], wsa_get_error_msg(result));
+            failed = 1;
+        }
+    }
+
+    snprintf(index_path, sizeof(index_path), "%s%s", path, WSA_RECORD_INDEX_SUFFIX);
+    remove(path);
+    remove(index_path);
+
+    wsa_close(&mem_dev);
+    free(mem.packet);
+    if (have_tcp) {
+        wsa_close(&tcp_dev);
+    }
+#ifndef _WIN32
+    test_sim_stop(sim);
+#endif
+
+    return failed;
+}
+
+/// @}
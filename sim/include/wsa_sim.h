@@ -0,0 +1,79 @@
+///
+/// @defgroup sim Software Device Simulator
+///
+/// A software stand-in for an analyzer, used to run and benchmark the library without hardware.
+///
+/// @{
+///
+
+///
+/// @file
+/// Interface for the device simulator engine.
+///
+/// The engine understands the subset of SCPI sent by wsa_api.c and produces the VRT packets a device
+/// would send in reply: IF data, receiver and digitizer context, and extension context.
+/// It does no I/O of its own: commands are fed in one line at a time and packets are pulled out one
+/// at a time, so the same engine can sit behind TCP sockets (wsasim) or be driven in-process.
+///
+/// @note RESTRICTIONS
+/// \li Triggers, decimation and frequency shift are accepted and echoed back but have no effect on the data.
+/// \li The signal is one tone over a noise floor; levels are nominal, not calibrated.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#ifndef __WSA_SIM_H__
+#define __WSA_SIM_H__
+
+#include "thinkrf_stdint.h"
+
+
+///
+/// \name Public Definitions
+///
+/// @{
+
+/// Spectral inversion applied to IF packets.
+#define WSA_SIM_INVERSION_OFF 0				///< Never inverted
+#define WSA_SIM_INVERSION_ON 1				///< Always inverted
+#define WSA_SIM_INVERSION_ALTERNATE 2		///< Inverted on every other tuning step
+
+/// Largest VRT packet the engine produces, in bytes.
+#define WSA_SIM_MAX_PACKET_BYTES (65536 * 4)
+
+/// Configuration of a simulated device.
+struct wsa_sim_config {
+    char idn[128];					///< Reply to *IDN?, i.e. "vendor,model,serial,firmware"
+    uint32_t spp;					///< Samples per packet after *RST and SWEEP:ENTRY:NEW
+    int16_t reference_level;		///< Reference level reported in digitizer context, in dBm
+    uint64_t tone_freq;				///< RF frequency of the simulated tone in Hz
+    float tone_level;				///< Level of the tone in dBm
+    float noise_level;				///< Level of the noise floor in dBm, per sample
+    uint8_t inversion;				///< One of WSA_SIM_INVERSION_*
+    double drop_rate;				///< Fraction of IF packets dropped (the packet count still advances)
+    double sample_loss_rate;		///< Fraction of IF packets flagged with the sample loss indicator
+    uint32_t retune_us;				///< Time a tuning step takes before its first packet, in microseconds
+    uint32_t seed;					///< Seed for the noise and loss generators
+};
+
+/// Opaque simulator state.
+struct wsa_sim;
+
+/// @}
+///
+/// \name Public Functions
+///
+/// @{
+
+void wsa_sim_config_defaults(struct wsa_sim_config *cfg);
+struct wsa_sim *wsa_sim_new(struct wsa_sim_config const *cfg);
+void wsa_sim_free(struct wsa_sim *sim);
+int32_t wsa_sim_command(struct wsa_sim *sim, char const *line, char *reply, int32_t reply_size);
+uint8_t wsa_sim_data_pending(struct wsa_sim const *sim);
+int32_t wsa_sim_next_packet(struct wsa_sim *sim, uint8_t *buf, int32_t buf_size, uint32_t *delay_us);
+
+/// @}
+
+#endif
+
+/// @}
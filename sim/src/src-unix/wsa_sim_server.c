@@ -0,0 +1,436 @@
+///
+/// @ingroup sim
+///
+/// @{
+///
+
+///
+/// @file
+/// wsasim: serves a simulated device on the control and data ports, for use in place of real hardware.
+///
+/// Run it and point any program at "TCPIP::127.0.0.1" (or "TCPIP::127.0.0.1::<ctrl>,<data>" when
+/// the ports are changed). One client is served at a time; a new connection replaces the old one.
+/// Run with --help for the options.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "wsa_sim.h"
+
+#define WSA_SIM_CTRL_PORT 37001			///< Default control port, as on a device
+#define WSA_SIM_DATA_PORT 37000			///< Default data port, as on a device
+#define WSA_SIM_LINE_MAX 4096			///< Longest control line accepted
+
+/// Server state.
+struct wsa_sim_server {
+    struct wsa_sim *sim;
+    int ctrl_listen;
+    int data_listen;
+    int ctrl;							///< Connected control socket, or -1
+    int data;							///< Connected data socket, or -1
+    char line[WSA_SIM_LINE_MAX];		///< Partial control line
+    size_t line_len;
+    uint8_t *packet;					///< Packet being sent
+    int32_t packet_len;
+    int32_t packet_sent;
+    uint64_t release_ns;				///< When the held packet may be sent
+    uint64_t period_ns;					///< Minimum time between packets, 0 for no limit
+    uint32_t stall_after;				///< Packets sent on a data connection before it stalls, 0 for never
+    uint32_t data_sent;					///< Packets sent on the data connection so far
+    uint8_t verbose;
+};
+
+static volatile sig_atomic_t wsa_sim_quit = 0;
+
+
+static void wsa_sim_on_signal( int sig )
+{
+    (void)sig;
+    wsa_sim_quit = 1;
+}
+
+
+///
+/// Read the monotonic clock in nanoseconds.
+///
+static uint64_t wsa_sim_now_ns( void )
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+///
+/// Open a listening socket on all interfaces.
+///
+/// @returns The socket, or -1 on error.
+///
+static int wsa_sim_listen( uint16_t port )
+{
+    struct sockaddr_in addr;
+    int fd;
+    int on = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("wsasim: socket");
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        fprintf(stderr, "wsasim: cannot listen on port %u: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+///
+/// Accept a connection, replacing any existing one on the same port.
+///
+static void wsa_sim_accept( int listen_fd, int *fd, char const *name, uint8_t verbose )
+{
+    int newfd = accept(listen_fd, NULL, NULL);
+    int on = 1;
+
+    if (newfd < 0) {
+        return;
+    }
+    if (*fd >= 0) {
+        close(*fd);
+    }
+    setsockopt(newfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    *fd = newfd;
+
+    if (verbose) {
+        fprintf(stderr, "wsasim: %s port connected\n", name);
+    }
+}
+
+
+///
+/// Drop both client connections and stop any capture in progress.
+///
+static void wsa_sim_disconnect( struct wsa_sim_server *srv )
+{
+    char reply[256];
+
+    if (srv->ctrl >= 0) {
+        close(srv->ctrl);
+        srv->ctrl = -1;
+    }
+    if (srv->data >= 0) {
+        close(srv->data);
+        srv->data = -1;
+    }
+    srv->line_len = 0;
+    srv->packet_len = 0;
+    srv->packet_sent = 0;
+    wsa_sim_command(srv->sim, "SYSTEM:ABORT", reply, sizeof(reply));
+
+    if (srv->verbose) {
+        fprintf(stderr, "wsasim: client disconnected\n");
+    }
+}
+
+
+///
+/// Read from the control socket and answer every complete line.
+///
+static void wsa_sim_serve_ctrl( struct wsa_sim_server *srv )
+{
+    char reply[1024];
+    char *start;
+    char *nl;
+    ssize_t got;
+    int32_t len;
+
+    got = recv(srv->ctrl, srv->line + srv->line_len, sizeof(srv->line) - 1 - srv->line_len, 0);
+    if (got <= 0) {
+        wsa_sim_disconnect(srv);
+        return;
+    }
+    srv->line_len += (size_t)got;
+    srv->line[srv->line_len] = '\0';
+
+    start = srv->line;
+    while ((nl = strchr(start, '\n')) != NULL) {
+        *nl = '\0';
+        if (srv->verbose) {
+            fprintf(stderr, "wsasim: <- %s\n", start);
+        }
+        len = wsa_sim_command(srv->sim, start, reply, sizeof(reply));
+        if (len > 0 && send(srv->ctrl, reply, (size_t)len, MSG_NOSIGNAL) != len) {
+            wsa_sim_disconnect(srv);
+            return;
+        }
+        start = nl + 1;
+    }
+
+    // Keep the partial line; throw away a line too long to ever complete.
+    srv->line_len -= (size_t)(start - srv->line);
+    if (srv->line_len == sizeof(srv->line) - 1) {
+        srv->line_len = 0;
+    }
+    memmove(srv->line, start, srv->line_len);
+}
+
+
+///
+/// Send as much of the current packet as the data socket takes without blocking.
+///
+static void wsa_sim_serve_data( struct wsa_sim_server *srv )
+{
+    ssize_t sent;
+
+    sent = send(srv->data, srv->packet + srv->packet_sent, (size_t)(srv->packet_len - srv->packet_sent), MSG_NOSIGNAL);
+    if (sent < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            wsa_sim_disconnect(srv);
+        }
+        return;
+    }
+
+    srv->packet_sent += (int32_t)sent;
+    if (srv->packet_sent == srv->packet_len) {
+        srv->packet_len = 0;
+        srv->packet_sent = 0;
+        srv->data_sent++;
+        if (srv->period_ns) {
+            srv->release_ns += srv->period_ns;
+        }
+    }
+}
+
+
+static void wsa_sim_usage( char const *prog )
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --ctrl-port N        control port (default %d)\n"
+            "  --data-port N        data port (default %d)\n"
+            "  --idn STRING         reply to *IDN? (default \"ThinkRF,R5500-418 ...\")\n"
+            "  --rate N             IF packets per second, 0 for as fast as possible (default 0)\n"
+            "  --spp N              samples per packet after *RST (default 1024)\n"
+            "  --inversion MODE     spectral inversion: off, on or alternate (default off)\n"
+            "  --retune-us N        time per tuning step before its first packet (default 0)\n"
+            "  --drop FRACTION      fraction of IF packets dropped (default 0)\n"
+            "  --sample-loss FRACTION  fraction of IF packets flagged with sample loss (default 0)\n"
+            "  --tone-freq HZ       tone frequency (default 2450000000)\n"
+            "  --tone-level DBM     tone level (default -30)\n"
+            "  --noise-level DBM    noise level (default -70)\n"
+            "  --ref-level DBM      reported reference level (default 0)\n"
+            "  --seed N             random seed (default 1)\n"
+            "  --stall-after N      on each data connection, send N packets and half of the next,\n"
+            "                       then nothing until the client reconnects (default 0, never)\n"
+            "  --verbose            log connections and commands\n",
+            prog, WSA_SIM_CTRL_PORT, WSA_SIM_DATA_PORT);
+}
+
+
+int main( int argc, char *argv[] )
+{
+    struct wsa_sim_config cfg;
+    struct wsa_sim_server srv;
+    struct pollfd fds[4];
+    struct timespec wait;
+    struct timespec *waitp;
+    uint16_t ctrl_port = WSA_SIM_CTRL_PORT;
+    uint16_t data_port = WSA_SIM_DATA_PORT;
+    double rate = 0;
+    uint32_t delay_us;
+    uint64_t now;
+    nfds_t nfds;
+    int i;
+
+    wsa_sim_config_defaults(&cfg);
+    memset(&srv, 0, sizeof(srv));
+
+    for (i = 1; i < argc; i++) {
+        char const *opt = argv[i];
+        char const *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(opt, "--verbose") == 0) {
+            srv.verbose = 1;
+            continue;
+        }
+        if (val == NULL || strcmp(opt, "--help") == 0) {
+            wsa_sim_usage(argv[0]);
+            return (strcmp(opt, "--help") == 0) ? 0 : 1;
+        }
+        i++;
+
+        if (strcmp(opt, "--ctrl-port") == 0) {
+            ctrl_port = (uint16_t)atoi(val);
+        } else if (strcmp(opt, "--data-port") == 0) {
+            data_port = (uint16_t)atoi(val);
+        } else if (strcmp(opt, "--idn") == 0) {
+            strncpy(cfg.idn, val, sizeof(cfg.idn) - 1);
+        } else if (strcmp(opt, "--rate") == 0) {
+            rate = atof(val);
+        } else if (strcmp(opt, "--spp") == 0) {
+            cfg.spp = (uint32_t)atoi(val);
+        } else if (strcmp(opt, "--inversion") == 0) {
+            cfg.inversion = (strcmp(val, "on") == 0) ? WSA_SIM_INVERSION_ON :
+                            ((strcmp(val, "alternate") == 0) ? WSA_SIM_INVERSION_ALTERNATE : WSA_SIM_INVERSION_OFF);
+        } else if (strcmp(opt, "--retune-us") == 0) {
+            cfg.retune_us = (uint32_t)atoi(val);
+        } else if (strcmp(opt, "--drop") == 0) {
+            cfg.drop_rate = atof(val);
+        } else if (strcmp(opt, "--sample-loss") == 0) {
+            cfg.sample_loss_rate = atof(val);
+        } else if (strcmp(opt, "--tone-freq") == 0) {
+            cfg.tone_freq = (uint64_t)atof(val);
+        } else if (strcmp(opt, "--tone-level") == 0) {
+            cfg.tone_level = (float)atof(val);
+        } else if (strcmp(opt, "--noise-level") == 0) {
+            cfg.noise_level = (float)atof(val);
+        } else if (strcmp(opt, "--ref-level") == 0) {
+            cfg.reference_level = (int16_t)atoi(val);
+        } else if (strcmp(opt, "--seed") == 0) {
+            cfg.seed = (uint32_t)strtoul(val, NULL, 10);
+        } else if (strcmp(opt, "--stall-after") == 0) {
+            srv.stall_after = (uint32_t)strtoul(val, NULL, 10);
+        } else {
+            wsa_sim_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    srv.sim = wsa_sim_new(&cfg);
+    srv.packet = (uint8_t *)malloc(WSA_SIM_MAX_PACKET_BYTES);
+    if (srv.sim == NULL || srv.packet == NULL) {
+        fprintf(stderr, "wsasim: out of memory\n");
+        return 1;
+    }
+    srv.period_ns = (rate > 0) ? (uint64_t)(1e9 / rate) : 0;
+    srv.ctrl = -1;
+    srv.data = -1;
+    srv.ctrl_listen = wsa_sim_listen(ctrl_port);
+    srv.data_listen = wsa_sim_listen(data_port);
+    if (srv.ctrl_listen < 0 || srv.data_listen < 0) {
+        return 1;
+    }
+
+    signal(SIGINT, wsa_sim_on_signal);
+    signal(SIGTERM, wsa_sim_on_signal);
+
+    fprintf(stderr, "wsasim: listening on control port %u, data port %u\n", ctrl_port, data_port);
+
+    while (!wsa_sim_quit) {
+        now = wsa_sim_now_ns();
+
+        // Fetch the next packet once the previous one is out, and charge it any retune time. A
+        // stalling connection gets half of the packet after its last, and then nothing.
+        if (srv.data >= 0 && srv.packet_len == 0 && wsa_sim_data_pending(srv.sim) &&
+            (srv.stall_after == 0 || srv.data_sent <= srv.stall_after)) {
+            srv.packet_len = wsa_sim_next_packet(srv.sim, srv.packet, WSA_SIM_MAX_PACKET_BYTES, &delay_us);
+            if (srv.packet_len > 0 && srv.stall_after > 0 && srv.data_sent == srv.stall_after) {
+                srv.packet_len /= 2;
+            }
+            if (srv.packet_len > 0) {
+                if (srv.release_ns < now) {
+                    srv.release_ns = now;
+                }
+                srv.release_ns += (uint64_t)delay_us * 1000ULL;
+            } else {
+                srv.packet_len = 0;
+            }
+        }
+
+        nfds = 0;
+        fds[nfds].fd = srv.ctrl_listen;
+        fds[nfds++].events = POLLIN;
+        fds[nfds].fd = srv.data_listen;
+        fds[nfds++].events = POLLIN;
+        if (srv.ctrl >= 0) {
+            fds[nfds].fd = srv.ctrl;
+            fds[nfds++].events = POLLIN;
+        }
+
+        // Hold a packet back until its release time; otherwise wait for room in the socket.
+        waitp = NULL;
+        if (srv.data >= 0) {
+            fds[nfds].fd = srv.data;
+            fds[nfds].events = 0;
+            if (srv.packet_len > 0) {
+                if (srv.release_ns > now && srv.packet_sent == 0) {
+                    wait.tv_sec = (time_t)((srv.release_ns - now) / 1000000000ULL);
+                    wait.tv_nsec = (long)((srv.release_ns - now) % 1000000000ULL);
+                    waitp = &wait;
+                } else {
+                    fds[nfds].events = POLLOUT;
+                }
+            }
+            nfds++;
+        }
+
+        if (ppoll(fds, nfds, waitp, NULL) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("wsasim: poll");
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            wsa_sim_accept(srv.ctrl_listen, &srv.ctrl, "control", srv.verbose);
+        }
+        if (fds[1].revents & POLLIN) {
+            wsa_sim_accept(srv.data_listen, &srv.data, "data", srv.verbose);
+            if (srv.data >= 0) {
+                fcntl(srv.data, F_SETFL, fcntl(srv.data, F_GETFL) | O_NONBLOCK);
+                srv.packet_len = 0;
+                srv.packet_sent = 0;
+                srv.data_sent = 0;
+            }
+        }
+        for (i = 2; i < (int)nfds; i++) {
+            if (fds[i].fd == srv.ctrl && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                wsa_sim_serve_ctrl(&srv);
+            } else if (fds[i].fd == srv.data && srv.data >= 0) {
+                if (fds[i].revents & (POLLHUP | POLLERR)) {
+                    wsa_sim_disconnect(&srv);
+                } else if (fds[i].revents & POLLOUT) {
+                    wsa_sim_serve_data(&srv);
+                }
+            }
+        }
+    }
+
+    wsa_sim_disconnect(&srv);
+    close(srv.ctrl_listen);
+    close(srv.data_listen);
+    free(srv.packet);
+    wsa_sim_free(srv.sim);
+
+    return 0;
+}
+
+/// @}
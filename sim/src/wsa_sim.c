@@ -0,0 +1,1110 @@
+///
+/// @ingroup sim
+///
+/// @{
+///
+
+///
+/// @file
+/// Implementation of the device simulator engine.
+///
+/// Full documentation is in wsa_sim.h.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+///
+/// \name External References
+///
+/// @{
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include "wsa_sim.h"
+#include "wsa_lib.h"
+
+/// @}
+///
+/// \name Internal Constants
+///
+/// @{
+
+#define WSA_SIM_SAMPLE_RATE 125000000ULL	///< ADC sample rate in samples per second
+#define WSA_SIM_PSEC_PER_SAMPLE 8000ULL		///< Picoseconds per ADC sample
+#define WSA_SIM_IF_CENTER 35000000.0		///< Centre of the SH/SHN passband in Hz
+#define WSA_SIM_FULL_SCALE 8192.0			///< Sample value of a 0 dBFS signal (I14 data)
+
+#define WSA_SIM_NOISE_LEN 65536				///< Length of the precomputed noise table, a power of 2
+#define WSA_SIM_NOISE_SIGMA 2048.0			///< Standard deviation of the values in the noise table
+#define WSA_SIM_MAX_ENTRIES 1024			///< Size of the sweep list
+#define WSA_SIM_MAX_SETTINGS 64				///< Number of generic settings remembered
+#define WSA_SIM_MAX_ERRORS 8				///< Depth of the SCPI error queue
+
+/// Capture modes, as reported by SYST:CAPT:MODE?.
+#define WSA_SIM_CAPTURE_BLOCK 0
+#define WSA_SIM_CAPTURE_STREAM 1
+#define WSA_SIM_CAPTURE_SWEEP 2
+
+/// Context packets still to be sent before the IF data of the current step.
+#define WSA_SIM_PENDING_EXTENSION 0x1
+#define WSA_SIM_PENDING_RECEIVER 0x2
+#define WSA_SIM_PENDING_DIGITIZER 0x4
+
+/// Per-stream VRT packet counters.
+#define WSA_SIM_COUNTER_IF 0
+#define WSA_SIM_COUNTER_RECEIVER 1
+#define WSA_SIM_COUNTER_DIGITIZER 2
+#define WSA_SIM_COUNTER_EXTENSION 3
+
+/// @}
+///
+/// \name Private Objects and Functions
+///
+/// @{
+
+/// One sweep list entry.
+struct wsa_sim_entry {
+    char mode[16];					///< RFE mode, e.g. "SH"
+    uint64_t fstart;				///< First centre frequency in Hz
+    uint64_t fstop;					///< Last centre frequency in Hz
+    uint64_t fstep;					///< Step between centre frequencies in Hz
+    uint32_t spp;					///< Samples per packet
+    uint32_t ppb;					///< Packets per block, i.e. per step
+};
+
+/// A setting the engine does not model, kept so its query returns what was set.
+struct wsa_sim_setting {
+    char key[64];					///< Canonical SCPI header
+    char value[128];				///< Arguments of the last set command
+};
+
+/// Simulator state.
+struct wsa_sim {
+    struct wsa_sim_config cfg;
+
+    // Manual (block and stream) capture settings.
+    struct wsa_sim_entry manual;
+
+    // Sweep list.
+    struct wsa_sim_entry edit;						///< Entry being edited by SWEEP:ENTRY:*
+    struct wsa_sim_entry *entries;
+    uint32_t entry_count;
+    int32_t iterations;								///< 0 sweeps forever
+
+    struct wsa_sim_setting settings[WSA_SIM_MAX_SETTINGS];
+    uint32_t setting_count;
+
+    char errors[WSA_SIM_MAX_ERRORS][128];
+    uint32_t error_count;
+
+    // Packet generator.
+    uint8_t capture;								///< One of WSA_SIM_CAPTURE_*
+    uint8_t running;								///< Packets are being produced
+    uint8_t pending;								///< WSA_SIM_PENDING_* flags
+    uint32_t start_id;								///< Id sent in the extension packet
+    uint32_t start_id_mask;							///< Indicator bit for the id
+    struct wsa_sim_entry const *step;				///< Settings of the current step
+    uint64_t freq;									///< Centre frequency of the current step
+    uint32_t entry_index;
+    int32_t iterations_done;
+    uint32_t packets_left;							///< IF packets left in the current step
+    uint32_t step_count;
+    uint32_t pending_delay;
+    uint8_t counters[4];							///< WSA_SIM_COUNTER_*
+
+    // Signal.
+    uint64_t sample_clock;							///< Samples produced since epoch
+    uint32_t epoch;
+    double osc_re, osc_im;							///< Tone oscillator state
+    int16_t *noise;
+    uint32_t rng;
+};
+
+
+///
+/// Advance the engine's random number generator (xorshift32).
+///
+/// @param[in,out] sim The simulator.
+///
+/// @returns The next 32-bit random value.
+///
+static uint32_t wsa_sim_rand( struct wsa_sim *sim )
+{
+    uint32_t x = sim->rng;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sim->rng = x;
+
+    return x;
+}
+
+
+///
+/// Draw from a uniform distribution on [0, 1).
+///
+static double wsa_sim_uniform( struct wsa_sim *sim )
+{
+    return (double)wsa_sim_rand(sim) / 4294967296.0;
+}
+
+
+///
+/// Queue a SCPI error for SYST:ERR?.
+///
+/// @param[in,out] sim The simulator.
+/// @param[in] msg The error, e.g. "-113,\"Undefined header\"".
+///
+static void wsa_sim_push_error( struct wsa_sim *sim, char const *msg )
+{
+    if (sim->error_count < WSA_SIM_MAX_ERRORS) {
+        strncpy(sim->errors[sim->error_count], msg, sizeof(sim->errors[0]) - 1);
+        sim->errors[sim->error_count][sizeof(sim->errors[0]) - 1] = '\0';
+        sim->error_count++;
+    }
+}
+
+
+///
+/// Reduce a SCPI header to a canonical form.
+///
+/// Each node is upper cased and cut to its short form, so long and short spellings of the same
+/// command compare equal: "SWEEP:ENTRY:FREQ:CENTER" and ":SWE:ENTR:FREQ:CENT" both give
+/// "SWE:ENTR:FREQ:CENT". The short form is the first four characters, or three if the fourth is
+/// a vowel.
+///
+/// @param[in] in The header, not necessarily NUL terminated.
+/// @param[in] len Length of the header, without any trailing '?'.
+/// @param[out] out Buffer for the canonical header.
+/// @param[in] out_size Size of the output buffer.
+///
+static void wsa_sim_canonical_header( char const *in, size_t len, char *out, size_t out_size )
+{
+    size_t i = 0;
+    size_t o = 0;
+    size_t node_start;
+    size_t node_len;
+    size_t keep;
+
+    if (len > 0 && in[0] == ':') {
+        i++;
+    }
+
+    while (i < len && o + 1 < out_size) {
+        node_start = i;
+        while (i < len && in[i] != ':') {
+            i++;
+        }
+        node_len = i - node_start;
+
+        keep = node_len;
+        if (node_len > 4) {
+            keep = strchr("AEIOU", toupper((unsigned char)in[node_start + 3])) ? 3 : 4;
+        }
+        while (keep-- > 0 && o + 1 < out_size) {
+            out[o++] = (char)toupper((unsigned char)in[node_start++]);
+        }
+
+        if (i < len && o + 1 < out_size) {
+            out[o++] = ':';
+            i++;
+        }
+    }
+    out[o] = '\0';
+}
+
+
+///
+/// Parse a frequency argument, e.g. "2400000000", "2.4 GHz" or "100 Hz".
+///
+/// @param[in,out] p Points to the argument; advanced past the number, its unit and any comma.
+/// @param[out] freq The frequency in Hz.
+///
+/// @returns 0 on success, or -1 if no number was found.
+///
+static int16_t wsa_sim_parse_freq( char const **p, uint64_t *freq )
+{
+    char *end;
+    double value;
+    double scale = 1.0;
+
+    value = strtod(*p, &end);
+    if (end == *p || value < 0) {
+        return -1;
+    }
+
+    while (*end == ' ') {
+        end++;
+    }
+    if (toupper((unsigned char)end[0]) == 'G') {
+        scale = 1e9;
+    } else if (toupper((unsigned char)end[0]) == 'M') {
+        scale = 1e6;
+    } else if (toupper((unsigned char)end[0]) == 'K') {
+        scale = 1e3;
+    }
+    while (isalpha((unsigned char)*end) || *end == ' ' || *end == ',') {
+        end++;
+    }
+
+    *freq = (uint64_t)(value * scale + 0.5);
+    *p = end;
+
+    return 0;
+}
+
+
+///
+/// Parse and check a samples per packet argument, queueing an error if it is out of range.
+///
+static int16_t wsa_sim_parse_spp( struct wsa_sim *sim, char const *args, uint32_t *spp )
+{
+    long value = strtol(args, NULL, 10);
+
+    if (value < WSA_MIN_SPP || value > WSA_MAX_SPP || (value % WSA_SPP_MULTIPLE) != 0) {
+        wsa_sim_push_error(sim, "-222,\"Data out of range\"");
+        return -1;
+    }
+    *spp = (uint32_t)value;
+
+    return 0;
+}
+
+
+///
+/// Parse and check an RFE mode argument, queueing an error if it is unknown.
+///
+static int16_t wsa_sim_parse_mode( struct wsa_sim *sim, char const *args, char *mode )
+{
+    static char const * const modes[] = { "ZIF", "HDR", "SH", "SHN", "DECSH", "DECSHN", "IQIN", "DD", NULL };
+    char upper[16];
+    uint32_t i;
+
+    for (i = 0; args[i] && args[i] != ' ' && i < sizeof(upper) - 1; i++) {
+        upper[i] = (char)toupper((unsigned char)args[i]);
+    }
+    upper[i] = '\0';
+
+    for (i = 0; modes[i]; i++) {
+        if (strcmp(upper, modes[i]) == 0) {
+            strcpy(mode, modes[i]);
+            return 0;
+        }
+    }
+    wsa_sim_push_error(sim, "-224,\"Illegal parameter value\"");
+
+    return -1;
+}
+
+
+///
+/// Copy a string into a fixed-size field, cutting it short if it does not fit.
+///
+static void wsa_sim_copy( char *dst, size_t size, char const *src )
+{
+    size_t len = strlen(src);
+
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+
+///
+/// Remember a setting the engine does not model.
+///
+static void wsa_sim_store_setting( struct wsa_sim *sim, char const *key, char const *value )
+{
+    uint32_t i;
+
+    for (i = 0; i < sim->setting_count; i++) {
+        if (strcmp(sim->settings[i].key, key) == 0) {
+            break;
+        }
+    }
+    if (i == sim->setting_count) {
+        if (i == WSA_SIM_MAX_SETTINGS) {
+            return;
+        }
+        sim->setting_count++;
+        wsa_sim_copy(sim->settings[i].key, sizeof(sim->settings[i].key), key);
+    }
+    wsa_sim_copy(sim->settings[i].value, sizeof(sim->settings[i].value), value);
+}
+
+
+///
+/// Look up a setting stored by wsa_sim_store_setting().
+///
+/// @returns The stored value, or "0" if it was never set.
+///
+static char const *wsa_sim_find_setting( struct wsa_sim const *sim, char const *key )
+{
+    uint32_t i;
+
+    for (i = 0; i < sim->setting_count; i++) {
+        if (strcmp(sim->settings[i].key, key) == 0) {
+            return sim->settings[i].value;
+        }
+    }
+
+    return "0";
+}
+
+
+///
+/// Put a sweep entry or the manual settings back to power-on values.
+///
+static void wsa_sim_entry_defaults( struct wsa_sim const *sim, struct wsa_sim_entry *entry )
+{
+    strcpy(entry->mode, "SH");
+    entry->fstart = 2400000000ULL;
+    entry->fstop = 2400000000ULL;
+    entry->fstep = 100000000ULL;
+    entry->spp = sim->cfg.spp;
+    entry->ppb = 1;
+}
+
+
+///
+/// Stop producing packets and go back to block capture mode.
+///
+static void wsa_sim_stop( struct wsa_sim *sim )
+{
+    sim->running = 0;
+    sim->pending = 0;
+    sim->packets_left = 0;
+    sim->capture = WSA_SIM_CAPTURE_BLOCK;
+}
+
+
+///
+/// Put the whole device back to power-on state, as *RST does.
+///
+static void wsa_sim_reset( struct wsa_sim *sim )
+{
+    wsa_sim_stop(sim);
+    wsa_sim_entry_defaults(sim, &sim->manual);
+    wsa_sim_entry_defaults(sim, &sim->edit);
+    sim->entry_count = 0;
+    sim->iterations = 1;
+    sim->setting_count = 0;
+    sim->error_count = 0;
+}
+
+
+///
+/// Start a tuning step at sim->step and sim->freq.
+///
+/// The step's context packets are queued ahead of its IF data, and the retune time is charged
+/// to the first of them.
+///
+static void wsa_sim_begin_step( struct wsa_sim *sim, uint32_t packets )
+{
+    sim->pending |= WSA_SIM_PENDING_RECEIVER | WSA_SIM_PENDING_DIGITIZER;
+    sim->packets_left = packets;
+    sim->pending_delay = sim->cfg.retune_us;
+    sim->step_count++;
+}
+
+
+///
+/// Move a running sweep on to its next tuning step.
+///
+/// Steps go from each entry's start to stop frequency, then on to the next entry. After the last
+/// entry the list repeats until the iteration count is reached.
+///
+/// @returns 1 if a new step was started, 0 if the sweep is finished.
+///
+static uint8_t wsa_sim_next_sweep_step( struct wsa_sim *sim )
+{
+    struct wsa_sim_entry const *entry = &sim->entries[sim->entry_index];
+
+    if (entry->fstep > 0 && sim->freq + entry->fstep <= entry->fstop) {
+        sim->freq += entry->fstep;
+    } else {
+        sim->entry_index++;
+        if (sim->entry_index >= sim->entry_count) {
+            sim->entry_index = 0;
+            sim->iterations_done++;
+            if (sim->iterations > 0 && sim->iterations_done >= sim->iterations) {
+                return 0;
+            }
+            // Each pass over the list starts with the sweep start id again, as on a device.
+            if (sim->start_id_mask == SWEEP_START_ID_INDICATOR_MASK) {
+                sim->pending |= WSA_SIM_PENDING_EXTENSION;
+            }
+        }
+        entry = &sim->entries[sim->entry_index];
+        sim->freq = entry->fstart;
+    }
+    sim->step = entry;
+    wsa_sim_begin_step(sim, entry->ppb);
+
+    return 1;
+}
+
+
+///
+/// Start producing packets.
+///
+/// @param[in,out] sim The simulator.
+/// @param[in] capture One of WSA_SIM_CAPTURE_*.
+/// @param[in] args Arguments of the start command; a number there is sent back in an extension packet.
+///
+static void wsa_sim_start( struct wsa_sim *sim, uint8_t capture, char const *args )
+{
+    char *end;
+    unsigned long id = strtoul(args, &end, 10);
+
+    sim->capture = capture;
+    sim->running = 1;
+    sim->pending = 0;
+    sim->step_count = 0;
+    sim->start_id_mask = 0;
+
+    if (end != args) {
+        sim->start_id = (uint32_t)id;
+        sim->start_id_mask = (capture == WSA_SIM_CAPTURE_SWEEP) ? SWEEP_START_ID_INDICATOR_MASK : STREAM_START_ID_INDICATOR_MASK;
+        sim->pending |= WSA_SIM_PENDING_EXTENSION;
+    }
+
+    if (capture == WSA_SIM_CAPTURE_SWEEP) {
+        sim->entry_index = 0;
+        sim->iterations_done = 0;
+        sim->step = &sim->entries[0];
+        sim->freq = sim->entries[0].fstart;
+        wsa_sim_begin_step(sim, sim->step->ppb);
+    } else {
+        sim->step = &sim->manual;
+        sim->freq = sim->manual.fstart;
+        wsa_sim_begin_step(sim, (capture == WSA_SIM_CAPTURE_STREAM) ? 0 : sim->manual.ppb);
+    }
+}
+
+
+///
+/// Handle the SWEEP:ENTRY:* and SWEEP:LIST:* commands.
+///
+/// @returns Length of the reply written, 0 for no reply, or -1 if the command is not one of these.
+///
+static int32_t wsa_sim_sweep_command( struct wsa_sim *sim, char const *key, uint8_t query, char const *args,
+                                      char *reply, int32_t reply_size )
+{
+    uint32_t n;
+    uint64_t fstart, fstop;
+    char const *p = args;
+
+    if (strcmp(key, "SWE:ENTR:NEW") == 0) {
+        wsa_sim_entry_defaults(sim, &sim->edit);
+    } else if (strcmp(key, "SWE:ENTR:DEL") == 0) {
+        n = (uint32_t)strtoul(args, NULL, 10);
+        if (toupper((unsigned char)args[0]) == 'A') {
+            sim->entry_count = 0;
+        } else if (n >= 1 && n <= sim->entry_count) {
+            memmove(&sim->entries[n - 1], &sim->entries[n], (sim->entry_count - n) * sizeof(struct wsa_sim_entry));
+            sim->entry_count--;
+        } else {
+            wsa_sim_push_error(sim, "-222,\"Data out of range\"");
+        }
+    } else if (strcmp(key, "SWE:ENTR:SAVE") == 0) {
+        n = (uint32_t)strtoul(args, NULL, 10);
+        if (sim->entry_count == WSA_SIM_MAX_ENTRIES) {
+            wsa_sim_push_error(sim, "-225,\"Out of memory\"");
+        } else {
+            if (n == 0 || n > sim->entry_count) {
+                n = sim->entry_count + 1;
+            }
+            memmove(&sim->entries[n], &sim->entries[n - 1], (sim->entry_count - (n - 1)) * sizeof(struct wsa_sim_entry));
+            sim->entries[n - 1] = sim->edit;
+            sim->entry_count++;
+        }
+    } else if (strcmp(key, "SWE:ENTR:COPY") == 0 || strcmp(key, "SWE:ENTR:READ") == 0) {
+        n = (uint32_t)strtoul(args, NULL, 10);
+        if (n >= 1 && n <= sim->entry_count) {
+            sim->edit = sim->entries[n - 1];
+        } else {
+            wsa_sim_push_error(sim, "-222,\"Data out of range\"");
+        }
+        if (query) {
+            return sprintf(reply, "%s,%llu,%llu,%llu,%u,%u\n", sim->edit.mode, sim->edit.fstart, sim->edit.fstop,
+                           sim->edit.fstep, sim->edit.spp, sim->edit.ppb);
+        }
+    } else if (strcmp(key, "SWE:ENTR:COUN") == 0) {
+        return sprintf(reply, "%u\n", sim->entry_count);
+    } else if (strcmp(key, "SWE:ENTR:MODE") == 0) {
+        if (query) {
+            return sprintf(reply, "%s\n", sim->edit.mode);
+        }
+        wsa_sim_parse_mode(sim, args, sim->edit.mode);
+    } else if (strcmp(key, "SWE:ENTR:FREQ:CENT") == 0) {
+        if (query) {
+            return sprintf(reply, "%llu,%llu\n", sim->edit.fstart, sim->edit.fstop);
+        }
+        if (wsa_sim_parse_freq(&p, &fstart) < 0 || wsa_sim_parse_freq(&p, &fstop) < 0 || fstop < fstart) {
+            wsa_sim_push_error(sim, "-222,\"Data out of range\"");
+        } else {
+            sim->edit.fstart = fstart;
+            sim->edit.fstop = fstop;
+        }
+    } else if (strcmp(key, "SWE:ENTR:FREQ:STEP") == 0) {
+        if (query) {
+            return sprintf(reply, "%llu\n", sim->edit.fstep);
+        }
+        if (wsa_sim_parse_freq(&p, &sim->edit.fstep) < 0) {
+            wsa_sim_push_error(sim, "-222,\"Data out of range\"");
+        }
+    } else if (strcmp(key, "SWE:ENTR:SPP") == 0) {
+        if (query) {
+            return sprintf(reply, "%u\n", sim->edit.spp);
+        }
+        wsa_sim_parse_spp(sim, args, &sim->edit.spp);
+    } else if (strcmp(key, "SWE:ENTR:PPBL") == 0) {
+        if (query) {
+            return sprintf(reply, "%u\n", sim->edit.ppb);
+        }
+        n = (uint32_t)strtoul(args, NULL, 10);
+        if (n < WSA_MIN_PPB) {
+            wsa_sim_push_error(sim, "-222,\"Data out of range\"");
+        } else {
+            sim->edit.ppb = n;
+        }
+    } else if (strcmp(key, "SWE:LIST:ITER") == 0) {
+        if (query) {
+            return sprintf(reply, "%d\n", sim->iterations);
+        }
+        sim->iterations = (int32_t)strtol(args, NULL, 10);
+    } else if (strcmp(key, "SWE:LIST:STAR") == 0) {
+        if (sim->capture != WSA_SIM_CAPTURE_BLOCK || sim->entry_count == 0) {
+            wsa_sim_push_error(sim, "-200,\"Execution error\"");
+        } else {
+            wsa_sim_start(sim, WSA_SIM_CAPTURE_SWEEP, args);
+        }
+    } else if (strcmp(key, "SWE:LIST:STOP") == 0) {
+        if (sim->capture == WSA_SIM_CAPTURE_SWEEP) {
+            wsa_sim_stop(sim);
+        }
+    } else if (strcmp(key, "SWE:LIST:STAT") == 0) {
+        return sprintf(reply, "%s\n", (sim->capture == WSA_SIM_CAPTURE_SWEEP) ? WSA_SWEEP_STATE_RUNNING : WSA_SWEEP_STATE_STOPPED);
+    } else {
+        return -1;
+    }
+
+    (void)reply_size;
+    return 0;
+}
+
+
+///
+/// Fill in the first five words shared by every packet: header, stream id and timestamp.
+///
+/// @returns The number of bytes written, always 20.
+///
+static int32_t wsa_sim_put_prologue( struct wsa_sim *sim, uint8_t *buf, uint8_t type, uint8_t trailer,
+                                     uint8_t counter, uint32_t stream_id, uint32_t words )
+{
+    uint32_t sec = sim->epoch + (uint32_t)(sim->sample_clock / WSA_SIM_SAMPLE_RATE);
+    uint64_t psec = (sim->sample_clock % WSA_SIM_SAMPLE_RATE) * WSA_SIM_PSEC_PER_SAMPLE;
+    int i;
+
+    buf[0] = (uint8_t)((type << 4) | (trailer ? 0x04 : 0x00));
+    buf[1] = (uint8_t)(0x40 | 0x20 | (sim->counters[counter] & 0x0f));		// UTC seconds, real-time picoseconds
+    buf[2] = (uint8_t)(words >> 8);
+    buf[3] = (uint8_t)words;
+    buf[4] = (uint8_t)(stream_id >> 24);
+    buf[5] = (uint8_t)(stream_id >> 16);
+    buf[6] = (uint8_t)(stream_id >> 8);
+    buf[7] = (uint8_t)stream_id;
+    buf[8] = (uint8_t)(sec >> 24);
+    buf[9] = (uint8_t)(sec >> 16);
+    buf[10] = (uint8_t)(sec >> 8);
+    buf[11] = (uint8_t)sec;
+    for (i = 0; i < 8; i++) {
+        buf[12 + i] = (uint8_t)(psec >> (56 - 8 * i));
+    }
+    sim->counters[counter]++;
+
+    return 20;
+}
+
+
+///
+/// Write a 32-bit big-endian word.
+///
+static void wsa_sim_put_u32( uint8_t *buf, uint32_t value )
+{
+    buf[0] = (uint8_t)(value >> 24);
+    buf[1] = (uint8_t)(value >> 16);
+    buf[2] = (uint8_t)(value >> 8);
+    buf[3] = (uint8_t)value;
+}
+
+
+///
+/// Write a 64-bit big-endian fixed point value with 20 fractional bits, as used for frequencies.
+///
+static void wsa_sim_put_freq( uint8_t *buf, uint64_t hz )
+{
+    uint64_t fixed = hz << 20;
+
+    wsa_sim_put_u32(buf, (uint32_t)(fixed >> 32));
+    wsa_sim_put_u32(buf + 4, (uint32_t)fixed);
+}
+
+
+///
+/// Build a context packet: extension (start id), receiver (frequency) or digitizer (bandwidth and reference level).
+///
+/// @returns Size of the packet in bytes.
+///
+static int32_t wsa_sim_context_packet( struct wsa_sim *sim, uint8_t which, uint8_t *buf )
+{
+    int32_t pos;
+
+    if (which == WSA_SIM_PENDING_EXTENSION) {
+        pos = wsa_sim_put_prologue(sim, buf, EXTENSION_PACKET_TYPE, 0, WSA_SIM_COUNTER_EXTENSION, EXTENSION_STREAM_ID, 7);
+        wsa_sim_put_u32(buf + pos, sim->start_id_mask);
+        wsa_sim_put_u32(buf + pos + 4, sim->start_id);
+        return pos + 8;
+    }
+
+    if (which == WSA_SIM_PENDING_RECEIVER) {
+        pos = wsa_sim_put_prologue(sim, buf, CONTEXT_PACKET_TYPE, 0, WSA_SIM_COUNTER_RECEIVER, RECEIVER_STREAM_ID, 8);
+        wsa_sim_put_u32(buf + pos, FREQ_INDICATOR_MASK);
+        wsa_sim_put_freq(buf + pos + 4, sim->freq);
+        return pos + 12;
+    }
+
+    pos = wsa_sim_put_prologue(sim, buf, CONTEXT_PACKET_TYPE, 0, WSA_SIM_COUNTER_DIGITIZER, DIGITIZER_STREAM_ID, 11);
+    wsa_sim_put_u32(buf + pos, BW_INDICATOR_MASK | RF_FREQ_OFFSET_INDICATOR_MASK | REF_LEVEL_INDICATOR_MASK);
+    wsa_sim_put_freq(buf + pos + 4, WSA_SIM_SAMPLE_RATE / 2);
+    wsa_sim_put_freq(buf + pos + 12, 0);
+    wsa_sim_put_u32(buf + pos + 20, (uint32_t)(uint16_t)(int16_t)(sim->cfg.reference_level * 128));
+
+    return pos + 24;
+}
+
+
+///
+/// Build one IF data packet for the current step.
+///
+/// SH-type modes give real samples with the tone placed around the 35 MHz IF, DD gives real
+/// samples of the RF input itself, and ZIF/IQIN give complex baseband samples.
+///
+/// @returns Size of the packet in bytes, or -1 if the buffer is too small.
+///
+static int32_t wsa_sim_if_packet( struct wsa_sim *sim, uint8_t *buf, int32_t buf_size )
+{
+    struct wsa_sim_entry const *step = sim->step;
+    uint8_t const complex_data = (strcmp(step->mode, "ZIF") == 0 || strcmp(step->mode, "IQIN") == 0);
+    uint8_t const wide_data = (strcmp(step->mode, "HDR") == 0);
+    uint8_t const real_if = !complex_data && strcmp(step->mode, "DD") != 0;
+    uint8_t inverted = 0;
+    uint8_t over_range = 0;
+    uint8_t sample_loss = 0;
+    uint32_t const spp = step->spp;
+    uint32_t payload_words = (complex_data || wide_data) ? spp : spp / 2;
+    uint32_t words = VRT_HEADER_SIZE + payload_words + VRT_TRAILER_SIZE;
+    uint32_t stream_id = complex_data ? I16Q16_DATA_STREAM_ID : (wide_data ? I32_DATA_STREAM_ID : I16_DATA_STREAM_ID);
+    uint32_t trailer;
+    uint32_t noise_pos;
+    uint32_t i;
+    double offset, fif, amp, rot_re, rot_im, tmp, mag;
+    double noise_scale;
+    int32_t v;
+    int32_t pos;
+    uint8_t *p;
+
+    if ((int32_t)(words * BYTES_PER_VRT_WORD) > buf_size) {
+        return -1;
+    }
+
+    if (real_if) {
+        inverted = (sim->cfg.inversion == WSA_SIM_INVERSION_ON) ||
+                   (sim->cfg.inversion == WSA_SIM_INVERSION_ALTERNATE && (sim->step_count & 1) == 0);
+    }
+
+    // Work out where the tone lands in the sampled band; leave it out if it's not in the band.
+    offset = (double)sim->cfg.tone_freq - (double)sim->freq;
+    if (complex_data) {
+        fif = offset;
+    } else if (real_if) {
+        fif = inverted ? WSA_SIM_IF_CENTER - offset : WSA_SIM_IF_CENTER + offset;
+    } else {
+        fif = (double)sim->cfg.tone_freq;
+    }
+    amp = WSA_SIM_FULL_SCALE * pow(10.0, (sim->cfg.tone_level - sim->cfg.reference_level) / 20.0);
+    if (fabs(fif) >= WSA_SIM_SAMPLE_RATE / 2 || (!complex_data && fif <= 0)) {
+        amp = 0;
+    }
+    rot_re = cos(2.0 * M_PI * fif / WSA_SIM_SAMPLE_RATE);
+    rot_im = sin(2.0 * M_PI * fif / WSA_SIM_SAMPLE_RATE);
+
+    // Renormalize the oscillator once per packet so rounding can't make it grow or decay.
+    mag = sqrt(sim->osc_re * sim->osc_re + sim->osc_im * sim->osc_im);
+    sim->osc_re /= mag;
+    sim->osc_im /= mag;
+
+    noise_scale = WSA_SIM_FULL_SCALE * pow(10.0, (sim->cfg.noise_level - sim->cfg.reference_level) / 20.0) / WSA_SIM_NOISE_SIGMA;
+    noise_pos = wsa_sim_rand(sim);
+
+    pos = wsa_sim_put_prologue(sim, buf, IF_PACKET_TYPE, 1, WSA_SIM_COUNTER_IF, stream_id, words);
+    p = buf + pos;
+
+    for (i = 0; i < spp; i++) {
+        v = (int32_t)(amp * sim->osc_re + noise_scale * sim->noise[(noise_pos + i) & (WSA_SIM_NOISE_LEN - 1)]);
+        if (v > 8191 || v < -8192) {
+            over_range = 1;
+            v = (v > 0) ? 8191 : -8192;
+        }
+
+        if (wide_data) {
+            wsa_sim_put_u32(p, (uint32_t)v);
+            p += 4;
+        } else {
+            *p++ = (uint8_t)(v >> 8);
+            *p++ = (uint8_t)v;
+        }
+
+        if (complex_data) {
+            v = (int32_t)(amp * sim->osc_im + noise_scale * sim->noise[(noise_pos + i + 7919) & (WSA_SIM_NOISE_LEN - 1)]);
+            v = (v > 8191) ? 8191 : ((v < -8192) ? -8192 : v);
+            *p++ = (uint8_t)(v >> 8);
+            *p++ = (uint8_t)v;
+        }
+
+        tmp = sim->osc_re * rot_re - sim->osc_im * rot_im;
+        sim->osc_im = sim->osc_im * rot_re + sim->osc_re * rot_im;
+        sim->osc_re = tmp;
+    }
+    sim->sample_clock += spp;
+
+    if (sim->cfg.sample_loss_rate > 0 && wsa_sim_uniform(sim) < sim->cfg.sample_loss_rate) {
+        sample_loss = 1;
+    }
+
+    // Trailer: valid data, reference lock, spectral inversion, over range and sample loss, all enabled.
+    trailer = (1U << 30) | (1U << 29) | (1U << 26) | (1U << 25) | (1U << 24) | (1U << 18) | (1U << 17);
+    trailer |= ((uint32_t)inverted << 14) | ((uint32_t)over_range << 13) | ((uint32_t)sample_loss << 12);
+    wsa_sim_put_u32(p, trailer);
+
+    return (int32_t)(words * BYTES_PER_VRT_WORD);
+}
+
+
+/// @}
+///
+/// \name Public Functions
+///
+/// @{
+
+///
+/// Fill in a simulator configuration with defaults.
+///
+/// The defaults describe an R5500-418 sending 1024 samples per packet, with a -30 dBm tone at
+/// 2.45 GHz over a -70 dBm noise floor, no spectral inversion, no loss and no retune time.
+///
+/// @param[out] cfg The configuration to fill in.
+///
+void wsa_sim_config_defaults( struct wsa_sim_config *cfg )
+{
+    memset(cfg, 0, sizeof(*cfg));
+    strcpy(cfg->idn, "ThinkRF,R5500-418 Simulated,SIM000001,1.0.0");
+    cfg->spp = 1024;
+    cfg->reference_level = 0;
+    cfg->tone_freq = 2450000000ULL;
+    cfg->tone_level = -30.0f;
+    cfg->noise_level = -70.0f;
+    cfg->inversion = WSA_SIM_INVERSION_OFF;
+    cfg->seed = 1;
+}
+
+
+///
+/// Create a simulated device.
+///
+/// @param[in] cfg The configuration, copied into the simulator.
+///
+/// @returns The simulator, or NULL if memory could not be allocated.
+///
+struct wsa_sim *wsa_sim_new( struct wsa_sim_config const *cfg )
+{
+    struct wsa_sim *sim;
+    double u1, u2;
+    uint32_t i;
+
+    sim = (struct wsa_sim *)calloc(1, sizeof(struct wsa_sim));
+    if (sim == NULL) {
+        return NULL;
+    }
+    sim->entries = (struct wsa_sim_entry *)malloc(sizeof(struct wsa_sim_entry) * WSA_SIM_MAX_ENTRIES);
+    sim->noise = (int16_t *)malloc(sizeof(int16_t) * WSA_SIM_NOISE_LEN);
+    if (sim->entries == NULL || sim->noise == NULL) {
+        wsa_sim_free(sim);
+        return NULL;
+    }
+
+    sim->cfg = *cfg;
+    sim->rng = cfg->seed ? cfg->seed : 1;
+    sim->epoch = 1500000000;
+    sim->osc_re = 1.0;
+    sim->osc_im = 0.0;
+
+    // Gaussian noise from the Box-Muller transform.
+    for (i = 0; i < WSA_SIM_NOISE_LEN; i++) {
+        u1 = (wsa_sim_rand(sim) + 1.0) / 4294967297.0;
+        u2 = wsa_sim_uniform(sim);
+        sim->noise[i] = (int16_t)(WSA_SIM_NOISE_SIGMA * sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2));
+    }
+
+    wsa_sim_reset(sim);
+
+    return sim;
+}
+
+
+///
+/// Free a simulated device.
+///
+/// @param[in] sim The simulator, may be NULL.
+///
+void wsa_sim_free( struct wsa_sim *sim )
+{
+    if (sim) {
+        free(sim->entries);
+        free(sim->noise);
+        free(sim);
+    }
+}
+
+
+///
+/// Handle one line received on the control port.
+///
+/// Set commands update the simulator's state and produce no reply; errors are queued for
+/// SYST:ERR? as on a real device. Queries produce a reply terminated by a newline.
+/// Commands the engine does not model are remembered, so that querying them returns the last value set.
+///
+/// @param[in,out] sim The simulator.
+/// @param[in] line The command, with or without the trailing newline.
+/// @param[out] reply Buffer for the reply; must hold at least 256 bytes.
+/// @param[in] reply_size Size of the reply buffer.
+///
+/// @returns Length of the reply in bytes, or 0 if there is none.
+///
+int32_t wsa_sim_command( struct wsa_sim *sim, char const *line, char *reply, int32_t reply_size )
+{
+    char key[128];
+    char args[256];
+    size_t hlen;
+    size_t alen;
+    uint8_t query = 0;
+    char const *p;
+    int32_t len;
+
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    hlen = strcspn(line, " \t\r\n");
+    if (hlen == 0) {
+        return 0;
+    }
+
+    p = line + hlen;
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    alen = strcspn(p, "\r\n");
+    while (alen > 0 && (p[alen - 1] == ' ' || p[alen - 1] == '\t')) {
+        alen--;
+    }
+    if (alen >= sizeof(args)) {
+        alen = sizeof(args) - 1;
+    }
+    memcpy(args, p, alen);
+    args[alen] = '\0';
+
+    if (line[hlen - 1] == '?') {
+        query = 1;
+        hlen--;
+    }
+    wsa_sim_canonical_header(line, hlen, key, sizeof(key));
+
+    // Common commands and the system subsystem.
+    if (strcmp(key, "*IDN") == 0) {
+        return sprintf(reply, "%s\n", sim->cfg.idn);
+    } else if (strcmp(key, "*STB") == 0) {
+        return sprintf(reply, "%d\n", sim->error_count ? SCPI_SBR_EVTAVL : 0);
+    } else if (strcmp(key, "*ESR") == 0) {
+        return sprintf(reply, "0\n");
+    } else if (strcmp(key, "*RST") == 0) {
+        wsa_sim_reset(sim);
+    } else if (strcmp(key, "*CLS") == 0) {
+        sim->error_count = 0;
+    } else if (strcmp(key, "SYST:ERR") == 0) {
+        if (sim->error_count == 0) {
+            return sprintf(reply, "0,\"No error\"\n");
+        }
+        len = sprintf(reply, "%s\n", sim->errors[0]);
+        sim->error_count--;
+        memmove(sim->errors[0], sim->errors[1], sim->error_count * sizeof(sim->errors[0]));
+        return len;
+    } else if (strcmp(key, "SYST:CAPT:MODE") == 0) {
+        return sprintf(reply, "%s\n", (sim->capture == WSA_SIM_CAPTURE_SWEEP) ? WSA_SWEEP_CAPTURE_MODE :
+                       ((sim->capture == WSA_SIM_CAPTURE_STREAM) ? WSA_STREAM_CAPTURE_MODE : WSA_BLOCK_CAPTURE_MODE));
+    } else if (strcmp(key, "SYST:LOCK:REQ") == 0 || strcmp(key, "SYST:LOCK:HAVE") == 0 ||
+               strcmp(key, "LOCK:REF") == 0 || strcmp(key, "LOCK:RF") == 0) {
+        return sprintf(reply, "1\n");
+    } else if (strcmp(key, "SYST:ABOR") == 0) {
+        wsa_sim_stop(sim);
+    } else if (strcmp(key, "SYST:FLUS") == 0) {
+        // Nothing is buffered inside the engine.
+    }
+
+    // Manual capture settings.
+    else if (strcmp(key, "FREQ:CENT") == 0) {
+        if (query) {
+            return sprintf(reply, "%llu\n", sim->manual.fstart);
+        }
+        p = args;
+        if (wsa_sim_parse_freq(&p, &sim->manual.fstart) < 0) {
+            wsa_sim_push_error(sim, "-222,\"Data out of range\"");
+        }
+    } else if (strcmp(key, "INP:MODE") == 0) {
+        if (query) {
+            return sprintf(reply, "%s\n", sim->manual.mode);
+        }
+        wsa_sim_parse_mode(sim, args, sim->manual.mode);
+    } else if (strcmp(key, "TRAC:SPP") == 0) {
+        if (query) {
+            return sprintf(reply, "%u\n", sim->manual.spp);
+        }
+        wsa_sim_parse_spp(sim, args, &sim->manual.spp);
+    } else if (strcmp(key, "TRAC:BLOC:PACK") == 0) {
+        if (query) {
+            return sprintf(reply, "%u\n", sim->manual.ppb);
+        }
+        sim->manual.ppb = (uint32_t)strtoul(args, NULL, 10);
+        if (sim->manual.ppb < WSA_MIN_PPB) {
+            sim->manual.ppb = WSA_MIN_PPB;
+            wsa_sim_push_error(sim, "-222,\"Data out of range\"");
+        }
+    } else if (strcmp(key, "SENS:FREQ:INV") == 0) {
+        return sprintf(reply, "%d\n", sim->cfg.inversion == WSA_SIM_INVERSION_ON);
+    }
+
+    // Captures.
+    else if (strcmp(key, "TRAC:BLOC:DATA") == 0) {
+        if (sim->capture != WSA_SIM_CAPTURE_BLOCK) {
+            wsa_sim_push_error(sim, "-200,\"Execution error\"");
+        } else {
+            wsa_sim_start(sim, WSA_SIM_CAPTURE_BLOCK, "");
+        }
+    } else if (strcmp(key, "TRAC:STR:STAR") == 0) {
+        if (sim->capture != WSA_SIM_CAPTURE_BLOCK) {
+            wsa_sim_push_error(sim, "-200,\"Execution error\"");
+        } else {
+            wsa_sim_start(sim, WSA_SIM_CAPTURE_STREAM, args);
+        }
+    } else if (strcmp(key, "TRAC:STR:STOP") == 0) {
+        if (sim->capture == WSA_SIM_CAPTURE_STREAM) {
+            wsa_sim_stop(sim);
+        }
+    }
+
+    else {
+        len = wsa_sim_sweep_command(sim, key, query, args, reply, reply_size);
+        if (len >= 0) {
+            return len;
+        }
+
+        // Everything else just remembers its value.
+        if (query) {
+            return sprintf(reply, "%s\n", wsa_sim_find_setting(sim, key));
+        }
+        wsa_sim_store_setting(sim, key, args);
+    }
+
+    return 0;
+}
+
+
+///
+/// Check whether a capture is producing packets.
+///
+/// @param[in] sim The simulator.
+///
+/// @returns 1 if wsa_sim_next_packet() has a packet to give, otherwise 0.
+///
+uint8_t wsa_sim_data_pending( struct wsa_sim const *sim )
+{
+    return sim->running;
+}
+
+
+///
+/// Produce the next packet for the data port.
+///
+/// Each tuning step sends a receiver and a digitizer context packet followed by its IF packets.
+/// A start id, if one was given, goes out first in an extension packet. Dropped packets are
+/// skipped over, leaving a gap in the IF packet count.
+///
+/// @param[in,out] sim The simulator.
+/// @param[out] buf Buffer for the packet, at least WSA_SIM_MAX_PACKET_BYTES long.
+/// @param[in] buf_size Size of the buffer in bytes.
+/// @param[out] delay_us Time the device would take before sending this packet, in microseconds.
+///
+/// @returns Size of the packet in bytes, 0 if no capture is running, or -1 if the buffer is too small.
+///
+int32_t wsa_sim_next_packet( struct wsa_sim *sim, uint8_t *buf, int32_t buf_size, uint32_t *delay_us )
+{
+    uint8_t which;
+    int32_t len;
+
+    *delay_us = 0;
+
+    while (sim->running) {
+
+        *delay_us += sim->pending_delay;
+        sim->pending_delay = 0;
+
+        if (sim->pending) {
+            which = (sim->pending & WSA_SIM_PENDING_EXTENSION) ? WSA_SIM_PENDING_EXTENSION :
+                    ((sim->pending & WSA_SIM_PENDING_RECEIVER) ? WSA_SIM_PENDING_RECEIVER : WSA_SIM_PENDING_DIGITIZER);
+            sim->pending &= (uint8_t)~which;
+            return wsa_sim_context_packet(sim, which, buf);
+        }
+
+        if (sim->packets_left > 0 || sim->capture == WSA_SIM_CAPTURE_STREAM) {
+            len = wsa_sim_if_packet(sim, buf, buf_size);
+            if (len < 0) {
+                return len;
+            }
+            if (sim->packets_left > 0) {
+                sim->packets_left--;
+            }
+            if (sim->cfg.drop_rate > 0 && wsa_sim_uniform(sim) < sim->cfg.drop_rate) {
+                continue;
+            }
+            return len;
+        }
+
+        // The step is done; a sweep moves on, a block capture is finished.
+        if (sim->capture != WSA_SIM_CAPTURE_SWEEP || !wsa_sim_next_sweep_step(sim)) {
+            wsa_sim_stop(sim);
+        }
+    }
+
+    return 0;
+}
+
+/// @}
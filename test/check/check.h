@@ -0,0 +1,87 @@
+///
+/// @file
+/// What the check programs share: reporting each check, the input generator, the usage prologue,
+/// the bad-argument checks and opening a simulator. Linked into every wsacheck_<name> from check_util.c.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#ifndef __CHECK_H__
+#define __CHECK_H__
+
+#include <stddef.h>
+
+#include "thinkrf_stdint.h"
+
+struct wsa_device;
+
+/// Set once any check has failed; what a check program returns from main.
+extern int check_failed;
+
+
+///
+/// Report a check, failing the run if it did not hold.
+///
+/// @param[in] what What was checked.
+/// @param[in] detail Why it did not hold, or "" if it did.
+///
+void check_report( char const *what, char const *detail );
+
+
+///
+/// Small deterministic generator, so every run sees the same input.
+///
+/// @param[in,out] state The generator's state; seed it with any value.
+///
+/// @return The next 24-bit number.
+///
+uint32_t check_rand( uint32_t *state );
+
+
+///
+/// Print the usage of a check program given an argument, as the start of main does with
+/// `if (argc > 1) return check_usage(argv[0], argv[1], NULL);`.
+///
+/// @param[in] prog The program, argv[0].
+/// @param[in] arg The argument it was given.
+/// @param[in] options Lines describing its options, or NULL if it takes none.
+///
+/// @return What main returns: 0 for --help, 1 for anything else.
+///
+int check_usage( char const *prog, char const *arg, char const *options );
+
+
+///
+/// Check that a call given a bad argument turned it away with WSA_ERR_INVINPUT. Chained with &&,
+/// so the calls after the first that fails are not made.
+///
+/// @param[in] result What the call returned.
+/// @param[in] taken What went wrong if it did not, i.e. "width 0 taken".
+/// @param[out] detail Set to \p taken if the call did not turn the argument away.
+/// @param[in] size Size of \p detail.
+///
+/// @return 1 if the argument was turned away, otherwise 0.
+///
+uint8_t check_refused( int16_t result, char const *taken, char *detail, size_t size );
+
+
+///
+/// Check that a call given good arguments among the bad ones succeeded, as check_refused() does.
+///
+/// @return 1 if the call succeeded, otherwise 0.
+///
+uint8_t check_accepted( int16_t result, char const *refused, char *detail, size_t size );
+
+
+///
+/// Open a simulator listening on loopback, saying why on stderr if it cannot be.
+///
+/// @param[out] dev The device to open.
+/// @param[in] ctrl_port The simulator's control port.
+/// @param[in] data_port The simulator's data port.
+///
+/// @return 0 on success, otherwise the library's error code.
+///
+int16_t check_open( struct wsa_device *dev, int ctrl_port, int data_port );
+
+#endif
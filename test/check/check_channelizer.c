@@ -0,0 +1,339 @@
+///
+/// @file
+/// wsacheck_channelizer: checks the polyphase channelizer (see wsa_channelizer.h) against direct
+/// down-conversion, and how far a channel keeps out its neighbours.
+///
+/// \li match: every output of every channel is worked out again in double, straight from the
+///     definition, mixing the input down to the channel, filtering it with the prototype and taking
+///     every M-th sample, and must agree to CHECK_MATCH. This is run for channel counts that are and
+///     are not a multiple of four, with and without workers, with the default and a given
+///     prototype, and with the input pushed in pieces of odd sizes.
+/// \li leakage: a tone at the centre of a channel must come out at 0 dB there, and at least
+///     CHECK_REJECTION dB down in the channels either side.
+///
+/// Built and run by `make check`. Prints one line per check and exits non-zero if any fails.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_error.h"
+#include "wsa_channelizer.h"
+#include "check.h"
+
+#define CHECK_OUTPUTS 300				///< Outputs per channel checked, more than a batch
+#define CHECK_MATCH 1e-6				///< Allowed difference from the direct outputs, at full scale
+#define CHECK_REJECTION 90.0			///< dB a centred tone must be down in the neighbouring channels
+#define CHECK_GAIN_DB 0.01				///< Allowed gain of a centred tone in its channel, in dB
+#define CHECK_MAX_CHANNELS 64
+
+
+///
+/// The channelizer's default prototype, or the given one, scaled to unity gain at 0 Hz.
+///
+static void check_prototype( float const *given, uint32_t m, uint32_t taps, double *h )
+{
+    uint32_t length = m * taps;
+    uint32_t i;
+    double sum = 0;
+    double t;
+
+    for (i = 0; i < length; i++) {
+        if (given) {
+            h[i] = given[i];
+        } else {
+            t = ((double)i - (length - 1) / 2.0) / m;
+            h[i] = (t == 0) ? 1.0 : sin(M_PI * t) / (M_PI * t);
+            h[i] *= 0.42 - 0.5 * cos(2 * M_PI * i / (length - 1)) + 0.08 * cos(4 * M_PI * i / (length - 1));
+        }
+        sum += h[i];
+    }
+    for (i = 0; i < length; i++) {
+        h[i] = (float)(h[i] / sum);
+    }
+}
+
+
+///
+/// Push input through a channelizer in pieces of the sizes given, in turn, and read every
+/// channel's outputs. \p out_i and \p out_q receive channel k's output n at [k * outputs + n].
+///
+static int16_t check_run( struct wsa_channelizer_config const *config, float const *idata, float const *qdata,
+                          uint32_t samples, int32_t const *pieces, size_t npieces, float *out_i, float *out_q,
+                          uint32_t outputs )
+{
+    struct wsa_channelizer *ch;
+    uint64_t position[CHECK_MAX_CHANNELS];
+    uint32_t done;
+    uint32_t piece;
+    uint32_t k;
+    size_t p;
+    int16_t result;
+
+    result = wsa_channelizer_alloc(config, &ch);
+    if (result < 0) {
+        return result;
+    }
+    memset(position, 0, sizeof(position));
+
+    for (done = 0, p = 0; done < samples && result >= 0; done += piece, p++) {
+        piece = (uint32_t)pieces[p % npieces];
+        piece = (piece < samples - done) ? piece : samples - done;
+        result = wsa_channelizer_push(ch, idata + done, qdata ? qdata + done : NULL, (int32_t)piece);
+
+        // Read as the outputs come, as they would be, so the rings may be small.
+        for (k = 0; k < config->channels; k++) {
+            if (position[k] < outputs) {
+                wsa_channelizer_read(ch, k, &position[k], out_i + (size_t)k * outputs + position[k],
+                                     out_q + (size_t)k * outputs + position[k], outputs - (uint32_t)position[k]);
+            }
+        }
+    }
+    for (k = 0; k < config->channels && result >= 0; k++) {
+        if (position[k] != outputs) {
+            result = WSA_ERR_INVINPUT;
+        }
+    }
+
+    wsa_channelizer_free(ch);
+
+    return result;
+}
+
+
+///
+/// Compare a channelizer with the direct mix, filter and decimate, output by output:
+///
+///     y_k[n] = sum_i h[i] x[n M + M - 1 - i] e^(-j 2 pi k (n M + M - 1 - i) / M)
+///
+/// with the input zero before its first sample.
+///
+static int16_t check_match( char const *what, uint32_t m, uint32_t taps, uint32_t workers, uint8_t given,
+                            uint8_t complex, int32_t const *pieces, size_t npieces )
+{
+    struct wsa_channelizer_config config;
+    uint32_t const length = m * taps;
+    uint32_t const samples = CHECK_OUTPUTS * m;
+    float *idata, *qdata, *out_i, *out_q, *prototype;
+    double *h;
+    double yi, yq, c, s;
+    double err, worst = 0;
+    uint32_t state = 0x5eed;
+    uint32_t worst_k = 0, worst_n = 0;
+    uint32_t k, n, i;
+    int64_t x;
+    char detail[128];
+    int16_t result;
+
+    idata = malloc(sizeof(float) * samples);
+    qdata = malloc(sizeof(float) * samples);
+    out_i = malloc(sizeof(float) * m * CHECK_OUTPUTS);
+    out_q = malloc(sizeof(float) * m * CHECK_OUTPUTS);
+    prototype = malloc(sizeof(float) * length);
+    h = malloc(sizeof(double) * length);
+    if (!idata || !qdata || !out_i || !out_q || !prototype || !h) {
+        result = WSA_ERR_MALLOCFAILED;
+        goto done;
+    }
+
+    // Full-scale noise, so every channel has something in it.
+    for (i = 0; i < samples; i++) {
+        idata[i] = (float)(check_rand(&state) & 0xffff) / 32768.0f - 1.0f;
+        qdata[i] = complex ? (float)(check_rand(&state) & 0xffff) / 32768.0f - 1.0f : 0.0f;
+    }
+    // A given prototype: a plain raised cosine, unscaled, so the scaling is checked too.
+    for (i = 0; i < length; i++) {
+        prototype[i] = (float)(3.0 * (1.0 - cos(2 * M_PI * (i + 1) / (length + 1))));
+    }
+
+    memset(&config, 0, sizeof(config));
+    config.channels = m;
+    config.taps_per_channel = taps;
+    config.prototype = given ? prototype : NULL;
+    config.workers = workers;
+    config.ring = 0;
+    result = check_run(&config, idata, complex ? qdata : NULL, samples, pieces, npieces, out_i, out_q,
+                       CHECK_OUTPUTS);
+    if (result < 0) {
+        goto done;
+    }
+
+    check_prototype(given ? prototype : NULL, m, taps, h);
+    for (k = 0; k < m; k++) {
+        for (n = 0; n < CHECK_OUTPUTS; n++) {
+            yi = 0;
+            yq = 0;
+            for (i = 0; i < length; i++) {
+                x = (int64_t)n * m + m - 1 - i;
+                if (x < 0) {
+                    break;
+                }
+                c = cos(2 * M_PI * (double)((k * (uint64_t)x) % m) / m);
+                s = -sin(2 * M_PI * (double)((k * (uint64_t)x) % m) / m);
+                yi += h[i] * (idata[x] * c - qdata[x] * s);
+                yq += h[i] * (idata[x] * s + qdata[x] * c);
+            }
+            err = sqrt((out_i[(size_t)k * CHECK_OUTPUTS + n] - yi) * (out_i[(size_t)k * CHECK_OUTPUTS + n] - yi) +
+                       (out_q[(size_t)k * CHECK_OUTPUTS + n] - yq) * (out_q[(size_t)k * CHECK_OUTPUTS + n] - yq));
+            if (err > worst) {
+                worst = err;
+                worst_k = k;
+                worst_n = n;
+            }
+        }
+    }
+
+    if (worst > CHECK_MATCH) {
+        snprintf(detail, sizeof(detail), "channel %u output %u is %.2g off the direct output", (unsigned)worst_k,
+                 (unsigned)worst_n, worst);
+        check_report(what, detail);
+    } else {
+        printf("ok   %s, %u channels: at most %.2g off\n", what, (unsigned)m, worst);
+    }
+
+done:
+    free(idata);
+    free(qdata);
+    free(out_i);
+    free(out_q);
+    free(prototype);
+    free(h);
+
+    return result;
+}
+
+
+///
+/// Put a tone at the centre of a channel, and measure it there and in every other channel, once
+/// the filter has filled.
+///
+static int16_t check_leakage( uint32_t m, uint32_t channel )
+{
+    struct wsa_channelizer_config config;
+    int32_t const pieces[] = { 4096 };
+    uint32_t const samples = CHECK_OUTPUTS * m;
+    float *idata, *qdata, *out_i, *out_q;
+    double power[CHECK_MAX_CHANNELS];
+    double phase;
+    double worst = 0;
+    double db;
+    uint32_t k, n, i;
+    char what[64];
+    char detail[128];
+    int16_t result;
+
+    idata = malloc(sizeof(float) * samples);
+    qdata = malloc(sizeof(float) * samples);
+    out_i = malloc(sizeof(float) * m * CHECK_OUTPUTS);
+    out_q = malloc(sizeof(float) * m * CHECK_OUTPUTS);
+    if (!idata || !qdata || !out_i || !out_q) {
+        result = WSA_ERR_MALLOCFAILED;
+        goto done;
+    }
+
+    for (i = 0; i < samples; i++) {
+        phase = 2 * M_PI * (double)(((uint64_t)channel * i) % m) / m;
+        idata[i] = (float)cos(phase);
+        qdata[i] = (float)sin(phase);
+    }
+
+    memset(&config, 0, sizeof(config));
+    config.channels = m;
+    result = check_run(&config, idata, qdata, samples, pieces, 1, out_i, out_q, CHECK_OUTPUTS);
+    if (result < 0) {
+        goto done;
+    }
+
+    for (k = 0; k < m; k++) {
+        power[k] = 0;
+        for (n = WSA_CHANNELIZER_TAPS; n < CHECK_OUTPUTS; n++) {
+            power[k] += (double)out_i[(size_t)k * CHECK_OUTPUTS + n] * out_i[(size_t)k * CHECK_OUTPUTS + n] +
+                        (double)out_q[(size_t)k * CHECK_OUTPUTS + n] * out_q[(size_t)k * CHECK_OUTPUTS + n];
+        }
+        power[k] /= CHECK_OUTPUTS - WSA_CHANNELIZER_TAPS;
+        if (k != channel && power[k] > worst) {
+            worst = power[k];
+        }
+    }
+
+    snprintf(what, sizeof(what), "tone in channel %u of %u", (unsigned)channel, (unsigned)m);
+    detail[0] = '\0';
+    db = 10 * log10(power[channel]);
+    if (fabs(db) > CHECK_GAIN_DB) {
+        snprintf(detail, sizeof(detail), "%.3f dB in its channel", db);
+    }
+    for (i = 1; i < m && !detail[0]; i += m - 2) {
+        k = (channel + i) % m;
+        db = 10 * log10(power[channel] / (power[k] > 0 ? power[k] : 1e-300));
+        if (db < CHECK_REJECTION) {
+            snprintf(detail, sizeof(detail), "only %.1f dB down in channel %u", db, (unsigned)k);
+        }
+    }
+    if (detail[0]) {
+        check_report(what, detail);
+    } else {
+        printf("ok   %s: neighbours %.1f and %.1f dB down, any other channel %.1f dB\n", what,
+               10 * log10(power[channel] / power[(channel + 1) % m]),
+               10 * log10(power[channel] / power[(channel + m - 1) % m]), 10 * log10(power[channel] / worst));
+    }
+
+done:
+    free(idata);
+    free(qdata);
+    free(out_i);
+    free(out_q);
+
+    return result;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    int32_t const packets[] = { 4096 };
+    int32_t const odd[] = { 1000, 1, 3333, 17, 0, 70000 };
+    int16_t result;
+
+    if (argc > 1) {
+        return check_usage(argv[0], argv[1], NULL);
+    }
+
+    result = check_match("match, default prototype", 16, WSA_CHANNELIZER_TAPS, 0, 0, 1, packets, 1);
+    if (result >= 0) {
+        result = check_match("match, pieces of odd sizes", 16, WSA_CHANNELIZER_TAPS, 0, 0, 1, odd, 6);
+    }
+    if (result >= 0) {
+        result = check_match("match, 3 workers", 64, WSA_CHANNELIZER_TAPS, 3, 0, 1, odd, 6);
+    }
+    if (result >= 0) {
+        result = check_match("match, not a multiple of four", 10, 12, 0, 0, 1, odd, 6);
+    }
+    if (result >= 0) {
+        result = check_match("match, given prototype", 8, 5, 2, 1, 1, packets, 1);
+    }
+    if (result >= 0) {
+        result = check_match("match, real data", 16, WSA_CHANNELIZER_TAPS, 0, 0, 0, packets, 1);
+    }
+    if (result >= 0) {
+        result = check_leakage(16, 3);
+    }
+    if (result >= 0) {
+        result = check_leakage(16, 0);
+    }
+    if (result >= 0) {
+        result = check_leakage(64, 40);
+    }
+
+    if (result < 0) {
+        fprintf(stderr, "channelizer failed: %s\n", wsa_get_error_msg(result));
+        check_failed = 1;
+    }
+
+    return check_failed;
+}
@@ -0,0 +1,549 @@
+///
+/// @file
+/// wsacheck_continuous: checks continuous sweep mode against wsasim.
+///
+/// wsasim is started on loopback, the sweep device is put in continuous mode with a small ring, and
+/// more sweeps are captured than the ring holds:
+/// \li order: each sweep is published under the next sweep number, its timestamps after the last's
+/// \li wrap: every age the ring keeps reads back the sweep it should, across the ring wrapping
+///     round, and an age past what it keeps is turned away
+/// \li reader: a thread reading the latest sweep while sweeps are captured never sees the numbers go
+///     back, or a frame's blocks stamped outside the sweep it was read as
+/// \li damaged: from a second wsasim that drops IF packets, every sweep reported damaged is counted
+///     in ring->damaged, and no read returns it
+/// \li stop: continuous mode sets the device back to one sweep per start when it stops
+///
+/// Damaged sweeps come from --drop; --sample-loss only sets the trailer flag, which a sweep is not
+/// dropped for.
+///
+/// Built and run by `make check`. Prints one line per check and exits non-zero if any fails.
+///
+/// Run with --help for the options.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_error.h"
+#include "wsa_sweep_device.h"
+#include "check.h"
+#include "test_sim.h"
+
+#define CHECK_CTRL_PORT 47601			///< Control port of the simulator started for the run
+#define CHECK_DATA_PORT 47600			///< Data port of the simulator started for the run
+#define CHECK_DROP_CTRL_PORT 47603		///< Control port of the simulator dropping packets
+#define CHECK_DROP_DATA_PORT 47602		///< Data port of the simulator dropping packets
+#define CHECK_FSTART (2400 * MHZ)		///< Start of the span swept
+#define CHECK_FSTOP (2500 * MHZ)		///< Stop of the span swept
+#define CHECK_RBW 100000				///< Resolution bandwidth of the span swept
+#define CHECK_NFRAMES 4					///< Frames in the ring
+#define CHECK_SWEEPS 13					///< Sweeps captured in order, enough to wrap the ring three times
+#define CHECK_READER_SWEEPS 40			///< Sweeps captured while the reader thread runs
+#define CHECK_DROP_SWEEPS 60			///< Sweeps captured from the simulator dropping packets
+
+/// Options for the simulator dropping packets: one IF packet in ten, the same ones every run.
+static char const * const check_drop_sim_args[] = { "--drop", "0.1", "--seed", "7", NULL };
+
+/// The options, as --help lists them.
+static char const check_options[] =
+    "  --sim PATH            simulator to start (default: wsasim next to this program)\n";
+
+/// What the reader thread shares with the capture thread.
+struct check_reader {
+    struct wsa_power_spectrum_config *cfg;
+    uint32_t volatile done;				///< Set by the capture thread once it has captured its sweeps
+    uint32_t reads;						///< Frames read
+    uint32_t bad;						///< Set once a frame read was wrong
+    char detail[160];					///< What was wrong
+};
+
+
+///
+/// Compare two timestamps.
+///
+/// @return Negative, 0 or positive as a is before, at or after b.
+///
+static int check_time_cmp( struct wsa_time const *a, struct wsa_time const *b )
+{
+    if (a->sec != b->sec) {
+        return (a->sec < b->sec) ? -1 : 1;
+    }
+    if (a->psec != b->psec) {
+        return (a->psec < b->psec) ? -1 : 1;
+    }
+    return 0;
+}
+
+
+///
+/// Check that a frame's blocks are all stamped within its sweep.
+///
+/// @return 1 if they are, otherwise 0 with detail filled in.
+///
+static uint8_t check_frame_segments( struct wsa_spectrum_frame_info const *info,
+                                     struct wsa_spectrum_segment const *segments, uint32_t count,
+                                     char *detail, size_t size )
+{
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        if (segments[i].bin_count == 0) {
+            continue;
+        }
+        if (check_time_cmp(&segments[i].timestamp, &info->first_timestamp) < 0 ||
+            check_time_cmp(&segments[i].timestamp, &info->last_timestamp) > 0) {
+            snprintf(detail, size, "sweep %llu block %u stamped %u.%012llu, outside %u.%012llu-%u.%012llu",
+                     (unsigned long long)info->sweep_number, (unsigned)i, (unsigned)segments[i].timestamp.sec,
+                     (unsigned long long)segments[i].timestamp.psec, (unsigned)info->first_timestamp.sec,
+                     (unsigned long long)info->first_timestamp.psec, (unsigned)info->last_timestamp.sec,
+                     (unsigned long long)info->last_timestamp.psec);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+///
+/// Allocate, configure and start continuous mode for the span.
+///
+/// @return 0 on success, otherwise the library's error code.
+///
+static int16_t check_start( struct wsa_sweep_device *sweep_device, struct wsa_power_spectrum_config **cfg )
+{
+    int16_t result;
+
+    result = wsa_power_spectrum_alloc(sweep_device, CHECK_FSTART, CHECK_FSTOP, CHECK_RBW, "SH", cfg);
+    if (result < 0) {
+        return result;
+    }
+
+    result = wsa_configure_sweep(sweep_device, *cfg);
+    if (result >= 0) {
+        result = wsa_sweep_continuous_start(sweep_device, *cfg, CHECK_NFRAMES);
+    }
+    if (result < 0) {
+        wsa_power_spectrum_free(*cfg);
+    }
+
+    return result;
+}
+
+
+///
+/// Check that sweeps are published in order, and that every age reads back the sweep it should as
+/// the ring wraps.
+///
+static int16_t check_order( struct wsa_sweep_device *sweep_device )
+{
+    struct wsa_power_spectrum_config *cfg;
+    struct wsa_spectrum_frame_info info;
+    struct wsa_spectrum_frame_info last;
+    struct wsa_spectrum_segment *segments;
+    float *out;
+    uint32_t n, age;
+    uint8_t order_bad = 0;
+    uint8_t wrap_bad = 0;
+    char what[96];
+    char order_detail[160];
+    char wrap_detail[160];
+    int16_t result;
+
+    result = check_start(sweep_device, &cfg);
+    if (result < 0) {
+        return result;
+    }
+
+    out = malloc(cfg->buflen * sizeof(float));
+    segments = malloc(cfg->segment_count * sizeof(struct wsa_spectrum_segment));
+    if (out == NULL || segments == NULL) {
+        free(out);
+        free(segments);
+        wsa_sweep_continuous_stop(sweep_device, cfg);
+        wsa_power_spectrum_free(cfg);
+        return WSA_ERR_MALLOCFAILED;
+    }
+
+    memset(&last, 0, sizeof(last));
+    for (n = 0; n < CHECK_SWEEPS && result >= 0; n++) {
+        result = wsa_sweep_continuous_capture(sweep_device, cfg);
+        if (result < 0) {
+            break;
+        }
+
+        // The sweep just captured is the latest, numbered in turn, and after the last.
+        result = wsa_sweep_continuous_read(cfg, 0, out, &info, segments);
+        if (result < 0) {
+            break;
+        }
+        if (!order_bad && info.sweep_number != n) {
+            snprintf(order_detail, sizeof(order_detail), "capture %u read back as sweep %llu", (unsigned)n,
+                     (unsigned long long)info.sweep_number);
+            order_bad = 1;
+        } else if (!order_bad && (check_time_cmp(&info.first_timestamp, &info.last_timestamp) > 0 ||
+                   (n > 0 && check_time_cmp(&info.first_timestamp, &last.last_timestamp) <= 0))) {
+            snprintf(order_detail, sizeof(order_detail),
+                     "sweep %u stamped %u.%012llu-%u.%012llu, the one before ended %u.%012llu", (unsigned)n,
+                     (unsigned)info.first_timestamp.sec, (unsigned long long)info.first_timestamp.psec,
+                     (unsigned)info.last_timestamp.sec, (unsigned long long)info.last_timestamp.psec,
+                     (unsigned)last.last_timestamp.sec, (unsigned long long)last.last_timestamp.psec);
+            order_bad = 1;
+        } else if (!order_bad &&
+                   !check_frame_segments(&info, segments, cfg->segment_count, order_detail, sizeof(order_detail))) {
+            order_bad = 1;
+        }
+        last = info;
+
+        // Every age the ring keeps holds the sweep that many before, once there has been one.
+        for (age = 1; age + 2 <= CHECK_NFRAMES && !wrap_bad; age++) {
+            result = wsa_sweep_continuous_read(cfg, age, out, &info, NULL);
+            if (age > n && result != WSA_ERR_SWEEPFRAMEUNAVAILABLE) {
+                snprintf(wrap_detail, sizeof(wrap_detail), "age %u after sweep %u gave %d, not unavailable",
+                         (unsigned)age, (unsigned)n, (int)result);
+                wrap_bad = 1;
+            } else if (age <= n && result < 0) {
+                snprintf(wrap_detail, sizeof(wrap_detail), "age %u after sweep %u: %s", (unsigned)age,
+                         (unsigned)n, wsa_get_error_msg(result));
+                wrap_bad = 1;
+            } else if (age <= n && info.sweep_number != n - age) {
+                snprintf(wrap_detail, sizeof(wrap_detail), "age %u after sweep %u read back sweep %llu",
+                         (unsigned)age, (unsigned)n, (unsigned long long)info.sweep_number);
+                wrap_bad = 1;
+            }
+        }
+        result = 0;
+
+        if (!wrap_bad && wsa_sweep_continuous_read(cfg, CHECK_NFRAMES - 1, out, &info, NULL) != WSA_ERR_INVINPUT) {
+            snprintf(wrap_detail, sizeof(wrap_detail), "age %u of a %u frame ring was not turned away",
+                     (unsigned)(CHECK_NFRAMES - 1), (unsigned)CHECK_NFRAMES);
+            wrap_bad = 1;
+        }
+    }
+
+    if (result >= 0) {
+        snprintf(what, sizeof(what), "order: %u sweeps through %u frames", (unsigned)CHECK_SWEEPS,
+                 (unsigned)CHECK_NFRAMES);
+        check_report(what, order_bad ? order_detail : "");
+        snprintf(what, sizeof(what), "wrap: ages 0-%u as the ring wraps", (unsigned)(CHECK_NFRAMES - 2));
+        check_report(what, wrap_bad ? wrap_detail : "");
+    }
+
+    free(out);
+    free(segments);
+    wsa_sweep_continuous_stop(sweep_device, cfg);
+    wsa_power_spectrum_free(cfg);
+
+    return result;
+}
+
+
+///
+/// Read the latest sweep over and over until the capture thread is done.
+///
+static void *check_reader_main( void *arg )
+{
+    struct check_reader *reader = arg;
+    struct wsa_power_spectrum_config *cfg = reader->cfg;
+    struct wsa_spectrum_frame_info info;
+    struct wsa_spectrum_segment *segments;
+    float *out;
+    uint64_t last = 0;
+    int16_t result;
+
+    out = malloc(cfg->buflen * sizeof(float));
+    segments = malloc(cfg->segment_count * sizeof(struct wsa_spectrum_segment));
+    if (out == NULL || segments == NULL) {
+        snprintf(reader->detail, sizeof(reader->detail), "out of memory");
+        reader->bad = 1;
+    }
+
+    while (!reader->bad && !reader->done) {
+        result = wsa_sweep_continuous_read(cfg, 0, out, &info, segments);
+        if (result == WSA_ERR_SWEEPFRAMEUNAVAILABLE) {
+            continue;
+        }
+        if (result < 0) {
+            snprintf(reader->detail, sizeof(reader->detail), "read %u: %s", (unsigned)reader->reads,
+                     wsa_get_error_msg(result));
+            reader->bad = 1;
+        } else if (reader->reads > 0 && info.sweep_number < last) {
+            snprintf(reader->detail, sizeof(reader->detail), "read sweep %llu after sweep %llu",
+                     (unsigned long long)info.sweep_number, (unsigned long long)last);
+            reader->bad = 1;
+        } else if (!check_frame_segments(&info, segments, cfg->segment_count, reader->detail, sizeof(reader->detail))) {
+            reader->bad = 1;
+        }
+        last = info.sweep_number;
+        reader->reads++;
+    }
+
+    free(out);
+    free(segments);
+
+    return NULL;
+}
+
+
+///
+/// Check a thread reading the ring while sweeps are captured into it.
+///
+static int16_t check_reader( struct wsa_sweep_device *sweep_device )
+{
+    struct wsa_power_spectrum_config *cfg;
+    struct check_reader reader;
+    pthread_t thread;
+    uint32_t n;
+    char what[96];
+    int16_t result;
+
+    result = check_start(sweep_device, &cfg);
+    if (result < 0) {
+        return result;
+    }
+
+    memset(&reader, 0, sizeof(reader));
+    reader.cfg = cfg;
+    if (pthread_create(&thread, NULL, check_reader_main, &reader) != 0) {
+        wsa_sweep_continuous_stop(sweep_device, cfg);
+        wsa_power_spectrum_free(cfg);
+        check_report("reader", "could not start the reader thread");
+        return 0;
+    }
+
+    for (n = 0; n < CHECK_READER_SWEEPS && result >= 0; n++) {
+        result = wsa_sweep_continuous_capture(sweep_device, cfg);
+    }
+    reader.done = 1;
+    pthread_join(thread, NULL);
+
+    if (result >= 0) {
+        if (!reader.bad && reader.reads == 0) {
+            snprintf(reader.detail, sizeof(reader.detail), "no frame read");
+            reader.bad = 1;
+        }
+        snprintf(what, sizeof(what), "reader: %u reads during %u sweeps", (unsigned)reader.reads,
+                 (unsigned)CHECK_READER_SWEEPS);
+        check_report(what, reader.bad ? reader.detail : "");
+    }
+
+    wsa_sweep_continuous_stop(sweep_device, cfg);
+    wsa_power_spectrum_free(cfg);
+
+    return result;
+}
+
+
+///
+/// Check that sweeps reported damaged are counted, and never published.
+///
+static int16_t check_damaged( struct wsa_sweep_device *sweep_device )
+{
+    struct wsa_power_spectrum_config *cfg;
+    struct wsa_spectrum_frame_info info;
+    uint8_t damaged[CHECK_DROP_SWEEPS];
+    uint32_t damaged_count = 0;
+    uint32_t n, age;
+    uint8_t bad = 0;
+    float *out;
+    char what[96];
+    char detail[160];
+    int16_t result;
+
+    result = check_start(sweep_device, &cfg);
+    if (result < 0) {
+        return result;
+    }
+
+    out = malloc(cfg->buflen * sizeof(float));
+    if (out == NULL) {
+        wsa_sweep_continuous_stop(sweep_device, cfg);
+        wsa_power_spectrum_free(cfg);
+        return WSA_ERR_MALLOCFAILED;
+    }
+
+    for (n = 0; n < CHECK_DROP_SWEEPS && result >= 0; n++) {
+        result = wsa_sweep_continuous_capture(sweep_device, cfg);
+        if (result < 0 && result != WSA_ERR_SWEEPDAMAGED) {
+            break;
+        }
+        damaged[n] = (result == WSA_ERR_SWEEPDAMAGED);
+        damaged_count += damaged[n];
+
+        // No age reads back a sweep that was damaged, and one that was not is the latest.
+        for (age = 0, result = 0; age + 2 <= CHECK_NFRAMES && !bad && result >= 0; age++) {
+            result = wsa_sweep_continuous_read(cfg, age, out, &info, NULL);
+            if (result >= 0 && (info.sweep_number > n || damaged[info.sweep_number])) {
+                snprintf(detail, sizeof(detail), "age %u after sweep %u read back damaged sweep %llu",
+                         (unsigned)age, (unsigned)n, (unsigned long long)info.sweep_number);
+                bad = 1;
+            } else if (result == WSA_ERR_SWEEPFRAMEUNAVAILABLE && age == 0 && !damaged[n]) {
+                snprintf(detail, sizeof(detail), "sweep %u was captured but could not be read", (unsigned)n);
+                bad = 1;
+            }
+            if (result == WSA_ERR_SWEEPFRAMEUNAVAILABLE) {
+                result = 0;
+            }
+        }
+    }
+
+    if (result >= 0) {
+        if (!bad && cfg->ring->damaged != damaged_count) {
+            snprintf(detail, sizeof(detail), "%u sweeps reported damaged, %u counted", (unsigned)damaged_count,
+                     (unsigned)cfg->ring->damaged);
+            bad = 1;
+        } else if (!bad && (damaged_count == 0 || damaged_count == CHECK_DROP_SWEEPS)) {
+            snprintf(detail, sizeof(detail), "%u of %u sweeps damaged, wsasim --drop should spoil some",
+                     (unsigned)damaged_count, (unsigned)CHECK_DROP_SWEEPS);
+            bad = 1;
+        }
+        snprintf(what, sizeof(what), "damaged: %u of %u sweeps, none read back", (unsigned)damaged_count,
+                 (unsigned)CHECK_DROP_SWEEPS);
+        check_report(what, bad ? detail : "");
+    }
+
+    free(out);
+    wsa_sweep_continuous_stop(sweep_device, cfg);
+    wsa_power_spectrum_free(cfg);
+
+    return result;
+}
+
+
+///
+/// Check that stopping continuous mode sets the device back to one sweep per start, and that a
+/// plain capture works after it.
+///
+static int16_t check_stop( struct wsa_sweep_device *sweep_device, struct wsa_device *dev )
+{
+    struct wsa_power_spectrum_config *cfg;
+    float *buf;
+    int32_t iteration = 0;
+    char detail[96] = "";
+    int16_t result;
+
+    result = check_start(sweep_device, &cfg);
+    if (result < 0) {
+        return result;
+    }
+
+    result = wsa_sweep_continuous_capture(sweep_device, cfg);
+    if (result >= 0) {
+        result = wsa_get_sweep_iteration(dev, &iteration);
+        if (result >= 0 && iteration != 0) {
+            snprintf(detail, sizeof(detail), "iteration %d while running, not 0", (int)iteration);
+        }
+    }
+    if (result < 0) {
+        wsa_sweep_continuous_stop(sweep_device, cfg);
+        wsa_power_spectrum_free(cfg);
+        return result;
+    }
+
+    result = wsa_sweep_continuous_stop(sweep_device, cfg);
+    if (result >= 0) {
+        result = wsa_get_sweep_iteration(dev, &iteration);
+    }
+    if (result >= 0 && !detail[0] && iteration != 1) {
+        snprintf(detail, sizeof(detail), "iteration %d after stop, not 1", (int)iteration);
+    }
+    if (result >= 0) {
+        buf = cfg->buf;
+        result = wsa_capture_power_spectrum(sweep_device, cfg, &buf);
+    }
+    if (result >= 0) {
+        check_report("stop: one sweep per start again", detail);
+    }
+
+    wsa_power_spectrum_free(cfg);
+
+    return result;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    struct wsa_device dev;
+    struct wsa_device drop_dev;
+    struct wsa_sweep_device *sweep_device;
+    struct wsa_sweep_device *drop_sweep_device;
+    char sim_path[1024];
+    pid_t sim;
+    pid_t drop_sim;
+    int opened;
+    int16_t result = 0;
+    int i;
+
+    test_sim_path(argv[0], sim_path, sizeof(sim_path));
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--sim") && i + 1 < argc) {
+            snprintf(sim_path, sizeof(sim_path), "%s", argv[++i]);
+        } else {
+            return check_usage(argv[0], argv[i], check_options);
+        }
+    }
+
+    sim = test_sim_start(sim_path, CHECK_CTRL_PORT, CHECK_DATA_PORT, NULL);
+    drop_sim = test_sim_start(sim_path, CHECK_DROP_CTRL_PORT, CHECK_DROP_DATA_PORT, check_drop_sim_args);
+    if (sim < 0 || drop_sim < 0) {
+        fprintf(stderr, "failed to start simulator %s\n", sim_path);
+        test_sim_stop(sim);
+        test_sim_stop(drop_sim);
+        return 1;
+    }
+
+    // Devices are opened in turn, and closed in reverse, as far as they got.
+    opened = 0;
+    if (check_open(&dev, CHECK_CTRL_PORT, CHECK_DATA_PORT) >= 0) {
+        sweep_device = wsa_sweep_device_new(&dev);
+        opened = 1;
+        if (check_open(&drop_dev, CHECK_DROP_CTRL_PORT, CHECK_DROP_DATA_PORT) >= 0) {
+            drop_sweep_device = wsa_sweep_device_new(&drop_dev);
+            opened = 2;
+        }
+    }
+    if (opened < 2) {
+        check_failed = 1;
+    }
+
+    if (opened == 2) {
+        result = check_order(sweep_device);
+    }
+    if (opened == 2 && result >= 0) {
+        result = check_reader(sweep_device);
+    }
+    if (opened == 2 && result >= 0) {
+        result = check_damaged(drop_sweep_device);
+    }
+    if (opened == 2 && result >= 0) {
+        result = check_stop(sweep_device, &dev);
+    }
+
+    if (result < 0) {
+        fprintf(stderr, "continuous capture failed: %s\n", wsa_get_error_msg(result));
+        check_failed = 1;
+    }
+
+    if (opened > 1) {
+        wsa_sweep_device_free(drop_sweep_device);
+        wsa_close(&drop_dev);
+    }
+    if (opened > 0) {
+        wsa_sweep_device_free(sweep_device);
+        wsa_close(&dev);
+    }
+    test_sim_stop(drop_sim);
+    test_sim_stop(sim);
+
+    return check_failed;
+}
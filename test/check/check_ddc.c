@@ -0,0 +1,497 @@
+///
+/// @file
+/// wsacheck_ddc: checks the digital down-converter (see wsa_ddc.h) with tones.
+///
+/// The input is at 125 MS/s and the band 20 MHz off its centre, taken down to output rates met by
+/// halfbands and a resampler together (10 MS/s, 1 MS/s) and by a resampler of many phases
+/// (7.3 MS/s, 584 / 625). For each:
+/// \li in band: a tone in the band comes out at its frequency less the offset, at 0 dB within
+///     CHECK_GAIN_DB, across the band and with real data (-6 dB, half the power being above 0 Hz)
+/// \li outside: a tone from anywhere outside the band, swept across the capture and put where
+///     each stage's decimation folds it into the band, leaves what lands in the band at least
+///     CHECK_REJECTION dB down
+/// \li pieces: the same input pushed in pieces of odd sizes gives the outputs of one push, to
+///     CHECK_PIECES, and as many as the rate says
+/// \li packets: wsa_ddc_push_packet() gives what wsa_ddc_push() does with the samples normalized
+///
+/// With the output rate that of the input, nothing is filtered, and a constant comes out as the
+/// oscillator itself; it must stay within CHECK_OSCILLATOR of exact over CHECK_SAMPLES.
+///
+/// Built and run by `make check`. Prints one line per check and exits non-zero if any fails.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_error.h"
+#include "wsa_ddc.h"
+#include "kiss_fft.h"
+#include "check.h"
+
+#define CHECK_SAMPLE_RATE 125e6
+#define CHECK_OFFSET 20e6
+#define CHECK_SAMPLES 600000			///< Most input samples a run takes
+#define CHECK_SETTLE 256				///< Outputs skipped while the filters fill
+#define CHECK_FFT 4096					///< Outputs measured, as one FFT
+#define CHECK_SWEEP 41					///< Tones swept across the capture
+#define CHECK_AMPLITUDE 0.5
+#define CHECK_GAIN_DB 0.01				///< Allowed gain of a tone in the band, in dB
+#define CHECK_REJECTION 88.0			///< dB a tone from outside the band must be down inside it
+#define CHECK_PIECES 1e-8				///< Allowed difference of outputs pushed in pieces
+#define CHECK_OSCILLATOR 1e-5			///< Allowed error of the oscillator, -100 dB
+
+
+///
+/// Write a tone at \p frequency from the capture's centre, complex, or real if \p qdata is NULL.
+///
+static void check_tone( double frequency, float *idata, float *qdata, uint32_t samples )
+{
+    double phase;
+    uint32_t n;
+
+    for (n = 0; n < samples; n++) {
+        phase = 2 * M_PI * fmod(frequency / CHECK_SAMPLE_RATE * n, 1.0);
+        idata[n] = (float)(CHECK_AMPLITUDE * cos(phase));
+        if (qdata) {
+            qdata[n] = (float)(CHECK_AMPLITUDE * sin(phase));
+        }
+    }
+}
+
+
+///
+/// Make a down-converter to an output rate, from the band CHECK_OFFSET off centre.
+///
+static int16_t check_alloc( double output_rate, struct wsa_ddc **ddc )
+{
+    struct wsa_ddc_config config;
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = CHECK_SAMPLE_RATE;
+    config.offset = CHECK_OFFSET;
+    config.output_rate = output_rate;
+
+    return wsa_ddc_alloc(&config, ddc);
+}
+
+
+///
+/// Down-convert a tone, and measure the outputs once the filters have filled, as dB of the tone's
+/// power: the tone at \p frequency less the offset, and all that lands within \p band of 0 Hz.
+///
+/// What lands in the band is taken from a Blackman-Harris windowed FFT of the outputs, whose
+/// sidelobes are far enough down that a tone just outside the band does not show in it.
+///
+static int16_t check_measure( double output_rate, double frequency, uint8_t real, double band, float *idata,
+                              float *qdata, float *out_i, float *out_q, double *tone_db, double *band_db )
+{
+    struct wsa_ddc *ddc;
+    kiss_fft_cfg fft;
+    static kiss_fft_cpx in[CHECK_FFT];
+    static kiss_fft_cpx out[CHECK_FFT];
+    double rate;
+    double phase;
+    double w, windowed = 0;
+    double si = 0, sq = 0, power = 0;
+    double f;
+    uint32_t samples;
+    int32_t n;
+    int32_t k;
+    int16_t result;
+
+    result = check_alloc(output_rate, &ddc);
+    if (result < 0) {
+        return result;
+    }
+    rate = wsa_ddc_output_rate(ddc);
+    samples = (uint32_t)ceil((CHECK_SETTLE + CHECK_FFT + 2) * CHECK_SAMPLE_RATE / rate);
+
+    check_tone(frequency, idata, real ? NULL : qdata, samples);
+    n = wsa_ddc_push(ddc, idata, real ? NULL : qdata, (int32_t)samples, out_i, out_q);
+    wsa_ddc_free(ddc);
+    if (n < 0) {
+        return (int16_t)n;
+    }
+    if (n < CHECK_SETTLE + CHECK_FFT) {
+        return WSA_ERR_INVINPUT;
+    }
+    out_i += CHECK_SETTLE;
+    out_q += CHECK_SETTLE;
+
+    for (k = 0; k < CHECK_FFT; k++) {
+        phase = 2 * M_PI * fmod((frequency - CHECK_OFFSET) / rate * (k + CHECK_SETTLE), 1.0);
+        si += out_i[k] * cos(phase) + out_q[k] * sin(phase);
+        sq += out_q[k] * cos(phase) - out_i[k] * sin(phase);
+
+        w = 0.35875 - 0.48829 * cos(2 * M_PI * k / CHECK_FFT) + 0.14128 * cos(4 * M_PI * k / CHECK_FFT) -
+            0.01168 * cos(6 * M_PI * k / CHECK_FFT);
+        in[k].r = (float)(w * out_i[k]);
+        in[k].i = (float)(w * out_q[k]);
+        windowed += w * w;
+    }
+    si /= CHECK_FFT;
+    sq /= CHECK_FFT;
+    *tone_db = 10 * log10((si * si + sq * sq) / (CHECK_AMPLITUDE * CHECK_AMPLITUDE) + 1e-30);
+
+    fft = kiss_fft_alloc(CHECK_FFT, 0, NULL, NULL);
+    if (fft == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+    kiss_fft(fft, in, out);
+    kiss_fft_free(fft);
+
+    // By Parseval, the bins add up to CHECK_FFT times the windowed power.
+    for (k = 0; k < CHECK_FFT; k++) {
+        f = ((k < CHECK_FFT / 2) ? k : k - CHECK_FFT) * rate / CHECK_FFT;
+        if (fabs(f) <= band) {
+            power += (double)out[k].r * out[k].r + (double)out[k].i * out[k].i;
+        }
+    }
+    *band_db = 10 * log10(power / (CHECK_FFT * windowed * CHECK_AMPLITUDE * CHECK_AMPLITUDE) + 1e-30);
+
+    return 0;
+}
+
+
+///
+/// Tones in the band, and tones from outside it: swept across the capture, and put where each
+/// stage's decimation folds them into the band.
+///
+static int16_t check_tones( double output_rate, float *idata, float *qdata, float *out_i, float *out_q )
+{
+    double const band = 0.8 * output_rate / 2;	// the default bandwidth, either side
+    double const in_band[] = { 0, 0.37 * band, -0.9 * band, 0.99 * band };
+    double const fold[] = { -0.99, -0.5, 0, 0.6, 0.99 };
+    double outside[CHECK_SWEEP + 2 * 5 * (WSA_DDC_MAX_HALFBANDS + 1)];
+    double tone_db, band_db, worst = 0;
+    double frequency;
+    double rate;
+    size_t noutside = 0;
+    size_t t;
+    size_t f;
+    int sign;
+    char what[80];
+    char detail[128];
+    int16_t result = 0;
+
+    detail[0] = '\0';
+    for (t = 0; t < sizeof(in_band) / sizeof(in_band[0]) && !detail[0]; t++) {
+        result = check_measure(output_rate, CHECK_OFFSET + in_band[t], 0, band, idata, qdata, out_i, out_q,
+                               &tone_db, &band_db);
+        if (result < 0) {
+            return result;
+        }
+        if (fabs(tone_db) > CHECK_GAIN_DB) {
+            snprintf(detail, sizeof(detail), "tone %+.0f Hz from the band's centre comes out at %.4f dB",
+                     in_band[t], tone_db);
+        }
+        worst = (fabs(tone_db) > worst) ? fabs(tone_db) : worst;
+    }
+    if (!detail[0]) {
+        // A real tone is two, at +-f, each of half the amplitude; the one at -f is filtered out.
+        result = check_measure(output_rate, CHECK_OFFSET + in_band[1], 1, band, idata, qdata, out_i, out_q,
+                               &tone_db, &band_db);
+        if (result < 0) {
+            return result;
+        }
+        if (fabs(tone_db - 20 * log10(0.5)) > CHECK_GAIN_DB) {
+            snprintf(detail, sizeof(detail), "real tone comes out at %.4f dB, not %.4f dB", tone_db, 20 * log10(0.5));
+        }
+    }
+    snprintf(what, sizeof(what), "%g samples/s, tones in the band", output_rate);
+    if (detail[0]) {
+        check_report(what, detail);
+    } else {
+        printf("ok   %s: within %.4f dB of 0 dB\n", what, worst);
+    }
+
+    // Across the capture, at a step that is no multiple of any rate, leaving out the band and a
+    // little either side, where a tone's own window sidelobes would show.
+    for (t = 0; t < CHECK_SWEEP; t++) {
+        frequency = -CHECK_SAMPLE_RATE / 2 + 0.31e6 + t * (CHECK_SAMPLE_RATE - 0.62e6) / (CHECK_SWEEP - 1) - CHECK_OFFSET;
+        if (fabs(frequency) > 1.05 * band) {
+            outside[noutside++] = frequency;
+        }
+    }
+    // Where the halfbands, while the rate is twice the output rate or more, and then the output
+    // rate itself fold a tone into the band.
+    for (rate = CHECK_SAMPLE_RATE; ; rate /= 2) {
+        if (rate < 2 * output_rate * (1 - 1e-12)) {
+            rate = output_rate;
+        }
+        for (sign = -1; sign <= 1; sign += 2) {
+            for (f = 0; f < sizeof(fold) / sizeof(fold[0]); f++) {
+                frequency = sign * rate + fold[f] * band;
+                if (fabs(CHECK_OFFSET + frequency) < CHECK_SAMPLE_RATE / 2 && fabs(frequency) > 1.05 * band) {
+                    outside[noutside++] = frequency;
+                }
+            }
+        }
+        if (rate == output_rate) {
+            break;
+        }
+    }
+
+    worst = -1000;
+    detail[0] = '\0';
+    for (t = 0; t < noutside && !detail[0]; t++) {
+        result = check_measure(output_rate, CHECK_OFFSET + outside[t], 0, band, idata, qdata, out_i, out_q,
+                               &tone_db, &band_db);
+        if (result < 0) {
+            return result;
+        }
+        if (-band_db < CHECK_REJECTION) {
+            snprintf(detail, sizeof(detail), "tone %+.0f Hz from the band's centre only %.1f dB down in it",
+                     outside[t], -band_db);
+        }
+        worst = (band_db > worst) ? band_db : worst;
+    }
+    snprintf(what, sizeof(what), "%g samples/s, %u tones from outside the band", output_rate, (unsigned)noutside);
+    if (detail[0]) {
+        check_report(what, detail);
+    } else {
+        printf("ok   %s: at least %.1f dB down in it\n", what, -worst);
+    }
+
+    return result;
+}
+
+
+///
+/// The same input pushed at once and in pieces of odd sizes, as floats and as packets.
+///
+static int16_t check_pieces( double output_rate, float *idata, float *qdata, float *out_i, float *out_q )
+{
+    struct wsa_ddc *ddc;
+    static int16_t i16[CHECK_SAMPLES];
+    static int16_t q16[CHECK_SAMPLES];
+    float *piece_i;
+    float *piece_q;
+    double err, worst = 0;
+    double expect;
+    uint32_t state = 0x5eed;
+    int32_t const packet = 16384;
+    int32_t once;
+    int32_t total;
+    int32_t done;
+    int32_t size;
+    int32_t n;
+    int32_t k;
+    char what[80];
+    char detail[128];
+    int16_t result;
+
+    piece_i = malloc(sizeof(float) * CHECK_SAMPLES);
+    piece_q = malloc(sizeof(float) * CHECK_SAMPLES);
+    result = (piece_i && piece_q) ? check_alloc(output_rate, &ddc) : WSA_ERR_MALLOCFAILED;
+    if (result < 0) {
+        free(piece_i);
+        free(piece_q);
+        return result;
+    }
+
+    // Full-scale noise, as 16 bit samples, so the packets carry the same.
+    for (k = 0; k < CHECK_SAMPLES; k++) {
+        i16[k] = (int16_t)((int32_t)(check_rand(&state) & 0x3fff) - 0x2000);
+        q16[k] = (int16_t)((int32_t)(check_rand(&state) & 0x3fff) - 0x2000);
+        idata[k] = i16[k] / 8192.0f;
+        qdata[k] = q16[k] / 8192.0f;
+    }
+
+    once = wsa_ddc_push(ddc, idata, qdata, CHECK_SAMPLES, out_i, out_q);
+
+    wsa_ddc_reset(ddc);
+    total = 0;
+    for (done = 0; done < CHECK_SAMPLES && total >= 0; done += size) {
+        size = (int32_t)(check_rand(&state) % 9000);
+        size = (size < CHECK_SAMPLES - done) ? size : CHECK_SAMPLES - done;
+        n = wsa_ddc_push(ddc, idata + done, qdata + done, size, piece_i + total, piece_q + total);
+        total = (n < 0) ? n : total + n;
+    }
+
+    snprintf(what, sizeof(what), "%g samples/s, pushed in pieces", output_rate);
+    detail[0] = '\0';
+    expect = (double)CHECK_SAMPLES * wsa_ddc_output_rate(ddc) / CHECK_SAMPLE_RATE;
+    if (once < 0 || total < 0) {
+        snprintf(detail, sizeof(detail), "push failed");
+    } else if (total != once || fabs(once - expect) > 1) {
+        snprintf(detail, sizeof(detail), "%d outputs in pieces, %d at once, %.1f from the rate", (int)total, (int)once,
+                 expect);
+    }
+    for (k = 0; k < once && !detail[0]; k++) {
+        err = fabs(piece_i[k] - out_i[k]) + fabs(piece_q[k] - out_q[k]);
+        worst = (err > worst) ? err : worst;
+    }
+    if (!detail[0] && worst > CHECK_PIECES) {
+        snprintf(detail, sizeof(detail), "outputs up to %.2g off those of one push", worst);
+    }
+    if (detail[0]) {
+        check_report(what, detail);
+    } else {
+        printf("ok   %s: %d outputs, at most %.2g off one push\n", what, (int)once, worst);
+    }
+
+    // packets, of the size a device sends
+    wsa_ddc_reset(ddc);
+    total = 0;
+    for (done = 0; done < CHECK_SAMPLES && total >= 0; done += size) {
+        size = (packet < CHECK_SAMPLES - done) ? packet : CHECK_SAMPLES - done;
+        n = wsa_ddc_push_packet(ddc, I16Q16_DATA_STREAM_ID, i16 + done, q16 + done, NULL, size, piece_i + total,
+                                piece_q + total);
+        total = (n < 0) ? n : total + n;
+    }
+    snprintf(what, sizeof(what), "%g samples/s, pushed as packets", output_rate);
+    detail[0] = '\0';
+    worst = 0;
+    if (total != once) {
+        snprintf(detail, sizeof(detail), "%d outputs from packets, %d at once", (int)total, (int)once);
+    }
+    for (k = 0; k < once && !detail[0]; k++) {
+        err = fabs(piece_i[k] - out_i[k]) + fabs(piece_q[k] - out_q[k]);
+        worst = (err > worst) ? err : worst;
+    }
+    if (!detail[0] && worst > CHECK_PIECES) {
+        snprintf(detail, sizeof(detail), "outputs up to %.2g off those of one push", worst);
+    }
+    check_report(what, detail);
+
+    wsa_ddc_free(ddc);
+    free(piece_i);
+    free(piece_q);
+
+    return 0;
+}
+
+
+///
+/// Check the oscillator alone against the exact phasor, at an offset of \p offset.
+///
+static int16_t check_oscillator( double offset, float *idata, float *qdata, float *out_i, float *out_q )
+{
+    struct wsa_ddc_config config;
+    struct wsa_ddc *ddc;
+    double phase;
+    double error;
+    double worst = 0;
+    char what[80];
+    char detail[96];
+    int32_t n;
+    int32_t k;
+    int16_t result;
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = CHECK_SAMPLE_RATE;
+    config.offset = offset;
+    config.output_rate = CHECK_SAMPLE_RATE;
+    config.bandwidth = 1e6;
+    result = wsa_ddc_alloc(&config, &ddc);
+    if (result < 0) {
+        return result;
+    }
+
+    for (k = 0; k < CHECK_SAMPLES; k++) {
+        idata[k] = 1.0f;
+        qdata[k] = 0.0f;
+    }
+    n = wsa_ddc_push(ddc, idata, qdata, CHECK_SAMPLES, out_i, out_q);
+    wsa_ddc_free(ddc);
+    if (n < 0) {
+        return (int16_t)n;
+    }
+
+    for (k = 0; k < n; k++) {
+        phase = -2 * M_PI * fmod(offset / CHECK_SAMPLE_RATE * k, 1.0);
+        error = hypot(out_i[k] - cos(phase), out_q[k] - sin(phase));
+        worst = (error > worst) ? error : worst;
+    }
+
+    snprintf(what, sizeof(what), "oscillator at %g Hz: at most %.1f dB off over %d samples", offset,
+             20 * log10(worst), (int)n);
+    detail[0] = '\0';
+    if (n != CHECK_SAMPLES || worst > CHECK_OSCILLATOR) {
+        snprintf(detail, sizeof(detail), "%d outputs, %.2g off, over %.2g", (int)n, worst, CHECK_OSCILLATOR);
+    }
+    check_report(what, detail);
+
+    return 0;
+}
+
+
+///
+/// Check that settings that cannot be met are turned away.
+///
+static void check_errors( void )
+{
+    struct wsa_ddc_config config;
+    struct wsa_ddc *ddc = NULL;
+    char detail[64];
+    uint8_t ok;
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = CHECK_SAMPLE_RATE;
+    config.offset = CHECK_OFFSET;
+    config.output_rate = 2 * CHECK_SAMPLE_RATE;
+    ok = check_refused(wsa_ddc_alloc(&config, &ddc), "output rate above the input rate taken", detail,
+                       sizeof(detail));
+    config.output_rate = 10e6;
+    config.bandwidth = 10e6;
+    ok = ok && check_refused(wsa_ddc_alloc(&config, &ddc), "bandwidth of the whole output rate taken", detail,
+                             sizeof(detail));
+    config.bandwidth = 0;
+    config.offset = CHECK_SAMPLE_RATE / 2;
+    ok = ok && check_refused(wsa_ddc_alloc(&config, &ddc), "band past the edge of the capture taken", detail,
+                             sizeof(detail));
+    check_report("bad settings", ok ? "" : detail);
+}
+
+
+int main( int argc, char *argv[] )
+{
+    double const rates[] = { 10e6, 7.3e6, 1e6 };
+    double const offsets[] = { CHECK_OFFSET, -31.234567e6, 3.3333e6 };
+    float *idata, *qdata, *out_i, *out_q;
+    int16_t result = 0;
+    size_t r;
+
+    if (argc > 1) {
+        return check_usage(argv[0], argv[1], NULL);
+    }
+
+    idata = malloc(sizeof(float) * CHECK_SAMPLES);
+    qdata = malloc(sizeof(float) * CHECK_SAMPLES);
+    out_i = malloc(sizeof(float) * CHECK_SAMPLES);
+    out_q = malloc(sizeof(float) * CHECK_SAMPLES);
+    if (!idata || !qdata || !out_i || !out_q) {
+        result = WSA_ERR_MALLOCFAILED;
+    }
+
+    for (r = 0; r < sizeof(rates) / sizeof(rates[0]) && result >= 0; r++) {
+        result = check_tones(rates[r], idata, qdata, out_i, out_q);
+        if (result >= 0) {
+            result = check_pieces(rates[r], idata, qdata, out_i, out_q);
+        }
+    }
+    for (r = 0; r < sizeof(offsets) / sizeof(offsets[0]) && result >= 0; r++) {
+        result = check_oscillator(offsets[r], idata, qdata, out_i, out_q);
+    }
+    check_errors();
+
+    if (result < 0) {
+        fprintf(stderr, "down-converter failed: %s\n", wsa_get_error_msg(result));
+        check_failed = 1;
+    }
+
+    free(idata);
+    free(qdata);
+    free(out_i);
+    free(out_q);
+
+    return check_failed;
+}
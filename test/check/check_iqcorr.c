@@ -0,0 +1,330 @@
+///
+/// @file
+/// wsacheck_iqcorr: checks the DC offset and IQ imbalance corrector (see wsa_iqcorr.h) against a
+/// tone with a known offset and imbalance.
+///
+/// I is A cos(wn) + dc_i and Q is g A sin(wn + phi) + dc_q, over whole periods, so the means of
+/// I, Q, I^2, Q^2 and I Q a packet gives are known exactly, and the estimates must be dc_i, dc_q, g
+/// and phi. The checks:
+/// \li the first packet sets the estimates outright, and the samples it is corrected to are
+///     A cos(wn) and A sin(wn) again
+/// \li after a step in offset, gain and phase, the estimates follow the running means over packets
+///     of several lengths, exp(-samples / time_constant) of the way from the old to the new
+/// \li DC only takes out the offsets and leaves the imbalance; real data has its offset taken out
+/// \li reset lets the next packet set the estimates outright again; bad arguments are turned away
+///
+/// Built and run by `make check`. Prints one line per check and exits non-zero if any fails.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_error.h"
+#include "wsa_iqcorr.h"
+#include "check.h"
+
+#define CHECK_PERIOD 64					///< Samples in a period of the tone
+#define CHECK_PACKET (64 * CHECK_PERIOD)	///< Samples in a packet, unless a check says otherwise
+#define CHECK_TIME_CONSTANT (4 * CHECK_PACKET)
+#define CHECK_AMPLITUDE 0.5
+#define CHECK_DC 1e-6					///< Allowed error of an offset, normalized
+#define CHECK_GAIN 1e-5					///< Allowed error of the gain
+#define CHECK_PHASE 1e-3				///< Allowed error of the phase, in degrees
+#define CHECK_SAMPLE 2e-6				///< Allowed error of a corrected sample
+
+/// A tone's offset and imbalance.
+struct check_tone {
+    double dc_i;
+    double dc_q;
+    double gain;
+    double phase;						///< In degrees
+};
+
+static struct check_tone const check_before = { 0.02, -0.015, 1.05, 3.0 };
+static struct check_tone const check_after = { -0.03, 0.01, 0.93, -2.0 };
+
+
+///
+/// Write samples of a tone, from the start of a period.
+///
+static void check_tone( struct check_tone const *tone, float *idata, float *qdata, int32_t samples )
+{
+    double w;
+    int32_t n;
+
+    for (n = 0; n < samples; n++) {
+        w = 2 * M_PI * (n % CHECK_PERIOD) / CHECK_PERIOD;
+        idata[n] = (float)(CHECK_AMPLITUDE * cos(w) + tone->dc_i);
+        if (qdata) {
+            qdata[n] = (float)(tone->gain * CHECK_AMPLITUDE * sin(w + tone->phase * M_PI / 180) + tone->dc_q);
+        }
+    }
+}
+
+
+///
+/// The means of I, Q, I^2, Q^2 and I Q over whole periods of a tone.
+///
+static void check_moments( struct check_tone const *tone, double *mean )
+{
+    double const power = CHECK_AMPLITUDE * CHECK_AMPLITUDE / 2;
+
+    mean[0] = tone->dc_i;
+    mean[1] = tone->dc_q;
+    mean[2] = power + tone->dc_i * tone->dc_i;
+    mean[3] = tone->gain * tone->gain * power + tone->dc_q * tone->dc_q;
+    mean[4] = tone->gain * power * sin(tone->phase * M_PI / 180) + tone->dc_i * tone->dc_q;
+}
+
+
+///
+/// Compare the estimates with the tone the means give, \p kept of the way from \p from to \p to.
+///
+static void check_estimates( struct wsa_iqcorr const *iqcorr, struct check_tone const *from,
+                             struct check_tone const *to, double kept, uint64_t samples, char *detail, size_t size )
+{
+    struct wsa_iqcorr_estimate estimate;
+    double a[5], b[5], m[5];
+    double var_i, var_q, cov;
+    double gain, phase;
+    int k;
+
+    check_moments(from, a);
+    check_moments(to, b);
+    for (k = 0; k < 5; k++) {
+        m[k] = b[k] + kept * (a[k] - b[k]);
+    }
+    var_i = m[2] - m[0] * m[0];
+    var_q = m[3] - m[1] * m[1];
+    cov = m[4] - m[0] * m[1];
+    gain = sqrt(var_q / var_i);
+    phase = asin(cov / sqrt(var_i * var_q)) * 180 / M_PI;
+
+    wsa_iqcorr_estimate(iqcorr, &estimate);
+    if (estimate.samples != samples) {
+        snprintf(detail, size, "from %llu samples, expected %llu", (unsigned long long)estimate.samples,
+                 (unsigned long long)samples);
+    } else if (fabs(estimate.dc_i - m[0]) > CHECK_DC || fabs(estimate.dc_q - m[1]) > CHECK_DC) {
+        snprintf(detail, size, "offsets %.7f, %.7f, expected %.7f, %.7f", estimate.dc_i, estimate.dc_q, m[0], m[1]);
+    } else if (fabs(estimate.gain - gain) > CHECK_GAIN) {
+        snprintf(detail, size, "gain %.6f, expected %.6f", estimate.gain, gain);
+    } else if (fabs(estimate.phase - phase) > CHECK_PHASE) {
+        snprintf(detail, size, "phase %.5f degrees, expected %.5f", estimate.phase, phase);
+    }
+}
+
+
+///
+/// Compare corrected samples with the tone taken back to A cos(wn) and A sin(wn), with \p tone's
+/// imbalance left in where \p dc_only.
+///
+static void check_corrected( struct check_tone const *tone, uint8_t dc_only, float const *idata,
+                             float const *qdata, int32_t samples, char *detail, size_t size )
+{
+    double w, i, q;
+    int32_t n;
+
+    for (n = 0; n < samples; n++) {
+        w = 2 * M_PI * (n % CHECK_PERIOD) / CHECK_PERIOD;
+        i = CHECK_AMPLITUDE * cos(w);
+        q = dc_only ? tone->gain * CHECK_AMPLITUDE * sin(w + tone->phase * M_PI / 180) : CHECK_AMPLITUDE * sin(w);
+        if (fabs(idata[n] - i) > CHECK_SAMPLE || (qdata && fabs(qdata[n] - q) > CHECK_SAMPLE)) {
+            snprintf(detail, size, "sample %d is %.7f, %.7f, expected %.7f, %.7f", (int)n, idata[n],
+                     qdata ? qdata[n] : 0.0f, i, qdata ? q : 0.0);
+            return;
+        }
+    }
+}
+
+
+///
+/// The first packet, then a step in the tone followed over packets of several lengths.
+///
+static int16_t check_tracking( void )
+{
+    int32_t const lengths[] = { 16 * CHECK_PERIOD, 5 * CHECK_PERIOD, 40 * CHECK_PERIOD, CHECK_PERIOD,
+                                 100 * CHECK_PERIOD, 23 * CHECK_PERIOD };
+    struct wsa_iqcorr_config config;
+    struct wsa_iqcorr *iqcorr;
+    static float idata[CHECK_PACKET * 2];
+    static float qdata[CHECK_PACKET * 2];
+    uint64_t samples;
+    uint64_t since;
+    size_t k;
+    char what[64];
+    char detail[128];
+    int16_t result;
+
+    config.time_constant = CHECK_TIME_CONSTANT;
+    config.dc_only = 0;
+    result = wsa_iqcorr_alloc(&config, &iqcorr);
+    if (result < 0) {
+        return result;
+    }
+
+    check_tone(&check_before, idata, qdata, CHECK_PACKET);
+    result = wsa_iqcorr_push(iqcorr, idata, qdata, CHECK_PACKET);
+    if (result < 0) {
+        wsa_iqcorr_free(iqcorr);
+        return result;
+    }
+    detail[0] = '\0';
+    check_estimates(iqcorr, &check_before, &check_before, 0, CHECK_PACKET, detail, sizeof(detail));
+    check_report("first packet sets offset, gain and phase", detail);
+    detail[0] = '\0';
+    check_corrected(&check_before, 0, idata, qdata, CHECK_PACKET, detail, sizeof(detail));
+    check_report("first packet corrected to cos and sin", detail);
+
+    samples = CHECK_PACKET;
+    since = 0;
+    for (k = 0; k < sizeof(lengths) / sizeof(lengths[0]); k++) {
+        check_tone(&check_after, idata, qdata, lengths[k]);
+        result = wsa_iqcorr_push(iqcorr, idata, qdata, lengths[k]);
+        if (result < 0) {
+            wsa_iqcorr_free(iqcorr);
+            return result;
+        }
+        samples += (uint64_t)lengths[k];
+        since += (uint64_t)lengths[k];
+
+        snprintf(what, sizeof(what), "step followed, %llu samples on",
+                 (unsigned long long)since);
+        detail[0] = '\0';
+        check_estimates(iqcorr, &check_before, &check_after, exp(-(double)since / CHECK_TIME_CONSTANT), samples,
+                        detail, sizeof(detail));
+        check_report(what, detail);
+    }
+
+    wsa_iqcorr_reset(iqcorr);
+    check_tone(&check_after, idata, qdata, CHECK_PACKET);
+    result = wsa_iqcorr_push(iqcorr, idata, qdata, CHECK_PACKET);
+    if (result >= 0) {
+        detail[0] = '\0';
+        check_estimates(iqcorr, &check_after, &check_after, 0, CHECK_PACKET, detail, sizeof(detail));
+        if (!detail[0]) {
+            check_corrected(&check_after, 0, idata, qdata, CHECK_PACKET, detail, sizeof(detail));
+        }
+        check_report("after reset, the next packet sets the estimates", detail);
+    }
+
+    wsa_iqcorr_free(iqcorr);
+
+    return result;
+}
+
+
+///
+/// DC only, and real data.
+///
+static int16_t check_dc( void )
+{
+    struct wsa_iqcorr_config config;
+    struct wsa_iqcorr *iqcorr;
+    struct wsa_iqcorr_estimate estimate;
+    static float idata[CHECK_PACKET];
+    static float qdata[CHECK_PACKET];
+    char detail[128];
+    int16_t result;
+
+    config.time_constant = 0;
+    config.dc_only = 1;
+    result = wsa_iqcorr_alloc(&config, &iqcorr);
+    if (result < 0) {
+        return result;
+    }
+
+    check_tone(&check_before, idata, qdata, CHECK_PACKET);
+    result = wsa_iqcorr_push(iqcorr, idata, qdata, CHECK_PACKET);
+    if (result >= 0) {
+        detail[0] = '\0';
+        check_estimates(iqcorr, &check_before, &check_before, 0, CHECK_PACKET, detail, sizeof(detail));
+        if (!detail[0]) {
+            check_corrected(&check_before, 1, idata, qdata, CHECK_PACKET, detail, sizeof(detail));
+        }
+        check_report("DC only leaves gain and phase", detail);
+    }
+
+    // Real data in a corrector that was given I and Q before; reset so the offset is set outright.
+    wsa_iqcorr_reset(iqcorr);
+    check_tone(&check_before, idata, NULL, CHECK_PACKET);
+    if (result >= 0) {
+        result = wsa_iqcorr_push(iqcorr, idata, NULL, CHECK_PACKET);
+    }
+    if (result >= 0) {
+        detail[0] = '\0';
+        wsa_iqcorr_estimate(iqcorr, &estimate);
+        if (fabs(estimate.dc_i - check_before.dc_i) > CHECK_DC || estimate.dc_q != 0) {
+            snprintf(detail, sizeof(detail), "offsets %.7f, %.7f, expected %.7f, 0", estimate.dc_i, estimate.dc_q,
+                     check_before.dc_i);
+        } else {
+            check_corrected(&check_before, 1, idata, NULL, CHECK_PACKET, detail, sizeof(detail));
+        }
+        check_report("real data has its offset taken out", detail);
+    }
+
+    wsa_iqcorr_free(iqcorr);
+
+    return result;
+}
+
+
+///
+/// Check that bad arguments are turned away, and an empty packet changes nothing.
+///
+static void check_errors( void )
+{
+    struct wsa_iqcorr *iqcorr = NULL;
+    struct wsa_iqcorr_estimate estimate;
+    float idata[4] = { 0 };
+    float qdata[4] = { 0 };
+    char detail[64];
+    uint8_t ok;
+
+    ok = check_refused(wsa_iqcorr_alloc(NULL, NULL), "no corrector to give taken", detail, sizeof(detail)) &&
+         check_accepted(wsa_iqcorr_alloc(NULL, &iqcorr), "cannot allocate with the defaults", detail,
+                        sizeof(detail)) &&
+         check_refused(wsa_iqcorr_push(iqcorr, NULL, qdata, 4), "bad packet taken", detail, sizeof(detail)) &&
+         check_refused(wsa_iqcorr_push(iqcorr, idata, qdata, -1), "bad packet taken", detail, sizeof(detail)) &&
+         check_accepted(wsa_iqcorr_push(iqcorr, idata, qdata, 0), "empty packet turned away", detail,
+                        sizeof(detail));
+    if (ok) {
+        wsa_iqcorr_estimate(iqcorr, &estimate);
+        if (estimate.samples != 0 || estimate.gain != 1 || estimate.phase != 0) {
+            snprintf(detail, sizeof(detail), "estimates moved with no samples");
+            ok = 0;
+        }
+    }
+    check_report("bad arguments", ok ? "" : detail);
+
+    wsa_iqcorr_free(iqcorr);
+}
+
+
+int main( int argc, char *argv[] )
+{
+    int16_t result;
+
+    if (argc > 1) {
+        return check_usage(argv[0], argv[1], NULL);
+    }
+
+    result = check_tracking();
+    if (result >= 0) {
+        result = check_dc();
+    }
+    check_errors();
+
+    if (result < 0) {
+        fprintf(stderr, "IQ correction failed: %s\n", wsa_get_error_msg(result));
+        check_failed = 1;
+    }
+
+    return check_failed;
+}
@@ -0,0 +1,308 @@
+///
+/// @file
+/// wsacheck_persistence: checks the persistence histogram (see wsa_persistence.h) against a plain
+/// model of it.
+///
+/// The model keeps every cell as a double, fades all of them by the decay before each spectrum and
+/// adds its hits, and divides by the faded count of spectra, which is what wsa_persistence_read()
+/// must give. Spectra are at whole dBm, one row a dBm, so the row of every bin is exact; they spread
+/// across tiles, past both ends of the range, and hold NaN and infinities. The checks:
+/// \li no decay: each cell is the share of spectra that hit it
+/// \li decay: after each spectrum, across the weight being scaled back several times
+/// \li spectra of other lengths than the width, and switching between lengths
+/// \li no decay, with a cell hit past 2^24 times, where a float would stop counting
+/// \li reset, and the errors for bad settings
+///
+/// Built and run by `make check`. Prints one line per check and exits non-zero if any fails.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "wsa_lib.h"
+#include "wsa_error.h"
+#include "wsa_persistence.h"
+#include "check.h"
+
+#define CHECK_WIDTH 20					///< Columns, past one tile across
+#define CHECK_HEIGHT 40					///< Rows, past two tiles down
+#define CHECK_TOP -60.0f				///< Top of the range, in dBm
+#define CHECK_BOTTOM -100.0f			///< Bottom of the range, one row a dBm
+#define CHECK_MAX_BINS (2 * CHECK_WIDTH)
+#define CHECK_RELATIVE 1e-5				///< Allowed relative difference of a cell
+#define CHECK_ABSOLUTE 1e-6				///< Allowed difference of a cell faded to almost nothing
+#define CHECK_LONG_BINS 4096			///< Bins of each spectrum of the long run, all in one cell
+#define CHECK_LONG_SPECTRA 8192			///< Spectra of the long run, 2^25 hits in all
+
+/// The histogram the slow way.
+struct check_model {
+    double cell[CHECK_HEIGHT][CHECK_WIDTH];
+    double total;
+};
+
+
+///
+/// Fill spectrum n of a length. Values run 2 dB past either end of the range, and a few bins hold
+/// NaN or an infinity.
+///
+static void check_spectrum( uint32_t n, float *spectrum, uint32_t bins )
+{
+    uint32_t b;
+
+    for (b = 0; b < bins; b++) {
+        spectrum[b] = CHECK_BOTTOM - 2.0f + (float)((b * 3 + n * 7 + (n * b) % 5) % 45);
+    }
+    if (n % 3 == 0) {
+        spectrum[n % bins] = (float)NAN;
+    }
+    if (n % 4 == 1) {
+        spectrum[(n * 5) % bins] = (float)INFINITY;
+    }
+    if (n % 4 == 2) {
+        spectrum[(n * 3) % bins] = -(float)INFINITY;
+    }
+}
+
+
+///
+/// Add a spectrum to the model: fade every cell, then add a hit for each bin.
+///
+static void check_model_push( struct check_model *m, float decay, float const *spectrum, uint32_t bins )
+{
+    uint32_t r, c, b;
+    int row;
+
+    for (r = 0; r < CHECK_HEIGHT; r++) {
+        for (c = 0; c < CHECK_WIDTH; c++) {
+            m->cell[r][c] *= decay;
+        }
+    }
+    m->total = m->total * decay + 1.0;
+
+    for (b = 0; b < bins; b++) {
+        if (spectrum[b] != spectrum[b] || spectrum[b] < CHECK_BOTTOM) {
+            row = CHECK_HEIGHT - 1;
+        } else if (spectrum[b] > CHECK_TOP) {
+            row = 0;
+        } else {
+            row = (int)(CHECK_TOP - spectrum[b]);
+            row = row < CHECK_HEIGHT - 1 ? row : CHECK_HEIGHT - 1;
+        }
+        m->cell[row][(b * CHECK_WIDTH) / bins] += 1.0;
+    }
+}
+
+
+///
+/// Compare the histogram's image with the model. Gives a description of the first difference.
+///
+static void check_compare( struct wsa_persistence *p, struct check_model const *m, char *detail, size_t size )
+{
+    float image[CHECK_HEIGHT * CHECK_WIDTH];
+    double expect, top = 0;
+    float got;
+    uint32_t r, c;
+
+    got = wsa_persistence_read(p, image);
+
+    for (r = 0; r < CHECK_HEIGHT; r++) {
+        for (c = 0; c < CHECK_WIDTH; c++) {
+            expect = m->total > 0 ? m->cell[r][c] / m->total : 0;
+            top = expect > top ? expect : top;
+            if (fabs(image[r * CHECK_WIDTH + c] - expect) > CHECK_ABSOLUTE + CHECK_RELATIVE * expect) {
+                snprintf(detail, size, "row %u column %u is %g, expected %g", (unsigned)r, (unsigned)c,
+                         image[r * CHECK_WIDTH + c], expect);
+                return;
+            }
+        }
+    }
+
+    if (fabs(got - top) > CHECK_ABSOLUTE + CHECK_RELATIVE * top) {
+        snprintf(detail, size, "largest value given as %g, expected %g", got, top);
+    }
+}
+
+
+///
+/// Push spectra to a histogram and its model, comparing them after each one.
+///
+static int16_t check_run( char const *what, float decay, uint32_t spectra, uint32_t const *lengths, size_t nlengths )
+{
+    struct wsa_persistence_config config;
+    struct wsa_persistence *p;
+    static struct check_model m;
+    float spectrum[CHECK_MAX_BINS];
+    uint32_t bins;
+    uint32_t n;
+    char detail[128];
+    int16_t result;
+
+    config.width = CHECK_WIDTH;
+    config.height = CHECK_HEIGHT;
+    config.min_dbm = CHECK_BOTTOM;
+    config.max_dbm = CHECK_TOP;
+    config.decay = decay;
+    result = wsa_persistence_alloc(&config, &p);
+    if (result < 0) {
+        return result;
+    }
+    memset(&m, 0, sizeof(m));
+
+    detail[0] = '\0';
+    check_compare(p, &m, detail, sizeof(detail));
+    for (n = 0; n < spectra && !detail[0]; n++) {
+        bins = lengths[n % nlengths];
+        check_spectrum(n, spectrum, bins);
+        result = wsa_persistence_push(p, spectrum, bins);
+        if (result < 0) {
+            wsa_persistence_free(p);
+            return result;
+        }
+        check_model_push(&m, decay, spectrum, bins);
+        check_compare(p, &m, detail, sizeof(detail));
+        if (detail[0]) {
+            snprintf(detail + strlen(detail), sizeof(detail) - strlen(detail), ", spectrum %u", (unsigned)n);
+        }
+    }
+    check_report(what, detail);
+
+    if (!detail[0]) {
+        wsa_persistence_reset(p);
+        memset(&m, 0, sizeof(m));
+        check_compare(p, &m, detail, sizeof(detail));
+        check_report("reset clears every hit", detail);
+    }
+
+    wsa_persistence_free(p);
+
+    return 0;
+}
+
+
+///
+/// Hit one cell with every bin of every spectrum, with no decay, until it is past 2^24 hits. It
+/// must still read as the number of bins.
+///
+static int16_t check_long( void )
+{
+    struct wsa_persistence_config config;
+    struct wsa_persistence *p;
+    static float spectrum[CHECK_LONG_BINS];
+    float image[4];
+    float top;
+    uint32_t n;
+    char detail[96];
+    int16_t result;
+
+    config.width = 1;
+    config.height = 4;
+    config.min_dbm = CHECK_BOTTOM;
+    config.max_dbm = CHECK_TOP;
+    config.decay = 1.0f;
+    result = wsa_persistence_alloc(&config, &p);
+    if (result < 0) {
+        return result;
+    }
+
+    for (n = 0; n < CHECK_LONG_BINS; n++) {
+        spectrum[n] = CHECK_TOP - 1.0f;
+    }
+    for (n = 0; n < CHECK_LONG_SPECTRA && result >= 0; n++) {
+        result = wsa_persistence_push(p, spectrum, CHECK_LONG_BINS);
+    }
+    if (result < 0) {
+        wsa_persistence_free(p);
+        return result;
+    }
+
+    detail[0] = '\0';
+    top = wsa_persistence_read(p, image);
+    if (image[0] != (float)CHECK_LONG_BINS || top != image[0]) {
+        snprintf(detail, sizeof(detail), "cell reads %g, largest %g, expected %g", image[0], top,
+                 (double)CHECK_LONG_BINS);
+    }
+    check_report("no decay, one cell hit 2^25 times", detail);
+
+    wsa_persistence_free(p);
+
+    return 0;
+}
+
+
+///
+/// Check that bad settings are turned away.
+///
+static void check_errors( void )
+{
+    struct wsa_persistence_config config;
+    struct wsa_persistence *p = NULL;
+    char detail[64];
+    uint8_t ok;
+
+    config.width = CHECK_WIDTH;
+    config.height = CHECK_HEIGHT;
+    config.min_dbm = CHECK_BOTTOM;
+    config.max_dbm = CHECK_TOP;
+
+    config.decay = 0.0f;
+    ok = check_refused(wsa_persistence_alloc(&config, &p), "decay 0 taken", detail, sizeof(detail));
+    config.decay = 1.5f;
+    ok = ok && check_refused(wsa_persistence_alloc(&config, &p), "decay 1.5 taken", detail, sizeof(detail));
+    config.decay = 0.5f;
+    config.max_dbm = config.min_dbm;
+    ok = ok && check_refused(wsa_persistence_alloc(&config, &p), "empty amplitude range taken", detail,
+                             sizeof(detail));
+    config.max_dbm = CHECK_TOP;
+    config.width = 0;
+    ok = ok && check_refused(wsa_persistence_alloc(&config, &p), "width 0 taken", detail, sizeof(detail));
+    config.width = CHECK_WIDTH;
+    ok = ok && check_accepted(wsa_persistence_alloc(&config, &p), "cannot allocate", detail, sizeof(detail));
+    ok = ok && check_refused(wsa_persistence_push(p, NULL, CHECK_WIDTH), "no spectrum taken", detail,
+                             sizeof(detail));
+    check_report("bad settings", ok ? "" : detail);
+
+    wsa_persistence_free(p);
+}
+
+
+int main( int argc, char *argv[] )
+{
+    uint32_t const width[] = { CHECK_WIDTH };
+    uint32_t const more[] = { CHECK_MAX_BINS };
+    uint32_t const mixed[] = { CHECK_MAX_BINS, 7, CHECK_WIDTH, 33 };
+    int16_t result;
+
+    if (argc > 1) {
+        return check_usage(argv[0], argv[1], NULL);
+    }
+
+    result = check_run("no decay, 50 spectra a bin a column", 1.0f, 50, width, 1);
+    if (result >= 0) {
+        result = check_run("no decay, 50 spectra two bins a column", 1.0f, 50, more, 1);
+    }
+    if (result >= 0) {
+        result = check_run("decay 0.9, 100 spectra", 0.9f, 100, width, 1);
+    }
+    // The weight doubles with each spectrum, passing the rescale point every 60 or so.
+    if (result >= 0) {
+        result = check_run("decay 0.5, 200 spectra, scaled back three times", 0.5f, 200, more, 1);
+    }
+    if (result >= 0) {
+        result = check_run("decay 0.8, spectra of changing lengths", 0.8f, 60, mixed, 4);
+    }
+    if (result >= 0) {
+        result = check_long();
+    }
+    check_errors();
+
+    if (result < 0) {
+        fprintf(stderr, "persistence failed: %s\n", wsa_get_error_msg(result));
+        check_failed = 1;
+    }
+
+    return check_failed;
+}
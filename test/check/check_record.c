@@ -0,0 +1,296 @@
+///
+/// @file
+/// wsacheck_record: checks recordings and their indexes against the packets wsasim sent.
+///
+/// wsasim is started on loopback, told to stall each data connection halfway through a packet,
+/// and a stream is recorded from it, once copied and once spliced (see WSA_RECORD_SPLICE). The
+/// recording is then read back and checked:
+/// \li index: there is one entry per packet recorded, and each entry's offset lands on a packet
+///     header whose stream id and timestamp are the entry's
+/// \li end: after the timeout that cut the last packet short, the recording ends on a packet
+///     boundary, with only the packets before it
+///
+/// Built and run by `make check`. Prints one line per check and exits non-zero if any fails.
+///
+/// Run with --help for the options.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_error.h"
+#include "wsa_record.h"
+#include "check.h"
+#include "test_sim.h"
+
+#define CHECK_CTRL_PORT 47611			///< Control port of the simulator started for the run
+#define CHECK_DATA_PORT 47610			///< Data port of the simulator started for the run
+#define CHECK_SPP 1024					///< Samples per packet streamed
+#define CHECK_FIRST_PACKETS 100			///< Packets recorded by the first wsa_recorder_run(), by count
+/// Packets the simulator sends on each data connection before it stalls, enough to fill the copy
+/// buffer twice.
+#define CHECK_STALL_AFTER 600
+#define CHECK_TIMEOUT_MS 400			///< Wait for each packet
+
+/// Options for the simulator: stall halfway through the packet after CHECK_STALL_AFTER, so a timeout
+/// cuts it short.
+static char const * const check_sim_args[] = { "--stall-after", "600", NULL };
+
+/// The options, as --help lists them.
+static char const check_options[] =
+    "  --sim PATH            simulator to start (default: wsasim next to this program)\n"
+    "  --file PATH           where to record (default wsacheck_record.vrt)\n";
+
+
+///
+/// Read a big-endian 32-bit word.
+///
+static uint32_t check_word( uint8_t const *p )
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+
+///
+/// Read a whole file.
+///
+/// @return The file's contents, to be freed, or NULL if it could not be read.
+///
+static uint8_t *check_load( char const *path, size_t *size )
+{
+    FILE *f;
+    uint8_t *data;
+    long len;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    // one byte more, so an empty file is not taken for a failure
+    data = (len >= 0) ? malloc((size_t)len + 1) : NULL;
+    if (data != NULL && fread(data, 1, (size_t)len, f) != (size_t)len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *size = (size_t)len;
+
+    return data;
+}
+
+
+///
+/// Check a recording and its index against each other, and against what the recorder counted.
+///
+static void check_recording( char const *path, char const *method, uint64_t packets, uint64_t bytes )
+{
+    char index_path[1024];
+    struct wsa_record_index_entry entry;
+    uint8_t *data;
+    uint8_t *index;
+    size_t data_size = 0;
+    size_t index_size = 0;
+    uint8_t const *header;
+    uint64_t offset = 0;
+    uint64_t psec;
+    size_t count;
+    size_t i;
+    char what[96];
+    char index_detail[160] = "";
+    char end_detail[160] = "";
+
+    snprintf(index_path, sizeof(index_path), "%s%s", path, WSA_RECORD_INDEX_SUFFIX);
+    data = check_load(path, &data_size);
+    index = check_load(index_path, &index_size);
+
+    count = (index_size >= WSA_RECORD_INDEX_MAGIC_LEN) ?
+            (index_size - WSA_RECORD_INDEX_MAGIC_LEN) / sizeof(struct wsa_record_index_entry) : 0;
+
+    if (data == NULL || index == NULL) {
+        snprintf(index_detail, sizeof(index_detail), "could not read the %s", (data == NULL) ? "recording" : "index");
+    } else if (index_size < WSA_RECORD_INDEX_MAGIC_LEN ||
+               memcmp(index, WSA_RECORD_INDEX_MAGIC, WSA_RECORD_INDEX_MAGIC_LEN) != 0) {
+        snprintf(index_detail, sizeof(index_detail), "index does not start with %s", WSA_RECORD_INDEX_MAGIC);
+    } else if (index_size != WSA_RECORD_INDEX_MAGIC_LEN + count * sizeof(struct wsa_record_index_entry)) {
+        snprintf(index_detail, sizeof(index_detail), "index of %lu bytes ends partway through an entry",
+                 (unsigned long)index_size);
+    } else if (count != packets) {
+        snprintf(index_detail, sizeof(index_detail), "%lu entries for %llu packets recorded", (unsigned long)count,
+                 (unsigned long long)packets);
+    }
+
+    // Each entry's packet starts where the one before ends.
+    for (i = 0; i < count && !index_detail[0]; i++) {
+        memcpy(&entry, index + WSA_RECORD_INDEX_MAGIC_LEN + i * sizeof(entry), sizeof(entry));
+        if (entry.offset != offset) {
+            snprintf(index_detail, sizeof(index_detail), "entry %lu at offset %llu, its packet is at %llu",
+                     (unsigned long)i, (unsigned long long)entry.offset, (unsigned long long)offset);
+            break;
+        }
+        if (offset + VRT_HEADER_SIZE * BYTES_PER_VRT_WORD > data_size) {
+            snprintf(index_detail, sizeof(index_detail), "entry %lu at offset %llu is past the end, %lu bytes",
+                     (unsigned long)i, (unsigned long long)offset, (unsigned long)data_size);
+            break;
+        }
+
+        header = data + offset;
+        psec = (header[1] & 0x30) ? ((uint64_t)check_word(header + 12) << 32) | check_word(header + 16) : 0;
+        if (check_word(header + 4) != entry.stream_id || check_word(header + 8) != entry.sec || psec != entry.psec) {
+            snprintf(index_detail, sizeof(index_detail),
+                     "entry %lu is stream 0x%08x at %u.%012llu, its packet stream 0x%08x at %u.%012llu",
+                     (unsigned long)i, (unsigned)entry.stream_id, (unsigned)entry.sec, (unsigned long long)entry.psec,
+                     (unsigned)check_word(header + 4), (unsigned)check_word(header + 8), (unsigned long long)psec);
+            break;
+        }
+        offset += (uint64_t)(((uint32_t)header[2] << 8) | header[3]) * BYTES_PER_VRT_WORD;
+    }
+
+    if (index_detail[0]) {
+        snprintf(end_detail, sizeof(end_detail), "index is wrong");
+    } else if (offset != data_size) {
+        snprintf(end_detail, sizeof(end_detail), "%lu bytes, the last packet ends at %llu", (unsigned long)data_size,
+                 (unsigned long long)offset);
+    } else if (data_size != bytes) {
+        snprintf(end_detail, sizeof(end_detail), "%lu bytes, %llu recorded", (unsigned long)data_size,
+                 (unsigned long long)bytes);
+    }
+
+    snprintf(what, sizeof(what), "index: %s, %llu packets each at its header", method, (unsigned long long)packets);
+    check_report(what, index_detail);
+    snprintf(what, sizeof(what), "end: %s, on a packet boundary after a timeout", method);
+    check_report(what, end_detail);
+
+    free(data);
+    free(index);
+}
+
+
+///
+/// Record a stream until the simulator stalls partway through a packet, and check the recording.
+///
+/// @return 0 on success, otherwise the library's error code.
+///
+static int16_t check_record( char const *path, uint32_t flags )
+{
+    struct wsa_device dev;
+    struct wsa_recorder *rec = NULL;
+    char const *method;
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    char what[64];
+    char detail[128] = "";
+    int16_t result;
+    int16_t cut;
+
+    // Each data connection is stalled afresh.
+    result = check_open(&dev, CHECK_CTRL_PORT, CHECK_DATA_PORT);
+    if (result < 0) {
+        return result;
+    }
+
+    result = wsa_set_samples_per_packet(&dev, CHECK_SPP);
+    if (result >= 0) {
+        result = wsa_recorder_alloc(&dev, path, flags, &rec);
+    }
+    if (result < 0) {
+        wsa_close(&dev);
+        return result;
+    }
+    method = wsa_recorder_zero_copy(rec) ? "spliced" : "copied";
+
+    result = wsa_stream_start(&dev);
+    if (result >= 0) {
+        result = wsa_recorder_run(rec, CHECK_FIRST_PACKETS, CHECK_TIMEOUT_MS);
+    }
+    if (result >= 0) {
+        wsa_recorder_totals(rec, &packets, NULL);
+        if (packets != CHECK_FIRST_PACKETS) {
+            snprintf(detail, sizeof(detail), "%llu packets recorded, not %u", (unsigned long long)packets,
+                     (unsigned)CHECK_FIRST_PACKETS);
+        }
+
+        // The rest run into the stall, and the timeout cuts the packet after them short.
+        cut = wsa_recorder_run(rec, 0, CHECK_TIMEOUT_MS);
+        wsa_recorder_totals(rec, &packets, &bytes);
+        if (!detail[0] && cut >= 0) {
+            snprintf(detail, sizeof(detail), "recording went on past the stall, %llu packets",
+                     (unsigned long long)packets);
+        } else if (!detail[0] && packets != CHECK_STALL_AFTER) {
+            snprintf(detail, sizeof(detail), "%llu packets recorded before the stall, not %u",
+                     (unsigned long long)packets, (unsigned)CHECK_STALL_AFTER);
+        }
+        snprintf(what, sizeof(what), "stall: %s, the timeout ends the recording", method);
+        check_report(what, detail);
+    }
+
+    wsa_stream_stop(&dev);
+    if (wsa_recorder_free(rec) < 0 && result >= 0) {
+        result = WSA_ERR_FILEWRITEFAILED;
+    }
+    wsa_close(&dev);
+
+    if (result >= 0) {
+        check_recording(path, method, packets, bytes);
+    }
+
+    return result;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    static uint32_t const methods[] = { 0, WSA_RECORD_SPLICE };
+    char const *path = "wsacheck_record.vrt";
+    char index_path[1024];
+    char sim_path[1024];
+    pid_t sim;
+    int16_t result = 0;
+    size_t m;
+    int i;
+
+    test_sim_path(argv[0], sim_path, sizeof(sim_path));
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--sim") && i + 1 < argc) {
+            snprintf(sim_path, sizeof(sim_path), "%s", argv[++i]);
+        } else if (!strcmp(argv[i], "--file") && i + 1 < argc) {
+            path = argv[++i];
+        } else {
+            return check_usage(argv[0], argv[i], check_options);
+        }
+    }
+
+    sim = test_sim_start(sim_path, CHECK_CTRL_PORT, CHECK_DATA_PORT, check_sim_args);
+    if (sim < 0) {
+        fprintf(stderr, "failed to start simulator %s\n", sim_path);
+        return 1;
+    }
+
+    for (m = 0; m < sizeof(methods) / sizeof(methods[0]) && result >= 0; m++) {
+        result = check_record(path, methods[m]);
+    }
+
+    if (result < 0) {
+        fprintf(stderr, "recording failed: %s\n", wsa_get_error_msg(result));
+        check_failed = 1;
+    }
+
+    snprintf(index_path, sizeof(index_path), "%s%s", path, WSA_RECORD_INDEX_SUFFIX);
+    remove(path);
+    remove(index_path);
+    test_sim_stop(sim);
+
+    return check_failed;
+}
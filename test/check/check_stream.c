@@ -0,0 +1,243 @@
+///
+/// @file
+/// wsacheck_stream: checks how packets are followed per stream, and the gaps found between them.
+///
+/// A device is played in this process over the memory transport (see wsa_transport.h), and a fixed
+/// run of VRT packets is read back through wsa_read_vrt_packet_raw(). Each packet is written with
+/// the packet count and timestamp a table gives it, and the gap flags and dropped count it is read
+/// with must be the ones the table expects: none for a packet that follows on, WSA_GAP_DROPPED,
+/// WSA_GAP_REORDERED, WSA_GAP_LATE or WSA_GAP_EARLY otherwise. The run has two IF streams
+/// interleaved, counts that wrap, timestamps that cross a second, a packet a sample off on either side,
+/// and a context packet that starts the timing again. At the end the device statistics must have
+/// counted the same gaps.
+///
+/// Built and run by `make check`. Prints one line per packet and exits non-zero if any check fails.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_error.h"
+#include "wsa_transport.h"
+#include "wsa_stats.h"
+#include "check.h"
+
+#define CHECK_SPP 256					///< Words of data in each IF packet
+#define CHECK_PSEC_PER_SAMPLE 8000ULL	///< 125 MS/s
+#define CHECK_EPOCH 1500000000U			///< Seconds of the first timestamp
+#define CHECK_START 124999000ULL		///< Sample of the first timestamp, so the run crosses a second
+#define CHECK_TIMEOUT_MS 100
+
+/// Streams the table writes to.
+enum check_stream {
+    CHECK_IQ,							///< I16Q16 IF data, CHECK_SPP samples a packet
+    CHECK_I,							///< I16 IF data, twice CHECK_SPP samples a packet
+    CHECK_RECEIVER						///< Receiver context
+};
+
+/// One packet of the run, and how it must be read.
+static struct {
+    enum check_stream stream;
+    uint8_t count;						///< VRT packet count
+    uint64_t sample;					///< Sample the timestamp is at, from CHECK_START
+    uint8_t gap;						///< WSA_GAP_* flags expected
+    uint8_t dropped;					///< Packets expected to be missing just before
+    char const *what;
+} const check_packets[] = {
+    { CHECK_IQ, 0, 0, 0, 0, "first packet of a stream" },
+    { CHECK_IQ, 1, 256, 0, 0, "next packet, the period is learned" },
+    { CHECK_I, 9, 0, 0, 0, "a second stream starts at its own count" },
+    { CHECK_IQ, 2, 512, 0, 0, "streams are followed apart" },
+    { CHECK_I, 10, 512, 0, 0, "second stream, its period is learned" },
+    { CHECK_I, 11, 1024, 0, 0, "second stream, across a second" },
+    { CHECK_IQ, 5, 1280, WSA_GAP_DROPPED | WSA_GAP_LATE, 2, "two packets missing" },
+    { CHECK_IQ, 6, 1536, 0, 0, "follows on after a loss" },
+    { CHECK_IQ, 4, 1024, WSA_GAP_REORDERED, 0, "an old packet" },
+    { CHECK_IQ, 7, 1792, 0, 0, "follows on after an old packet" },
+    { CHECK_IQ, 8, 2148, WSA_GAP_LATE, 0, "100 samples late" },
+    { CHECK_IQ, 9, 2404, 0, 0, "follows on from the late packet" },
+    { CHECK_IQ, 10, 2610, WSA_GAP_EARLY, 0, "50 samples early" },
+    { CHECK_IQ, 11, 2866, 0, 0, "follows on from the early packet" },
+    { CHECK_IQ, 12, 3123, 0, 0, "one sample late is on time" },
+    { CHECK_IQ, 13, 3378, 0, 0, "one sample early is on time" },
+    { CHECK_IQ, 14, 3636, WSA_GAP_LATE, 0, "two samples late" },
+    { CHECK_IQ, 15, 3892, 0, 0, "last count" },
+    { CHECK_IQ, 0, 4148, 0, 0, "count wraps" },
+    { CHECK_IQ, 8, 6196, WSA_GAP_DROPPED | WSA_GAP_LATE, 7, "seven missing, the most a count shows" },
+    { CHECK_IQ, 1, 6452, WSA_GAP_REORDERED, 0, "eight ahead reads as behind" },
+    { CHECK_IQ, 9, 6452, 0, 0, "follows on from before" },
+    { CHECK_RECEIVER, 3, 6708, 0, 0, "context packet" },
+    { CHECK_IQ, 10, 1000000, 0, 0, "after context, a capture starts anywhere" },
+    { CHECK_IQ, 11, 1000256, 0, 0, "after context, the period is learned again" },
+    { CHECK_IQ, 12, 1000542, WSA_GAP_LATE, 0, "after context, timing is checked again" },
+    { CHECK_I, 12, 1536, 0, 0, "second stream, its count follows on past the first's gaps" },
+};
+
+/// The device played over the memory transport. It answers queries and holds no data of its own.
+struct check_mem_device {
+    struct wsa_mem_link *link;
+};
+
+
+static void check_put_word( uint8_t *p, uint32_t word )
+{
+    p[0] = (uint8_t)(word >> 24);
+    p[1] = (uint8_t)(word >> 16);
+    p[2] = (uint8_t)(word >> 8);
+    p[3] = (uint8_t)word;
+}
+
+
+static int16_t check_mem_command( void *arg, struct wsa_mem_link *link, char const *command )
+{
+    char const *reply = "0";
+
+    (void)arg;
+
+    if (command[strlen(command) - 1] != '?') {
+        return 0;
+    }
+
+    if (strcmp(command, "*IDN?") == 0) {
+        reply = "ThinkRF,R5500-427,MEM,1.0";
+    } else if (strcmp(command, "SYST:ERR?") == 0) {
+        reply = "0,\"No error\"";
+    }
+
+    return wsa_mem_reply(link, reply);
+}
+
+
+///
+/// Write one packet of the table and queue it on the data channel.
+///
+static int16_t check_push( struct wsa_mem_link *link, enum check_stream stream, uint8_t count, uint64_t sample )
+{
+    uint8_t packet[(VRT_HEADER_SIZE + CHECK_SPP + VRT_TRAILER_SIZE) * BYTES_PER_VRT_WORD];
+    uint64_t const samples_per_sec = 1000000000000ULL / CHECK_PSEC_PER_SAMPLE;
+    uint64_t psec;
+    uint32_t words;
+
+    sample += CHECK_START;
+    psec = (sample % samples_per_sec) * CHECK_PSEC_PER_SAMPLE;
+
+    memset(packet, 0, sizeof(packet));
+    if (stream == CHECK_RECEIVER) {
+        words = VRT_HEADER_SIZE + 1;
+        packet[0] = (uint8_t)(CONTEXT_PACKET_TYPE << 4);
+        check_put_word(packet + 4, RECEIVER_STREAM_ID);
+    } else {
+        words = VRT_HEADER_SIZE + CHECK_SPP + VRT_TRAILER_SIZE;
+        packet[0] = (uint8_t)((IF_PACKET_TYPE << 4) | 0x04);
+        check_put_word(packet + 4, stream == CHECK_IQ ? I16Q16_DATA_STREAM_ID : I16_DATA_STREAM_ID);
+    }
+    packet[1] = (uint8_t)(0x40 | 0x20 | (count & 0x0f));
+    packet[2] = (uint8_t)(words >> 8);
+    packet[3] = (uint8_t)words;
+    check_put_word(packet + 8, CHECK_EPOCH + (uint32_t)(sample / samples_per_sec));
+    check_put_word(packet + 12, (uint32_t)(psec >> 32));
+    check_put_word(packet + 16, (uint32_t)psec);
+
+    return wsa_mem_push_data(link, packet, (int32_t)(words * BYTES_PER_VRT_WORD));
+}
+
+
+///
+/// Compare a statistics counter with what the table adds up to.
+///
+static void check_counter( struct wsa_stats const *stats, enum wsa_stats_counter counter, char const *name,
+                           uint64_t expected )
+{
+    char what[64];
+    char detail[64];
+
+    snprintf(what, sizeof(what), "stats %s: %llu", name, (unsigned long long)expected);
+    detail[0] = '\0';
+    if (stats->counter[counter] != expected) {
+        snprintf(detail, sizeof(detail), "counted %llu", (unsigned long long)stats->counter[counter]);
+    }
+    check_report(what, detail);
+}
+
+
+int main( int argc, char *argv[] )
+{
+    struct wsa_device dev;
+    struct wsa_mem_device device;
+    struct check_mem_device mem;
+    struct wsa_vrt_packet_header header;
+    struct wsa_vrt_packet_trailer trailer;
+    struct wsa_receiver_packet receiver;
+    struct wsa_digitizer_packet digitizer;
+    struct wsa_extension_packet extension;
+    struct wsa_stats stats;
+    uint8_t data[CHECK_SPP * BYTES_PER_VRT_WORD];
+    char what[96];
+    char detail[96];
+    uint64_t dropped = 0, reordered = 0, late = 0, early = 0;
+    size_t i;
+    int16_t result;
+
+    if (argc > 1) {
+        return check_usage(argv[0], argv[1], NULL);
+    }
+
+    memset(&dev, 0, sizeof(dev));
+    memset(&mem, 0, sizeof(mem));
+    device.command = check_mem_command;
+    device.fill = NULL;
+    device.arg = &mem;
+
+    result = wsa_mem_link_alloc(&device, &mem.link);
+    if (result >= 0) {
+        result = wsa_connect_transport(&dev, &wsa_mem_transport, mem.link);
+    }
+    if (result < 0) {
+        fprintf(stderr, "cannot connect the memory device: %s\n", wsa_get_error_msg(result));
+        return 1;
+    }
+    wsa_stats_reset(&dev);
+
+    for (i = 0; i < sizeof(check_packets) / sizeof(check_packets[0]); i++) {
+        result = check_push(mem.link, check_packets[i].stream, check_packets[i].count, check_packets[i].sample);
+        if (result >= 0) {
+            result = wsa_read_vrt_packet_raw(&dev, &header, &trailer, &receiver, &digitizer, &extension, data,
+                                             CHECK_SPP, CHECK_TIMEOUT_MS);
+        }
+        snprintf(what, sizeof(what), "%s: gap 0x%x", check_packets[i].what, (unsigned)check_packets[i].gap);
+        if (result < 0) {
+            snprintf(detail, sizeof(detail), "read failed: %s", wsa_get_error_msg(result));
+            check_report(what, detail);
+            break;
+        }
+
+        detail[0] = '\0';
+        if (header.gap != check_packets[i].gap || header.dropped != check_packets[i].dropped) {
+            snprintf(detail, sizeof(detail), "gap 0x%x, %u dropped; expected %u dropped", (unsigned)header.gap,
+                     (unsigned)header.dropped, (unsigned)check_packets[i].dropped);
+        }
+        check_report(what, detail);
+
+        dropped += check_packets[i].dropped;
+        reordered += (check_packets[i].gap & WSA_GAP_REORDERED) != 0;
+        late += (check_packets[i].gap & WSA_GAP_LATE) != 0;
+        early += (check_packets[i].gap & WSA_GAP_EARLY) != 0;
+    }
+
+    if (!check_failed) {
+        wsa_stats_read(&dev, &stats, 0);
+        check_counter(&stats, WSA_STAT_DROPPED, "dropped", dropped);
+        check_counter(&stats, WSA_STAT_REORDERED, "reordered", reordered);
+        check_counter(&stats, WSA_STAT_LATE, "late", late);
+        check_counter(&stats, WSA_STAT_EARLY, "early", early);
+    }
+
+    wsa_close(&dev);
+
+    return check_failed;
+}
@@ -0,0 +1,859 @@
+///
+/// @file
+/// wsacheck_sweep: checks what the sweep device derives from a capture against what it must be.
+///
+/// wsasim is started on loopback with a -30 dBm tone at 2.45 GHz, and power spectra are captured
+/// from it. Each view of a capture is then checked against the spectrum buffer of the same capture,
+/// worked out here the slow, obvious way:
+/// \li trace: every detector, at several trace lengths, against the bins each trace point covers;
+///     and with the buffer released, the peak trace still finds the tone
+/// \li pyramid: every node's min, max and sum against its bins, and zoomed views of several
+///     windows and widths against the bins each pixel covers, over two captures in a row
+/// \li segments: the blocks' bin and frequency ranges tile the buffer in order, their timestamps
+///     rise, and their reference level and trailer flags are what a second wsasim was told to send
+/// \li bands: sweeps of disjoint bands, one or two of them below the DD cutoff, keep each band's
+///     blocks within its own bins and fill every block, and the tone shows in the band it is in and
+///     nowhere else, from the first wsasim and from a third with its tone in the DD band; bands out
+///     of order or overlapping are turned away
+///
+/// Built and run by `make check`. Prints one line per check and exits non-zero if any fails.
+///
+/// Run with --help for the options.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_error.h"
+#include "wsa_sweep_device.h"
+#include "check.h"
+#include "test_sim.h"
+
+#define CHECK_CTRL_PORT 47501			///< Control port of the simulator started for the run
+#define CHECK_DATA_PORT 47500			///< Data port of the simulator started for the run
+#define CHECK_FLAGS_CTRL_PORT 47503		///< Control port of the simulator sending trailer flags
+#define CHECK_FLAGS_DATA_PORT 47502		///< Data port of the simulator sending trailer flags
+#define CHECK_FLAGS_REF_LEVEL -40		///< Reference level of the simulator sending trailer flags, below its tone
+#define CHECK_R5500_REF_OFFSET 15		///< What the library adds to an R5500's reference level (see REFLEVEL_OFFSET)
+#define CHECK_DD_CTRL_PORT 47505		///< Control port of the simulator with its tone in the DD band
+#define CHECK_DD_DATA_PORT 47504		///< Data port of the simulator with its tone in the DD band
+#define CHECK_TONE_FREQ 2450000000ULL	///< Frequency of the simulator's tone
+#define CHECK_DD_TONE_FREQ 25000000ULL	///< Frequency of the tone of the simulator for the DD band
+#define CHECK_BAND_CLEAR_DB 20.0		///< How far every other band's peak must be below the tone
+/// Allowed distance of the tone's peak from where it should be, as a fraction of its band's bins. The
+/// library lays bins out rbw apart, a little wider than the FFT's, so a tone far from the bin a block
+/// is placed by lands a few bins off.
+#define CHECK_BAND_SLIP 0.02
+#define CHECK_TONE_LEVEL -30.0			///< Level of the simulator's tone, in dBm
+#define CHECK_AVERAGE_DB 1e-3			///< Allowed difference of a power-averaged trace point, in dB
+#define CHECK_SUM_REL 1e-5				///< Allowed relative difference of a pyramid sum or zoomed mean
+
+/// A span to capture.
+struct check_span {
+    uint64_t fstart;
+    uint64_t fstop;
+    uint32_t rbw;
+    char const *mode;
+};
+
+/// A span of overlapping SH blocks around the tone, and one starting with a DD block.
+static struct check_span const check_spans[] = {
+    { 2400 * MHZ, 2500 * MHZ, 100000, "SH" },
+    { 20 * MHZ, 200 * MHZ, 100000, "SH" },
+};
+
+/// Options for the simulator sending trailer flags: every packet has sample loss, every other step is
+/// inverted, and the tone is over range.
+static char const * const check_flags_sim_args[] = {
+    "--ref-level", "-40", "--inversion", "alternate", "--sample-loss", "1", NULL
+};
+
+/// Options for the simulator with its tone in the DD band, at CHECK_DD_TONE_FREQ.
+static char const * const check_dd_sim_args[] = { "--tone-freq", "25000000", NULL };
+
+/// Sets of disjoint bands to sweep at once; in the second, two bands share the DD block.
+static struct {
+    char const *name;
+    uint32_t count;
+    uint64_t edges[3][2];
+} const check_band_sets[] = {
+    { "10-40, 900-1000, 2400-2500 MHz", 3,
+      { { 10 * MHZ, 40 * MHZ }, { 900 * MHZ, 1000 * MHZ }, { 2400 * MHZ, 2500 * MHZ } } },
+    { "5-15, 20-40, 2400-2500 MHz", 3,
+      { { 5 * MHZ, 15 * MHZ }, { 20 * MHZ, 40 * MHZ }, { 2400 * MHZ, 2500 * MHZ } } },
+};
+
+/// Zoom windows, as fractions of the buffer: first bin, bins and pixels. A pixel count of 0 asks for
+/// one pixel more than there are bins.
+static struct {
+    double first;
+    double bins;
+    uint32_t pixels;
+} const check_zooms[] = {
+    { 0, 1, 1 },
+    { 0, 1, 7 },
+    { 0, 1, 640 },
+    { 0.27, 0.43, 37 },
+    { 0.5, 0.01, 0 },
+    { 0.999, 0.001, 1 },
+};
+
+static char const * const check_detector_names[] = { "", "peak", "sample", "neg-peak", "average" };
+
+/// The options, as --help lists them.
+static char const check_options[] =
+    "  --sim PATH            simulator to start (default: wsasim next to this program)\n";
+
+
+///
+/// Allocate and configure a power spectrum for a span.
+///
+/// @return 0 on success, otherwise the library's error code.
+///
+static int16_t check_alloc( struct wsa_sweep_device *sweep_device, struct check_span const *span,
+                            struct wsa_power_spectrum_config **cfg )
+{
+    int16_t result;
+
+    result = wsa_power_spectrum_alloc(sweep_device, span->fstart, span->fstop, span->rbw, span->mode, cfg);
+    if (result < 0) {
+        return result;
+    }
+
+    result = wsa_configure_sweep(sweep_device, *cfg);
+    if (result < 0) {
+        wsa_power_spectrum_free(*cfg);
+    }
+
+    return result;
+}
+
+
+///
+/// Capture into cfg->buf, if it is kept.
+///
+static int16_t check_capture( struct wsa_sweep_device *sweep_device, struct wsa_power_spectrum_config *cfg )
+{
+    float *buf = cfg->buf;
+
+    return wsa_capture_power_spectrum(sweep_device, cfg, &buf);
+}
+
+
+///
+/// Work out one trace point from the spectrum buffer.
+///
+/// @return The trace point, or POISONED_BUFFER_VALUE if it covers no bins.
+///
+static float check_trace_point( float const *buf, uint32_t buflen, uint32_t tracelen, uint32_t detector, uint32_t point )
+{
+    // The bins b with floor(b * tracelen / buflen) == point.
+    uint32_t const first = (uint32_t)(((uint64_t)point * buflen + tracelen - 1) / tracelen);
+    uint32_t const end = (uint32_t)(((uint64_t)(point + 1) * buflen + tracelen - 1) / tracelen);
+    double sum = 0;
+    float v;
+    uint32_t b;
+
+    if (first >= end) {
+        return POISONED_BUFFER_VALUE;
+    }
+
+    v = buf[first];
+    for (b = first; b < end; b++) {
+        if (detector == WSA_TRACE_DETECTOR_PEAK && buf[b] > v) {
+            v = buf[b];
+        } else if (detector == WSA_TRACE_DETECTOR_NEG_PEAK && buf[b] < v) {
+            v = buf[b];
+        }
+        sum += pow(10.0, buf[b] / 10.0);
+    }
+
+    if (detector == WSA_TRACE_DETECTOR_AVERAGE) {
+        v = (float)(10.0 * log10(sum / (end - first)));
+    }
+
+    return v;
+}
+
+
+///
+/// Check every detector at several trace lengths against the spectrum buffer of the same capture.
+///
+static int16_t check_trace( struct wsa_sweep_device *sweep_device, struct check_span const *span )
+{
+    struct wsa_power_spectrum_config *cfg;
+    uint32_t tracelens[4];
+    uint32_t detector;
+    uint32_t t, p;
+    uint32_t bad;
+    float expect;
+    char what[64];
+    char detail[128];
+    int16_t result;
+
+    result = check_alloc(sweep_device, span, &cfg);
+    if (result < 0) {
+        return result;
+    }
+
+    // One point, a length that does not divide the buffer, a display width, and one point per bin.
+    tracelens[0] = 1;
+    tracelens[1] = 7;
+    tracelens[2] = cfg->buflen / 3 + 1;
+    tracelens[3] = cfg->buflen;
+
+    for (detector = WSA_TRACE_DETECTOR_PEAK; detector <= WSA_TRACE_DETECTOR_AVERAGE; detector++) {
+        for (t = 0; t < 4; t++) {
+            result = wsa_power_spectrum_set_trace(cfg, tracelens[t], detector, 1);
+            if (result >= 0) {
+                result = check_capture(sweep_device, cfg);
+            }
+            if (result < 0) {
+                wsa_power_spectrum_free(cfg);
+                return result;
+            }
+
+            snprintf(what, sizeof(what), "trace %s %u-%u MHz, %u of %u", check_detector_names[detector],
+                     (unsigned)(span->fstart / MHZ), (unsigned)(span->fstop / MHZ), (unsigned)tracelens[t],
+                     (unsigned)cfg->buflen);
+
+            bad = 0;
+            for (p = 0; p < tracelens[t]; p++) {
+                expect = check_trace_point(cfg->buf, cfg->buflen, tracelens[t], detector, p);
+                if ((detector == WSA_TRACE_DETECTOR_AVERAGE) ? (fabs(cfg->trace[p] - expect) > CHECK_AVERAGE_DB)
+                                                             : (cfg->trace[p] != expect)) {
+                    if (bad++ == 0) {
+                        snprintf(detail, sizeof(detail), "point %u is %f, bins give %f", (unsigned)p,
+                                 cfg->trace[p], expect);
+                    }
+                }
+            }
+            check_report(what, bad ? detail : "");
+        }
+    }
+
+    wsa_power_spectrum_free(cfg);
+
+    return 0;
+}
+
+
+///
+/// Check that with the buffer released, the peak trace still shows the tone where it is.
+///
+static int16_t check_trace_only( struct wsa_sweep_device *sweep_device, struct check_span const *span )
+{
+    struct wsa_power_spectrum_config *cfg;
+    uint32_t const tracelen = 100;
+    uint32_t peak = 0;
+    uint32_t tone;
+    uint32_t p;
+    char what[64];
+    char detail[128];
+    int16_t result;
+
+    result = check_alloc(sweep_device, span, &cfg);
+    if (result < 0) {
+        return result;
+    }
+
+    result = wsa_power_spectrum_set_trace(cfg, tracelen, WSA_TRACE_DETECTOR_PEAK, 0);
+    if (result >= 0) {
+        result = check_capture(sweep_device, cfg);
+    }
+    if (result < 0) {
+        wsa_power_spectrum_free(cfg);
+        return result;
+    }
+
+    snprintf(what, sizeof(what), "trace peak %u-%u MHz, no buffer", (unsigned)(span->fstart / MHZ),
+             (unsigned)(span->fstop / MHZ));
+
+    for (p = 1; p < tracelen; p++) {
+        if (cfg->trace[p] > cfg->trace[peak]) {
+            peak = p;
+        }
+    }
+    tone = (uint32_t)((double)(CHECK_TONE_FREQ - cfg->fstart_actual) / (cfg->fstop_actual - cfg->fstart_actual)
+                      * tracelen);
+
+    detail[0] = '\0';
+    if (cfg->buf != NULL) {
+        snprintf(detail, sizeof(detail), "the buffer was kept");
+    } else if (peak + 1 < tone || peak > tone + 1 || fabs(cfg->trace[peak] - CHECK_TONE_LEVEL) > 6) {
+        snprintf(detail, sizeof(detail), "peak %f dBm at point %u, tone is %.0f dBm at point %u", cfg->trace[peak],
+                 (unsigned)peak, CHECK_TONE_LEVEL, (unsigned)tone);
+    }
+    check_report(what, detail);
+
+    wsa_power_spectrum_free(cfg);
+
+    return 0;
+}
+
+
+///
+/// Work out the min, max and mean of bins [first, end) of the spectrum buffer.
+///
+static void check_bins( float const *buf, uint32_t first, uint32_t end, float *vmin, float *vmax, double *sum )
+{
+    uint32_t b;
+
+    *vmin = *vmax = buf[first];
+    *sum = 0;
+    for (b = first; b < end; b++) {
+        if (buf[b] < *vmin) {
+            *vmin = buf[b];
+        }
+        if (buf[b] > *vmax) {
+            *vmax = buf[b];
+        }
+        *sum += buf[b];
+    }
+}
+
+
+///
+/// Check the zoom pyramid of a capture against its spectrum buffer.
+///
+static void check_pyramid_nodes( struct wsa_power_spectrum_config const *cfg, char const *what )
+{
+    struct wsa_spectrum_pyramid const *pyr = cfg->pyramid;
+    uint32_t k, j, node;
+    uint32_t first, end;
+    uint32_t bad = 0;
+    float vmin, vmax;
+    double sum;
+    char detail[128];
+
+    for (k = 1; k < pyr->levels; k++) {
+        for (j = 0; j < pyr->level_len[k]; j++) {
+            first = j << k;
+            end = (first + (1U << k) < cfg->buflen) ? first + (1U << k) : cfg->buflen;
+            check_bins(cfg->buf, first, end, &vmin, &vmax, &sum);
+            node = pyr->level_offset[k] + j;
+            if (pyr->min[node] != vmin || pyr->max[node] != vmax ||
+                fabs(pyr->sum[node] - sum) > CHECK_SUM_REL * fabs(sum)) {
+                if (bad++ == 0) {
+                    snprintf(detail, sizeof(detail), "level %u node %u has %f/%f/%f, bins give %f/%f/%f",
+                             (unsigned)k, (unsigned)j, pyr->min[node], pyr->max[node], pyr->sum[node], vmin, vmax,
+                             sum);
+                }
+            }
+        }
+    }
+
+    // The top level is a single node over the whole buffer.
+    if (!bad && pyr->level_len[pyr->levels - 1] != 1) {
+        snprintf(detail, sizeof(detail), "top level has %u nodes", (unsigned)pyr->level_len[pyr->levels - 1]);
+        bad = 1;
+    }
+
+    check_report(what, bad ? detail : "");
+}
+
+
+///
+/// Check a zoomed view of a capture against its spectrum buffer.
+///
+static int16_t check_pyramid_zoom( struct wsa_power_spectrum_config const *cfg, char const *what, uint32_t first_bin,
+                                   uint32_t nbins, uint32_t pixels )
+{
+    float *zmin;
+    float *zmax;
+    float *zmean;
+    uint32_t p, lo, hi;
+    uint32_t bad = 0;
+    float vmin, vmax;
+    double sum;
+    char detail[128];
+    int16_t result;
+
+    zmin = malloc(sizeof(float) * pixels * 3);
+    if (zmin == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+    zmax = zmin + pixels;
+    zmean = zmax + pixels;
+
+    result = wsa_power_spectrum_zoom(cfg, first_bin, nbins, pixels, zmin, zmax, zmean);
+    if (result < 0) {
+        free(zmin);
+        return result;
+    }
+
+    for (p = 0; p < pixels; p++) {
+        // As documented: pixel p covers its share of the bins, or the one bin it falls on.
+        lo = first_bin + (uint32_t)(((uint64_t)p * nbins) / pixels);
+        hi = first_bin + (uint32_t)(((uint64_t)(p + 1) * nbins) / pixels);
+        if (hi <= lo) {
+            hi = lo + 1;
+        }
+        check_bins(cfg->buf, lo, hi, &vmin, &vmax, &sum);
+        sum /= hi - lo;
+        if (zmin[p] != vmin || zmax[p] != vmax || fabs(zmean[p] - sum) > CHECK_SUM_REL * fabs(sum)) {
+            if (bad++ == 0) {
+                snprintf(detail, sizeof(detail), "pixel %u has %f/%f/%f, bins %u-%u give %f/%f/%f", (unsigned)p,
+                         zmin[p], zmax[p], zmean[p], (unsigned)lo, (unsigned)hi, vmin, vmax, sum);
+            }
+        }
+    }
+
+    check_report(what, bad ? detail : "");
+
+    free(zmin);
+
+    return 0;
+}
+
+
+///
+/// Check the zoom pyramid against the spectrum buffer over two captures in a row, so that a part of the
+/// pyramid left over from the first would show.
+///
+static int16_t check_pyramid( struct wsa_sweep_device *sweep_device, struct check_span const *span )
+{
+    struct wsa_power_spectrum_config *cfg;
+    uint32_t first, nbins, pixels;
+    int capture;
+    size_t z;
+    char what[96];
+    int16_t result;
+
+    result = check_alloc(sweep_device, span, &cfg);
+    if (result >= 0) {
+        result = wsa_power_spectrum_set_pyramid(cfg, 1);
+        if (result < 0) {
+            wsa_power_spectrum_free(cfg);
+        }
+    }
+    if (result < 0) {
+        return result;
+    }
+
+    for (capture = 1; capture <= 2 && result >= 0; capture++) {
+        result = check_capture(sweep_device, cfg);
+        if (result < 0) {
+            break;
+        }
+
+        snprintf(what, sizeof(what), "pyramid %u-%u MHz, capture %d, %u levels", (unsigned)(span->fstart / MHZ),
+                 (unsigned)(span->fstop / MHZ), capture, (unsigned)cfg->pyramid->levels);
+        check_pyramid_nodes(cfg, what);
+
+        for (z = 0; z < sizeof(check_zooms) / sizeof(check_zooms[0]) && result >= 0; z++) {
+            first = (uint32_t)(check_zooms[z].first * cfg->buflen);
+            nbins = (uint32_t)(check_zooms[z].bins * cfg->buflen);
+            if (nbins == 0) {
+                nbins = 1;
+            }
+            if (first + nbins > cfg->buflen) {
+                first = cfg->buflen - nbins;
+            }
+            pixels = check_zooms[z].pixels ? check_zooms[z].pixels : nbins + 1;
+
+            snprintf(what, sizeof(what), "zoom %u-%u MHz, capture %d, bins %u+%u to %u pixels",
+                     (unsigned)(span->fstart / MHZ), (unsigned)(span->fstop / MHZ), capture, (unsigned)first,
+                     (unsigned)nbins, (unsigned)pixels);
+            result = check_pyramid_zoom(cfg, what, first, nbins, pixels);
+        }
+    }
+
+    wsa_power_spectrum_free(cfg);
+
+    return result;
+}
+
+
+///
+/// Check the block metadata of a capture: the blocks' bins and frequencies tile the buffer in order,
+/// their timestamps rise, each reports its centre frequency and the expected reference level.
+///
+static int16_t check_segments( struct wsa_sweep_device *sweep_device, struct check_span const *span, char const *sim,
+                               float reflevel )
+{
+    struct wsa_power_spectrum_config *cfg;
+    struct wsa_spectrum_segment const *seg;
+    double bin_hz;
+    uint32_t i;
+    uint32_t bad = 0;
+    uint32_t first_sh;
+    char what[96];
+    char detail[160];
+    int16_t result;
+
+    result = check_alloc(sweep_device, span, &cfg);
+    if (result >= 0) {
+        result = check_capture(sweep_device, cfg);
+        if (result < 0) {
+            wsa_power_spectrum_free(cfg);
+        }
+    }
+    if (result < 0) {
+        return result;
+    }
+
+    snprintf(what, sizeof(what), "segments %u-%u MHz, %s, %u blocks", (unsigned)(span->fstart / MHZ),
+             (unsigned)(span->fstop / MHZ), sim, (unsigned)cfg->segment_count);
+
+    bin_hz = (double)(cfg->fstop_actual - cfg->fstart_actual) / cfg->buflen;
+
+    // The DD block reports no centre frequency of its own.
+    first_sh = cfg->bands[0].dd_mode ? 1 : 0;
+
+    for (i = 0; i < cfg->segment_count && !bad; i++) {
+        seg = &cfg->segments[i];
+        bad = 1;
+        if (seg->bin_count == 0) {
+            snprintf(detail, sizeof(detail), "block %u wrote no bins", (unsigned)i);
+        } else if (i == 0 && seg->bin_offset != 0) {
+            snprintf(detail, sizeof(detail), "first block starts at bin %u", (unsigned)seg->bin_offset);
+        } else if (i > 0 && (seg->bin_offset <= seg[-1].bin_offset || seg->bin_offset > seg[-1].bin_offset + seg[-1].bin_count)) {
+            snprintf(detail, sizeof(detail), "block %u at bins %u+%u does not follow on from %u+%u", (unsigned)i,
+                     (unsigned)seg->bin_offset, (unsigned)seg->bin_count, (unsigned)seg[-1].bin_offset,
+                     (unsigned)seg[-1].bin_count);
+        } else if (i + 1 == cfg->segment_count && seg->bin_offset + seg->bin_count != cfg->buflen) {
+            snprintf(detail, sizeof(detail), "last block ends at bin %u of %u", (unsigned)(seg->bin_offset + seg->bin_count),
+                     (unsigned)cfg->buflen);
+        } else if (fabs((double)seg->fstart - (cfg->fstart_actual + seg->bin_offset * bin_hz)) > 1 ||
+                   fabs((double)seg->fstop - (cfg->fstart_actual + (seg->bin_offset + seg->bin_count) * bin_hz)) > 1) {
+            snprintf(detail, sizeof(detail), "block %u covers %llu-%llu Hz, its bins %u+%u are at %.0f-%.0f Hz",
+                     (unsigned)i, (unsigned long long)seg->fstart, (unsigned long long)seg->fstop,
+                     (unsigned)seg->bin_offset, (unsigned)seg->bin_count, cfg->fstart_actual + seg->bin_offset * bin_hz,
+                     cfg->fstart_actual + (seg->bin_offset + seg->bin_count) * bin_hz);
+        } else if (i >= first_sh && (seg->fcenter < seg->fstart || seg->fcenter > seg->fstop)) {
+            snprintf(detail, sizeof(detail), "block %u centre %llu Hz is outside %llu-%llu Hz", (unsigned)i,
+                     (unsigned long long)seg->fcenter, (unsigned long long)seg->fstart,
+                     (unsigned long long)seg->fstop);
+        } else if (i > 0 && (seg->timestamp.sec < seg[-1].timestamp.sec ||
+                             (seg->timestamp.sec == seg[-1].timestamp.sec && seg->timestamp.psec <= seg[-1].timestamp.psec))) {
+            snprintf(detail, sizeof(detail), "block %u timestamp %u.%012llu is not after %u.%012llu", (unsigned)i,
+                     (unsigned)seg->timestamp.sec, (unsigned long long)seg->timestamp.psec,
+                     (unsigned)seg[-1].timestamp.sec, (unsigned long long)seg[-1].timestamp.psec);
+        } else if (seg->reflevel != reflevel) {
+            snprintf(detail, sizeof(detail), "block %u reference level %.1f dBm, expected %.1f", (unsigned)i,
+                     seg->reflevel, reflevel);
+        } else {
+            bad = 0;
+        }
+    }
+
+    check_report(what, bad ? detail : "");
+
+    wsa_power_spectrum_free(cfg);
+
+    return 0;
+}
+
+
+///
+/// Check the trailer flags of each block against what the flags simulator sends: sample loss on every
+/// packet, every other step inverted starting with the second, and over range where the tone is.
+///
+static int16_t check_segment_flags( struct wsa_sweep_device *sweep_device, struct check_span const *span )
+{
+    struct wsa_power_spectrum_config *cfg;
+    struct wsa_spectrum_segment const *seg;
+    uint32_t i;
+    uint32_t bad = 0;
+    uint8_t tone;
+    char what[96];
+    char detail[160];
+    int16_t result;
+
+    result = check_alloc(sweep_device, span, &cfg);
+    if (result >= 0) {
+        result = check_capture(sweep_device, cfg);
+        if (result < 0) {
+            wsa_power_spectrum_free(cfg);
+        }
+    }
+    if (result < 0) {
+        return result;
+    }
+
+    snprintf(what, sizeof(what), "segment flags %u-%u MHz, %u blocks", (unsigned)(span->fstart / MHZ),
+             (unsigned)(span->fstop / MHZ), (unsigned)cfg->segment_count);
+
+    for (i = 0; i < cfg->segment_count && !bad; i++) {
+        seg = &cfg->segments[i];
+        tone = (CHECK_TONE_FREQ >= seg->fstart && CHECK_TONE_FREQ < seg->fstop);
+        if (!seg->sample_loss || seg->spectral_inversion != (i & 1) || seg->over_range != tone) {
+            snprintf(detail, sizeof(detail), "block %u has sample loss %u, inversion %u, over range %u; expected 1, %u, %u",
+                     (unsigned)i, (unsigned)seg->sample_loss, (unsigned)seg->spectral_inversion,
+                     (unsigned)seg->over_range, (unsigned)(i & 1), (unsigned)tone);
+            bad = 1;
+        }
+    }
+
+    check_report(what, bad ? detail : "");
+
+    wsa_power_spectrum_free(cfg);
+
+    return 0;
+}
+
+
+///
+/// Check a sweep of several bands: each block stays within the bins of one band, the blocks tile
+/// the buffer in order, every block was filled, and the tone peaks where it is in its band, well
+/// above the peaks of the other bands.
+///
+static int16_t check_bands( struct wsa_sweep_device *sweep_device, size_t set, char const *sim, uint64_t tone )
+{
+    struct wsa_sweep_band bands[3];
+    struct wsa_power_spectrum_config *cfg;
+    struct wsa_sweep_band const *band;
+    struct wsa_spectrum_segment const *seg;
+    uint32_t const count = check_band_sets[set].count;
+    uint32_t b, i, t;
+    uint32_t end;
+    uint32_t peak;
+    uint32_t expect = 0;
+    uint32_t slip = 0;
+    float other = -1000.0f;
+    char what[128];
+    char detail[160];
+    int16_t result;
+
+    memset(bands, 0, sizeof(bands));
+    for (b = 0; b < count; b++) {
+        bands[b].fstart = check_band_sets[set].edges[b][0];
+        bands[b].fstop = check_band_sets[set].edges[b][1];
+    }
+
+    result = wsa_power_spectrum_alloc_bands(sweep_device, bands, count, 100000, "SH", &cfg);
+    if (result < 0) {
+        return result;
+    }
+    result = wsa_configure_sweep(sweep_device, cfg);
+    if (result >= 0) {
+        result = check_capture(sweep_device, cfg);
+    }
+    if (result < 0) {
+        wsa_power_spectrum_free(cfg);
+        return result;
+    }
+
+    snprintf(what, sizeof(what), "bands %s, %s, blocks of %u in %u bands", check_band_sets[set].name, sim,
+             (unsigned)cfg->segment_count, (unsigned)count);
+
+    // The blocks, in order, each within the band its first bin is in.
+    detail[0] = '\0';
+    b = 0;
+    end = 0;
+    for (i = 0; i < cfg->segment_count && !detail[0]; i++) {
+        seg = &cfg->segments[i];
+        while (b + 1 < count && seg->bin_offset >= cfg->bands[b + 1].bin_offset) {
+            b++;
+        }
+        band = &cfg->bands[b];
+        if (seg->bin_count == 0) {
+            snprintf(detail, sizeof(detail), "block %u was not filled", (unsigned)i);
+        } else if (seg->bin_offset > end || (i > 0 && seg->bin_offset <= seg[-1].bin_offset)) {
+            snprintf(detail, sizeof(detail), "block %u at bins %u+%u does not follow on from bin %u", (unsigned)i,
+                     (unsigned)seg->bin_offset, (unsigned)seg->bin_count, (unsigned)end);
+        } else if (seg->bin_offset + seg->bin_count > band->bin_offset + band->bin_count) {
+            snprintf(detail, sizeof(detail), "block %u at bins %u+%u runs past band %u at %u+%u", (unsigned)i,
+                     (unsigned)seg->bin_offset, (unsigned)seg->bin_count, (unsigned)b, (unsigned)band->bin_offset,
+                     (unsigned)band->bin_count);
+        } else if (seg->fstart < band->fstart_actual || seg->fstop > band->fstop_actual) {
+            snprintf(detail, sizeof(detail), "block %u covers %llu-%llu Hz, outside band %u", (unsigned)i,
+                     (unsigned long long)seg->fstart, (unsigned long long)seg->fstop, (unsigned)b);
+        }
+        if (seg->bin_offset + seg->bin_count > end) {
+            end = seg->bin_offset + seg->bin_count;
+        }
+    }
+    if (!detail[0] && end != cfg->buflen) {
+        snprintf(detail, sizeof(detail), "the blocks end at bin %u of %u", (unsigned)end, (unsigned)cfg->buflen);
+    }
+    check_report(what, detail);
+
+    // The tone, in the band it is in, and the highest peak of the others.
+    snprintf(what, sizeof(what), "bands %s, %s, tone at %llu Hz", check_band_sets[set].name, sim,
+             (unsigned long long)tone);
+    t = count;
+    peak = 0;
+    for (b = 0; b < count; b++) {
+        band = &cfg->bands[b];
+        for (i = band->bin_offset; i < band->bin_offset + band->bin_count; i++) {
+            if (tone >= band->fstart_actual && tone < band->fstop_actual) {
+                if (t != b || cfg->buf[i] > cfg->buf[peak]) {
+                    peak = i;
+                }
+                t = b;
+            } else if (cfg->buf[i] > other) {
+                other = cfg->buf[i];
+            }
+        }
+        if (t == b) {
+            expect = band->bin_offset + (uint32_t)((double)(tone - band->fstart_actual) /
+                                                   (band->fstop_actual - band->fstart_actual) * band->bin_count);
+            slip = 1 + (uint32_t)(CHECK_BAND_SLIP * band->bin_count);
+        }
+    }
+
+    detail[0] = '\0';
+    if (t == count) {
+        snprintf(detail, sizeof(detail), "no band holds the tone");
+    } else if (peak + slip < expect || peak > expect + slip || fabs(cfg->buf[peak] - CHECK_TONE_LEVEL) > 6) {
+        snprintf(detail, sizeof(detail), "band %u peaks at %f dBm at bin %u, tone is %.0f dBm at bin %u", (unsigned)t,
+                 cfg->buf[peak], (unsigned)peak, CHECK_TONE_LEVEL, (unsigned)expect);
+    } else if (other > cfg->buf[peak] - CHECK_BAND_CLEAR_DB) {
+        snprintf(detail, sizeof(detail), "another band peaks at %f dBm, the tone at %f dBm", other, cfg->buf[peak]);
+    }
+    check_report(what, detail);
+
+    wsa_power_spectrum_free(cfg);
+
+    return 0;
+}
+
+
+///
+/// Check that bands out of order or overlapping are turned away.
+///
+static void check_band_errors( struct wsa_sweep_device *sweep_device )
+{
+    struct wsa_sweep_band bands[2];
+    struct wsa_power_spectrum_config *cfg = NULL;
+    char detail[64];
+    uint8_t ok;
+
+    memset(bands, 0, sizeof(bands));
+    bands[0].fstart = 2400 * MHZ;
+    bands[0].fstop = 2500 * MHZ;
+    bands[1].fstart = 900 * MHZ;
+    bands[1].fstop = 1000 * MHZ;
+    ok = check_refused(wsa_power_spectrum_alloc_bands(sweep_device, bands, 2, 100000, "SH", &cfg),
+                       "bands out of order taken", detail, sizeof(detail));
+    bands[1].fstart = 2450 * MHZ;
+    bands[1].fstop = 2550 * MHZ;
+    ok = ok && check_refused(wsa_power_spectrum_alloc_bands(sweep_device, bands, 2, 100000, "SH", &cfg),
+                             "overlapping bands taken", detail, sizeof(detail));
+    check_report("bands out of order or overlapping", ok ? "" : detail);
+
+    if (!ok && cfg) {
+        wsa_power_spectrum_free(cfg);
+    }
+}
+
+
+int main( int argc, char *argv[] )
+{
+    struct wsa_device dev;
+    struct wsa_device flags_dev;
+    struct wsa_device dd_dev;
+    struct wsa_sweep_device *sweep_device;
+    struct wsa_sweep_device *flags_sweep_device;
+    struct wsa_sweep_device *dd_sweep_device;
+    char sim_path[1024];
+    pid_t sim;
+    pid_t flags_sim;
+    pid_t dd_sim;
+    int opened;
+    int16_t result = 0;
+    size_t s;
+    int i;
+
+    test_sim_path(argv[0], sim_path, sizeof(sim_path));
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--sim") && i + 1 < argc) {
+            snprintf(sim_path, sizeof(sim_path), "%s", argv[++i]);
+        } else {
+            return check_usage(argv[0], argv[i], check_options);
+        }
+    }
+
+    sim = test_sim_start(sim_path, CHECK_CTRL_PORT, CHECK_DATA_PORT, NULL);
+    flags_sim = test_sim_start(sim_path, CHECK_FLAGS_CTRL_PORT, CHECK_FLAGS_DATA_PORT, check_flags_sim_args);
+    dd_sim = test_sim_start(sim_path, CHECK_DD_CTRL_PORT, CHECK_DD_DATA_PORT, check_dd_sim_args);
+    if (sim < 0 || flags_sim < 0 || dd_sim < 0) {
+        fprintf(stderr, "failed to start simulator %s\n", sim_path);
+        test_sim_stop(sim);
+        test_sim_stop(flags_sim);
+        test_sim_stop(dd_sim);
+        return 1;
+    }
+
+    // Devices are opened in turn, and closed in reverse, as far as they got.
+    opened = 0;
+    if (check_open(&dev, CHECK_CTRL_PORT, CHECK_DATA_PORT) >= 0) {
+        sweep_device = wsa_sweep_device_new(&dev);
+        opened = 1;
+        if (check_open(&flags_dev, CHECK_FLAGS_CTRL_PORT, CHECK_FLAGS_DATA_PORT) >= 0) {
+            flags_sweep_device = wsa_sweep_device_new(&flags_dev);
+            opened = 2;
+            if (check_open(&dd_dev, CHECK_DD_CTRL_PORT, CHECK_DD_DATA_PORT) >= 0) {
+                dd_sweep_device = wsa_sweep_device_new(&dd_dev);
+                opened = 3;
+            }
+        }
+    }
+    if (opened < 3) {
+        check_failed = 1;
+    }
+
+    for (s = 0; s < sizeof(check_spans) / sizeof(check_spans[0]) && opened == 3 && result >= 0; s++) {
+        result = check_trace(sweep_device, &check_spans[s]);
+    }
+    if (opened == 3 && result >= 0) {
+        result = check_trace_only(sweep_device, &check_spans[0]);
+    }
+    for (s = 0; s < sizeof(check_spans) / sizeof(check_spans[0]) && opened == 3 && result >= 0; s++) {
+        result = check_pyramid(sweep_device, &check_spans[s]);
+    }
+    for (s = 0; s < sizeof(check_spans) / sizeof(check_spans[0]) && opened == 3 && result >= 0; s++) {
+        result = check_segments(sweep_device, &check_spans[s], "plain", CHECK_R5500_REF_OFFSET);
+        if (result >= 0) {
+            result = check_segments(flags_sweep_device, &check_spans[s], "flags",
+                                    CHECK_FLAGS_REF_LEVEL + CHECK_R5500_REF_OFFSET);
+        }
+    }
+    if (opened == 3 && result >= 0) {
+        result = check_segment_flags(flags_sweep_device, &check_spans[0]);
+    }
+    for (s = 0; s < sizeof(check_band_sets) / sizeof(check_band_sets[0]) && opened == 3 && result >= 0; s++) {
+        result = check_bands(sweep_device, s, "plain", CHECK_TONE_FREQ);
+        if (result >= 0) {
+            result = check_bands(dd_sweep_device, s, "DD tone", CHECK_DD_TONE_FREQ);
+        }
+    }
+    if (opened == 3) {
+        check_band_errors(sweep_device);
+    }
+
+    if (result < 0) {
+        fprintf(stderr, "capture failed: %s\n", wsa_get_error_msg(result));
+        check_failed = 1;
+    }
+
+    if (opened > 2) {
+        wsa_sweep_device_free(dd_sweep_device);
+        wsa_close(&dd_dev);
+    }
+    if (opened > 1) {
+        wsa_sweep_device_free(flags_sweep_device);
+        wsa_close(&flags_dev);
+    }
+    if (opened > 0) {
+        wsa_sweep_device_free(sweep_device);
+        wsa_close(&dev);
+    }
+    test_sim_stop(dd_sim);
+    test_sim_stop(flags_sim);
+    test_sim_stop(sim);
+
+    return check_failed;
+}
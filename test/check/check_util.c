@@ -0,0 +1,85 @@
+///
+/// @file
+/// What the check programs share (see check.h).
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <stdio.h>
+#include <string.h>
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_error.h"
+#include "check.h"
+
+int check_failed = 0;
+
+
+void check_report( char const *what, char const *detail )
+{
+    if (detail[0]) {
+        printf("FAIL %s: %s\n", what, detail);
+        check_failed = 1;
+    } else {
+        printf("ok   %s\n", what);
+    }
+}
+
+
+uint32_t check_rand( uint32_t *state )
+{
+    *state = *state * 1664525u + 1013904223u;
+
+    return *state >> 8;
+}
+
+
+int check_usage( char const *prog, char const *arg, char const *options )
+{
+    if (options) {
+        printf("Usage: %s [options]\n%s", prog, options);
+    } else {
+        printf("Usage: %s\n", prog);
+    }
+
+    return strcmp(arg, "--help") ? 1 : 0;
+}
+
+
+uint8_t check_refused( int16_t result, char const *taken, char *detail, size_t size )
+{
+    if (result != WSA_ERR_INVINPUT) {
+        snprintf(detail, size, "%s", taken);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+uint8_t check_accepted( int16_t result, char const *refused, char *detail, size_t size )
+{
+    if (result < 0) {
+        snprintf(detail, size, "%s", refused);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+int16_t check_open( struct wsa_device *dev, int ctrl_port, int data_port )
+{
+    char intf[64];
+    int16_t result;
+
+    snprintf(intf, sizeof(intf), "TCPIP::127.0.0.1::%d,%d", ctrl_port, data_port);
+
+    result = wsa_open(dev, intf);
+    if (result < 0) {
+        fprintf(stderr, "wsa_open(%s) failed: %s\n", intf, wsa_get_error_msg(result));
+    }
+
+    return result;
+}
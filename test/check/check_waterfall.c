@@ -0,0 +1,301 @@
+///
+/// @file
+/// wsacheck_waterfall: checks the waterfall ring (see wsa_waterfall.h) against fixed spectra.
+///
+/// Spectrum n is a ramp, bin b at -100 + n + b dBm, so every row it reduces to is known:
+/// \li rows: each detector at a width that divides the bins, one that does not, and one wider than
+///     the spectrum, against the bins each point covers
+/// \li wrap: after every push, across several turns of the ring, the latest rows are one block,
+///     oldest first, with their numbers, sizes, times and ranges
+/// \li intact: rows read stay intact until the push that reuses the oldest one's slot
+/// \li range: the colour range of the latest rows, and the errors for bad arguments
+///
+/// Built and run by `make check`. Prints one line per check and exits non-zero if any fails.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "wsa_lib.h"
+#include "wsa_error.h"
+#include "wsa_sweep_device.h"
+#include "wsa_waterfall.h"
+#include "check.h"
+
+#define CHECK_BINS 16					///< Bins in each spectrum
+#define CHECK_ROWS 4					///< Rows in the ring
+#define CHECK_PUSHES 11					///< Spectra pushed, almost three turns of the ring
+#define CHECK_AVERAGE_DB 1e-4			///< Allowed difference of a power-averaged point, in dB
+
+static char const * const check_detector_names[] = { "", "peak", "sample", "neg-peak", "average" };
+
+
+///
+/// Fill spectrum n.
+///
+static void check_spectrum( uint32_t n, float *spectrum )
+{
+    uint32_t b;
+
+    for (b = 0; b < CHECK_BINS; b++) {
+        spectrum[b] = -100.0f + (float)n + (float)b;
+    }
+}
+
+
+///
+/// Work out point p of spectrum n reduced to a width, the slow way.
+///
+static float check_point( uint32_t n, uint32_t width, uint32_t detector, uint32_t p )
+{
+    uint32_t b;
+    uint32_t first = CHECK_BINS;
+    uint32_t last = 0;
+    double sum = 0;
+
+    // The bins b with floor(b * width / bins) == p.
+    for (b = 0; b < CHECK_BINS; b++) {
+        if ((b * width) / CHECK_BINS == p) {
+            if (b < first) {
+                first = b;
+            }
+            last = b;
+            sum += pow(10.0, (-100.0 + n + b) / 10.0);
+        }
+    }
+
+    // A point with no bin of its own shows the one it falls in.
+    if (first == CHECK_BINS) {
+        return -100.0f + (float)n + (float)((p * CHECK_BINS) / width);
+    }
+
+    switch (detector) {
+    case WSA_TRACE_DETECTOR_PEAK:
+        return -100.0f + (float)n + (float)last;
+    case WSA_TRACE_DETECTOR_AVERAGE:
+        return (float)(10.0 * log10(sum / (last - first + 1)));
+    default:
+        return -100.0f + (float)n + (float)first;
+    }
+}
+
+
+///
+/// Check the rows of every detector at a width against the bins each point covers.
+///
+static int16_t check_rows( uint32_t width )
+{
+    struct wsa_waterfall *wf;
+    struct wsa_waterfall_row const *info;
+    float spectrum[CHECK_BINS];
+    float const *rows;
+    float expect;
+    uint32_t detector;
+    uint32_t p;
+    char what[64];
+    char detail[128];
+    int16_t result;
+
+    check_spectrum(5, spectrum);
+
+    for (detector = WSA_TRACE_DETECTOR_PEAK; detector <= WSA_TRACE_DETECTOR_AVERAGE; detector++) {
+        result = wsa_waterfall_alloc(width, CHECK_ROWS, detector, &wf);
+        if (result < 0) {
+            return result;
+        }
+        result = wsa_waterfall_push(wf, spectrum, CHECK_BINS, NULL);
+        if (result < 0) {
+            wsa_waterfall_free(wf);
+            return result;
+        }
+
+        snprintf(what, sizeof(what), "row %s, %u bins to %u points", check_detector_names[detector],
+                 (unsigned)CHECK_BINS, (unsigned)width);
+        detail[0] = '\0';
+
+        if (wsa_waterfall_latest(wf, 1, &rows, &info, NULL) != 1) {
+            snprintf(detail, sizeof(detail), "no row");
+        }
+        for (p = 0; p < width && !detail[0]; p++) {
+            expect = check_point(5, width, detector, p);
+            if ((detector == WSA_TRACE_DETECTOR_AVERAGE) ? (fabs(rows[p] - expect) > CHECK_AVERAGE_DB)
+                                                         : (rows[p] != expect)) {
+                snprintf(detail, sizeof(detail), "point %u is %f, bins give %f", (unsigned)p, rows[p], expect);
+            }
+        }
+        check_report(what, detail);
+
+        wsa_waterfall_free(wf);
+    }
+
+    return 0;
+}
+
+
+///
+/// Check the latest rows after every push, across several turns of the ring, and that rows read stay
+/// intact until the oldest one's slot is reused.
+///
+static int16_t check_wrap( void )
+{
+    struct wsa_waterfall *wf;
+    struct wsa_waterfall_row const *info;
+    struct wsa_time time_stamp;
+    float spectrum[CHECK_BINS];
+    float const *rows;
+    float lo, hi;
+    uint32_t const width = 4;
+    uint32_t n, got, want, first;
+    uint32_t i, p;
+    uint32_t number;
+    char what[64];
+    char detail[160];
+    int16_t result;
+
+    result = wsa_waterfall_alloc(width, CHECK_ROWS, WSA_TRACE_DETECTOR_PEAK, &wf);
+    if (result < 0) {
+        return result;
+    }
+
+    snprintf(what, sizeof(what), "range of an empty waterfall");
+    detail[0] = '\0';
+    if (wsa_waterfall_range(wf, CHECK_ROWS, &lo, &hi) != WSA_ERR_INVINPUT ||
+        wsa_waterfall_latest(wf, CHECK_ROWS, &rows, &info, &first) != 0) {
+        snprintf(detail, sizeof(detail), "rows given before any was pushed");
+    }
+    check_report(what, detail);
+
+    for (n = 0; n < CHECK_PUSHES; n++) {
+        check_spectrum(n, spectrum);
+        time_stamp.sec = 1500000000 + n;
+        time_stamp.psec = 250000000000ULL;
+        result = wsa_waterfall_push(wf, spectrum, CHECK_BINS, &time_stamp);
+        if (result < 0) {
+            wsa_waterfall_free(wf);
+            return result;
+        }
+
+        // Asking for more than nrows - 1 gives nrows - 1, as the row after the latest may be mid-write.
+        want = (n + 1 < CHECK_ROWS - 1) ? n + 1 : CHECK_ROWS - 1;
+        got = wsa_waterfall_latest(wf, CHECK_ROWS + 2, &rows, &info, &first);
+
+        snprintf(what, sizeof(what), "latest rows after %u pushes", (unsigned)(n + 1));
+        detail[0] = '\0';
+        if (got != want || first != n + 1 - want) {
+            snprintf(detail, sizeof(detail), "%u rows from %u, expected %u from %u", (unsigned)got, (unsigned)first,
+                     (unsigned)want, (unsigned)(n + 1 - want));
+        }
+        for (i = 0; i < got && !detail[0]; i++) {
+            number = first + i;
+            if (info[i].number != number || info[i].bins != CHECK_BINS ||
+                info[i].time_stamp.sec != 1500000000 + number || info[i].time_stamp.psec != 250000000000ULL ||
+                info[i].min != check_point(number, width, WSA_TRACE_DETECTOR_PEAK, 0) ||
+                info[i].max != check_point(number, width, WSA_TRACE_DETECTOR_PEAK, width - 1)) {
+                snprintf(detail, sizeof(detail), "row %u is number %u, %u bins, time %u, range %f to %f",
+                         (unsigned)i, (unsigned)info[i].number, (unsigned)info[i].bins,
+                         (unsigned)info[i].time_stamp.sec, info[i].min, info[i].max);
+            }
+            for (p = 0; p < width && !detail[0]; p++) {
+                if (rows[i * width + p] != check_point(number, width, WSA_TRACE_DETECTOR_PEAK, p)) {
+                    snprintf(detail, sizeof(detail), "row %u point %u is %f, row %u gives %f", (unsigned)i,
+                             (unsigned)p, rows[i * width + p], (unsigned)number,
+                             check_point(number, width, WSA_TRACE_DETECTOR_PEAK, p));
+                }
+            }
+        }
+        if (!detail[0] && !wsa_waterfall_intact(wf, first)) {
+            snprintf(detail, sizeof(detail), "rows just given are not intact");
+        }
+        if (!detail[0]) {
+            result = wsa_waterfall_range(wf, CHECK_ROWS, &lo, &hi);
+            if (result < 0 || lo != check_point(first, width, WSA_TRACE_DETECTOR_PEAK, 0) ||
+                hi != check_point(n, width, WSA_TRACE_DETECTOR_PEAK, width - 1)) {
+                snprintf(detail, sizeof(detail), "range %f to %f, rows give %f to %f", lo, hi,
+                         check_point(first, width, WSA_TRACE_DETECTOR_PEAK, 0),
+                         check_point(n, width, WSA_TRACE_DETECTOR_PEAK, width - 1));
+            }
+        }
+        check_report(what, detail);
+    }
+
+    // Rows read from first on survive pushes until row first + nrows, which takes the oldest one's slot.
+    got = wsa_waterfall_latest(wf, CHECK_ROWS - 1, &rows, &info, &first);
+    for (i = 1; i <= 2; i++) {
+        result = wsa_waterfall_push(wf, spectrum, CHECK_BINS, NULL);
+        if (result < 0) {
+            wsa_waterfall_free(wf);
+            return result;
+        }
+        snprintf(what, sizeof(what), "intact after %u more push%s", (unsigned)i, i > 1 ? "es" : "");
+        detail[0] = '\0';
+        if (wsa_waterfall_intact(wf, first) != (i == 1)) {
+            snprintf(detail, sizeof(detail), "rows %u-%u reported %s", (unsigned)first, (unsigned)(first + got - 1),
+                     (i == 1) ? "overwritten" : "intact");
+        }
+        check_report(what, detail);
+    }
+
+    wsa_waterfall_free(wf);
+
+    return 0;
+}
+
+
+///
+/// Check that bad arguments are turned away.
+///
+static void check_errors( void )
+{
+    struct wsa_waterfall *wf = NULL;
+    float spectrum[CHECK_BINS];
+    char detail[64];
+    uint8_t ok;
+
+    ok = check_refused(wsa_waterfall_alloc(0, CHECK_ROWS, WSA_TRACE_DETECTOR_PEAK, &wf), "width 0 taken", detail,
+                       sizeof(detail)) &&
+         check_refused(wsa_waterfall_alloc(4, 1, WSA_TRACE_DETECTOR_PEAK, &wf), "one row taken", detail,
+                       sizeof(detail)) &&
+         check_refused(wsa_waterfall_alloc(4, CHECK_ROWS, 0, &wf), "unknown detector taken", detail,
+                       sizeof(detail)) &&
+         check_refused(wsa_waterfall_alloc(4, CHECK_ROWS, WSA_TRACE_DETECTOR_AVERAGE + 1, &wf),
+                       "unknown detector taken", detail, sizeof(detail)) &&
+         check_accepted(wsa_waterfall_alloc(4, CHECK_ROWS, WSA_TRACE_DETECTOR_PEAK, &wf), "cannot allocate", detail,
+                        sizeof(detail)) &&
+         check_refused(wsa_waterfall_push(wf, spectrum, 0, NULL), "empty spectrum taken", detail, sizeof(detail)) &&
+         check_refused(wsa_waterfall_push(wf, NULL, CHECK_BINS, NULL), "empty spectrum taken", detail,
+                       sizeof(detail));
+    check_report("bad arguments", ok ? "" : detail);
+
+    wsa_waterfall_free(wf);
+}
+
+
+int main( int argc, char *argv[] )
+{
+    uint32_t const widths[] = { 4, 5, 20 };
+    int16_t result = 0;
+    size_t w;
+
+    if (argc > 1) {
+        return check_usage(argv[0], argv[1], NULL);
+    }
+
+    for (w = 0; w < sizeof(widths) / sizeof(widths[0]) && result >= 0; w++) {
+        result = check_rows(widths[w]);
+    }
+    if (result >= 0) {
+        result = check_wrap();
+    }
+    check_errors();
+
+    if (result < 0) {
+        fprintf(stderr, "waterfall failed: %s\n", wsa_get_error_msg(result));
+        check_failed = 1;
+    }
+
+    return check_failed;
+}
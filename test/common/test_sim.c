@@ -0,0 +1,116 @@
+///
+/// @file
+/// Starting and stopping wsasim (see test_sim.h).
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#endif
+
+#include "thinkrf_stdint.h"
+#include "test_sim.h"
+
+#define TEST_SIM_MAX_ARGS 16			///< Simulator arguments, with the ports and the NULL that ends them
+#define TEST_SIM_TRIES 100				///< Times to try connecting before giving up
+#define TEST_SIM_RETRY_US 20000			///< Time between tries
+
+
+void test_sim_path( char const *prog, char *path, size_t size )
+{
+    char *slash;
+
+    snprintf(path, size, "%s", prog);
+    slash = strrchr(path, '/');
+    snprintf(slash ? slash + 1 : path, size - (slash ? (size_t)(slash + 1 - path) : 0), "wsasim");
+}
+
+#ifndef _WIN32
+
+pid_t test_sim_start( char const *path, int ctrl_port, int data_port, char const * const *args )
+{
+    char ctrl[16];
+    char data[16];
+    char const *argv[TEST_SIM_MAX_ARGS];
+    struct sockaddr_in addr;
+    pid_t pid;
+    int sock;
+    int tries;
+    int n = 0;
+
+    snprintf(ctrl, sizeof(ctrl), "%d", ctrl_port);
+    snprintf(data, sizeof(data), "%d", data_port);
+
+    argv[n++] = path;
+    argv[n++] = "--ctrl-port";
+    argv[n++] = ctrl;
+    argv[n++] = "--data-port";
+    argv[n++] = data;
+    while (args && *args && n < TEST_SIM_MAX_ARGS - 1) {
+        argv[n++] = *args++;
+    }
+    argv[n] = NULL;
+
+    pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+#ifdef __linux__
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+        execv(path, (char * const *)argv);
+        fprintf(stderr, "cannot run %s\n", path);
+        _exit(127);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)ctrl_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for (tries = 0; tries < TEST_SIM_TRIES; tries++) {
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock >= 0 && connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            close(sock);
+            return pid;
+        }
+        if (sock >= 0) {
+            close(sock);
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            return -1;
+        }
+        usleep(TEST_SIM_RETRY_US);
+    }
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    return -1;
+}
+
+
+void test_sim_stop( pid_t pid )
+{
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+}
+
+#endif
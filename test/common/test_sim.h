@@ -0,0 +1,53 @@
+///
+/// @file
+/// Starting and stopping wsasim for the benchmarks, checks and stress test that run against it.
+/// Built into each of them from test_sim.c.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#ifndef __TEST_SIM_H__
+#define __TEST_SIM_H__
+
+#include <stddef.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+
+///
+/// Work out where the simulator is by default: wsasim, in the directory the program was run from.
+///
+/// @param[in] prog The program, argv[0].
+/// @param[out] path The simulator.
+/// @param[in] size Size of \p path.
+///
+void test_sim_path( char const *prog, char *path, size_t size );
+
+#ifndef _WIN32
+
+///
+/// Start wsasim on loopback and wait until it accepts connections. On Linux it is stopped too if
+/// this program dies, i.e. when ThreadSanitizer aborts it.
+///
+/// @param[in] path The simulator.
+/// @param[in] ctrl_port Its control port.
+/// @param[in] data_port Its data port.
+/// @param[in] args More options for it, ending with NULL, or NULL for none.
+///
+/// @return The simulator's process id, or -1 on failure.
+///
+pid_t test_sim_start( char const *path, int ctrl_port, int data_port, char const * const *args );
+
+
+///
+/// Stop a simulator test_sim_start() started, and wait for it to exit.
+///
+/// @param[in] pid Its process id; -1 does nothing.
+///
+void test_sim_stop( pid_t pid );
+
+#endif
+
+#endif
@@ -0,0 +1,272 @@
+///
+/// @file
+/// wsastress: drives several devices at once, one thread each, to check the library's threading
+/// contract (see the Threads section of the main page).
+///
+/// One wsasim is started on loopback per device. Each worker thread opens its own device,
+/// captures power spectra over a few spans, changes the log level as it goes, and closes the
+/// device. A monitor thread reads every device's statistics while the workers run.
+///
+/// Built by `make stress` with ThreadSanitizer, which fails the run on any data race. The program
+/// itself fails if any library call does, or if a device's statistics show no packets.
+///
+/// Run with --help for the options.
+///
+/// @copyright (C) 2017 ThinkRF Inc.
+///
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "wsa_lib.h"
+#include "wsa_api.h"
+#include "wsa_error.h"
+#include "wsa_sweep_device.h"
+#include "wsa_atomic.h"
+#include "debug_printf.h"
+#include "test_sim.h"
+
+#define STRESS_BASE_PORT 47301			///< Control port of the first simulator; each takes two ports
+#define STRESS_MAX_DEVICES 32
+#define STRESS_DEFAULT_DEVICES 4
+#define STRESS_DEFAULT_ROUNDS 3			///< Default passes over the spans per worker
+#define STRESS_SWEEPS 2					///< Captures per span per pass
+
+/// Spans each worker sweeps, starting at a different one per device.
+static struct {
+    uint64_t fstart;
+    uint64_t fstop;
+} const stress_spans[] = {
+    { 2400 * MHZ, 2500 * MHZ },
+    { 2000 * MHZ, 2200 * MHZ },
+    { 900 * MHZ, 1000 * MHZ },
+};
+
+/// One device and the thread driving it.
+struct stress_worker {
+    int index;
+    int ctrl_port;
+    int data_port;
+    uint32_t rounds;
+    pid_t sim;
+    pthread_t thread;
+    struct wsa_device dev;
+    uint32_t volatile opened;		///< Set once dev is open, until it is closed
+    int16_t error;					///< First failure, or 0
+    uint64_t packets;				///< Packets counted in the final statistics
+};
+
+static struct stress_worker stress_workers[STRESS_MAX_DEVICES];
+static int stress_devices = STRESS_DEFAULT_DEVICES;
+static uint32_t volatile stress_started = 0;	///< Workers that have opened their device or failed to
+static uint32_t volatile stress_finished = 0;	///< Workers that have finished capturing
+static uint32_t volatile stress_monitor_done = 0;
+static uint64_t stress_reads = 0;				///< Statistics reads made by the monitor
+
+
+///
+/// Capture every span in turn, rounds times, on an open device.
+///
+/// @return 0 on success, otherwise the library's error code.
+///
+static int16_t stress_capture( struct stress_worker *w )
+{
+    struct wsa_sweep_device *sweep_device;
+    struct wsa_power_spectrum_config *cfg;
+    float *buf;
+    uint32_t nspans = sizeof(stress_spans) / sizeof(stress_spans[0]);
+    uint32_t round;
+    uint32_t s;
+    uint32_t n;
+    int16_t result = 0;
+
+    sweep_device = wsa_sweep_device_new(&w->dev);
+    if (sweep_device == NULL) {
+        return WSA_ERR_MALLOCFAILED;
+    }
+
+    for (round = 0; round < w->rounds && result >= 0; round++) {
+        for (s = 0; s < nspans && result >= 0; s++) {
+            // the log level and debug mask are process-wide and may change under other threads
+            wsa_debuglevel((w->index + round + s) % 2 ? DLOW : DMED);
+            wsa_atomic_store_u32(&g_debug_mask, (round + s) % 2 ? DEBUG_TIMEOUTS : 0);
+
+            cfg = NULL;
+            result = wsa_power_spectrum_alloc(sweep_device, stress_spans[(w->index + s) % nspans].fstart,
+                                              stress_spans[(w->index + s) % nspans].fstop, 100000, "SH", &cfg);
+            if (result < 0) {
+                break;
+            }
+            result = wsa_configure_sweep(sweep_device, cfg);
+            for (n = 0; n < STRESS_SWEEPS && result >= 0; n++) {
+                result = wsa_capture_power_spectrum(sweep_device, cfg, &buf);
+            }
+            wsa_power_spectrum_free(cfg);
+        }
+    }
+
+    wsa_sweep_device_free(sweep_device);
+
+    return result;
+}
+
+
+///
+/// Worker thread: open the device, capture, then keep it open until the monitor is done with it.
+///
+static void *stress_worker_main( void *arg )
+{
+    struct stress_worker *w = (struct stress_worker *)arg;
+    struct wsa_stats stats;
+    char intf[64];
+    int16_t result;
+
+    snprintf(intf, sizeof(intf), "TCPIP::127.0.0.1::%d,%d", w->ctrl_port, w->data_port);
+
+    result = wsa_open(&w->dev, intf);
+    if (result >= 0) {
+        wsa_atomic_store_u32(&w->opened, 1);
+    }
+    wsa_atomic_add_u32(&stress_started, 1);
+
+    if (result >= 0) {
+        result = stress_capture(w);
+    }
+    if (result < 0) {
+        w->error = result;
+    }
+    wsa_atomic_add_u32(&stress_finished, 1);
+
+    while (!wsa_atomic_load_u32(&stress_monitor_done)) {
+        usleep(1000);
+    }
+
+    if (wsa_atomic_load_u32(&w->opened)) {
+        wsa_stats_read(&w->dev, &stats, 0);
+        w->packets = stats.counter[WSA_STAT_PACKETS];
+        wsa_atomic_store_u32(&w->opened, 0);
+        wsa_close(&w->dev);
+    }
+
+    return NULL;
+}
+
+
+///
+/// Monitor thread: read every open device's statistics until the workers are done.
+///
+static void *stress_monitor_main( void *arg )
+{
+    struct wsa_stats stats;
+    int i;
+
+    (void)arg;
+
+    while (wsa_atomic_load_u32(&stress_started) < (uint32_t)stress_devices) {
+        usleep(1000);
+    }
+
+    while (wsa_atomic_load_u32(&stress_finished) < (uint32_t)stress_devices) {
+        for (i = 0; i < stress_devices; i++) {
+            if (wsa_atomic_load_u32(&stress_workers[i].opened)) {
+                wsa_stats_read(&stress_workers[i].dev, &stats, 0);
+                stress_reads++;
+            }
+        }
+        usleep(500);
+    }
+
+    wsa_atomic_store_u32(&stress_monitor_done, 1);
+
+    return NULL;
+}
+
+
+static void stress_usage( char const *prog )
+{
+    printf("usage: %s [options]\n"
+           "  --sim PATH          simulator to start (default: wsasim next to this program)\n"
+           "  --devices N         devices to drive at once, up to %d (default %d)\n"
+           "  --rounds N          passes over the spans per device (default %d)\n",
+           prog, STRESS_MAX_DEVICES, STRESS_DEFAULT_DEVICES, STRESS_DEFAULT_ROUNDS);
+}
+
+
+int main( int argc, char **argv )
+{
+    char sim_path[1024];
+    uint32_t rounds = STRESS_DEFAULT_ROUNDS;
+    pthread_t monitor;
+    int failed = 0;
+    int i;
+
+    // The simulator is built into the same directory.
+    test_sim_path(argv[0], sim_path, sizeof(sim_path));
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--sim") && i + 1 < argc) {
+            snprintf(sim_path, sizeof(sim_path), "%s", argv[++i]);
+        } else if (!strcmp(argv[i], "--devices") && i + 1 < argc) {
+            stress_devices = atoi(argv[++i]);
+            if (stress_devices < 1 || stress_devices > STRESS_MAX_DEVICES) {
+                stress_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--rounds") && i + 1 < argc) {
+            rounds = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else {
+            stress_usage(argv[0]);
+            return strcmp(argv[i], "--help") ? 1 : 0;
+        }
+    }
+
+    for (i = 0; i < stress_devices; i++) {
+        stress_workers[i].index = i;
+        stress_workers[i].ctrl_port = STRESS_BASE_PORT + 2 * i;
+        stress_workers[i].data_port = STRESS_BASE_PORT + 2 * i + 1;
+        stress_workers[i].rounds = rounds;
+        stress_workers[i].sim = test_sim_start(sim_path, stress_workers[i].ctrl_port, stress_workers[i].data_port,
+                                                NULL);
+        if (stress_workers[i].sim < 0) {
+            fprintf(stderr, "failed to start simulator %s on port %d\n", sim_path, stress_workers[i].ctrl_port);
+            stress_devices = i;
+            failed = 1;
+            break;
+        }
+    }
+
+    if (!failed) {
+        pthread_create(&monitor, NULL, stress_monitor_main, NULL);
+        for (i = 0; i < stress_devices; i++) {
+            pthread_create(&stress_workers[i].thread, NULL, stress_worker_main, &stress_workers[i]);
+        }
+        for (i = 0; i < stress_devices; i++) {
+            pthread_join(stress_workers[i].thread, NULL);
+        }
+        pthread_join(monitor, NULL);
+
+        for (i = 0; i < stress_devices; i++) {
+            if (stress_workers[i].error < 0) {
+                fprintf(stderr, "device %d failed: %s\n", i, wsa_get_error_msg(stress_workers[i].error));
+                failed = 1;
+            } else if (stress_workers[i].packets == 0) {
+                fprintf(stderr, "device %d received no packets\n", i);
+                failed = 1;
+            }
+        }
+        printf("%d devices, %lu rounds, %llu statistics reads: %s\n", stress_devices, (unsigned long)rounds,
+               (unsigned long long)stress_reads, failed ? "FAILED" : "ok");
+    }
+
+    for (i = 0; i < stress_devices; i++) {
+        test_sim_stop(stress_workers[i].sim);
+    }
+
+    return failed;
+}